@@ -0,0 +1,196 @@
+/**
+ * BatchMatch.cpp
+ * Reads netflows from files and finds all the matches of a query with
+ * BatchMatcher, using all the cores.  Given the result files of a
+ * streaming run (RunTrianglesComplex --writeNetflows and --resultFile), it
+ * also reports the streaming matcher's recall against the batch matches.
+ * The query is a triangle (the same as RunTrianglesComplex's), a cycle, or
+ * a path of temporally ordered edges.
+ */
+
+#include <sam/BatchMatcher.hpp>
+#include <sam/SubgraphQuery.hpp>
+#include <sam/SubgraphResultSink.hpp>
+#include <sam/VastNetflow.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace sam;
+namespace po = boost::program_options;
+using namespace std::chrono;
+
+typedef BatchMatcher<VastNetflow, SourceIp, DestIp, TimeSeconds,
+                     DurationSeconds> MatcherType;
+typedef MatcherType::QueryType SubgraphQueryType;
+typedef MatcherType::ResultType ResultType;
+typedef SubgraphResultSink<VastNetflow, SourceIp, DestIp, TimeSeconds,
+                           DurationSeconds> SinkType;
+
+/**
+ * Makes a query of numEdges edges, each starting after the first and all
+ * within queryTimeWindow of it.
+ * \param queryType "cycle" for n0 -> n1 -> ... -> n0, "path" for
+ *   n0 -> n1 -> ... -> nk, or "triangle" for a cycle of three edges.
+ * \return Returns nullptr if the type or size doesn't make a query.
+ */
+std::shared_ptr<SubgraphQueryType> makeQuery(std::string queryType,
+  size_t numEdges, double queryTimeWindow,
+  std::shared_ptr<FeatureMap> featureMap)
+{
+  if (queryType == "triangle") {
+    queryType = "cycle";
+    numEdges = 3;
+  }
+  bool cycle = queryType == "cycle";
+  if ((!cycle && queryType != "path") || numEdges < (cycle ? 2 : 1)) {
+    return nullptr;
+  }
+
+  auto node = [](size_t i) {
+    return "node" + boost::lexical_cast<std::string>(i);
+  };
+  auto query = std::make_shared<SubgraphQueryType>(featureMap);
+  for (size_t i = 0; i < numEdges; i++) {
+    std::string e = "e" + boost::lexical_cast<std::string>(i);
+    query->addExpression(EdgeExpression(node(i), e,
+      node(cycle ? (i + 1) % numEdges : i + 1)));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, e,
+      i == 0 ? EdgeOperator::Assignment : EdgeOperator::GreaterThan, 0));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, e,
+      EdgeOperator::LessThan, queryTimeWindow));
+  }
+  query->finalize();
+  return query;
+}
+
+int main(int argc, char** argv) {
+
+  std::vector<std::string> infiles; ///> The netflow files
+  std::vector<std::string> resultFiles; ///> Streaming results to validate
+  std::string queryType; ///> The shape of the query
+  size_t querySize; ///> Edges in a cycle or path query
+  double queryTimeWindow; ///> Amount of time within a match can occur.
+  size_t numThreads; ///> Threads finding matches
+  size_t printMissing; ///> How many missed matches to print
+
+  po::options_description desc("Reads netflows from files and finds the "
+    "matches of a query among them with all cores.  With result files from"
+    " a streaming run, reports its recall.");
+  desc.add_options()
+    ("help", "help message")
+    ("infile", po::value<std::vector<std::string>>(&infiles)->composing(),
+      "A file with netflows, one per line.  Can be given more than once,"
+      " e.g. for the netflows of each node.")
+    ("resultFile",
+      po::value<std::vector<std::string>>(&resultFiles)->composing(),
+      "A binary result file of a streaming run to validate.  Can be given"
+      " more than once.")
+    ("query", po::value<std::string>(&queryType)->default_value("triangle"),
+      "The query: triangle, cycle, or path (default: triangle).")
+    ("querySize", po::value<size_t>(&querySize)->default_value(3),
+      "The number of edges of a cycle or path query (default: 3).")
+    ("queryTimeWindow",
+      po::value<double>(&queryTimeWindow)->default_value(10),
+      "Time window for the query to be satisfied (default: 10).")
+    ("numThreads", po::value<size_t>(&numThreads)->default_value(0),
+      "Threads finding matches.  Zero uses one per hardware thread.")
+    ("printMissing", po::value<size_t>(&printMissing)->default_value(0),
+      "How many matches the streaming run missed to print.")
+  ;
+
+  // Parse the command line variables
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  // Print out the help and exit if --help was specified.
+  if (vm.count("help") || infiles.empty()) {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = makeQuery(queryType, querySize, queryTimeWindow, featureMap);
+  if (!query) {
+    std::cerr << "Can't make a " << queryType << " query of " << querySize
+              << " edges" << std::endl;
+    return 1;
+  }
+
+  auto t1 = high_resolution_clock::now();
+  std::vector<VastNetflow> netflows;
+  for (auto const& infile : infiles) {
+    std::ifstream netflowFile(infile);
+    if (!netflowFile) {
+      std::cerr << "Couldn't open " << infile << std::endl;
+      return 1;
+    }
+    std::string line;
+    while (std::getline(netflowFile, line)) {
+      netflows.push_back(makeNetflow(netflows.size(), line));
+    }
+  }
+
+  MatcherType matcher(std::move(netflows), numThreads);
+  auto t2 = high_resolution_clock::now();
+  printf("Read %lu netflows, %lu vertices in %f seconds\n",
+    matcher.getNumEdges(), matcher.getNumVertices(),
+    duration_cast<duration<double>>(t2 - t1).count());
+
+  // Only keep the matches when there is something to compare them with.
+  std::vector<std::string> matches;
+  MatcherType::ResultFunction keep;
+  if (!resultFiles.empty()) {
+    keep = [&matches](ResultType const& result) {
+      matches.push_back(MatcherType::signature(result.getResultTuples()));
+    };
+  }
+  size_t numMatches = matcher.match(query, keep);
+  auto t3 = high_resolution_clock::now();
+  double matchTime = duration_cast<duration<double>>(t3 - t2).count();
+  printf("Number of matches %lu\n", numMatches);
+  printf("Matched in %f seconds with %lu threads, %lu edges examined\n",
+    matchTime, matcher.getNumThreads(), matcher.getNumEdgesExamined());
+
+  if (resultFiles.empty()) return 0;
+
+  std::unordered_set<std::string> streamed;
+  size_t numStreamed = 0;
+  for (auto const& resultFile : resultFiles) {
+    numStreamed += SinkType::readBinary(resultFile,
+      [&streamed](double, std::vector<VastNetflow> const& edges) {
+        streamed.insert(MatcherType::signature(edges));
+      });
+  }
+
+  size_t found = 0;
+  size_t printed = 0;
+  std::unordered_set<std::string> expected;
+  for (auto const& match : matches) {
+    expected.insert(match);
+    if (streamed.count(match)) {
+      found++;
+    } else if (printed < printMissing) {
+      printf("Missed %s\n", match.c_str());
+      printed++;
+    }
+  }
+  size_t extra = 0;
+  for (auto const& match : streamed) {
+    if (!expected.count(match)) extra++;
+  }
+
+  printf("Streaming results %lu (%lu distinct), %lu of %lu matches found,"
+    " %lu not matches\n", numStreamed, streamed.size(), found,
+    numMatches, extra);
+  printf("Recall %f\n", numMatches > 0 ?
+    static_cast<double>(found) / numMatches : 1.0);
+  return 0;
+}
@@ -20,6 +20,9 @@
 #include <sam/GraphStore.hpp>
 #include <sam/EdgeDescription.hpp>
 #include <sam/SubgraphQuery.hpp>
+#include <sam/SubgraphAggregate.hpp>
+#include <sam/SubgraphResultSink.hpp>
+#include <sam/TemporalMotifCounter.hpp>
 #include <sam/ZeroMQPushPull.hpp>
 #include <sam/VastNetflowGenerators.hpp>
 #include <boost/program_options.hpp>
@@ -49,7 +52,21 @@ typedef ZeroMQPushPull<VastNetflow, VastNetflowTuplizer, SourceHash, TargetHash>
 
 typedef GraphStoreType::ResultType ResultType;  
 
+typedef SubgraphResultSink<VastNetflow, SourceIp, DestIp, TimeSeconds,
+                           DurationSeconds> SinkType;
+
 void printStuff(std::shared_ptr<GraphStoreType> graphStore, size_t nodeId) {
+  printf("Node %lu consume workers %lu max queue length %lu mean latency %f"
+    " max latency %f stolen %lu\n", nodeId,
+    graphStore->getNumConsumeWorkers(),
+    graphStore->getMaxConsumeQueueLength(),
+    graphStore->getMeanConsumeLatency(),
+    graphStore->getMaxConsumeLatency(),
+    graphStore->getNumConsumeTasksStolen());
+  printf("Node %lu parallel expansions %lu expansion tasks %lu\n", nodeId,
+    graphStore->getNumParallelExpansions(),
+    graphStore->getNumExpansionTasks());
+
   #ifdef TIMING
   printf("Node %lu Timing total consume time: %f\n", nodeId, 
     graphStore->getTotalTimeConsume());
@@ -110,6 +127,8 @@ void printStuff(std::shared_ptr<GraphStoreType> graphStore, size_t nodeId) {
     graphStore->getTotalEdgeRequestMapPushFails());
   printf("Node %lu Metrics total EdgeRequestMap edge requests viewed: %lu\n", nodeId,
     graphStore->getTotalEdgeRequestMapRequestsViewed());
+  printf("Node %lu Metrics EdgeRequestMap edge requests viewed per tuple: %f\n",
+    nodeId, graphStore->getEdgeRequestMapRequestsViewedPerTuple());
   /////// End EdgeRequestMap metrics /////////////////////////////////
 
 
@@ -186,6 +205,25 @@ int main(int argc, char** argv) {
   size_t timeout = 1000;
   double dropTolerance;
   double keepQueries;
+  size_t consumeWorkers; ///> Threads processing tuples in GraphStore
+  size_t consumeQueue; ///> Tuples that can wait before consume blocks
+  size_t batchSize; ///> Tuples GraphStore processes as one batch
+  double batchDelay; ///> Tuple time a batch waits to fill up
+  bool queryPlanning; ///> Whether GraphStore picks where results start
+  bool genericJoin; ///> Join triangles when their last edge arrives
+  bool motifCounter; ///> Also count triangles with TemporalMotifCounter
+  double motifSampling; ///> Fraction of edges the motif counter keeps
+  std::string resultFile = ""; ///> Where triangles are written
+  bool jsonResults; ///> Write triangles as JSON lines instead of binary
+  bool countOnly; ///> Only count triangles into the feature map
+  bool vertexSummaries; ///> Drop edge requests other nodes can't answer
+  size_t remoteEdgeCache; ///> Remote edges cached to answer edge requests
+  size_t hubMirrors; ///> Busiest vertices mirrored to the other nodes
+  size_t expansionThreads; ///> Threads expanding large partial result sets
+  size_t expansionThreshold; ///> Partial results it takes to use them
+  double shedLatency; ///> Consume latency that triggers load shedding
+  size_t shedQueueLength; ///> Consume queue length that triggers it
+  size_t shedResults; ///> Partial results that trigger it
 
   po::options_description desc("This code creates a set of vertices "
     " and generates edges amongst that set.  It finds triangles among the"
@@ -251,6 +289,84 @@ int main(int argc, char** argv) {
       "How long (in seconds) this process can get behind before dropping.")
     ("keepQueries", po::value<double>(&keepQueries)->default_value(1.0),
       "Percentage of checks aginst queries to keep") 
+    ("consumeWorkers", po::value<size_t>(&consumeWorkers)->default_value(0),
+      "Number of threads that process tuples in the GraphStore (default 0,"
+      " one per hardware thread)")
+    ("consumeQueue",
+      po::value<size_t>(&consumeQueue)->default_value(MAX_NUM_FUTURES),
+      "How many tuples can wait to be processed before the GraphStore"
+      " blocks the producer")
+    ("batchSize",
+      po::value<size_t>(&batchSize)->default_value(
+        GRAPH_STORE_DEFAULT_BATCH_SIZE),
+      "How many tuples the GraphStore adds to the graph as one batch")
+    ("batchDelay",
+      po::value<double>(&batchDelay)->default_value(
+        GRAPH_STORE_DEFAULT_BATCH_DELAY),
+      "Seconds of tuple time a batch waits to fill up before it is"
+      " processed anyway")
+    ("queryPlanning",
+      po::bool_switch(&queryPlanning)->default_value(false),
+      "Lets the GraphStore start results at the most selective edge"
+      " (single node only)")
+    ("genericJoin",
+      po::bool_switch(&genericJoin)->default_value(false),
+      "Finds triangles with a worst-case optimal join when their last edge"
+      " arrives instead of keeping partial results (single node only; the"
+      " time window has to cover the query time window)")
+    ("motifCounter",
+      po::bool_switch(&motifCounter)->default_value(false),
+      "Also counts triangles, wedges, and 2-cycles within the query time"
+      " window with a dedicated motif counter (exact on a single node)")
+    ("motifSampling",
+      po::value<double>(&motifSampling)->default_value(1),
+      "Fraction of edges the motif counter keeps.  Under 1 its counts are"
+      " estimates (default: 1).")
+    ("resultFile", po::value<std::string>(&resultFile),
+      "If specified, triangles are written to this file by a separate"
+      " writer thread")
+    ("jsonResults",
+      po::bool_switch(&jsonResults)->default_value(false),
+      "Writes the result file as JSON lines rather than binary")
+    ("countOnly",
+      po::bool_switch(&countOnly)->default_value(false),
+      "Only counts triangles (in total, per vertex x, and per query time"
+      " window) into the feature map instead of keeping them")
+    ("vertexSummaries",
+      po::bool_switch(&vertexSummaries)->default_value(false),
+      "Nodes broadcast Bloom filters of the vertices they have seen and"
+      " drop edge requests for vertices the other node hasn't seen")
+    ("remoteEdgeCache",
+      po::value<size_t>(&remoteEdgeCache)->default_value(0),
+      "How many edges sent by other nodes to cache and answer later edge"
+      " requests with.  Zero turns the cache off.")
+    ("hubMirrors",
+      po::value<size_t>(&hubMirrors)->default_value(0),
+      "How many of its busiest vertices each node mirrors to the others,"
+      " which then answer edge requests for them locally.  Zero turns"
+      " mirroring off.")
+    ("expansionThreads",
+      po::value<size_t>(&expansionThreads)->default_value(0),
+      "How many threads look up partial results in the graph when an edge"
+      " advances many at once.  Zero does it on the consume thread.")
+    ("expansionThreshold",
+      po::value<size_t>(&expansionThreshold)->default_value(
+        SUBGRAPH_QUERY_RESULT_MAP_DEFAULT_PARALLEL_THRESHOLD),
+      "How many partial results an edge has to advance before they are"
+      " looked up with the expansion threads.")
+    ("shedLatency",
+      po::value<double>(&shedLatency)->default_value(0),
+      "Mean consume latency in seconds above which fewer triangle starts"
+      " are kept.  Zero ignores latency.")
+    ("shedQueueLength",
+      po::value<size_t>(&shedQueueLength)->default_value(0),
+      "Consume queue length above which fewer triangle starts are kept."
+      "  Zero ignores the queue.")
+    ("shedResults",
+      po::value<size_t>(&shedResults)->default_value(0),
+      "Partial results above which fewer triangle starts are kept and the"
+      " partial results furthest from completion are shed.  Zero ignores"
+      " them.")
   ;
 
   // Parse the command line variables
@@ -308,7 +424,10 @@ int main(int argc, char** argv) {
                                     startingPort, timeout, false, 
                                     hwm);
 
-  auto featureMap = std::make_shared<FeatureMap>(1000);
+  // Counting per vertex needs room for a feature per vertex.
+  // So does the motif counter, for each of its three motifs.
+  auto featureMap = std::make_shared<FeatureMap>(1000 +
+    (countOnly ? 2 * numVertices : 0) + (motifCounter ? 3 * numVertices : 0));
 
   auto graphStore = std::make_shared<GraphStoreType>(
      numNodes, nodeId,
@@ -316,11 +435,47 @@ int main(int argc, char** argv) {
      hwm, graphCapacity,
      tableCapacity, resultsCapacity, 
      numPushSockets, numPullThreads, timeout,
-     timeWindow, keepQueries, featureMap);
+     timeWindow, keepQueries, featureMap, consumeQueue, false,
+     consumeWorkers);
+  graphStore->setBatchSize(batchSize);
+  graphStore->setBatchDelay(batchDelay);
+  graphStore->setQueryPlanning(queryPlanning);
+  graphStore->setGenericJoin(genericJoin);
+  if (vertexSummaries) {
+    graphStore->setVertexSummaries(0, numVertices);
+  }
+  if (remoteEdgeCache > 0) {
+    graphStore->setRemoteEdgeCache(remoteEdgeCache);
+  }
+  if (hubMirrors > 0) {
+    graphStore->setHubMirroring(hubMirrors);
+  }
+  if (shedLatency > 0 || shedQueueLength > 0 || shedResults > 0) {
+    graphStore->setLoadShedding(shedLatency, shedQueueLength, shedResults);
+  }
+  if (expansionThreads > 0) {
+    graphStore->setParallelExpansion(expansionThreads, expansionThreshold);
+  }
+
+  std::shared_ptr<SinkType> sink;
+  if (resultFile != "") {
+    sink = std::make_shared<SinkType>(resultFile,
+      jsonResults ? SinkFormat::JsonLines : SinkFormat::Binary);
+    graphStore->setPrinter(sink);
+  }
 
   // Set up GraphStore object to get input from ZeroMQPushPull objects
   pushPull->registerConsumer(graphStore);
 
+  typedef TemporalMotifCounter<VastNetflow, SourceIp, DestIp, TimeSeconds>
+    MotifCounterType;
+  std::shared_ptr<MotifCounterType> motifs;
+  if (motifCounter) {
+    motifs = std::make_shared<MotifCounterType>(queryTimeWindow, nodeId,
+      featureMap, "motifs", motifSampling);
+    pushPull->registerConsumer(motifs);
+  }
+
   // Set up the triangle query
   EdgeFunction starttimeFunction = EdgeFunction::StartTime;
   EdgeFunction endtimeFunction = EdgeFunction::EndTime;
@@ -379,6 +534,13 @@ int main(int argc, char** argv) {
   //query.addExpression(endE0Second);
   //query.addExpression(endE1Second);
   //query.addExpression(endE2Second);
+  std::shared_ptr<SubgraphAggregate<std::string>> aggregate;
+  if (countOnly) {
+    aggregate = std::make_shared<SubgraphAggregate<std::string>>(featureMap,
+      "triangles", queryTimeWindow);
+    aggregate->countVariable("x");
+    query->setAggregate(aggregate);
+  }
   query->finalize();
 
   graphStore->registerQuery(query);
@@ -479,9 +641,29 @@ int main(int argc, char** argv) {
   printf("Node %lu found %lu triangles\n",
     nodeId, graphStore->getNumResults());
   printf("Node %lu num dropped netflows %lu\n", nodeId, numDropped);
+  if (sink) {
+    sink->flush();
+    printf("Node %lu wrote %lu triangles to %s, %lu dropped\n", nodeId,
+      sink->getNumWritten(), resultFile.c_str(), sink->getNumDropped());
+  }
+
+  if (aggregate) {
+    printf("Node %lu counted %lu triangles, %lu feature map update fails\n",
+      nodeId, aggregate->getTotal(), aggregate->getNumFailedUpdates());
+  }
+
+  if (motifs) {
+    printf("Node %lu motif counter: %f triangles, %f wedges, %f 2-cycles,"
+      " %lu late edges, %lu feature map update fails\n", nodeId,
+      motifs->getNumTriangles(), motifs->getNumWedges(),
+      motifs->getNumCycles(), motifs->getNumLate(),
+      motifs->getNumFailedUpdates());
+  }
 
+  // Count-only triangles aren't kept, so there is nothing to check.
   size_t numResults = (graphStore->getNumResults() < resultsCapacity) ?
     graphStore->getNumResults() : resultsCapacity;
+  if (countOnly) numResults = 0;
 
   printf("Node %lu total GraphStore edge push attempts: %lu\n", nodeId,
     graphStore->getTotalEdgePushes());
@@ -491,6 +673,54 @@ int main(int argc, char** argv) {
   pushPull->terminate();
   
   printStuff(graphStore, nodeId);
+
+  if (auto summaries = graphStore->getVertexSummaries()) {
+    printf("Node %lu vertex summaries sent %lu received %lu\n", nodeId,
+      summaries->getNumSent(), summaries->getNumReceived());
+    printf("Node %lu edge requests checked %lu suppressed %lu\n", nodeId,
+      summaries->getNumChecked(), summaries->getNumSuppressed());
+    printf("Node %lu false positive requests received %lu, estimated false"
+      " positive rate %f, late tuples %lu\n", nodeId,
+      summaries->getNumFalsePositives(),
+      summaries->getEstimatedFalsePositiveRate(),
+      summaries->getNumLate());
+  }
+
+  if (auto mirror = graphStore->getHubMirror()) {
+    printf("Node %lu hubs %lu promoted %lu renewed %lu dropped %lu"
+      " announcements received %lu\n", nodeId, mirror->getNumHubs(),
+      mirror->getNumPromoted(), mirror->getNumRenewed(),
+      mirror->getNumDropped(), mirror->getNumAnnouncementsReceived());
+  }
+
+  if (auto shedder = graphStore->getLoadShedder()) {
+    printf("Node %lu load shedding load %f adjustments %lu overloaded %lu\n",
+      nodeId, shedder->getLoad(), shedder->getNumAdjustments(),
+      shedder->getNumOverloaded());
+    for (size_t q = 0; q < shedder->getNumQueries(); q++) {
+      printf("Node %lu query %lu keep probability %f starts kept %lu of %lu"
+        " shed %lu estimated recall loss %f\n", nodeId, q,
+        shedder->getKeepProbability(q), shedder->getNumKept(q),
+        shedder->getNumOffered(q), shedder->getNumEvicted(q),
+        shedder->getEstimatedRecallLoss(q));
+    }
+  }
+
+  if (auto join = graphStore->getGenericJoin()) {
+    printf("Node %lu generic join joins %lu intersections %lu candidates %lu"
+      " bindings %lu matches %lu\n", nodeId, join->getNumJoins(),
+      join->getNumIntersections(), join->getNumCandidates(),
+      join->getNumBindings(), join->getNumMatches());
+  }
+
+  if (auto cache = graphStore->getRemoteEdgeCache()) {
+    printf("Node %lu remote edge cache hits %lu misses %lu hit rate %f\n",
+      nodeId, cache->getNumHits(), cache->getNumMisses(),
+      cache->getHitRate());
+    printf("Node %lu remote edge cache edges served %lu held %lu keys %lu"
+      " evicted %lu\n", nodeId, cache->getNumEdgesServed(),
+      cache->getNumEdges(), cache->getNumKeys(), cache->getNumEvicted());
+  }
  
   if (check) {
     for(size_t i = 0; i < numResults; i++)
@@ -0,0 +1,342 @@
+#ifndef SAM_BATCH_MATCHER_HPP
+#define SAM_BATCH_MATCHER_HPP
+
+#include <sam/SubgraphQuery.hpp>
+#include <sam/SubgraphQueryResult.hpp>
+#include <sam/ThreadPool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+
+/// How many first edges one BatchMatcher task starts matches from.
+#define BATCH_MATCHER_CHUNK 4096
+
+namespace sam {
+
+class BatchMatcherException : public std::runtime_error
+{
+public:
+  BatchMatcherException(char const* message) :
+    std::runtime_error(message) {}
+  BatchMatcherException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * Finds every match of a SubgraphQuery in a fixed set of edges, such as a
+ * netflow archive.  It is the offline counterpart of GraphStore: there is
+ * no window to slide and no partial result to keep, so it is both a fast
+ * way to hunt over old data and the reference that the streaming matcher's
+ * results (SubgraphResultSink::readBinary) are checked against.
+ *
+ * The constructor sorts the edges by time and builds an in-memory CSR and
+ * CSC over them, whose adjacency lists are in time order.  match() starts
+ * a match from every edge satisfying the first edge description and
+ * extends it depth first: edge description k is looked up in the
+ * adjacency list of whichever of its variables is bound (or in all of the
+ * edges if neither is), and the time range it allows is found by binary
+ * search.  SubgraphQueryResult::addEdge checks the constraints, so the
+ * matches are the ones the streaming matcher finds with a time window that
+ * covers the query.  The first edges are split into chunks run over a
+ * ThreadPool; results are delivered in the order of their first edge
+ * whatever the number of threads.
+ */
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+class BatchMatcher
+{
+public:
+  typedef typename std::tuple_element<source, TupleType>::type NodeType;
+  typedef SubgraphQuery<TupleType, source, target, time, duration>
+    QueryType;
+  typedef SubgraphQueryResult<TupleType, source, target, time, duration>
+    ResultType;
+  typedef std::function<void(ResultType const&)> ResultFunction;
+
+private:
+  /// The edges sorted by time.
+  std::vector<TupleType> edges;
+
+  /// Dense index of each vertex.
+  std::unordered_map<NodeType, size_t> vertexIndex;
+
+  /// The out-edges of vertex v are outEdges[outOffsets[v]] up to
+  /// outEdges[outOffsets[v + 1]], as indices into edges.  The same for
+  /// in-edges.
+  std::vector<size_t> outOffsets;
+  std::vector<size_t> outEdges;
+  std::vector<size_t> inOffsets;
+  std::vector<size_t> inEdges;
+
+  /// Every edge, for edge descriptions with no bound vertex.
+  std::vector<size_t> allEdges;
+
+  size_t numThreads;
+
+  /// The counts of one match() call.
+  struct Counts {
+    size_t matches = 0;
+    size_t edgesExamined = 0;
+  };
+
+  std::atomic<size_t> numMatches;
+  std::atomic<size_t> numEdgesExamined;
+
+  /**
+   * Fills offsets and lists with the edges by the vertex at index i of
+   * each tuple.
+   */
+  template <size_t i>
+  void buildAdjacency(std::vector<size_t>& offsets,
+                      std::vector<size_t>& lists) const;
+
+  /**
+   * The edges of the list in [lo, hi] by time.
+   */
+  std::pair<std::vector<size_t>::const_iterator,
+            std::vector<size_t>::const_iterator>
+  timeRange(std::vector<size_t>::const_iterator begin,
+            std::vector<size_t>::const_iterator end,
+            double lo, double hi) const;
+
+  /**
+   * Extends result by its current edge description, depth first.
+   */
+  void extend(ResultType& result, Counts& counts,
+              std::vector<ResultType>* results) const;
+
+public:
+  /**
+   * \param tuples The edges.  Their order doesn't matter.
+   * \param numThreads Threads match() uses.  Zero means one per hardware
+   *   thread.
+   */
+  BatchMatcher(std::vector<TupleType> tuples, size_t numThreads = 0);
+
+  /**
+   * Finds the matches of query.
+   * \param query A finalized query.
+   * \param emit If set, called with each match, in order of first edge,
+   *   on the calling thread.  The matches are held until all threads are
+   *   done, so leave it unset to only count them.
+   * \return Returns the number of matches.
+   */
+  size_t match(std::shared_ptr<const QueryType> query,
+               ResultFunction emit = nullptr);
+
+  /**
+   * A key identifying a match by the source, target, and time of its
+   * edges, to compare matches from different runs (the tuple ids given by
+   * GraphStore differ from the ones in the file).
+   */
+  static std::string signature(std::vector<TupleType> const& matchEdges);
+
+  size_t getNumEdges() const { return edges.size(); }
+  size_t getNumVertices() const { return vertexIndex.size(); }
+  size_t getNumThreads() const { return numThreads; }
+
+  /// Matches found by all match() calls.
+  size_t getNumMatches() const { return numMatches; }
+
+  /// Edges looked at by all match() calls.
+  size_t getNumEdgesExamined() const { return numEdgesExamined; }
+};
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+BatchMatcher<TupleType, source, target, time, duration>::
+BatchMatcher(std::vector<TupleType> tuples, size_t numThreads) :
+  edges(std::move(tuples)), numThreads(numThreads), numMatches(0),
+  numEdgesExamined(0)
+{
+  if (this->numThreads == 0) {
+    this->numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  std::stable_sort(edges.begin(), edges.end(),
+    [](TupleType const& a, TupleType const& b) {
+      return std::get<time>(a) < std::get<time>(b);
+    });
+
+  for (auto const& edge : edges) {
+    vertexIndex.emplace(std::get<source>(edge), vertexIndex.size());
+    vertexIndex.emplace(std::get<target>(edge), vertexIndex.size());
+  }
+  buildAdjacency<source>(outOffsets, outEdges);
+  buildAdjacency<target>(inOffsets, inEdges);
+
+  allEdges.resize(edges.size());
+  for (size_t e = 0; e < edges.size(); e++) allEdges[e] = e;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+template <size_t i>
+void
+BatchMatcher<TupleType, source, target, time, duration>::
+buildAdjacency(std::vector<size_t>& offsets, std::vector<size_t>& lists) const
+{
+  // Counting sort by vertex.  Edges are visited in time order, so each
+  // list stays in time order.
+  offsets.assign(vertexIndex.size() + 1, 0);
+  for (auto const& edge : edges) {
+    offsets[vertexIndex.at(std::get<i>(edge)) + 1]++;
+  }
+  for (size_t v = 0; v < vertexIndex.size(); v++) {
+    offsets[v + 1] += offsets[v];
+  }
+  std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+  lists.resize(edges.size());
+  for (size_t e = 0; e < edges.size(); e++) {
+    lists[next[vertexIndex.at(std::get<i>(edges[e]))]++] = e;
+  }
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+std::pair<std::vector<size_t>::const_iterator,
+          std::vector<size_t>::const_iterator>
+BatchMatcher<TupleType, source, target, time, duration>::
+timeRange(std::vector<size_t>::const_iterator begin,
+          std::vector<size_t>::const_iterator end,
+          double lo, double hi) const
+{
+  auto first = std::lower_bound(begin, end, lo,
+    [this](size_t e, double t) { return std::get<time>(edges[e]) < t; });
+  auto last = std::upper_bound(first, end, hi,
+    [this](double t, size_t e) { return t < std::get<time>(edges[e]); });
+  return std::make_pair(first, last);
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+size_t
+BatchMatcher<TupleType, source, target, time, duration>::
+match(std::shared_ptr<const QueryType> query, ResultFunction emit)
+{
+  if (!query->isFinalized()) {
+    throw BatchMatcherException("BatchMatcher::match the query isn't "
+      "finalized");
+  }
+
+  size_t numChunks = (edges.size() + BATCH_MATCHER_CHUNK - 1) /
+                     BATCH_MATCHER_CHUNK;
+  std::vector<Counts> counts(numChunks);
+  std::vector<std::vector<ResultType>> results(emit ? numChunks : 0);
+
+  auto runChunk = [this, &query, &counts, &results](size_t c) {
+    std::vector<ResultType>* out = results.empty() ? nullptr : &results[c];
+    size_t end = std::min(edges.size(), (c + 1) * BATCH_MATCHER_CHUNK);
+    for (size_t e = c * BATCH_MATCHER_CHUNK; e < end; e++) {
+      TupleType const& first = edges[e];
+      counts[c].edgesExamined++;
+      double queryStart = std::get<time>(first);
+      if (!query->zeroTimeRelativeToStart()) {
+        queryStart += std::get<duration>(first);
+      }
+      if (!query->satisfiesConstraints(0, first, queryStart)) continue;
+      ResultType result(query, first);
+      if (result.complete()) {
+        counts[c].matches++;
+        if (out) out->push_back(result);
+      } else {
+        extend(result, counts[c], out);
+      }
+    }
+  };
+
+  if (numThreads == 1 || numChunks <= 1) {
+    for (size_t c = 0; c < numChunks; c++) runChunk(c);
+  } else {
+    ThreadPool pool(numThreads);
+    for (size_t c = 0; c < numChunks; c++) {
+      pool.submit([&runChunk, c]() { runChunk(c); });
+    }
+    pool.wait();
+  }
+
+  size_t total = 0;
+  for (size_t c = 0; c < numChunks; c++) {
+    total += counts[c].matches;
+    numEdgesExamined.fetch_add(counts[c].edgesExamined);
+    if (emit) {
+      for (auto const& result : results[c]) emit(result);
+    }
+  }
+  numMatches.fetch_add(total);
+  return total;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+void
+BatchMatcher<TupleType, source, target, time, duration>::
+extend(ResultType& result, Counts& counts,
+       std::vector<ResultType>* results) const
+{
+  std::shared_ptr<const QueryType> query = result.getSubgraphQuery();
+  size_t k = result.getCurrentEdge();
+  auto const& desc = query->getEdgeDescription(k);
+  NodeType const& src = result.getBindings()[query->getSourceSlot(k)];
+  NodeType const& trg = result.getBindings()[query->getTargetSlot(k)];
+
+  // Edges come in strictly increasing time (addEdge skips equal times).
+  double lo = std::max(std::get<time>(result.getResultTuple(k - 1)),
+                       result.getStartTime() + desc.startTimeRange.first);
+  double hi = result.getStartTime() + desc.startTimeRange.second;
+  if (hi < lo) return;
+
+  std::vector<size_t>::const_iterator begin = allEdges.begin();
+  std::vector<size_t>::const_iterator end = allEdges.end();
+  if (!isNull(src) || !isNull(trg)) {
+    bool out = !isNull(src);
+    auto it = vertexIndex.find(out ? src : trg);
+    if (it == vertexIndex.end()) return;
+    std::vector<size_t> const& offsets = out ? outOffsets : inOffsets;
+    std::vector<size_t> const& lists = out ? outEdges : inEdges;
+    begin = lists.begin() + offsets[it->second];
+    end = lists.begin() + offsets[it->second + 1];
+  }
+
+  auto range = timeRange(begin, end, lo, hi);
+  for (auto e = range.first; e != range.second; ++e) {
+    TupleType const& edge = edges[*e];
+    counts.edgesExamined++;
+    if (!isNull(trg) && std::get<target>(edge) != trg) continue;
+    auto p = result.addEdge(edge);
+    if (!p.first) continue;
+    if (p.second.complete()) {
+      counts.matches++;
+      if (results) results->push_back(p.second);
+    } else {
+      extend(p.second, counts, results);
+    }
+  }
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+std::string
+BatchMatcher<TupleType, source, target, time, duration>::
+signature(std::vector<TupleType> const& matchEdges)
+{
+  std::string key;
+  for (auto const& edge : matchEdges) {
+    key += boost::lexical_cast<std::string>(std::get<source>(edge)) + " " +
+           boost::lexical_cast<std::string>(std::get<target>(edge)) + " " +
+           boost::lexical_cast<std::string>(std::get<time>(edge)) + ";";
+  }
+  return key;
+}
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef SAM_BLOOM_FILTER_HPP
+#define SAM_BLOOM_FILTER_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sam {
+
+/**
+ * A Bloom filter over precomputed hashes.  Callers hash the key with
+ * whatever hash function they already use (e.g. the graph's HF) and the
+ * filter derives its k probe positions from that one value with double
+ * hashing.
+ */
+class BloomFilter
+{
+private:
+  std::vector<uint64_t> words;
+  size_t numBits;
+  size_t numHashes;
+
+  static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+  }
+
+public:
+  /**
+   * \param numBits Size of the filter in bits (rounded up to a multiple
+   *   of 64).
+   * \param numHashes How many bits each key sets.
+   */
+  BloomFilter(size_t numBits = 64, size_t numHashes = 1) :
+    words((numBits + 63) / 64, 0),
+    numBits(words.size() * 64),
+    numHashes(numHashes > 0 ? numHashes : 1)
+  {}
+
+  /**
+   * Rebuilds a filter from the words returned by getWords().
+   */
+  BloomFilter(std::vector<uint64_t> words, size_t numHashes) :
+    words(std::move(words)),
+    numHashes(numHashes > 0 ? numHashes : 1)
+  {
+    if (this->words.empty()) this->words.push_back(0);
+    numBits = this->words.size() * 64;
+  }
+
+  /**
+   * Sizes a filter for the expected number of keys and false positive
+   * rate.
+   */
+  static BloomFilter forCapacity(size_t expectedKeys, double fpRate) {
+    if (expectedKeys == 0) expectedKeys = 1;
+    double ln2 = std::log(2.0);
+    double bits = -static_cast<double>(expectedKeys) * std::log(fpRate) /
+                  (ln2 * ln2);
+    size_t k = static_cast<size_t>(std::round(
+      bits / expectedKeys * ln2));
+    return BloomFilter(static_cast<size_t>(std::ceil(bits)), k);
+  }
+
+  void add(size_t hash) {
+    uint64_t h1 = mix(hash);
+    uint64_t h2 = mix(h1) | 1;
+    for (size_t i = 0; i < numHashes; i++) {
+      size_t bit = (h1 + i * h2) % numBits;
+      words[bit / 64] |= static_cast<uint64_t>(1) << (bit % 64);
+    }
+  }
+
+  /**
+   * Returns false if the key was definitely never added.
+   */
+  bool mayContain(size_t hash) const {
+    uint64_t h1 = mix(hash);
+    uint64_t h2 = mix(h1) | 1;
+    for (size_t i = 0; i < numHashes; i++) {
+      size_t bit = (h1 + i * h2) % numBits;
+      if (!(words[bit / 64] & (static_cast<uint64_t>(1) << (bit % 64)))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Ors in another filter of the same size and number of hashes.
+   * \return Returns false (and does nothing) if the shapes differ.
+   */
+  bool merge(BloomFilter const& other) {
+    if (other.numBits != numBits || other.numHashes != numHashes) {
+      return false;
+    }
+    for (size_t i = 0; i < words.size(); i++) words[i] |= other.words[i];
+    return true;
+  }
+
+  void clear() {
+    for (auto& w : words) w = 0;
+  }
+
+  /**
+   * The expected false positive rate given the fraction of bits set.
+   */
+  double estimatedFalsePositiveRate() const {
+    size_t set = 0;
+    for (auto w : words) set += __builtin_popcountll(w);
+    return std::pow(static_cast<double>(set) / numBits, numHashes);
+  }
+
+  std::vector<uint64_t> const& getWords() const { return words; }
+  size_t getNumBits() const { return numBits; }
+  size_t getNumHashes() const { return numHashes; }
+};
+
+} // end namespace sam
+
+#endif
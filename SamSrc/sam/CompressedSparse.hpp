@@ -6,7 +6,17 @@
 #include <mutex>
 #include <sam/Util.hpp>
 #include <sam/EdgeRequest.hpp>
+#include <sam/SlabAllocator.hpp>
+#include <sam/ResizableTable.hpp>
+#include <sam/MemoryBudget.hpp>
+#include <sam/SealedSegment.hpp>
+#include <sam/Serialization.hpp>
+#include <sam/DegreeStatistics.hpp>
+#include <algorithm>
+#include <limits>
+#include <memory>
 #include <thread>
+#include <vector>
 
 namespace sam {
 
@@ -34,10 +44,18 @@ public:
   typedef EdgeRequest<TupleType, source, target> EdgeRequestType;
   typedef EdgeRequest<TupleType, target, source> ReversedEdgeRequestType;
 
+  /// Edges with the same source, oldest first.
+  typedef std::list<TupleType, SlabAllocator<TupleType>> EdgeListType;
+  /// The lists of edges that hash to one slot.
+  typedef std::list<EdgeListType, SlabAllocator<EdgeListType>> SlotType;
+
+  /// On-disk tier for edges older than the memory tier holds.
+  typedef SealedSegment<TupleType, source, time, HF, EF> SegmentType;
+
 private:
 
-  // Time window in seconds.  
-  double window = 1;
+  // Time window in seconds.  Can be shortened by the memory budget.
+  std::atomic<double> window;
 
   /**
    * The current time.  We update current time in method addEdge in a
@@ -51,29 +69,117 @@ private:
   EF equal;
 
   /**
-   * How many slots there are in alle (the array of lists of lists of edges).
-   * Each slot has a mutex associated with it so that only one thread can
-   * access the slot at one time.
+   * The hash table of slots, each slot a list of lists of edges.  Each list
+   * within a slot holds the edges for one source.  The table grows and
+   * shrinks with the number of lists (i.e. the lists scanned per lookup)
+   * and locks a stripe of slots at a time so that only one thread can
+   * access a slot at one time.
    */
-  size_t capacity; 
- 
+  ResizableTable<SlotType>* alle;
+
+  /// Charged for every edge and list stored, if set.
+  MemoryBudget* memoryBudget = nullptr;
+
   /**
-   * A mutex for each element in alle.  This help us reduce thread contention.
-   */ 
-  std::mutex* mutexes;
+   * Edge and vertex counts and the degree distribution of the in-memory
+   * tier, updated whenever a list grows or shrinks.  A list holds the
+   * edges of one source, so its length is the out-degree in a CSR and the
+   * in-degree in a CSC.  Mutable because findEdges removes expired edges.
+   */
+  mutable DegreeStatistics<NodeType> degrees;
+
+  /**
+   * Bytes charged to the memory budget for one stored edge.
+   */
+  static size_t edgeBytes(TupleType const& tuple) {
+    return slabUsableSize(sizeof(TupleType) + LIST_NODE_OVERHEAD) +
+           heapBytes(tuple);
+  }
+
+  /**
+   * Bytes charged to the memory budget for one (empty) list in a slot.
+   */
+  static size_t listBytes() {
+    return slabUsableSize(sizeof(EdgeListType) + LIST_NODE_OVERHEAD);
+  }
+
+  /**
+   * Tiered storage.  When enabled, edges older than currentTime -
+   * segmentDuration are periodically sealed into a SegmentType file and
+   * removed from memory.  Edges before sealedUpTo live only on disk.
+   * segments and sealedUpTo change together under segmentsMutex so that a
+   * lookup sees each edge in exactly one tier.
+   */
+  std::string segmentPrefix;
+  double segmentDuration = 0;
+  std::atomic<double> sealedUpTo;
+  std::atomic<double> nextSeal;
+  std::atomic<bool> sealing;
+  size_t numSegmentsCreated = 0;
+  mutable std::mutex segmentsMutex;
+  std::vector<std::shared_ptr<SegmentType>> segments;
+
+  mutable std::atomic<size_t> numSegmentProbes;
+  mutable std::atomic<size_t> numSegmentBloomSkips;
+
+  /// Lookups redone because a seal ran while they scanned memory.
+  mutable std::atomic<size_t> numSealRetries;
+  std::atomic<size_t> numLateEdges;
+
+  bool tiered() const { return segmentDuration > 0; }
 
-  // array of lists of lists of edges
-  std::list<std::list<TupleType>>* alle;
+  /**
+   * Seals edges if enough time has passed since the last seal.  Only one
+   * thread seals at a time; the others carry on.
+   */
+  void maybeSeal();
+
+  /**
+   * Writes the in-memory edges in [sealedUpTo, boundary) to a new
+   * segment, publishes it, then removes them from memory.  Also drops
+   * segments that are entirely outside of the window.
+   */
+  void seal(double boundary);
+
+  /**
+   * Returns true if the edge matches the target and time constraints of a
+   * lookup.  The source has already been matched.
+   */
+  bool matches(TupleType const& edge, NodeType const& trg,
+               double startTimeFirst, double startTimeSecond,
+               double endTimeFirst, double endTimeSecond) const;
 
   /**
    * For the given slot in the hash table (alle), we clear out edges that 
-   * have expired (i.e. older than currentTime - window).
+   * have expired (i.e. older than currentTime - window) or that have been
+   * sealed to disk.
    * \return Returns the number edges deleted.
    */
-  size_t cleanupEdges(size_t index);
+  size_t cleanupEdges(SlotType& slot);
+
+  /**
+   * Removes an edge from the front of a list, crediting the memory budget.
+   */
+  void popEdge(EdgeListType& l);
+
+  /**
+   * Advances currentTime to the tuple's time and charges the memory
+   * budget for it.
+   * \return Returns false if the tuple is too late to be kept (it falls
+   *   in a part of the timeline that has already been sealed).
+   */
+  bool admit(TupleType const& tuple);
+
+  /**
+   * Appends the tuple to the edge list for its source in the given slot.
+   * The caller holds the slot's lock.
+   * \return Returns a number representing the amount of work.
+   */
+  size_t insertIntoSlot(SlotType& slot, TupleType const& tuple);
 
   #ifdef METRICS
   mutable size_t totalEdgesAdded = 0;
+  mutable size_t totalBatches = 0;
   mutable size_t totalEdgesDeleted = 0; 
   #endif
 
@@ -81,7 +187,8 @@ private:
 public:
 
   /**
-   * \param capacity How big the storage is.
+   * \param capacity The initial number of slots.  The table resizes itself
+   *   based on load, so this only needs to be in the right ballpark.
    * \param window How big the time window is in seconds.
    */
   CompressedSparse(size_t capacity, double window);
@@ -94,6 +201,15 @@ public:
    */
   size_t addEdge(TupleType tuple);
 
+  /**
+   * Adds a batch of tuples.  The tuples are grouped by the stripe of the
+   * table their source hashes to, and each group is inserted under a
+   * single lock acquisition.  Tuples with the same source keep their
+   * relative order.
+   * \return Returns a number representing the amount of work.
+   */
+  size_t addEdges(std::vector<TupleType> const& tuples);
+
   /**
    * Finds all edges that fulfill the given edgeRequest.
    * \param edgeRequest We find edges that match this edge request.
@@ -133,13 +249,175 @@ public:
 
 
   /** 
-   * Counts the number of edges in the graph.  Linear operation.
+   * Returns the number of edges stored, in memory and (with tiered
+   * storage) on disk.  O(1) for the memory tier plus one add per sealed
+   * segment.  Expired edges are removed lazily, so edges that have left
+   * the window but haven't been swept yet are included;
+   * countEdgesInWindow() excludes them at the cost of a full walk.
+   */
+  size_t countEdges() const {
+    size_t count = degrees.getNumEdges();
+    if (tiered()) count += getNumSealedEdges();
+    return count;
+  }
+
+  /**
+   * Charges every edge stored from now on to the given budget.  Call before
+   * adding edges.
+   */
+  void setMemoryBudget(MemoryBudget* memoryBudget) {
+    this->memoryBudget = memoryBudget;
+  }
+
+  /**
+   * Changes how long edges are kept.  Edges older than the new window are
+   * removed lazily, or right away with removeExpiredEdges().
+   */
+  void setWindow(double window) { this->window = window; }
+
+  double getWindow() const { return window; }
+
+  /**
+   * Same as countEdges() used to be: walks the whole table with four
+   * threads and counts only the edges still within the window.  Use for
+   * checking countEdges(); it contends with addEdge for the slot locks.
+   */
+  size_t countEdgesInWindow() const;
+
+  /**
+   * Number of vertices with at least one stored edge (sources for a CSR,
+   * targets for a CSC).  O(1).  Doesn't include sealed segments.
+   */
+  size_t getNumVertices() const { return degrees.getNumVertices(); }
+
+  /**
+   * Returns the number of stored edges of the vertex, i.e. its out-degree
+   * in a CSR and its in-degree in a CSC.  Edges in sealed segments aren't
+   * counted.  Costs one slot lookup.
    */
-  size_t countEdges() const;
+  size_t getDegree(NodeType const& vertex) const;
+
+  /**
+   * Returns the degree histogram of the in-memory edges.  histogram[k]
+   * for k > 0 is the number of vertices with degree in [2^(k-1), 2^k).
+   * O(1).
+   */
+  std::vector<size_t> getDegreeHistogram() const {
+    return degrees.getHistogram();
+  }
+
+  /**
+   * Returns up to k of the highest degree vertices with their current
+   * degrees, highest first.  Candidates are tracked incrementally, so this
+   * only looks up O(DEGREE_TOP_CANDIDATES) vertices.  A vertex whose
+   * degree fell and then grew back without passing the candidates may be
+   * missed.
+   */
+  std::vector<std::pair<NodeType, size_t>> getTopDegree(size_t k) const;
+
+  /**
+   * Average number of lists (vertices, plus empty lists not yet reclaimed)
+   * per slot, i.e. the expected lookup chain length.  O(1); use
+   * getChainLengthStats() for the full distribution.
+   */
+  double getMeanChainLength() const {
+    return static_cast<double>(alle->size()) / alle->getCapacity();
+  }
+
+  /**
+   * Walks the whole table and removes edges outside of the window.
+   * \return Returns the number of edges removed.
+   */
+  size_t removeExpiredEdges();
+
+  /**
+   * Turns on tiered storage: edges older than segmentDuration are sealed
+   * into immutable memory-mapped files named prefix_N.seg, and findEdges
+   * searches both tiers.  Segments are deleted once they fall out of the
+   * window.  Edges that arrive more than segmentDuration behind the
+   * newest edge may be missed by a seal, so segmentDuration should be
+   * larger than the expected disorder in the stream.  Call before adding
+   * edges.
+   * \param prefix Path prefix for the segment files (the directory must
+   *   exist).
+   * \param segmentDuration How many seconds of edges go in each segment.
+   */
+  void setTieredStorage(std::string prefix, double segmentDuration) {
+    this->segmentPrefix = prefix;
+    this->segmentDuration = segmentDuration;
+  }
+
+  /**
+   * Number of sealed segments currently on disk.
+   */
+  size_t getNumSegments() const {
+    std::lock_guard<std::mutex> lock(segmentsMutex);
+    return segments.size();
+  }
+
+  /**
+   * Number of edges currently stored in sealed segments.
+   */
+  size_t getNumSealedEdges() const {
+    std::lock_guard<std::mutex> lock(segmentsMutex);
+    size_t count = 0;
+    for (auto const& segment : segments) count += segment->getNumEdges();
+    return count;
+  }
+
+  /**
+   * Edges before this time are on disk rather than in memory.
+   */
+  double getSealedUpTo() const { return sealedUpTo; }
+
+  /// How many segment lookups findEdges has done.
+  size_t getNumSegmentProbes() const { return numSegmentProbes; }
+
+  /// How many segment lookups were skipped by the segment's Bloom filter.
+  size_t getNumSegmentBloomSkips() const { return numSegmentBloomSkips; }
+
+  /// Lookups redone because a seal ran while they scanned memory.
+  size_t getNumSealRetries() const { return numSealRetries; }
+
+  /// Edges dropped because they arrived after their time had been sealed.
+  size_t getNumLateEdges() const { return numLateEdges; }
+
+  /**
+   * Appends the window, the current time, and every edge still within the
+   * window (from both tiers) to out.  Edges are written one record per
+   * source list so that restore() can load lists in parallel.  The caller
+   * is responsible for keeping writers out while this runs if it wants a
+   * consistent snapshot.
+   */
+  void checkpoint(std::string& out) const;
+
+  /**
+   * Loads what checkpoint() wrote, advancing p past it.  The graph must be
+   * empty.  Lists are decoded and inserted by numThreads threads, and the
+   * table is sized for all of them up front.  With tiered storage, the
+   * restored edges start out in memory and are sealed again as time
+   * advances.
+   * \throws CompressedSparseException if the graph isn't empty.
+   * \throws SerializationException if the input is truncated.
+   */
+  void restore(char const*& p, char const* end, size_t numThreads);
+
+  /**
+   * Returns the current number of slots in the hash table.
+   */
+  size_t getCapacity() const { return alle->getCapacity(); }
+
+  /**
+   * Returns the distribution of the number of lists per slot.
+   */
+  ChainLengthStats getChainLengthStats() const {
+    return alle->getChainLengthStats();
+  }
 
   #ifdef METRICS
   size_t getTotalEdgesAdded() const { return totalEdgesAdded; }
   size_t getTotalEdgesDeleted() const { return totalEdgesDeleted; }
+  size_t getTotalBatches() const { return totalBatches; }
   #endif
 
 };
@@ -149,14 +427,25 @@ template <typename TupleType, size_t source, size_t target,
           typename HF, typename EF>
 CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
 CompressedSparse( size_t capacity, double window ) :
-  currentTime(0)
+  window(window), currentTime(0),
+  sealedUpTo(std::numeric_limits<double>::lowest()),
+  nextSeal(std::numeric_limits<double>::max()), sealing(false),
+  numSegmentProbes(0), numSegmentBloomSkips(0), numSealRetries(0),
+  numLateEdges(0)
 {
-  this->capacity = capacity;
-  this->window = window;
-
-  mutexes = new std::mutex[capacity];
-
-  alle = new std::list<std::list<TupleType>>[capacity];
+  // When a slot is migrated during a resize, each list is rehashed by its
+  // source.  Lists whose edges have all expired are dropped.
+  alle = new ResizableTable<SlotType>(capacity,
+    [this](EdgeListType const& l, size_t& h) {
+      if (l.size() == 0) {
+        if (this->memoryBudget) {
+          this->memoryBudget->remove(MemoryCategory::Edges, listBytes());
+        }
+        return false;
+      }
+      h = this->hash(std::get<source>(l.front()));
+      return true;
+    });
 }
 
 template <typename TupleType, size_t source, size_t target, 
@@ -165,8 +454,7 @@ template <typename TupleType, size_t source, size_t target,
 CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
 ~CompressedSparse()
 {
-  delete[] mutexes;
-  delete[] alle;
+  delete alle;
 }
 
 template <typename TupleType, size_t source, size_t target,
@@ -233,117 +521,183 @@ const
   DEBUG_PRINT("CompressedSparse::findEdges src %s trg %s %f %f %f %f\n",
     src.c_str(), trg.c_str(),
     startTimeFirst, startTimeSecond, endTimeFirst, endTimeSecond);
-  
-  size_t index = hash(src) % capacity;
 
-  std::lock_guard<std::mutex> lock(mutexes[index]);
+  // Take both tiers as of the same seal so that each edge is seen once.
+  // A seal moves edges out of memory into a segment that isn't in the
+  // snapshot, so if one happened during the in-memory scan, it is redone
+  // with a new snapshot.
+  double sealedBoundary = std::numeric_limits<double>::lowest();
+  std::vector<std::shared_ptr<SegmentType>> sealed;
+  std::list<TupleType> inMemory;
+  for (;;) {
+    if (tiered()) {
+      std::lock_guard<std::mutex> segmentsLock(segmentsMutex);
+      sealedBoundary = sealedUpTo.load();
+      sealed = segments;
+    }
+  
+    std::unique_lock<std::mutex> lock;
+    SlotType& slot = alle->lockBucket(hash(src), lock);
 
-  DEBUG_PRINT("CompressedSparse::findEdges src %s trg %s  number of lists"
-    " to consider: %lu\n", src.c_str(), trg.c_str(), alle[index].size());
-  for (auto & l : alle[index]) {
-    // l should be a list of lists
+    DEBUG_PRINT("CompressedSparse::findEdges src %s trg %s  number of lists"
+      " to consider: %lu\n", src.c_str(), trg.c_str(), slot.size());
+    for (auto & l : slot) {
+      // l should be a list of lists
 
-    DEBUG_PRINT("CompressedSparse::findEdges number of edges to consider: "
-      "%lu\n", l.size());
+      DEBUG_PRINT("CompressedSparse::findEdges number of edges to consider: "
+        "%lu\n", l.size());
 
-    if(l.size() > 0) {
+      if(l.size() > 0) {
 
-      try {
-        // All the tuples in each list should have the same source, so
-        // look at the first one and see if it matches what we are looking
-        // for.  
-        SourceType s0 = std::get<source>(l.front());  
-        if (equal(src, s0)) 
-        {
-          // If the first one matched on the source, look through
-          // all other tuples in the list.
-          for(auto it = l.begin(); it != l.end(); )
+        try {
+          // All the tuples in each list should have the same source, so
+          // look at the first one and see if it matches what we are looking
+          // for.  
+          SourceType s0 = std::get<source>(l.front());  
+          if (equal(src, s0)) 
           {
+            // If the first one matched on the source, look through
+            // all other tuples in the list.
+            for(auto it = l.begin(); it != l.end(); )
+            {
 
-            #ifdef DEBUG
-            printf("CompressedSparse::findEdges considering graph edge %s\n",
-              sam::toString(*it).c_str());
-            #endif
-
-            // Check that the edge hasn't expired.
-            #ifdef DEBUG
-            printf("CompressedSparse::findEdges currentTime %f tupletype"
-              " %f window %f \n", currentTime.load(), std::get<time>(*it), 
-              window);
-            #endif
+              #ifdef DEBUG
+              printf("CompressedSparse::findEdges considering graph edge %s\n",
+                sam::toString(*it).c_str());
+              #endif
 
-            if ( currentTime.load() - std::get<time>(*it) < window) 
-            {
+              // Check that the edge hasn't expired.
               #ifdef DEBUG
-              printf("CompressedSparse::findEdges edge hasn't expired\n");
+              printf("CompressedSparse::findEdges currentTime %f tupletype"
+                " %f window %f \n", currentTime.load(), std::get<time>(*it), 
+                window.load());
               #endif
-              
-              bool passed = true;
 
-              // Check to see if the source matches. It always should, so
-              // throw an exception if it doesn't
-              SourceType candSrc = std::get<source>(*it);
-              if (!equal(src, candSrc))
+              if ( currentTime.load() - std::get<time>(*it) < window.load()) 
               {
-                std::string message = "CompressedSpare::findEdges: Found an "
-                  "edge where the source doesn't match the source of the "
-                  "first edge.  This is a logical error.";
-                throw CompressedSparseException(message);
-              }
+                #ifdef DEBUG
+                printf("CompressedSparse::findEdges edge hasn't expired\n");
+                #endif
+              
+                bool passed = true;
 
-              // Check to see if the target matches if the target is defined
-              // in the edge request.
-              if (!isNull(trg)) {
-                TargetType candTrg = std::get<target>(*it);
-                if (!equal(trg, candTrg))
+                // Check to see if the source matches. It always should, so
+                // throw an exception if it doesn't
+                SourceType candSrc = std::get<source>(*it);
+                if (!equal(src, candSrc))
                 {
-                  passed = false;
+                  std::string message = "CompressedSpare::findEdges: Found an "
+                    "edge where the source doesn't match the source of the "
+                    "first edge.  This is a logical error.";
+                  throw CompressedSparseException(message);
                 }
-              }
-              DEBUG_PRINT("CompressedSparse::findEdges pass after checking "
-                "source/target: %d\n", passed);
-
-              if (passed) {
-                double candTime = std::get<time>(*it);
-                double candDuration = std::get<duration>(*it);
-                // Check that the time is after starttime and 
-                // before stoptime
-                DEBUG_PRINT("CompressedSparse::findEdges candTime %f "
-                  "candDuration %f "
-                  "startTimeFirst %f startTimeSecond %f "
-                  "endTimeFirst %f endTimeSecond %f\n",
-                  candTime, candDuration, startTimeFirst, startTimeSecond,
-                  endTimeFirst, endTimeSecond);
-                if (candTime < startTimeFirst ||
-                    candTime > startTimeSecond ||
-                    candTime + candDuration < endTimeFirst ||
-                    candTime + candDuration > endTimeSecond)
-                {
+
+                // Edges before the seal boundary are looked up on disk.
+                if (std::get<time>(*it) < sealedBoundary) {
                   passed = false;
                 }
-              }
-              if (passed) {
-                foundEdges.push_back(*it);
-              }
-              ++it;
-            } else {
-              // The edge has expired, so we get rid of it.
 
-              DEBUG_PRINT("CompressedSparse::findEdges the edge has expired"
-                " %s\n", toString(*it).c_str());
+                if (passed) {
+                  passed = matches(*it, trg, startTimeFirst, startTimeSecond,
+                                   endTimeFirst, endTimeSecond);
+                }
+                if (passed) {
+                  inMemory.push_back(*it);
+                }
+                ++it;
+              } else {
+                // The edge has expired, so we get rid of it.
+
+                DEBUG_PRINT("CompressedSparse::findEdges the edge has expired"
+                  " %s\n", toString(*it).c_str());
               
-              it = l.erase(it);
-              METRICS_INCREMENT(this->totalEdgesDeleted)
+                if (memoryBudget) {
+                  memoryBudget->remove(MemoryCategory::Edges, edgeBytes(*it));
+                }
+                it = l.erase(it);
+                degrees.update(src, l.size() + 1, l.size());
+                METRICS_INCREMENT(this->totalEdgesDeleted)
+              }
             }
           }
+        } catch (std::exception e) {
+          std::string message = std::string("addEdge: Error accessing first "
+            "element of list") + e.what();  
+          throw CompressedSparseException(message);
         }
-      } catch (std::exception e) {
-        std::string message = std::string("addEdge: Error accessing first "
-          "element of list") + e.what();  
-        throw CompressedSparseException(message);
       }
     }
+    lock.unlock();
+
+    if (!tiered() || sealedUpTo.load() == sealedBoundary) break;
+    inMemory.clear();
+    numSealRetries.fetch_add(1);
+  }
+  foundEdges.splice(foundEdges.end(), inMemory);
+
+  if (sealed.empty()) return;
+
+  // Sealed edges are never newer than the boundary, and the ones older
+  // than the window have expired.
+  double oldest = std::max(startTimeFirst, currentTime.load() - window.load());
+  double newest = std::min(startTimeSecond, sealedBoundary);
+  std::list<TupleType> candidates;
+  for (auto const& segment : sealed) {
+    if (segment->getMaxTime() < oldest || segment->getMinTime() > newest) {
+      continue;
+    }
+    numSegmentProbes.fetch_add(1);
+    if (!segment->findEdges(src, oldest, newest, candidates)) {
+      numSegmentBloomSkips.fetch_add(1);
+    }
+  }
+  for (auto& edge : candidates) {
+    if (matches(edge, trg, startTimeFirst, startTimeSecond,
+                endTimeFirst, endTimeSecond))
+    {
+      foundEdges.push_back(std::move(edge));
+    }
+  }
+}
+
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+bool
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
+matches(
+  TupleType const& edge,
+  NodeType const& trg,
+  double startTimeFirst,
+  double startTimeSecond,
+  double endTimeFirst,
+  double endTimeSecond)
+const
+{
+  // Check to see if the target matches if the target is defined
+  // in the edge request.
+  if (!isNull(trg)) {
+    TargetType candTrg = std::get<target>(edge);
+    if (!equal(trg, candTrg))
+    {
+      return false;
+    }
   }
+
+  double candTime = std::get<time>(edge);
+  double candDuration = std::get<duration>(edge);
+  // Check that the time is after starttime and 
+  // before stoptime
+  DEBUG_PRINT("CompressedSparse::matches candTime %f "
+    "candDuration %f "
+    "startTimeFirst %f startTimeSecond %f "
+    "endTimeFirst %f endTimeSecond %f\n",
+    candTime, candDuration, startTimeFirst, startTimeSecond,
+    endTimeFirst, endTimeSecond);
+  return !(candTime < startTimeFirst ||
+           candTime > startTimeSecond ||
+           candTime + candDuration < endTimeFirst ||
+           candTime + candDuration > endTimeSecond);
 }
 
 
@@ -359,6 +713,81 @@ CompressedSparse<TupleType, source, target, time, duration, HF, EF>::addEdge(
   #endif
   METRICS_INCREMENT(totalEdgesAdded)
 
+  if (!admit(tuple)) return 0;
+
+  std::unique_lock<std::mutex> lock;
+  SlotType& slot = alle->lockBucket(hash(std::get<source>(tuple)), lock);
+  size_t work = insertIntoSlot(slot, tuple);
+  lock.unlock();
+
+  // Grow or shrink the table if needed, and move any resize along.
+  alle->maintain();
+
+  if (tiered()) {
+    maybeSeal();
+  }
+  return work;
+}
+
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+size_t 
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::addEdges(
+  std::vector<TupleType> const& tuples)
+{
+  // Admit the whole batch first so that currentTime (and with it what
+  // cleanupEdges considers expired) is the same for every group.
+  std::vector<std::pair<size_t, size_t>> order;
+  order.reserve(tuples.size());
+  for (size_t i = 0; i < tuples.size(); i++) {
+    #ifdef DEBUG
+    printf("CompressedSparse::addEdges tuple %s\n",
+      sam::toString(tuples[i]).c_str());
+    #endif
+    METRICS_INCREMENT(totalEdgesAdded)
+    if (admit(tuples[i])) {
+      order.push_back(std::make_pair(
+        alle->getStripe(hash(std::get<source>(tuples[i]))), i));
+    }
+  }
+
+  // Group by stripe, keeping arrival order within a group so that the
+  // edge lists stay in time order.
+  std::stable_sort(order.begin(), order.end(),
+    [](std::pair<size_t, size_t> const& a,
+       std::pair<size_t, size_t> const& b) { return a.first < b.first; });
+
+  size_t work = 0;
+  size_t g = 0;
+  while (g < order.size()) {
+    size_t stripe = order[g].first;
+    std::unique_lock<std::mutex> lock;
+    alle->lockStripe(stripe, lock);
+    for (; g < order.size() && order[g].first == stripe; g++) {
+      TupleType const& tuple = tuples[order[g].second];
+      SlotType& slot = alle->lockedBucket(hash(std::get<source>(tuple)));
+      work += insertIntoSlot(slot, tuple);
+    }
+    lock.unlock();
+  }
+  METRICS_INCREMENT(totalBatches)
+
+  alle->maintain();
+
+  if (tiered()) {
+    maybeSeal();
+  }
+  return work;
+}
+
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+bool 
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::admit(
+  TupleType const& tuple)
+{
   // Updating time in a somewhat unsafe manner that should generally work.
   //uint64_t tupleTime = convert(std::get<time>(tuple));
   double tupleTime = std::get<time>(tuple);
@@ -366,17 +795,38 @@ CompressedSparse<TupleType, source, target, time, duration, HF, EF>::addEdge(
     currentTime.store(tupleTime);
   }
 
-  SourceType s = std::get<source>(tuple);
-  size_t index = hash(s) % capacity;
+  if (tiered()) {
+    // That part of the timeline is already on disk.
+    if (tupleTime < sealedUpTo.load()) {
+      numLateEdges.fetch_add(1);
+      return false;
+    }
+    double noSeal = std::numeric_limits<double>::max();
+    nextSeal.compare_exchange_strong(noSeal,
+      tupleTime + 2 * segmentDuration);
+  }
 
-  std::lock_guard<std::mutex> lock(mutexes[index]);
+  if (memoryBudget) {
+    memoryBudget->add(MemoryCategory::Edges, edgeBytes(tuple));
+  }
+  return true;
+}
+
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+size_t 
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
+insertIntoSlot(SlotType& slot, TupleType const& tuple)
+{
+  SourceType s = std::get<source>(tuple);
 
   // If we find a list that has entries where the source is the same
   // as tuple's source, this is set to true.
   bool found = false;
-  std::list<TupleType>* emptyListPtr = 0;
-  size_t work = alle[index].size();
-  for (auto & l : alle[index]) {
+  EdgeListType* emptyListPtr = 0;
+  size_t work = slot.size();
+  for (auto & l : slot) {
     if (l.size() > 0) {
       try {
         SourceType s0 = std::get<source>(l.front());  
@@ -384,6 +834,7 @@ CompressedSparse<TupleType, source, target, time, duration, HF, EF>::addEdge(
         {
           found = true;
           l.push_back(tuple);
+          degrees.update(s, l.size() - 1, l.size());
           break;
         }
       } catch (std::exception e) {
@@ -402,65 +853,354 @@ CompressedSparse<TupleType, source, target, time, duration, HF, EF>::addEdge(
   if (!found) {
 
     work += 1;
+    degrees.update(s, 0, 1);
     // If we found an empty list, use that list.
     if (emptyListPtr) {
       emptyListPtr->push_back(tuple);
     } else {
       // No empty lists, so we need to add another list to this slot
-      alle[index].push_back(std::list<TupleType>());
-      alle[index].back().push_back(tuple);
+      slot.push_back(EdgeListType());
+      slot.back().push_back(tuple);
+      alle->added();
+      if (memoryBudget) {
+        memoryBudget->add(MemoryCategory::Edges, listBytes());
+      }
     }
   } else {
     // If we did find a list, we can clean up edges that have expired.
-    work += cleanupEdges(index);
+    work += cleanupEdges(slot);
   }
   return work;
 }
 
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+void
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
+maybeSeal()
+{
+  double now = currentTime.load();
+  if (now < nextSeal.load()) return;
+
+  bool expected = false;
+  if (!sealing.compare_exchange_strong(expected, true)) return;
+  try {
+    // Keep the most recent segmentDuration in memory so that edges that
+    // arrive a little out of order still make it into a segment.
+    seal(now - segmentDuration);
+  } catch (...) {
+    sealing = false;
+    throw;
+  }
+  nextSeal = now + segmentDuration;
+  sealing = false;
+}
+
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+void
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
+seal(double boundary)
+{
+  double from = sealedUpTo.load();
+  double oldest = currentTime.load() - window.load();
+  std::vector<TupleType> edges;
+  alle->forEachBucket([&edges, from, oldest, boundary](SlotType& slot) {
+    for (auto const& l : slot) {
+      for (auto const& edge : l) {
+        double t = std::get<time>(edge);
+        if (t >= from && t < boundary && t > oldest) {
+          edges.push_back(edge);
+        }
+      }
+    }
+  });
+
+  std::shared_ptr<SegmentType> segment;
+  if (!edges.empty()) {
+    std::string filename = segmentPrefix + "_" +
+      boost::lexical_cast<std::string>(numSegmentsCreated++) + ".seg";
+    segment = std::make_shared<SegmentType>(filename, edges);
+  }
+
+  {
+    std::lock_guard<std::mutex> segmentsLock(segmentsMutex);
+    if (segment) segments.push_back(segment);
+    sealedUpTo = boundary;
+
+    // Segments that are entirely out of the window are unmapped and
+    // deleted once no lookup is using them.
+    segments.erase(std::remove_if(segments.begin(), segments.end(),
+      [oldest](std::shared_ptr<SegmentType> const& s) {
+        return s->getMaxTime() <= oldest;
+      }), segments.end());
+  }
+
+  // Everything before the boundary is on disk now.
+  removeExpiredEdges();
+}
+
 template <typename TupleType, size_t source, size_t target, 
           size_t time, size_t duration,
           typename HF, typename EF>
 size_t
 CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
-cleanupEdges( size_t index )
+cleanupEdges( SlotType& slot )
 {
   // Should only be called by addEdge and (maybe) findEdges, 
-  // which has this slot (alle[index]) locked out.
+  // which has this slot locked out.
   size_t work = 0;
-  for( auto & l : alle[index]) {
+  double w = window.load();
+  double sealedBoundary = sealedUpTo.load();
+  for( auto & l : slot) {
     while (l.size() > 0 && 
-           currentTime.load() - std::get<time>(l.front()) > window) {
+           (currentTime.load() - std::get<time>(l.front()) > w ||
+            std::get<time>(l.front()) < sealedBoundary)) {
       work++;
-      l.pop_front();
-      METRICS_INCREMENT(totalEdgesDeleted)
+      popEdge(l);
     }
   }
   return work;
 }
 
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+void
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
+popEdge( EdgeListType& l )
+{
+  if (memoryBudget) {
+    memoryBudget->remove(MemoryCategory::Edges, edgeBytes(l.front()));
+  }
+  degrees.update(std::get<source>(l.front()), l.size(), l.size() - 1);
+  l.pop_front();
+  METRICS_INCREMENT(totalEdgesDeleted)
+}
+
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+size_t
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
+removeExpiredEdges()
+{
+  size_t removed = 0;
+  alle->forEachBucket([this, &removed](SlotType& slot) {
+    removed += this->cleanupEdges(slot);
+  });
+  return removed;
+}
+
+
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+void
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
+checkpoint(std::string& out) const
+{
+  double now = currentTime.load();
+  double w = window.load();
+  double sealedBoundary = sealedUpTo.load();
+  serialize(out, w);
+  serialize(out, now);
+
+  // The number of lists isn't known until we've walked the table, so
+  // write a placeholder and fill it in at the end.
+  size_t countOffset = out.size();
+  uint64_t numLists = 0;
+  serialize(out, numLists);
+
+  std::string edges;
+  uint64_t numEdges = 0;
+  auto flush = [&out, &edges, &numEdges, &numLists]() {
+    if (numEdges == 0) return;
+    std::string record;
+    serialize(record, numEdges);
+    record.append(edges);
+    serialize(out, record);
+    numLists++;
+    edges.clear();
+    numEdges = 0;
+  };
+
+  alle->forEachBucket([&](SlotType& slot) {
+    for (auto const& l : slot) {
+      for (auto const& edge : l) {
+        double t = std::get<time>(edge);
+        if (now - t <= w && t >= sealedBoundary) {
+          serialize(edges, edge);
+          numEdges++;
+        }
+      }
+      flush();
+    }
+  });
+
+  if (tiered()) {
+    std::lock_guard<std::mutex> segmentsLock(segmentsMutex);
+    for (auto const& segment : segments) {
+      // Edges for a source are contiguous within a segment.
+      bool first = true;
+      SourceType previous;
+      segment->forEachEdge([&](TupleType const& edge) {
+        if (now - std::get<time>(edge) > w) return;
+        if (!first && !equal(previous, std::get<source>(edge))) flush();
+        previous = std::get<source>(edge);
+        first = false;
+        serialize(edges, edge);
+        numEdges++;
+      });
+      flush();
+    }
+  }
+
+  std::memcpy(&out[countOffset], &numLists, sizeof(numLists));
+}
+
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+void
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
+restore(char const*& p, char const* end, size_t numThreads)
+{
+  if (alle->size() > 0) {
+    throw CompressedSparseException("CompressedSparse::restore: the graph "
+      "must be empty");
+  }
+
+  double w, now;
+  deserialize(p, end, w);
+  deserialize(p, end, now);
+  window = w;
+  currentTime = now;
+
+  std::vector<RecordType> records = readRecords(p, end);
+  alle->reserve(records.size());
+
+  forEachRecordInParallel(records, numThreads,
+    [this](char const* q, char const* recordEnd) {
+      uint64_t numEdges;
+      deserialize(q, recordEnd, numEdges);
+      EdgeListType l;
+      for (uint64_t i = 0; i < numEdges; i++) {
+        TupleType edge;
+        deserialize(q, recordEnd, edge);
+        if (this->memoryBudget) {
+          this->memoryBudget->add(MemoryCategory::Edges, edgeBytes(edge));
+        }
+        l.push_back(std::move(edge));
+      }
+      if (l.empty()) return;
+
+      SourceType s = std::get<source>(l.front());
+      std::unique_lock<std::mutex> lock;
+      SlotType& slot = this->alle->lockBucket(this->hash(s), lock);
+
+      // A source can have a list from memory and lists from segments;
+      // merge them in time order.
+      bool found = false;
+      for (auto& existing : slot) {
+        if (existing.size() > 0 &&
+            this->equal(s, std::get<source>(existing.front())))
+        {
+          size_t added = l.size();
+          existing.merge(l, [](TupleType const& a, TupleType const& b) {
+            return std::get<time>(a) < std::get<time>(b);
+          });
+          this->degrees.update(s, existing.size() - added, existing.size());
+          found = true;
+          break;
+        }
+      }
+      if (!found) {
+        this->degrees.update(s, 0, l.size());
+        slot.push_back(std::move(l));
+        this->alle->added();
+        if (this->memoryBudget) {
+          this->memoryBudget->add(MemoryCategory::Edges, listBytes());
+        }
+      }
+      lock.unlock();
+      this->alle->maintain();
+    });
+}
 
 template <typename TupleType, size_t source, size_t target, 
           size_t time, size_t duration,
           typename HF, typename EF>
 size_t
 CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
-countEdges()
+getDegree(NodeType const& vertex) const
+{
+  std::unique_lock<std::mutex> lock;
+  SlotType& slot = alle->lockBucket(hash(vertex), lock);
+  for (auto const& l : slot) {
+    if (l.size() > 0 && equal(vertex, std::get<source>(l.front()))) {
+      return l.size();
+    }
+  }
+  return 0;
+}
+
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+std::vector<std::pair<typename CompressedSparse<TupleType, source, target,
+  time, duration, HF, EF>::NodeType, size_t>>
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
+getTopDegree(size_t k) const
+{
+  std::vector<std::pair<NodeType, size_t>> top = degrees.getCandidates();
+  for (auto& p : top) {
+    p.second = getDegree(p.first);
+  }
+  degrees.refreshCandidates(top);
+
+  std::sort(top.begin(), top.end(),
+    [](std::pair<NodeType, size_t> const& a,
+       std::pair<NodeType, size_t> const& b) {
+      return a.second > b.second;
+    });
+  while (!top.empty() && top.back().second == 0) top.pop_back();
+  if (top.size() > k) top.resize(k);
+  return top;
+}
+
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename HF, typename EF>
+size_t
+CompressedSparse<TupleType, source, target, time, duration, HF, EF>::
+countEdgesInWindow()
 const
 {
    // For fun we parallelized it
   int numThreads = 4;
   std::vector<std::thread> threads;
   std::atomic<size_t> allCount(0);
+  size_t numStripes = alle->getNumStripes();
   for (int i = 0; i < numThreads; i++) {
-    threads.push_back(std::thread([i, numThreads, this, &allCount]() {
+    threads.push_back(std::thread([i, numThreads, numStripes, this,
+                                   &allCount]() {
       size_t count = 0;
-      int beg = get_begin_index(capacity, i, numThreads); 
-      int end = get_end_index(capacity, i, numThreads); 
-      for (int j = beg; j < end; j++) {
-        for (auto l1 : this->alle[j]) {
-          count += l1.size();
+      int beg = get_begin_index(numStripes, i, numThreads); 
+      int end = get_end_index(numStripes, i, numThreads); 
+      double now = this->currentTime.load();
+      double sealedBoundary = this->sealedUpTo.load();
+      this->alle->forEachBucket(beg, end,
+        [&count, now, sealedBoundary, this](SlotType& slot) {
+        for (auto const& l1 : slot) {
+          for (auto const& edge : l1) {
+            if (now - std::get<time>(edge) <= this->window.load() &&
+                std::get<time>(edge) >= sealedBoundary) count++;
+          }
         }
-      }
+      });
       allCount.fetch_add(count); 
     }));
   }
@@ -469,6 +1209,14 @@ const
     threads[i].join();
   }
 
+  if (tiered()) {
+    double oldest = currentTime.load() - window.load();
+    std::lock_guard<std::mutex> segmentsLock(segmentsMutex);
+    for (auto const& segment : segments) {
+      allCount.fetch_add(segment->countEdges(oldest));
+    }
+  }
+
   return allCount.load();
 }
 
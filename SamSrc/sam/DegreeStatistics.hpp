@@ -0,0 +1,156 @@
+#ifndef SAM_DEGREE_STATISTICS_HPP
+#define SAM_DEGREE_STATISTICS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/// Number of log2 bins in a degree histogram (enough for any size_t).
+#define DEGREE_HISTOGRAM_BINS 65
+
+/// How many high-degree vertices are tracked as top-degree candidates.
+#define DEGREE_TOP_CANDIDATES 64
+
+namespace sam {
+
+/**
+ * Counters that describe a graph's degree distribution, kept up to date as
+ * edges come and go so that reading them doesn't walk the graph.  The
+ * owner calls update() whenever a vertex's degree changes.
+ *
+ * histogram[0] is unused (vertices of degree zero aren't tracked) and
+ * histogram[k] for k > 0 is the number of vertices with degree in
+ * [2^(k-1), 2^k), the same binning as ChainLengthStats.
+ *
+ * The top-degree vertices are tracked as a bounded set of candidates.  A
+ * vertex enters the set when its degree passes the smallest degree in the
+ * set; degrees in the set can go stale as edges expire, so the owner
+ * should refresh them with exact degrees before reporting.
+ */
+template <typename NodeType>
+class DegreeStatistics
+{
+private:
+  std::atomic<size_t> numEdges;
+  std::atomic<size_t> numVertices;
+  std::atomic<size_t> histogram[DEGREE_HISTOGRAM_BINS];
+
+  mutable std::mutex candidatesMutex;
+  std::map<NodeType, size_t> candidates;
+
+  /// Smallest degree in candidates once it is full, otherwise zero.  Read
+  /// without the lock to skip it for the common (low degree) case.
+  std::atomic<size_t> candidateThreshold;
+
+  static size_t bin(size_t degree) {
+    size_t b = 0;
+    while (b + 1 < DEGREE_HISTOGRAM_BINS &&
+           (static_cast<size_t>(1) << b) <= degree) b++;
+    return b;
+  }
+
+  /// Caller holds candidatesMutex.
+  void recomputeThreshold() {
+    if (candidates.size() < DEGREE_TOP_CANDIDATES) {
+      candidateThreshold = 0;
+      return;
+    }
+    size_t smallest = candidates.begin()->second;
+    for (auto const& p : candidates) smallest = std::min(smallest, p.second);
+    candidateThreshold = smallest;
+  }
+
+public:
+  DegreeStatistics() : numEdges(0), numVertices(0), candidateThreshold(0) {
+    for (auto& count : histogram) count = 0;
+  }
+
+  /**
+   * Records that vertex went from oldDegree to newDegree.
+   */
+  void update(NodeType const& vertex, size_t oldDegree, size_t newDegree) {
+    if (oldDegree == newDegree) return;
+    if (newDegree > oldDegree) {
+      numEdges.fetch_add(newDegree - oldDegree);
+    } else {
+      numEdges.fetch_sub(oldDegree - newDegree);
+    }
+
+    if (oldDegree == 0) numVertices.fetch_add(1);
+    if (newDegree == 0) numVertices.fetch_sub(1);
+
+    size_t oldBin = bin(oldDegree);
+    size_t newBin = bin(newDegree);
+    if (oldBin != newBin) {
+      if (oldDegree > 0) histogram[oldBin].fetch_sub(1);
+      if (newDegree > 0) histogram[newBin].fetch_add(1);
+    }
+
+    // Only growing vertices can become candidates; shrinking ones are
+    // corrected when the candidates are refreshed.
+    if (newDegree > oldDegree && newDegree > candidateThreshold.load()) {
+      std::lock_guard<std::mutex> lock(candidatesMutex);
+      candidates[vertex] = newDegree;
+      if (candidates.size() > DEGREE_TOP_CANDIDATES) {
+        auto smallest = candidates.begin();
+        for (auto it = candidates.begin(); it != candidates.end(); ++it) {
+          if (it->second < smallest->second) smallest = it;
+        }
+        candidates.erase(smallest);
+      }
+      recomputeThreshold();
+    }
+  }
+
+  size_t getNumEdges() const { return numEdges; }
+  size_t getNumVertices() const { return numVertices; }
+
+  /**
+   * Returns the degree histogram, trimmed after the last non-empty bin.
+   */
+  std::vector<size_t> getHistogram() const {
+    std::vector<size_t> h;
+    for (size_t b = 0; b < DEGREE_HISTOGRAM_BINS; b++) {
+      h.push_back(histogram[b].load());
+    }
+    while (h.size() > 1 && h.back() == 0) h.pop_back();
+    return h;
+  }
+
+  /**
+   * Returns the current candidates and their (possibly stale) degrees.
+   */
+  std::vector<std::pair<NodeType, size_t>> getCandidates() const {
+    std::lock_guard<std::mutex> lock(candidatesMutex);
+    return std::vector<std::pair<NodeType, size_t>>(candidates.begin(),
+                                                     candidates.end());
+  }
+
+  /**
+   * Replaces the candidates' degrees with exact ones, dropping vertices
+   * whose degree has gone to zero.
+   */
+  void refreshCandidates(
+    std::vector<std::pair<NodeType, size_t>> const& exact)
+  {
+    std::lock_guard<std::mutex> lock(candidatesMutex);
+    for (auto const& p : exact) {
+      auto it = candidates.find(p.first);
+      if (it == candidates.end()) continue;
+      if (p.second == 0) {
+        candidates.erase(it);
+      } else {
+        it->second = p.second;
+      }
+    }
+    recomputeThreshold();
+  }
+};
+
+} // end namespace sam
+
+#endif
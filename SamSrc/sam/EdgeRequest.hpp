@@ -6,7 +6,12 @@
 #include <sam/Null.hpp>
 #include <sam/Util.hpp>
 #include <sam/ZeroMQUtil.hpp>
+#include <algorithm>
+#include <list>
 #include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <boost/lexical_cast.hpp>
 
 namespace sam {
 
@@ -44,6 +49,12 @@ public:
   zmq::message_t toZmqMessage() const { return emptyZmqMessage(); }
 
   bool isExpired(double currentTime) const { return true; }
+
+  size_t memoryUsage() const { return sizeof(*this); }
+
+  bool coalescesWith(EdgeRequest const& other) const { return false; }
+
+  void merge(EdgeRequest const& other) {}
 };
 
 
@@ -158,8 +169,76 @@ public:
     return false; 
   }
 
+  /**
+   * Returns true if the other request asks for the same edges (same source
+   * and target, either of which may be null) to be sent to the same node.
+   * Such requests differ only in their time ranges and can be merged.
+   */
+  bool coalescesWith(EdgeRequest const& other) const {
+    return getReturn() == other.getReturn() &&
+           getSource() == other.getSource() &&
+           getTarget() == other.getTarget();
+  }
+
+  /**
+   * Widens the time ranges of this request to cover the other's as well.
+   * A null (unset) bound on either side stays null.
+   */
+  void merge(EdgeRequest const& other) {
+    auto lower = [](double a, double b) {
+      return (isNull(a) || isNull(b)) ? nullValue<double>() : std::min(a, b);
+    };
+    auto upper = [](double a, double b) {
+      return (isNull(a) || isNull(b)) ? nullValue<double>() : std::max(a, b);
+    };
+    setStartTimeFirst(lower(getStartTimeFirst(), other.getStartTimeFirst()));
+    setStartTimeSecond(upper(getStartTimeSecond(),
+                             other.getStartTimeSecond()));
+    setEndTimeFirst(lower(getEndTimeFirst(), other.getEndTimeFirst()));
+    setEndTimeSecond(upper(getEndTimeSecond(), other.getEndTimeSecond()));
+  }
+
+  /**
+   * Returns the bytes used by this request, including the protobuf
+   * message's heap allocations.
+   */
+  size_t memoryUsage() const {
+    return sizeof(*this) - sizeof(request) + request.SpaceUsedLong();
+  }
+
 };
 
+/**
+ * Merges the requests that ask for the same edges to be sent to the same
+ * node (see EdgeRequest::coalescesWith), widening the time ranges of the
+ * first of each group to cover the rest.
+ * \param requests The requests.
+ * \param coalesced The merged requests are appended to this, in the order
+ *   of their first request.
+ * \return Returns how many requests were merged into an earlier one.
+ */
+template <typename EdgeRequestType>
+size_t coalesce(std::list<EdgeRequestType> const& requests,
+                std::list<EdgeRequestType>& coalesced)
+{
+  std::unordered_map<std::string, EdgeRequestType*> groups;
+  size_t numMerged = 0;
+  for (auto const& request : requests) {
+    std::string key = boost::lexical_cast<std::string>(request.getSource()) +
+      '\0' + boost::lexical_cast<std::string>(request.getTarget()) + '\0' +
+      boost::lexical_cast<std::string>(request.getReturn());
+    auto it = groups.find(key);
+    if (it != groups.end()) {
+      it->second->merge(request);
+      numMerged++;
+    } else {
+      coalesced.push_back(request);
+      groups[key] = &coalesced.back();
+    }
+  }
+  return numMerged;
+}
+
 }
 
 #endif
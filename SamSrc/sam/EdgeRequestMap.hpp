@@ -2,16 +2,29 @@
 #define SAM_EDGE_REQUEST_MAP_HPP
 
 #include <atomic>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
 #include <zmq.hpp>
 #include <boost/lexical_cast.hpp>
 #include <sam/EdgeRequest.hpp>
 #include <sam/Null.hpp>
 #include <sam/Util.hpp>
 #include <sam/TemporalSet.hpp>
+#include <sam/SlabAllocator.hpp>
+#include <sam/ResizableTable.hpp>
+#include <sam/MemoryBudget.hpp>
+#include <sam/Serialization.hpp>
 #include <sam/ZeroMQUtil.hpp>
 
 #define TOLERANCE 1.0
 
+/// The most expiry entries one call to EdgeRequestMap::expire handles, so
+/// that a large backlog is spread over several tuples.
+#define EDGE_REQUEST_MAP_EXPIRE_STEP 64
+
 namespace sam {
 
 class EdgeRequestMapException : public std::runtime_error {
@@ -25,11 +38,26 @@ public:
 /**
  * This class has a list of edge requests that have been made of a node.
  * We store them in a hash table where each entry in the hash table has a 
- * mutex lock.  Each entry is a list of edge requests that hash to the
- * same location.
+ * mutex lock.  Each slot holds one list of edge requests per key, where the
+ * key is what the request binds: its source, its target, or both.  The
+ * slot is chosen by a mix of the key's hashes (and which of the three kinds
+ * it is), so requests for different keys rarely share a slot.
+ *
+ * When process(tuple) is called, we look up the tuple's source, target,
+ * and source/target keys, and only walk the requests stored under those
+ * keys.  If any match, we send the tuple to the appropriate node(s).
  *
- * When process(tuple) is called, we find if there are any matching edge 
- * requests.  If so, we send the tuple to the appropriate node(s).
+ * Requests are also kept in a heap ordered by when they expire.  As the
+ * tuples' time moves past the front of the heap, expire() removes the
+ * expired requests from their slots, so requests for keys that no tuple
+ * touches anymore don't linger until a tuple happens to land on them.
+ *
+ * Many partial results can be waiting on edges of the same vertex, each
+ * sending its own request.  Requests for the same source and target from
+ * the same node only differ in their time ranges, so addRequest merges
+ * them into one request covering all the ranges.  The stored requests (and
+ * the work per tuple in process) grow with the number of distinct needs
+ * rather than with the number of partial results.
  */
 template <typename TupleType, size_t source, size_t target, size_t time,
           typename SourceHF, typename TargetHF,
@@ -40,10 +68,18 @@ public:
   typedef EdgeRequest<TupleType, source, target> EdgeRequestType;
   typedef typename std::tuple_element<source, TupleType>::type SourceType;
   typedef typename std::tuple_element<target, TupleType>::type TargetType;
+  /// Requests with the same key (source, target, or both).
+  typedef std::list<EdgeRequestType, SlabAllocator<EdgeRequestType>>
+    RequestListType;
+  /// The lists of requests that hash to one slot.
+  typedef std::list<RequestListType, SlabAllocator<RequestListType>>
+    SlotType;
 
 public:
   /**
    * Constructor.  
+   * \param tableCapacity The initial size of the hash table storing
+   *   the edge requests.  The table resizes itself based on load.
    */
    EdgeRequestMap(std::size_t numNodes,
                   std::size_t nodeId,
@@ -57,7 +93,8 @@ public:
 
   /**
    * Add a request to the list.  This is called by the requestPullThread of
-   * the GraphStore class.  
+   * the GraphStore class.  If a request for the same source and target from
+   * the same node is already stored, the new one is merged into it.
    */
   void addRequest(EdgeRequestType request);
 
@@ -69,6 +106,55 @@ public:
    */
   size_t process(TupleType const& tuple);
 
+  /**
+   * Removes requests that have expired by currentTime, oldest first, up to
+   * EDGE_REQUEST_MAP_EXPIRE_STEP heap entries per call.  process calls this
+   * whenever a tuple's time passes the earliest expiry.  If another thread
+   * is already expiring, returns right away.
+   * \return Returns the number of requests removed.
+   */
+  size_t expire(double currentTime);
+
+  /**
+   * Charges every edge request stored from now on to the given budget.
+   * Call before adding requests.
+   */
+  void setMemoryBudget(MemoryBudget* memoryBudget) {
+    this->memoryBudget = memoryBudget;
+  }
+
+  /**
+   * Returns the current size of the hash table storing the edge requests.
+   */
+  size_t getCapacity() const { return ale->getCapacity(); }
+
+  /**
+   * Returns the number of edge requests stored.
+   */
+  size_t getNumRequests() const { return numRequests; }
+
+  /**
+   * Returns the number of distinct keys (request lists) stored.
+   */
+  size_t getNumKeys() const { return ale->size(); }
+
+  /**
+   * Returns how many requests have been removed because they expired.
+   */
+  size_t getNumExpired() const { return totalExpired; }
+
+  /**
+   * Returns how many added requests were merged into a stored one.
+   */
+  size_t getNumCoalesced() const { return numCoalesced; }
+
+  /**
+   * Returns the distribution of the number of request lists per slot.
+   */
+  ChainLengthStats getChainLengthStats() const {
+    return ale->getChainLengthStats();
+  }
+
   #ifdef METRICS
   /**
    * Returns how many edges we've sent
@@ -84,6 +170,20 @@ public:
    * Returns how many total edge requests this class examines.
    */
   uint64_t getTotalEdgeRequestsViewed() { return edgeRequestsViewedCounter; }
+
+  /**
+   * Returns how many tuples have been processed.
+   */
+  uint64_t getTotalTuplesProcessed() { return tuplesProcessedCounter; }
+
+  /**
+   * Returns the average number of edge requests examined per tuple.
+   */
+  double getEdgeRequestsViewedPerTuple() {
+    uint64_t tuples = tuplesProcessedCounter;
+    if (tuples == 0) return 0;
+    return static_cast<double>(edgeRequestsViewedCounter) / tuples;
+  }
   #endif
 
   #ifdef DETAIL_TIMING
@@ -97,6 +197,18 @@ public:
    */
   double getTotalTimeLock() { return totalTimeLock; }
   #endif
+
+  /**
+   * Appends every outstanding edge request to out, one record per request
+   * in the request's wire format.
+   */
+  void checkpoint(std::string& out) const;
+
+  /**
+   * Loads what checkpoint() wrote, advancing p past it.  Requests are
+   * decoded and added by numThreads threads.
+   */
+  void restore(char const*& p, char const* end, size_t numThreads);
 	
   /**
    * Iterates through the edge push sockets and sends a terminate
@@ -106,8 +218,40 @@ public:
 
 private:
 
-  size_t process(TupleType const& tuple,
-        std::function<size_t(TupleType const&)> indexFunction,
+  /// Which of the request's source and target are bound.
+  enum class KeyKind { Source, Target, SourceTarget };
+
+  /**
+   * Returns the kind of key the request is stored under.
+   * \throws EdgeRequestMapException if neither source nor target is set.
+   */
+  KeyKind keyKind(EdgeRequestType const& request) const;
+
+  /**
+   * Returns the hash of a key, mixing in the kind so that, say, a source
+   * and a target with the same hash go to different slots.  Only the parts
+   * of the key that the kind binds are used.
+   */
+  size_t keyHash(KeyKind kind, SourceType const& src,
+                 TargetType const& trg) const;
+
+  /**
+   * Returns the hash that determines where the request is stored.
+   */
+  size_t requestHash(EdgeRequestType const& request) const;
+
+  /**
+   * Returns true if the list holds requests for the given key.
+   */
+  bool hasKey(RequestListType const& requests, KeyKind kind,
+              SourceType const& src, TargetType const& trg) const;
+
+  /**
+   * Remembers when the request expires so that expire() can remove it.
+   */
+  void scheduleExpiry(EdgeRequestType const& request, size_t h);
+
+  size_t process(TupleType const& tuple, KeyKind kind,
         std::function<bool(EdgeRequestType const&, TupleType const&)> 
           checkFunction);
 
@@ -120,24 +264,53 @@ private:
   size_t numNodes;
   size_t nodeId;
 
-  /// The size of the hash table storing the edge requests.
-  size_t tableCapacity;
+  /// A hash table of slots, each a list of request lists, with locks per
+  /// stripe of slots.  The table's size is the number of request lists.
+  ResizableTable<SlotType>* ale;
+
+  std::atomic<size_t> numRequests;
+  std::atomic<size_t> totalExpired;
+
+  /// When a request expires and the hash of its key.
+  typedef std::pair<double, size_t> ExpiryType;
+
+  /**
+   * The expiry of every stored request, earliest first.  A request merged
+   * into a longer lived one leaves its old entry behind; when that entry
+   * comes up the slot is swept but the request stays.
+   */
+  std::priority_queue<ExpiryType, std::vector<ExpiryType>,
+                      std::greater<ExpiryType>> expiries;
+  std::mutex expiryMutex;
+
+  /// The earliest expiry in the heap, so process can skip expire() without
+  /// taking the lock.
+  std::atomic<double> nextExpiry;
+
+  /// Charged for every edge request stored, if set.
+  MemoryBudget* memoryBudget = nullptr;
 
-  /// An array of lists of edge requests
-  std::list<EdgeRequestType> *ale;
+  /**
+   * Bytes charged to the memory budget for a stored request.
+   */
+  static size_t requestBytes(EdgeRequestType const& request) {
+    return slabUsableSize(sizeof(EdgeRequestType) + LIST_NODE_OVERHEAD) +
+           request.memoryUsage() - sizeof(EdgeRequestType);
+  }
 
-  /// mutexes for each array element of ale.
-  std::mutex* mutexes;
+  /**
+   * Bytes charged to the memory budget for one (empty) list in a slot.
+   */
+  static size_t listBytes() {
+    return slabUsableSize(sizeof(RequestListType) + LIST_NODE_OVERHEAD);
+  }
 
   PushPull* edgeCommunicator;
 
-  std::function<size_t(TupleType const&)> sourceIndexFunction;
   std::function<bool(EdgeRequestType const&, TupleType const&)> 
     sourceCheckFunction;
-  std::function<size_t(TupleType const&)> targetIndexFunction;
   std::function<bool(EdgeRequestType const&, TupleType const&)> 
     targetCheckFunction;
-  std::function<size_t(TupleType const&)> sourceTargetIndexFunction;
   std::function<bool(EdgeRequestType const&, TupleType const&)> 
     sourceTargetCheckFunction;
 
@@ -150,6 +323,8 @@ private:
   std::atomic<size_t> sendFailCounter; 
 
   std::atomic<uint64_t> edgeRequestsViewedCounter;
+
+  std::atomic<uint64_t> tuplesProcessedCounter;
   #endif 
 
   #ifdef DETAIL_TIMING
@@ -158,6 +333,8 @@ private:
   #endif
 
   std::atomic<bool> terminated;
+
+  std::atomic<size_t> numCoalesced;
 };
 
 // Constructor 
@@ -177,24 +354,9 @@ EdgeRequestMap( std::size_t numNodes,
   sendFailCounter = 0;
   edgePushCounter = 0;
   edgeRequestsViewedCounter = 0;
+  tuplesProcessedCounter = 0;
   #endif
 
-  sourceIndexFunction = [this](TupleType const& tuple) {
-    SourceType src = std::get<source>(tuple);
-    return sourceHash(src) % this->tableCapacity;
-  };
-
-  targetIndexFunction = [this](TupleType const& tuple) {
-    TargetType trg = std::get<target>(tuple);
-    return targetHash(trg) % this->tableCapacity;
-  };
-  
-  sourceTargetIndexFunction = [this](TupleType const& tuple) {
-    SourceType src = std::get<source>(tuple);
-    TargetType trg = std::get<target>(tuple);
-    return (sourceHash(src) * targetHash(trg)) % this->tableCapacity;
-  };
-
   sourceCheckFunction = [this](EdgeRequestType const& edgeRequest,
                                TupleType const& tuple) 
   {
@@ -260,11 +422,18 @@ EdgeRequestMap( std::size_t numNodes,
 
  
   terminated = false;
+  numCoalesced = 0;
+  numRequests = 0;
+  totalExpired = 0;
+  nextExpiry = std::numeric_limits<double>::max();
   this->numNodes = numNodes;
   this->nodeId = nodeId;
-  this->tableCapacity = tableCapacity;
-  mutexes = new std::mutex[tableCapacity];
-  ale = new std::list<EdgeRequestType>[tableCapacity];
+  ale = new ResizableTable<SlotType>(tableCapacity,
+    [this](RequestListType const& requests, size_t& h) {
+      if (requests.empty()) return false;
+      h = this->requestHash(requests.front());
+      return true;
+    });
 
 }
 
@@ -276,14 +445,109 @@ EdgeRequestMap<TupleType, source, target, time,
   SourceHF, TargetHF, SourceEF, TargetEF>::
 ~EdgeRequestMap()
 {
-  delete[] mutexes;
-  delete[] ale;
+  delete ale;
   terminate();
   DEBUG_PRINT("Node %lu end of ~EdgeRequestMap\n", nodeId);
 }
 
 
 
+template <typename TupleType, size_t source, size_t target, size_t time,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+typename EdgeRequestMap<TupleType, source, target, time,
+  SourceHF, TargetHF, SourceEF, TargetEF>::KeyKind
+EdgeRequestMap<TupleType, source, target, time,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+keyKind(EdgeRequestType const& request) const
+{
+  bool hasSource = !isNull(request.getSource());
+  bool hasTarget = !isNull(request.getTarget());
+
+  if (hasSource && hasTarget) {
+    return KeyKind::SourceTarget;
+  } else if (hasSource) {
+    return KeyKind::Source;
+  } else if (hasTarget) {
+    return KeyKind::Target;
+  } else {
+    std::string message = "Node " + boost::lexical_cast<std::string>(nodeId) +
+      " EdgeRequestMap::addRequest tried to add a request with no source or"
+      " target";
+    throw EdgeRequestMapException(message);
+  }
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+size_t
+EdgeRequestMap<TupleType, source, target, time,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+keyHash(KeyKind kind, SourceType const& src, TargetType const& trg) const
+{
+  // Combined the way boost::hash_combine does, over mixed hashes so that
+  // poor hash functions (e.g. the last octet of an IP) still spread out.
+  auto combine = [](size_t seed, size_t h) {
+    return seed ^ (ResizableTable<SlotType>::mix(h) + 0x9e3779b97f4a7c15ULL +
+                   (seed << 6) + (seed >> 2));
+  };
+
+  size_t seed = static_cast<size_t>(kind) + 1;
+  if (kind != KeyKind::Target) seed = combine(seed, sourceHash(src));
+  if (kind != KeyKind::Source) seed = combine(seed, targetHash(trg));
+  return seed;
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+size_t
+EdgeRequestMap<TupleType, source, target, time,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+requestHash(EdgeRequestType const& request) const
+{
+  // TODO: Very similar to SubgraphQueryResult::hash.  Anyway to combine?
+  return keyHash(keyKind(request), request.getSource(), request.getTarget());
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+bool
+EdgeRequestMap<TupleType, source, target, time,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+hasKey(RequestListType const& requests, KeyKind kind,
+       SourceType const& src, TargetType const& trg) const
+{
+  if (requests.empty()) return false;
+  EdgeRequestType const& front = requests.front();
+  if (keyKind(front) != kind) return false;
+  if (kind != KeyKind::Target && !sourceEquals(src, front.getSource())) {
+    return false;
+  }
+  if (kind != KeyKind::Source && !targetEquals(trg, front.getTarget())) {
+    return false;
+  }
+  return true;
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+EdgeRequestMap<TupleType, source, target, time,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+scheduleExpiry(EdgeRequestType const& request, size_t h)
+{
+  double endTime = request.getEndTimeSecond();
+  if (isNull(endTime)) return; // Never expires
+
+  std::lock_guard<std::mutex> lock(expiryMutex);
+  expiries.push(ExpiryType(endTime, h));
+  nextExpiry = expiries.top().first;
+}
+
 template <typename TupleType, size_t source, size_t target, size_t time,
           typename SourceHF, typename TargetHF,
           typename SourceEF, typename TargetEF>
@@ -292,35 +556,129 @@ EdgeRequestMap<TupleType, source, target, time,
   SourceHF, TargetHF, SourceEF, TargetEF>::
 addRequest(EdgeRequestType request)
 {
+  KeyKind kind = keyKind(request);
   SourceType src = request.getSource();
   TargetType trg = request.getTarget();
+  size_t h = keyHash(kind, src, trg);
 
-  size_t index;
+  std::unique_lock<std::mutex> lock;
+  SlotType& slot = ale->lockBucket(h, lock);
 
-  // TODO: Very similar to SubgraphQueryResult::hash.  Anyway to combine?
-  if (isNull(src) && !isNull(trg))
-  {
-    index = targetHash(trg) % tableCapacity;
-  } else
-  if (!isNull(src) && isNull(trg))
-  {
-    index = sourceHash(src) % tableCapacity;
-  } else
-  if (!isNull(src) && !isNull(trg))
-  {
-    index = (sourceHash(src) * targetHash(trg)) % tableCapacity;
-  } else
+  auto requests = slot.begin();
+  while (requests != slot.end() && !hasKey(*requests, kind, src, trg)) {
+    ++requests;
+  }
+
+  if (requests != slot.end()) {
+    for (auto& stored : *requests) {
+      if (stored.coalescesWith(request)) {
+        // Matching ignores the time ranges, so the merged request forwards
+        // the same tuples until the later of the two expiries.
+        double endTime = stored.getEndTimeSecond();
+        size_t before = memoryBudget ? requestBytes(stored) : 0;
+        stored.merge(request);
+        if (memoryBudget) {
+          // Merging can change what the request uses (e.g. setting a
+          // protobuf field), so charge the difference.
+          size_t after = requestBytes(stored);
+          if (after > before) {
+            memoryBudget->add(MemoryCategory::Requests, after - before);
+          } else if (before > after) {
+            memoryBudget->remove(MemoryCategory::Requests, before - after);
+          }
+        }
+        numCoalesced.fetch_add(1);
+        bool extended = stored.getEndTimeSecond() != endTime;
+        lock.unlock();
+        if (extended) scheduleExpiry(request, h);
+        return;
+      }
+    }
+  } else {
+    slot.emplace_back();
+    requests = std::prev(slot.end());
+    ale->added();
+    if (memoryBudget) {
+      memoryBudget->add(MemoryCategory::Requests, listBytes());
+    }
+  }
+
+  requests->push_back(request);
+  numRequests.fetch_add(1);
+  if (memoryBudget) {
+    memoryBudget->add(MemoryCategory::Requests,
+                      requestBytes(requests->back()));
+  }
+  lock.unlock();
+
+  scheduleExpiry(request, h);
+  ale->maintain();
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+size_t
+EdgeRequestMap<TupleType, source, target, time,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+expire(double currentTime)
+{
+  if (!(currentTime > nextExpiry)) return 0;
+
+  // Only one thread expires at a time; the others carry on.
+  std::unique_lock<std::mutex> expiryLock(expiryMutex, std::try_to_lock);
+  if (!expiryLock.owns_lock()) return 0;
+
+  std::vector<size_t> hashes;
+  while (!expiries.empty() && currentTime > expiries.top().first &&
+         hashes.size() < EDGE_REQUEST_MAP_EXPIRE_STEP)
   {
-    std::string message = "Node " + boost::lexical_cast<std::string>(nodeId) +
-      " EdgeRequestMap::addRequest tried to add a request with no source or"
-      " target";
-    throw EdgeRequestMapException(message);
+    hashes.push_back(expiries.top().second);
+    expiries.pop();
+  }
+  nextExpiry = expiries.empty() ? std::numeric_limits<double>::max() :
+                                  expiries.top().first;
+  expiryLock.unlock();
+
+  size_t removed = 0;
+  for (size_t h : hashes) {
+    std::unique_lock<std::mutex> lock;
+    SlotType& slot = ale->lockBucket(h, lock);
+    size_t numListsRemoved = 0;
+    for (auto requests = slot.begin(); requests != slot.end();) {
+      for (auto request = requests->begin(); request != requests->end();) {
+        if (request->isExpired(currentTime)) {
+          if (memoryBudget) {
+            memoryBudget->remove(MemoryCategory::Requests,
+                                 requestBytes(*request));
+          }
+          request = requests->erase(request);
+          removed++;
+        } else {
+          ++request;
+        }
+      }
+      if (requests->empty()) {
+        if (memoryBudget) {
+          memoryBudget->remove(MemoryCategory::Requests, listBytes());
+        }
+        requests = slot.erase(requests);
+        numListsRemoved++;
+      } else {
+        ++requests;
+      }
+    }
+    lock.unlock();
+    ale->removed(numListsRemoved);
   }
 
-  mutexes[index].lock();
-  ale[index].push_back(request);
-  mutexes[index].unlock();
+  numRequests.fetch_sub(removed);
+  totalExpired.fetch_add(removed);
+  ale->maintain();
 
+  DEBUG_PRINT("Node %lu EdgeRequestMap::expire currentTime %f removed %lu "
+    "requests\n", nodeId, currentTime, removed);
+  return removed;
 }
 
 template <typename TupleType, size_t source, size_t target, size_t time,
@@ -334,10 +692,16 @@ process(TupleType const& tuple)
   DEBUG_PRINT("Node %lu EdgeRequestMap::process(tuple) tuple: %s\n", nodeId,
     toString(tuple).c_str());
  
+  #ifdef METRICS
+  tuplesProcessedCounter.fetch_add(1);
+  #endif
+
+  expire(std::get<time>(tuple));
+
   size_t totalWork = 0; 
-  totalWork += process(tuple, sourceIndexFunction, sourceCheckFunction);
-  totalWork += process(tuple, targetIndexFunction, targetCheckFunction);
-  totalWork += process(tuple, sourceTargetIndexFunction, 
+  totalWork += process(tuple, KeyKind::Source, sourceCheckFunction);
+  totalWork += process(tuple, KeyKind::Target, targetCheckFunction);
+  totalWork += process(tuple, KeyKind::SourceTarget, 
                        sourceTargetCheckFunction);
   return totalWork;
 }
@@ -349,13 +713,13 @@ template <typename TupleType, size_t source, size_t target, size_t time,
 size_t
 EdgeRequestMap<TupleType, source, target, time,
   SourceHF, TargetHF, SourceEF, TargetEF>::
-process(TupleType const& tuple,
-        std::function<size_t(TupleType const&)> indexFunction,
+process(TupleType const& tuple, KeyKind kind,
         std::function<bool(EdgeRequestType const&, TupleType const&)> 
           checkFunction)
 {
-  size_t index = indexFunction(tuple);
-  size_t edgeId = std::get<0>(tuple);
+  SourceType src = std::get<source>(tuple);
+  TargetType trg = std::get<target>(tuple);
+  size_t h = keyHash(kind, src, trg);
 
   double currentTime = std::get<time>(tuple);
 
@@ -365,22 +729,29 @@ process(TupleType const& tuple,
   for (size_t i = 0; i < numNodes; i++) sentEdges[i] = false;
 
   DETAIL_TIMING_BEG1
-  mutexes[index].lock();
+  std::unique_lock<std::mutex> lock;
+  SlotType& slot = ale->lockBucket(h, lock);
   DETAIL_TIMING_END_TOL1(nodeId, totalTimeLock, TOLERANCE, 
     "EdgeRequestMap::process obtaining lock exceeded "
     "tolerance")
   size_t count = 0;
 
+  auto list = slot.begin();
+  while (list != slot.end() && !hasKey(*list, kind, src, trg)) ++list;
+  if (list == slot.end()) return 0;
+  RequestListType& requests = *list;
+
   DEBUG_PRINT("Node %lu EdgeRequestMap::process number of requests to look at"
-    " %lu processing tuple %s\n", nodeId, ale[index].size(), 
+    " %lu processing tuple %s\n", nodeId, requests.size(), 
     toString(tuple).c_str());
 
   #ifdef METRICS
-  edgeRequestsViewedCounter.fetch_add(ale[index].size());
+  edgeRequestsViewedCounter.fetch_add(requests.size());
   #endif
 
-  for(auto edgeRequest = ale[index].begin();
-        edgeRequest != ale[index].end();)
+  size_t numExpired = 0;
+  for(auto edgeRequest = requests.begin();
+        edgeRequest != requests.end();)
   {
 
     DEBUG_PRINT("Node %lu EdgeRequestMap::process looking at edgeRequest %s "
@@ -388,14 +759,20 @@ process(TupleType const& tuple,
       toString(tuple).c_str());
      
     // Deleting edge requests that are no longer valid because the request
-    // is too old. 
+    // is too old.  expire() gets most of them first, but it doesn't keep
+    // up with every tuple.
     if (edgeRequest->isExpired(currentTime)) {
 
       DEBUG_PRINT("Node %lu EdgeRequestMap::process deleting old edgeRequest"
         " %s currentTime %f\n", nodeId, edgeRequest->toString().c_str(), 
         currentTime);
       
-      edgeRequest = ale[index].erase(edgeRequest);
+      if (memoryBudget) {
+        memoryBudget->remove(MemoryCategory::Requests, 
+                             requestBytes(*edgeRequest));
+      }
+      edgeRequest = requests.erase(edgeRequest);
+      numExpired++;
     } else {
 
       count++;
@@ -423,8 +800,6 @@ process(TupleType const& tuple,
             //// End sending tuple
             
             sentEdges[node] = true;
-            double edgeTime = std::get<time>(tuple);
-            //seenEdges[node]->insert(edgeId, edgeTime);
 
             if (!sent) {
               DEBUG_PRINT("Node %lu->%lu EdgeRequestMap::process error sending"
@@ -450,10 +825,64 @@ process(TupleType const& tuple,
     }
   }
 
-  mutexes[index].unlock();
+  bool emptied = requests.empty();
+  if (emptied) {
+    if (memoryBudget) {
+      memoryBudget->remove(MemoryCategory::Requests, listBytes());
+    }
+    slot.erase(list);
+  }
+  lock.unlock();
+  numRequests.fetch_sub(numExpired);
+  totalExpired.fetch_add(numExpired);
+  if (emptied) {
+    ale->removed();
+    ale->maintain();
+  }
   return count;
 }
 
+template <typename TupleType, size_t source, size_t target, size_t time,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+EdgeRequestMap<TupleType, source, target, time,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+checkpoint(std::string& out) const
+{
+  size_t countOffset = out.size();
+  uint64_t numRequests = 0;
+  serialize(out, numRequests);
+
+  ale->forEachBucket([&out, &numRequests](SlotType& slot) {
+    for (auto const& requests : slot) {
+      for (auto const& request : requests) {
+        serialize(out, request.serialize());
+        numRequests++;
+      }
+    }
+  });
+
+  std::memcpy(&out[countOffset], &numRequests, sizeof(numRequests));
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+EdgeRequestMap<TupleType, source, target, time,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+restore(char const*& p, char const* end, size_t numThreads)
+{
+  std::vector<RecordType> records = readRecords(p, end);
+  ale->reserve(ale->size() + records.size());
+
+  forEachRecordInParallel(records, numThreads,
+    [this](char const* q, char const* recordEnd) {
+      this->addRequest(EdgeRequestType(std::string(q, recordEnd)));
+    });
+}
+
 template <typename TupleType, size_t source, size_t target, size_t time,
           typename SourceHF, typename TargetHF,
           typename SourceEF, typename TargetEF>
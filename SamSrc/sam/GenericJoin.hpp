@@ -0,0 +1,474 @@
+#ifndef SAM_GENERIC_JOIN_HPP
+#define SAM_GENERIC_JOIN_HPP
+
+#include <sam/SubgraphQuery.hpp>
+#include <sam/SubgraphQueryResult.hpp>
+#include <sam/CompressedSparse.hpp>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace sam {
+
+class GenericJoinException : public std::runtime_error
+{
+public:
+  GenericJoinException(char const* message) :
+    std::runtime_error(message) {}
+  GenericJoinException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * Matches cyclic subgraph queries (triangles, 4-cycles, ...) with a
+ * worst-case optimal join instead of growing partial results.
+ *
+ * The edges of a match arrive in the order of the query's sorted edge
+ * descriptions, so every match is complete when the tuple matching its
+ * last edge description arrives, and the other edges are already in the
+ * graph.  matchLast() takes that tuple, binds the two variables of the last
+ * edge description, and binds the remaining variables one at a time
+ * (generic join): the candidates for a variable are the intersection of
+ * the neighbor sets of the bound variables it shares a query edge with.
+ * The neighbor sets are read from the CSR and CSC within the query's time
+ * extent, sorted, and intersected with leapfrog search, so a variable only
+ * considers vertices that close every cycle through it.  Once all of the
+ * variables are bound, the edges between the bound vertices are looked up
+ * and checked against the edge descriptions in order with
+ * SubgraphQueryResult::addEdge, which applies the time and vertex
+ * constraints.
+ *
+ * The incremental approach keeps a partial result for every path that may
+ * become a cycle, most of which never close; the join stores nothing and
+ * only enumerates closed cycles, at the cost of a few graph lookups per
+ * tuple matching the last edge description.
+ *
+ * Every vertex has to be local, so it should only be used on a single
+ * node, and the graph's time window has to cover the query's time extent.
+ */
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+class GenericJoin
+{
+public:
+  typedef typename std::tuple_element<source, TupleType>::type NodeType;
+  typedef SubgraphQuery<TupleType, source, target, time, duration>
+    QueryType;
+  typedef SubgraphQueryResult<TupleType, source, target, time, duration>
+    ResultType;
+  typedef CompressedSparse<TupleType, source, target, time, duration,
+            SourceHF, SourceEF> CsrType;
+  typedef CompressedSparse<TupleType, target, source, time, duration,
+            TargetHF, TargetEF> CscType;
+  typedef std::function<void(ResultType const&)> ResultFunction;
+
+private:
+  CsrType const& csr;
+  CscType const& csc;
+
+  /// What one call of matchLast needs.  Neighbor sets are cached by
+  /// (outgoing, vertex) since the same bound vertex is asked for again in
+  /// other branches of the search.
+  struct Search {
+    std::shared_ptr<const QueryType> query;
+    TupleType const* tuple;
+    double from;
+    double to;
+    std::vector<NodeType> bindings;
+    std::map<std::pair<bool, NodeType>, std::vector<NodeType>> neighbors;
+    ResultFunction const* emit;
+    size_t work = 0;
+  };
+
+  std::atomic<size_t> numJoins;
+  std::atomic<size_t> numIntersections;
+  std::atomic<size_t> numCandidates;
+  std::atomic<size_t> numBindings;
+  std::atomic<size_t> numMatches;
+
+  /**
+   * The sorted, distinct targets (outgoing) or sources of the edges of
+   * vertex within the search's time range.
+   */
+  std::vector<NodeType> const& neighborsOf(Search& search, bool outgoing,
+                                           NodeType const& vertex) const;
+
+  /**
+   * Binds the unbound variable with the most query edges to bound ones,
+   * and recurses for each of its candidates.
+   */
+  void bindNext(Search& search, size_t numBound);
+
+  /**
+   * All variables are bound: looks up the edges between the bound vertices
+   * and emits the results they make.
+   */
+  void matchEdges(Search& search);
+
+  /**
+   * Extends result by the edges of edge description i onwards.
+   */
+  void extend(Search& search, ResultType& result, size_t i,
+              std::vector<std::vector<TupleType>> const& edges);
+
+public:
+  GenericJoin(CsrType const& csr, CscType const& csc) :
+    csr(csr), csc(csc), numJoins(0), numIntersections(0), numCandidates(0),
+    numBindings(0), numMatches(0) {}
+
+  /**
+   * Leapfrog intersection of sorted lists of distinct values.
+   * \param lists The lists to intersect.
+   * \param out Cleared, then filled with the values in every list, in
+   *   order.
+   */
+  static void intersect(std::vector<std::vector<NodeType> const*> const& lists,
+                        std::vector<NodeType>& out);
+
+  /**
+   * Whether the query's variables form a single connected pattern with a
+   * cycle (ignoring edge direction), which is what the join is for.  A
+   * chain of edges gains nothing from it.
+   */
+  static bool supports(QueryType const& query);
+
+  /**
+   * Finds the matches of query whose last edge is tuple.  The tuple must
+   * already be in the graph or have a later time than every edge that is.
+   * \param query A finalized query that supports() accepts.
+   * \param tuple The tuple matched against the last edge description.
+   * \param emit Called with each complete result.
+   * \return Returns a number representing the amount of work.
+   */
+  size_t matchLast(std::shared_ptr<const QueryType> query,
+                   TupleType const& tuple, ResultFunction const& emit);
+
+  /// How many tuples matched a last edge description and were joined.
+  size_t getNumJoins() const { return numJoins; }
+
+  /// How many candidate sets were intersected.
+  size_t getNumIntersections() const { return numIntersections; }
+
+  /// How many vertices the intersections produced in all.
+  size_t getNumCandidates() const { return numCandidates; }
+
+  /// How many times every variable of a query was bound.
+  size_t getNumBindings() const { return numBindings; }
+
+  /// How many complete results were found.
+  size_t getNumMatches() const { return numMatches; }
+};
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+GenericJoin<TupleType, source, target, time, duration,
+            SourceHF, TargetHF, SourceEF, TargetEF>::
+intersect(std::vector<std::vector<NodeType> const*> const& lists,
+          std::vector<NodeType>& out)
+{
+  typedef typename std::vector<NodeType>::const_iterator Iterator;
+
+  out.clear();
+  if (lists.empty()) return;
+  for (auto list : lists) {
+    if (list->empty()) return;
+  }
+  if (lists.size() == 1) {
+    out = *lists[0];
+    return;
+  }
+
+  // Leapfrog needs the iterators in order of their current values.
+  std::vector<std::pair<Iterator, Iterator>> its;
+  for (auto list : lists) its.emplace_back(list->begin(), list->end());
+  std::sort(its.begin(), its.end(),
+    [](std::pair<Iterator, Iterator> const& a,
+       std::pair<Iterator, Iterator> const& b) {
+      return *a.first < *b.first;
+    });
+
+  size_t k = its.size();
+  size_t i = 0;
+  NodeType max = *its[k - 1].first;
+  while (true) {
+    auto& it = its[i];
+    if (!(*it.first < max)) {
+      // The smallest value equals the largest: it is in every list.
+      out.push_back(max);
+      ++it.first;
+    } else {
+      it.first = std::lower_bound(it.first, it.second, max);
+    }
+    if (it.first == it.second) return;
+    max = *it.first;
+    i = (i + 1) % k;
+  }
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+bool
+GenericJoin<TupleType, source, target, time, duration,
+            SourceHF, TargetHF, SourceEF, TargetEF>::
+supports(QueryType const& query)
+{
+  // Union-find over the variable slots.  An edge between two variables
+  // that are already connected closes a cycle.
+  size_t n = query.getNumVariables();
+  std::vector<size_t> parent(n);
+  for (size_t v = 0; v < n; v++) parent[v] = v;
+  std::function<size_t(size_t)> find = [&parent, &find](size_t v) {
+    return parent[v] == v ? v : parent[v] = find(parent[v]);
+  };
+
+  bool cyclic = false;
+  size_t components = n;
+  for (size_t i = 0; i < query.size(); i++) {
+    size_t s = query.getSourceSlot(i);
+    size_t t = query.getTargetSlot(i);
+    if (s == t) continue;
+    size_t a = find(s);
+    size_t b = find(t);
+    if (a == b) {
+      cyclic = true;
+    } else {
+      parent[a] = b;
+      components--;
+    }
+  }
+  return cyclic && components == 1;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+std::vector<typename GenericJoin<TupleType, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::NodeType> const&
+GenericJoin<TupleType, source, target, time, duration,
+            SourceHF, TargetHF, SourceEF, TargetEF>::
+neighborsOf(Search& search, bool outgoing, NodeType const& vertex) const
+{
+  auto key = std::make_pair(outgoing, vertex);
+  auto it = search.neighbors.find(key);
+  if (it != search.neighbors.end()) return it->second;
+
+  std::list<TupleType> found;
+  double lowest = std::numeric_limits<double>::lowest();
+  double highest = std::numeric_limits<double>::max();
+  std::vector<NodeType> neighbors;
+  if (outgoing) {
+    csr.findEdges(vertex, nullValue<NodeType>(), search.from, search.to,
+                  lowest, highest, found);
+    for (auto const& edge : found) neighbors.push_back(std::get<target>(edge));
+  } else {
+    csc.findEdges(vertex, nullValue<NodeType>(), search.from, search.to,
+                  lowest, highest, found);
+    for (auto const& edge : found) neighbors.push_back(std::get<source>(edge));
+  }
+  search.work += found.size();
+  std::sort(neighbors.begin(), neighbors.end());
+  neighbors.erase(std::unique(neighbors.begin(), neighbors.end()),
+                  neighbors.end());
+  return search.neighbors.emplace(key, std::move(neighbors)).first->second;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+size_t
+GenericJoin<TupleType, source, target, time, duration,
+            SourceHF, TargetHF, SourceEF, TargetEF>::
+matchLast(std::shared_ptr<const QueryType> query, TupleType const& tuple,
+          ResultFunction const& emit)
+{
+  if (query->size() < 2) {
+    throw GenericJoinException("GenericJoin::matchLast needs a query with "
+      "more than one edge");
+  }
+  size_t last = query->size() - 1;
+  if (!query->satisfiesVertexConstraints(last, tuple)) return 1;
+
+  Search search;
+  search.query = query;
+  search.tuple = &tuple;
+  search.emit = &emit;
+  search.bindings.assign(query->getNumVariables(), nullValue<NodeType>());
+
+  // When the query's times are relative to the start of the first edge,
+  // every earlier edge starts at most getMaxTimeExtent() before the end of
+  // the last one, so no earlier than this.  When they are relative to its
+  // end, the extent is between end times and the first edge can start any
+  // time before, so only the time window bounds it.  Edges at the same
+  // time as the tuple are found too, but addEdge rejects them.
+  search.to = std::get<time>(tuple);
+  search.from = query->zeroTimeRelativeToStart() ?
+    search.to - query->getMaxTimeExtent() :
+    std::numeric_limits<double>::lowest();
+
+  size_t s = query->getSourceSlot(last);
+  size_t t = query->getTargetSlot(last);
+  NodeType const& src = std::get<source>(tuple);
+  NodeType const& trg = std::get<target>(tuple);
+  if (s == t && src != trg) return 1;
+  search.bindings[s] = src;
+  search.bindings[t] = trg;
+  numJoins.fetch_add(1, std::memory_order_relaxed);
+
+  bindNext(search, s == t ? 1 : 2);
+  return search.work + 1;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+GenericJoin<TupleType, source, target, time, duration,
+            SourceHF, TargetHF, SourceEF, TargetEF>::
+bindNext(Search& search, size_t numBound)
+{
+  QueryType const& query = *search.query;
+  size_t numVariables = query.getNumVariables();
+  if (numBound == numVariables) {
+    numBindings.fetch_add(1, std::memory_order_relaxed);
+    matchEdges(search);
+    return;
+  }
+
+  // The unbound variable with the most query edges to bound variables.
+  size_t best = numVariables;
+  size_t bestCount = 0;
+  for (size_t v = 0; v < numVariables; v++) {
+    if (!isNull(search.bindings[v])) continue;
+    size_t count = 0;
+    for (size_t i = 0; i < query.size(); i++) {
+      size_t s = query.getSourceSlot(i);
+      size_t t = query.getTargetSlot(i);
+      if ((s == v && t != v && !isNull(search.bindings[t])) ||
+          (t == v && s != v && !isNull(search.bindings[s])))
+      {
+        count++;
+      }
+    }
+    if (count > bestCount) {
+      best = v;
+      bestCount = count;
+    }
+  }
+  if (best == numVariables) {
+    throw GenericJoinException("GenericJoin::bindNext the query's variables "
+      "aren't connected");
+  }
+
+  // Its candidates are in the neighbor set of every bound variable it
+  // shares an edge with.
+  std::vector<std::vector<NodeType> const*> lists;
+  for (size_t i = 0; i < query.size(); i++) {
+    size_t s = query.getSourceSlot(i);
+    size_t t = query.getTargetSlot(i);
+    if (s == best && t != best && !isNull(search.bindings[t])) {
+      lists.push_back(&neighborsOf(search, false, search.bindings[t]));
+    } else if (t == best && s != best && !isNull(search.bindings[s])) {
+      lists.push_back(&neighborsOf(search, true, search.bindings[s]));
+    }
+  }
+  std::vector<NodeType> candidates;
+  intersect(lists, candidates);
+  numIntersections.fetch_add(1, std::memory_order_relaxed);
+  numCandidates.fetch_add(candidates.size(), std::memory_order_relaxed);
+  search.work += candidates.size();
+
+  std::string const& variable = query.getVariable(best);
+  for (auto const& candidate : candidates) {
+    if (!query.satisfiesVertexConstraints(variable, candidate)) continue;
+    search.bindings[best] = candidate;
+    bindNext(search, numBound + 1);
+  }
+  search.bindings[best] = nullValue<NodeType>();
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+GenericJoin<TupleType, source, target, time, duration,
+            SourceHF, TargetHF, SourceEF, TargetEF>::
+matchEdges(Search& search)
+{
+  QueryType const& query = *search.query;
+  size_t last = query.size() - 1;
+  double lowest = std::numeric_limits<double>::lowest();
+  double highest = std::numeric_limits<double>::max();
+
+  // The edges that could match each of the earlier edge descriptions.
+  std::vector<std::vector<TupleType>> edges(last);
+  for (size_t i = 0; i < last; i++) {
+    std::list<TupleType> found;
+    csr.findEdges(search.bindings[query.getSourceSlot(i)],
+                  search.bindings[query.getTargetSlot(i)],
+                  search.from, search.to, lowest, highest, found);
+    search.work += found.size();
+    if (found.empty()) return;
+    edges[i].assign(found.begin(), found.end());
+  }
+
+  for (auto const& first : edges[0]) {
+    double queryStart = std::get<time>(first);
+    if (!query.zeroTimeRelativeToStart()) {
+      queryStart += std::get<duration>(first);
+    }
+    if (!query.satisfiesConstraints(0, first, queryStart)) continue;
+    ResultType result(search.query, first);
+    extend(search, result, 1, edges);
+  }
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+GenericJoin<TupleType, source, target, time, duration,
+            SourceHF, TargetHF, SourceEF, TargetEF>::
+extend(Search& search, ResultType& result, size_t i,
+       std::vector<std::vector<TupleType>> const& edges)
+{
+  if (i == edges.size()) {
+    TupleType const& tuple = *search.tuple;
+    if (!result.noSamId(std::get<0>(tuple))) return;
+    auto p = result.addEdge(tuple);
+    if (p.first && p.second.complete()) {
+      numMatches.fetch_add(1, std::memory_order_relaxed);
+      (*search.emit)(p.second);
+    }
+    return;
+  }
+
+  for (auto const& edge : edges[i]) {
+    if (!result.noSamId(std::get<0>(edge))) continue;
+    auto p = result.addEdge(edge);
+    if (p.first) extend(search, p.second, i + 1, edges);
+  }
+}
+
+}
+
+#endif
@@ -15,20 +15,46 @@
 #include <sam/CompressedSparse.hpp>
 #include <sam/SubgraphQuery.hpp>
 #include <sam/SubgraphQueryResultMap.hpp>
+#include <sam/QueryNetwork.hpp>
+#include <sam/QueryPlanner.hpp>
+#include <sam/GenericJoin.hpp>
 #include <sam/EdgeRequestMap.hpp>
+#include <sam/VertexSummary.hpp>
+#include <sam/RemoteEdgeCache.hpp>
+#include <sam/HubMirror.hpp>
 #include <sam/ZeroMQUtil.hpp>
 #include <sam/FeatureMap.hpp>
 #include <sam/AbstractSubgraphPrinter.hpp>
+#include <sam/MemoryBudget.hpp>
+#include <sam/LoadShedder.hpp>
+#include <sam/Serialization.hpp>
+#include <sam/ThreadPool.hpp>
 #include <zmq.hpp>
 #include <thread>
 #include <cstdlib>
-#include <future>
+#include <cstdio>
+#include <fstream>
+#include <shared_mutex>
 
 namespace sam {
 
-#define MAX_NUM_FUTURES 1028
+/// Default for how many tuples can wait in consume's thread pool.
+#define MAX_NUM_FUTURES THREAD_POOL_DEFAULT_MAX_QUEUED
 #define TOLERANCE 1.0 
 
+/// Whether GraphStores plan queries (QueryPlanner) unless told otherwise.
+#define GRAPH_STORE_DEFAULT_QUERY_PLANNING false
+
+/// Default for how many tuples consume() groups into one batch.  One means
+/// every tuple is processed on its own.
+#define GRAPH_STORE_DEFAULT_BATCH_SIZE 1
+
+/// Default for how many seconds (of tuple time) a tuple waits for its
+/// batch to fill up before the batch is handed off anyway.
+#define GRAPH_STORE_DEFAULT_BATCH_DELAY 1.0
+
+#define GRAPH_STORE_CHECKPOINT_MAGIC 0x53414d434b505432ULL // "SAMCKPT2"
+
 class GraphStoreException : public std::runtime_error {
 public:
   GraphStoreException(char const * message) : std::runtime_error(message) { } 
@@ -64,6 +90,15 @@ public:
   typedef SubgraphQueryResult<TupleType, source, target, time, duration>
           ResultType;
 
+  typedef QueryPlanner<TupleType, source, target, time, duration>
+          PlannerType;
+
+  typedef QueryNetwork<TupleType, source, target, time, duration>
+          NetworkType;
+
+  typedef GenericJoin<TupleType, source, target, time, duration,
+    SourceHF, TargetHF, SourceEF, TargetEF> JoinType;
+
   typedef EdgeRequest<TupleType, source, target> EdgeRequestType;
   typedef EdgeRequest<TupleType, target, source> CscEdgeRequestType;
 
@@ -79,6 +114,13 @@ public:
                           TargetHF, TargetEF> cscType;
 
   typedef EdgeDescription<TupleType, time, duration> EdgeDescriptionType;
+
+  typedef VertexSummaries<SourceType, SourceHF> SummariesType;
+
+  typedef RemoteEdgeCache<TupleType, source, target, time, duration>
+    RemoteEdgeCacheType;
+
+  typedef HubMirror<SourceType> HubMirrorType;
  
 private:
 
@@ -141,6 +183,10 @@ private:
   /// This is the count of how many edges we failed to send from this class
   /// and not from the EdgeRequestMap.
   std::atomic<size_t> edgePushFails; 
+
+  /// How many outgoing edge requests were merged into another before being
+  /// sent.
+  std::atomic<size_t> numEdgeRequestsCoalesced;
   
   size_t numNodes; ///> How many total nodes there are
   size_t nodeId; ///> The node id of this node
@@ -148,14 +194,38 @@ private:
   std::shared_ptr<csrType> csr; ///> Compressed Sparse Row graph
   std::shared_ptr<cscType> csc; ///> Compressed Sparse column graph
   std::vector<std::shared_ptr<QueryType>> queries; ///> The list of queries.
+
+  /// Shares the first edge tests of the queries.
+  NetworkType network;
+
+  /// One planner per query, in the same order.  Planning only happens on
+  /// a single node, where the whole graph is local.
+  std::vector<std::shared_ptr<PlannerType>> planners;
+  bool queryPlanning = GRAPH_STORE_DEFAULT_QUERY_PLANNING;
+
+  /// Matches the cyclic queries when their last edge arrives, if set.
+  std::shared_ptr<JoinType> join;
+
+  /// For each query, whether join matches it instead of the result map.
+  std::vector<bool> joined;
+
+  /// Mean degree of the graph, for the planners.
+  double getMeanDegree() const {
+    double out = csr->countEdges() /
+      std::max(1.0, static_cast<double>(csr->getNumVertices()));
+    double in = csc->countEdges() /
+      std::max(1.0, static_cast<double>(csc->getNumVertices()));
+    return std::max(out, in);
+  }
   
   /// Keeps track of how many consume threads are active.
   std::atomic<size_t> consumeThreadsActive; 
   
-  size_t currentFuture = 0;
-  std::future<bool> futures[MAX_NUM_FUTURES];
+  /// Runs consumeDoesTheWork.  Each task holds its own copy of the tuple.
+  std::shared_ptr<ThreadPool> consumePool;
 
-  bool cycled = false;
+  /// Expands large levels of partial results in the result map, if set.
+  std::shared_ptr<ThreadPool> expansionPool;
 
   void processRequestAgainstGraph(EdgeRequestType const& edgeRequest);
   
@@ -172,6 +242,34 @@ private:
   void sendEdgeRequest(EdgeRequestType const& edgeRequest,
     std::function<size_t(EdgeRequestType const&)> addressFunction);
 
+  /// Summaries of the vertices on the other nodes, if they are used.
+  std::shared_ptr<SummariesType> summaries;
+
+  /// Edges other nodes have sent us, if they are cached.
+  std::shared_ptr<RemoteEdgeCacheType> remoteEdgeCache;
+
+  /// Picks the vertices of this node mirrored to the others, if any are.
+  std::shared_ptr<HubMirrorType> hubMirror;
+
+  /**
+   * If a new epoch has started, picks the hubs and, for each one and each
+   * other node, adds an edge request for the hub's edges to the
+   * EdgeRequestMap and tells the node about it.
+   */
+  void mirrorHubs(double currentTime);
+
+  /**
+   * Checks the summary of the node an edge request goes to.  Returns false
+   * if the request is certain to come back empty.
+   */
+  bool mayAnswer(EdgeRequestType const& edgeRequest, size_t node);
+
+  /**
+   * Adds the vertices of a consumed tuple to this node's summary, and
+   * broadcasts the summary when a new epoch starts.
+   */
+  void summarize(TupleType const& tuple);
+
 #ifdef DROP_QUERIES
   double keepQueries = 1;
 #endif
@@ -181,7 +279,60 @@ private:
 
   std::shared_ptr<FeatureMap> featureMap;
 
-  size_t maxFutures; ///> How many async threads can be active
+  /// Byte accounting for edges, intermediate results, and edge requests.
+  MemoryBudget memoryBudget;
+
+  /// The edge window we were constructed with.  The memory budget may
+  /// shorten the window temporarily.
+  double originalWindow;
+
+  /// Only one thread at a time tries to get us back under budget.
+  std::mutex memoryBudgetMutex;
+
+  std::atomic<size_t> memoryBudgetTicks;
+
+  /**
+   * If we are over the memory budget, applies the eviction policies.  If
+   * we are well under budget and the window was shortened, grows it back.
+   */
+  void enforceMemoryBudget();
+
+  /// Adjusts query start sampling under load and sheds partial results,
+  /// if set.
+  std::shared_ptr<LoadShedder> loadShedder;
+
+  std::atomic<size_t> loadShedderTicks;
+
+  /// The index of each registered query, for the load shedder.
+  std::map<QueryType const*, size_t> queryIndex;
+
+  /**
+   * Gives the load shedder the current signals and sheds the partial
+   * results it asks for.
+   */
+  void shedLoad();
+
+  /// Tuple processing holds this shared; checkpoint() holds it exclusively
+  /// so that the snapshot is taken between tuples.
+  std::shared_timed_mutex checkpointMutex;
+
+  /// How many tuples consume() collects before handing them to a worker.
+  std::atomic<size_t> batchSize;
+
+  /// How far (in tuple time) a tuple can be past the oldest one waiting in
+  /// the batch before the batch is handed off, full or not.
+  std::atomic<double> batchDelay;
+
+  /// Tuples consumed but not yet handed to a worker.
+  std::mutex batchMutex;
+  std::vector<TupleType> batch;
+
+  std::atomic<size_t> numBatches;
+
+  /**
+   * Hands the tuples collected so far to the thread pool as one batch.
+   */
+  void flushBatch();
 
 public:
 
@@ -198,10 +349,13 @@ public:
    *   sequentially from this port.  Includes both the edge communicator
    *   and the request communicator.
    * \param hwm The highwater mark.
-   * \param graphCapacity The number of bins in the graph representation.
-   * \param tableCapacity The number of bins in the SubgraphQueryResultMap.
+   * \param graphCapacity The initial number of bins in the graph 
+   *   representation.  The tables resize based on load.
+   * \param tableCapacity The initial number of bins in the 
+   *   SubgraphQueryResultMap and EdgeRequestMap.
    * \param resultsCapacity How many completed queries can be stored in
-   *          SubgraphQueryResultMap.
+   *          SubgraphQueryResultMap.  Zero keeps none (e.g. when a
+   *          SubgraphResultSink takes them), and getResult can't be used.
    * \param numPushSockets How many push sockets to talk to one node. 
    *   numPushSockets * (numNodes - 1) push sockets are created.
    * \param numPullThreads How many pull threads to create.  Each one covers
@@ -213,8 +367,11 @@ public:
    * \param keepQueries If compiled to include, can set what fraction of queries
    *   to keep.
    * \param featureMap The featureMap that is being used by this node.
-   * \param maxFutures The number of async threads that can be created.
+   * \param maxQueued How many tuples can wait to be processed before
+   *   consume() blocks.
    * \param local Boolean indicating that we are on one node.
+   * \param numWorkers How many threads process consumed tuples.  Zero
+   *   means one per hardware thread.
    */
   GraphStore(
              std::size_t numNodes,
@@ -233,8 +390,9 @@ public:
              double keepQueries,
 #endif
              std::shared_ptr<FeatureMap> featureMap,
-             size_t maxFutures = MAX_NUM_FUTURES,
-             bool local=false);
+             size_t maxQueued = MAX_NUM_FUTURES,
+             bool local=false,
+             size_t numWorkers = 0);
 
   ~GraphStore();
 
@@ -245,9 +403,103 @@ public:
    */
   size_t addEdge(TupleType n);
 
+  /**
+   * Queues a copy of the tuple for the worker threads and returns.  Blocks
+   * if maxQueued tuples are already waiting.
+   */
   bool consume(TupleType const& tuple);
   bool consumeDoesTheWork(TupleType const& tuple);
 
+  /**
+   * Processes a batch of tuples.  All of the edges are added to the graph
+   * first, grouped by table stripe (CompressedSparse::addEdges), then
+   * each tuple is matched against the intermediate results, the edge
+   * requests, and the queries in order.  A result started by an earlier
+   * tuple may find a later tuple of the batch already in the graph; the
+   * result's seen edges keep resultMap->process from extending it with
+   * the same edge again.
+   */
+  bool consumeBatchDoesTheWork(std::vector<TupleType> const& tuples);
+
+  /**
+   * Sets how many tuples consume() collects into one batch.  Tuples
+   * already collected are handed off first.
+   * \throws GraphStoreException if batchSize is zero.
+   */
+  void setBatchSize(size_t batchSize);
+  size_t getBatchSize() const { return batchSize; }
+
+  /**
+   * Sets how long a batch waits to fill up: once a consumed tuple's time
+   * is delay seconds past the oldest tuple waiting, the batch is handed
+   * off whether or not it is full.  This bounds how long a slow stream
+   * holds back matches.
+   * \throws GraphStoreException if delay is negative.
+   */
+  void setBatchDelay(double delay);
+  double getBatchDelay() const { return batchDelay; }
+
+  /// How many batches have been processed.
+  size_t getNumBatches() const { return numBatches; }
+
+  /**
+   * Blocks until every consumed tuple has been processed, including those
+   * waiting for a batch to fill up.
+   * \throws Rethrows the first exception thrown while processing a tuple,
+   *   if any.
+   */
+  void waitForConsume() {
+    flushBatch();
+    consumePool->wait();
+  }
+
+  /**
+   * Consume thread pool metrics.  Latency is in seconds, from consume()
+   * to the tuple being processed.
+   */
+  size_t getNumConsumeWorkers() const { return consumePool->getNumWorkers(); }
+  size_t getConsumeQueueLength() const {
+    return consumePool->getQueueLength();
+  }
+  size_t getMaxConsumeQueueLength() const {
+    return consumePool->getMaxQueueLength();
+  }
+  double getMeanConsumeLatency() const {
+    return consumePool->getMeanLatency();
+  }
+  double getMaxConsumeLatency() const {
+    return consumePool->getMaxLatency();
+  }
+  size_t getNumConsumeTasksStolen() const {
+    return consumePool->getNumStolen();
+  }
+
+  /**
+   * When an edge advances at least threshold partial results at once
+   * (typically an edge of a hub vertex), looks them up in the graph over
+   * a pool of numThreads threads instead of on the consume thread alone.
+   * Call before consuming tuples.
+   * \param numThreads How many threads.  Zero means one per hardware
+   *   thread.
+   * \param threshold How many partial results it takes.
+   */
+  void setParallelExpansion(size_t numThreads,
+    size_t threshold = SUBGRAPH_QUERY_RESULT_MAP_DEFAULT_PARALLEL_THRESHOLD)
+  {
+    expansionPool = std::make_shared<ThreadPool>(numThreads);
+    resultMap->setExpansionPool(expansionPool, threshold);
+  }
+
+  /// How many levels of partial results were expanded in parallel.
+  size_t getNumParallelExpansions() const {
+    return resultMap->getNumParallelLevels();
+  }
+
+  /// How many tasks those expansions handed to the pool.
+  size_t getNumExpansionTasks() const {
+    return resultMap->getNumExpansionTasks();
+  }
+
   /**
    * Called by producer to indicate that no more data is coming and that this
    * consumer should clean up and exit.
@@ -262,7 +514,155 @@ public:
       throw GraphStoreException("Tried to add query that had not been"
         " finalized");
     }
+    queryIndex[query.get()] = queries.size();
     queries.push_back(query);
+    if (loadShedder) loadShedder->addQuery();
+    network.add(query);
+    planners.push_back(std::make_shared<PlannerType>(query,
+      queryPlanning && numNodes == 1));
+    joined.push_back(join && JoinType::supports(*query));
+  }
+
+  /**
+   * The network deciding which queries a tuple starts results for.
+   */
+  NetworkType const& getNetwork() const { return network; }
+
+  /**
+   * Turns query planning on or off for all queries, registered or not.
+   * Call before consuming tuples.  Planning stays off with more than one
+   * node.
+   */
+  void setQueryPlanning(bool enabled) {
+    queryPlanning = enabled;
+    for (size_t i = 0; i < queries.size(); i++) {
+      planners[i] = std::make_shared<PlannerType>(queries[i],
+        queryPlanning && numNodes == 1);
+    }
+  }
+  bool getQueryPlanning() const { return queryPlanning; }
+
+  /**
+   * Turns the generic join on or off for all queries, registered or not.
+   * With it on, the queries that GenericJoin::supports (cyclic ones) don't
+   * keep partial results: each tuple matching a query's last edge
+   * description is joined against the graph for the rest of the match.
+   * The time window has to cover the queries' time extent.  Call before
+   * consuming tuples.  The join stays off with more than one node, where
+   * the graph isn't all local.
+   */
+  void setGenericJoin(bool enabled) {
+    join = nullptr;
+    if (enabled && numNodes == 1) {
+      join = std::make_shared<JoinType>(*csr, *csc);
+    }
+    for (size_t i = 0; i < queries.size(); i++) {
+      joined[i] = join && JoinType::supports(*queries[i]);
+    }
+  }
+
+  /**
+   * The generic join with its counts, or null if it isn't used.
+   */
+  std::shared_ptr<const JoinType> getGenericJoin() const { return join; }
+
+  /**
+   * Whether the ith registered query is matched by the generic join.
+   */
+  bool usesGenericJoin(size_t i) const { return joined[i]; }
+
+  /**
+   * Makes the nodes broadcast Bloom filter summaries of the vertices they
+   * have seen, and drops edge requests that the summary of the receiving
+   * node shows to be empty (see VertexSummaries).  Call before consuming
+   * tuples, on every node.  Does nothing with one node, which never sends
+   * edge requests.
+   * \param epochLength How many seconds of tuples go into each summary.
+   *   Zero uses the time window.
+   * \param expectedVertices The number of distinct vertices a node is
+   *   expected to see within the time window.
+   * \param fpRate The false positive rate the filters are sized for.
+   */
+  void setVertexSummaries(double epochLength = 0,
+    size_t expectedVertices = VERTEX_SUMMARY_DEFAULT_EXPECTED_VERTICES,
+    double fpRate = VERTEX_SUMMARY_DEFAULT_FP_RATE)
+  {
+    if (numNodes == 1) return;
+    summaries = std::make_shared<SummariesType>(numNodes, nodeId,
+      epochLength > 0 ? epochLength : originalWindow, originalWindow,
+      expectedVertices, fpRate);
+  }
+
+  /**
+   * The vertex summaries with their counts of suppressed requests, or null
+   * if they aren't used.
+   */
+  std::shared_ptr<const SummariesType> getVertexSummaries() const {
+    return summaries;
+  }
+
+  /**
+   * Caches the edges other nodes send back, and answers edge requests the
+   * cache covers from it instead of sending them (see RemoteEdgeCache).
+   * Cached edges are dropped as they fall out of the time window.  Call
+   * before consuming tuples.  Does nothing with one node, which never
+   * sends edge requests.
+   * \param capacity The most edges (and keys) the cache holds.
+   */
+  void setRemoteEdgeCache(
+    size_t capacity = REMOTE_EDGE_CACHE_DEFAULT_CAPACITY)
+  {
+    if (numNodes == 1) return;
+    remoteEdgeCache = std::make_shared<RemoteEdgeCacheType>(capacity,
+      originalWindow);
+  }
+
+  /**
+   * The remote edge cache with its hit and miss counts, or null if it isn't
+   * used.
+   */
+  std::shared_ptr<RemoteEdgeCacheType> getRemoteEdgeCache() const {
+    return remoteEdgeCache;
+  }
+
+  /**
+   * Mirrors hub vertices to the other nodes (see HubMirror).  This node
+   * forwards every new edge of its busiest vertices to all of the others,
+   * which answer edge requests for them from their remote edge cache.
+   * Sets up a remote edge cache if there isn't one.  Call before consuming
+   * tuples, on every node.  Does nothing with one node.
+   * \param maxHubs The most vertices this node mirrors at once.
+   * \param minRequestRate Edge requests per second that make a vertex a
+   *   hub.
+   * \param minDegree The degree that makes a vertex a hub.  Zero selects by
+   *   request rate only.
+   * \param epochLength How many seconds between hub selections.  Zero uses
+   *   half of the time window.
+   */
+  void setHubMirroring(size_t maxHubs = HUB_MIRROR_DEFAULT_MAX_HUBS,
+    double minRequestRate = HUB_MIRROR_DEFAULT_MIN_REQUEST_RATE,
+    size_t minDegree = 0, double epochLength = 0)
+  {
+    if (numNodes == 1) return;
+    hubMirror = std::make_shared<HubMirrorType>(maxHubs,
+      epochLength > 0 ? epochLength : originalWindow / 2, minRequestRate,
+      minDegree);
+    if (!remoteEdgeCache) setRemoteEdgeCache();
+  }
+
+  /**
+   * The hub mirror with its counts, or null if hubs aren't mirrored.
+   */
+  std::shared_ptr<const HubMirrorType> getHubMirror() const {
+    return hubMirror;
+  }
+
+  /**
+   * The planner for the ith registered query.  Planners are only
+   * consulted while query planning is on.
+   */
+  std::shared_ptr<PlannerType> getPlanner(size_t i) const {
+    return planners[i];
   }
 
   size_t checkSubgraphQueries(TupleType const& tuple,
@@ -282,10 +682,176 @@ public:
     resultMap->clearResults(); 
   }
   
-  size_t getNumIntermediateResults() const { 
+  size_t getNumIntermediateResults() const {
     return resultMap->getNumIntermediateResults();
   }
 
+  /**
+   * Sets a limit on the bytes used by edges, intermediate results, and
+   * edge requests, and what to do when it is exceeded.
+   * \param bytes The budget in bytes, or 0 for no limit.
+   * \param policies MemoryPolicy flags or'ed together.
+   */
+  void setMemoryBudget(size_t bytes, unsigned int policies) {
+    memoryBudget.setBudget(bytes);
+    memoryBudget.setPolicies(policies);
+  }
+
+  /**
+   * Degrades gracefully under overload (see LoadShedder): new results of
+   * each query are started with a probability that drops while consume
+   * latency, the consume queue, or the partial results are over their
+   * limits and recovers once they are back under, and partial results
+   * over their limit are shed furthest from completion first.  Zero turns
+   * a limit off.  Call before consuming tuples.
+   * \param targetLatency Mean consume latency in seconds.
+   * \param maxQueueLength Tuples waiting to be consumed.
+   * \param maxIntermediateResults Partial results held.
+   * \param interval How many tuples between adjustments.
+   */
+  void setLoadShedding(double targetLatency, size_t maxQueueLength,
+    size_t maxIntermediateResults,
+    size_t interval = LOAD_SHEDDER_DEFAULT_INTERVAL)
+  {
+    loadShedder = std::make_shared<LoadShedder>(targetLatency,
+      maxQueueLength, maxIntermediateResults, interval);
+    for (size_t i = 0; i < queries.size(); i++) {
+      loadShedder->addQuery();
+    }
+    resultMap->setCompletionListener([this](ResultType const& result) {
+      auto it = this->queryIndex.find(result.getSubgraphQuery().get());
+      if (it != this->queryIndex.end()) {
+        this->loadShedder->completed(it->second);
+      }
+    });
+  }
+
+  /**
+   * The load shedder with its keep probabilities and recall estimates per
+   * query (in registration order), or null if load shedding is off.
+   */
+  std::shared_ptr<const LoadShedder> getLoadShedder() const {
+    return loadShedder;
+  }
+
+  /**
+   * Keeps only the most recent segmentDuration seconds of edges in
+   * memory; older edges are sealed into memory-mapped files named
+   * prefix_csr_N.seg and prefix_csc_N.seg.  Lookups search both tiers.
+   * Call before consuming tuples.
+   * \param prefix Path prefix for the segment files.
+   * \param segmentDuration Seconds of edges per segment.
+   */
+  void setTieredStorage(std::string prefix, double segmentDuration) {
+    csr->setTieredStorage(prefix + "_csr", segmentDuration);
+    csc->setTieredStorage(prefix + "_csc", segmentDuration);
+  }
+
+  /**
+   * Writes the edge window (CSR and CSC), the intermediate results, and
+   * the outstanding edge requests to a compact binary file.  Tuples
+   * consumed before the call, including those waiting for a batch to fill
+   * up, are processed first.  Tuple processing is paused while the
+   * snapshot is taken so that the pieces are consistent with each other.  The file is written under a
+   * temporary name and renamed, so an existing checkpoint is only replaced
+   * by a complete one.
+   * \throws GraphStoreException if the file can't be written.
+   */
+  void checkpoint(std::string filename);
+
+  /**
+   * Loads a file written by checkpoint() into this (empty) GraphStore.
+   * The same queries must have been registered, in the same order, as when
+   * the checkpoint was taken.  Each structure is bulk loaded with
+   * numThreads threads rather than replaying edges.  Call before
+   * consuming tuples.
+   * \throws GraphStoreException if the file is missing, not a checkpoint,
+   *   or was taken with a different number of queries.
+   */
+  void restore(std::string filename,
+               size_t numThreads = std::thread::hardware_concurrency());
+
+  /**
+   * Number of edges in sealed segments across the CSR and CSC.
+   */
+  size_t getNumSealedEdges() const {
+    return csr->getNumSealedEdges() + csc->getNumSealedEdges();
+  }
+
+  /**
+   * Returns the memory accounting, which includes current usage per
+   * category and how much has been shed by each policy.
+   */
+  MemoryBudget const& getMemoryBudget() const { return memoryBudget; }
+
+  /**
+   * Returns the total bytes used by edges, intermediate results, and
+   * edge requests.
+   */
+  size_t getMemoryUsage() const { return memoryBudget.getUsage(); }
+
+  /**
+   * Returns the current edge window, which may be shorter than the one
+   * given to the constructor if the memory budget shortened it.
+   */
+  double getWindow() const { return csr->getWindow(); }
+
+  /**
+   * Chain length distributions for the hash tables.  The tables resize
+   * themselves, so these are mostly useful for checking the hash
+   * functions and the load factor settings.
+   */
+  ChainLengthStats getCsrChainLengthStats() const {
+    return csr->getChainLengthStats();
+  }
+  ChainLengthStats getCscChainLengthStats() const {
+    return csc->getChainLengthStats();
+  }
+  ChainLengthStats getResultMapChainLengthStats() const {
+    return resultMap->getChainLengthStats();
+  }
+  ChainLengthStats getEdgeRequestMapChainLengthStats() const {
+    return edgeRequestMap->getChainLengthStats();
+  }
+
+  /**
+   * Number of edges stored on this node.  O(1); includes edges that have
+   * left the window but haven't been swept yet.
+   */
+  size_t getNumEdges() const { return csr->countEdges(); }
+
+  /**
+   * Degrees of a vertex over the edges stored on this node.  One slot
+   * lookup each.  Edges in sealed segments aren't counted.
+   */
+  size_t getOutDegree(SourceType const& vertex) const {
+    return csr->getDegree(vertex);
+  }
+  size_t getInDegree(TargetType const& vertex) const {
+    return csc->getDegree(vertex);
+  }
+
+  /**
+   * Log2 degree histograms, maintained as edges are added and removed.
+   * See CompressedSparse::getDegreeHistogram.
+   */
+  std::vector<size_t> getOutDegreeHistogram() const {
+    return csr->getDegreeHistogram();
+  }
+  std::vector<size_t> getInDegreeHistogram() const {
+    return csc->getDegreeHistogram();
+  }
+
+  /**
+   * Up to k of the highest degree vertices, highest first.
+   */
+  std::vector<std::pair<SourceType, size_t>> getTopOutDegree(size_t k) const {
+    return csr->getTopDegree(k);
+  }
+  std::vector<std::pair<TargetType, size_t>> getTopInDegree(size_t k) const {
+    return csc->getTopDegree(k);
+  }
+
   ResultType getResult(size_t index) const {
     return resultMap->getResult(index);
   }
@@ -323,6 +889,30 @@ public:
     return edgeCommunicator->getTotalMessagesFailed(); 
   }
  
+  /**
+   * Returns how many edge requests this node merged into another request
+   * for the same edges before sending.
+   */
+  size_t getNumEdgeRequestsCoalesced() const {
+    return numEdgeRequestsCoalesced;
+  }
+
+  /**
+   * Returns how many edge requests received by this node were merged into
+   * one it already had.
+   */
+  size_t getNumStoredRequestsCoalesced() const {
+    return edgeRequestMap->getNumCoalesced();
+  }
+
+  /**
+   * Returns how many stored edge requests were removed because they
+   * expired.
+   */
+  size_t getNumStoredRequestsExpired() const {
+    return edgeRequestMap->getNumExpired();
+  }
+
   /**
    * Returns the total number of edge requests that this nodes has issued.
    */
@@ -367,6 +957,14 @@ public:
   size_t getTotalEdgeRequestMapRequestsViewed() {
     return edgeRequestMap->getTotalEdgeRequestsViewed();
   }
+
+  /**
+   * Returns the average number of edge requests the EdgeRequestMap viewed
+   * per tuple.
+   */
+  double getEdgeRequestMapRequestsViewedPerTuple() {
+    return edgeRequestMap->getEdgeRequestsViewedPerTuple();
+  }
   #endif
 
   #ifdef TIMING
@@ -471,6 +1069,25 @@ public:
   size_t getTotalEdgesDeletedInCsc() const {
     return csc->getTotalEdgesDeleted();
   }
+
+  /**
+   * Returns the number of blocks handed out by the slab allocators that
+   * back the graph, request, and result containers (shared by all
+   * GraphStores in the process).
+   */
+  uint64_t getTotalSlabAllocations() const {
+    return getSlabMetrics().allocations;
+  }
+
+  /**
+   * Returns the number of times the slab allocators had to go to the
+   * global heap per tuple consumed.
+   */
+  double getHeapAllocationsPerTuple() const {
+    if (consumeCount == 0) return 0;
+    return static_cast<double>(getSlabMetrics().heapAllocations) /
+           consumeCount;
+  }
   #endif
 
 
@@ -513,59 +1130,106 @@ checkSubgraphQueries(TupleType const& tuple,
     nodeId, sam::toString(tuple).c_str(), queries.size()); 
 
   size_t totalWork = 0;
+  double tupleTime = std::get<time>(tuple);
 
-  for (std::shared_ptr<const QueryType> query : queries) 
-  {
-    totalWork++;
-
-    //TODO: Don't really like this.  I think SubgraphQueryResult should
-    // have a constructor that just takes the query, and then we can
-    // call addEdgeInPlace.  Then we wouldn't need this logic in this class.
-    double queryStart;
-    if (query->zeroTimeRelativeToStart()) {
-      queryStart = std::get<time>(tuple);
-    } else {
-      queryStart = std::get<time>(tuple) + std::get<duration>(tuple);
-    }
-
-    if (query->satisfiesConstraints(0, tuple, queryStart)) 
+  if (queryPlanning) {
+    std::vector<typename PlannerType::Segment> anchored;
+    for (size_t q = 0; q < queries.size(); q++) 
     {
+      std::shared_ptr<const QueryType> query = queries[q];
+      PlannerType& planner = *planners[q];
+      if (joined[q]) continue;
+      totalWork++;
 
-      // We only want one node to own the query result, so we make sure
-      // that this node owns the source
-      SourceType src = std::get<source>(tuple);
-      
-      DEBUG_PRINT("Node %lu GraphStore::checkSubgraphQueries src %s "
-        "soruceHash(src) %llu numNodes %lu sourceHash(src) mod numNodes %llu\n",
-        nodeId, src.c_str(), sourceHash(src), numNodes, 
-        sourceHash(src) % numNodes);
-
-      if (sourceHash(src) % numNodes == nodeId) {
-        ResultType queryResult(query, tuple);
-
-        DEBUG_PRINT("Node %lu GraphStore::checkSubgraphQueries adding"
-          " queryResult %s from tuple %s\n", this->nodeId, 
-          queryResult.toString().c_str(), toString(tuple).c_str());
-
-        resultMap->add(queryResult, edgeRequests);  
-        
-        DEBUG_PRINT("Node %lu GraphStore::checkSubgraphQueries added"
-          " queryResult %s for tuple %s.  EdgeRequests.size() %lu\n", 
-          this->nodeId, 
-          queryResult.toString().c_str(), toString(tuple).c_str(), 
-          edgeRequests.size());
-      } else {
-
-        DEBUG_PRINT("Node %lu GraphStore::checkSubgraphQueries this node "
-          "didn't own source in %s\n", this->nodeId, 
-          sam::toString(tuple).c_str());
+      if (planner.observe(tuple)) {
+        planner.replan(tupleTime, getMeanDegree());
+      }
+
+      // Complete results whose plan starts them at a later edge.
+      anchored.clear();
+      planner.getAnchoredSegments(tupleTime, anchored);
+      for (auto const& segment : anchored) {
+        if (!query->satisfiesVertexConstraints(segment.anchor, tuple)) {
+          continue;
+        }
+        if (memoryBudget.hasPolicy(MEMORY_POLICY_DROP_QUERY_STARTS) &&
+            memoryBudget.overBudget())
+        {
+          memoryBudget.recordQueryStartDropped();
+          continue;
+        }
+        if (loadShedder && !loadShedder->admit(q)) continue;
+        totalWork += resultMap->addAnchored(query, segment.anchor, tuple,
+          segment.from, segment.to, edgeRequests);
       }
-    } else {
-      DEBUG_PRINT("Node %lu GraphStore::checkSubgraphQueries tuple %s"
-        " didn't satisfy query %s\n", this->nodeId, 
-        sam::toString(tuple).c_str(), query->toString().c_str());
     }
   }
+
+  // Joined queries are matched in one go when their last edge arrives.
+  if (join) {
+    for (size_t q = 0; q < queries.size(); q++) {
+      if (!joined[q]) continue;
+      totalWork += join->matchLast(queries[q], tuple,
+        [this, &edgeRequests](ResultType const& result) {
+          resultMap->add(result, edgeRequests);
+        });
+    }
+  }
+
+  // The queries whose first edge description the tuple satisfies.
+  std::vector<size_t> starts;
+  totalWork += network.match(tuple, starts);
+
+  // We only want one node to own the query result, so we make sure
+  // that this node owns the source
+  SourceType src = std::get<source>(tuple);
+
+  DEBUG_PRINT("Node %lu GraphStore::checkSubgraphQueries src %s "
+    "soruceHash(src) %llu numNodes %lu sourceHash(src) mod numNodes %llu"
+    " matching queries %lu\n",
+    nodeId, src.c_str(), sourceHash(src), numNodes, 
+    sourceHash(src) % numNodes, starts.size());
+
+  if (!starts.empty() && sourceHash(src) % numNodes != nodeId) {
+    DEBUG_PRINT("Node %lu GraphStore::checkSubgraphQueries this node "
+      "didn't own source in %s\n", this->nodeId, 
+      sam::toString(tuple).c_str());
+    starts.clear();
+  }
+
+  for (size_t q : starts)
+  {
+    std::shared_ptr<const QueryType> query = queries[q];
+
+    if (joined[q]) continue;
+
+    // Results starting with this tuple are created when their anchor
+    // arrives.
+    if (queryPlanning && planners[q]->getAnchor(tupleTime) != 0) continue;
+
+    if (memoryBudget.hasPolicy(MEMORY_POLICY_DROP_QUERY_STARTS) &&
+        memoryBudget.overBudget())
+    {
+      memoryBudget.recordQueryStartDropped();
+      continue;
+    }
+
+    if (loadShedder && !loadShedder->admit(q)) continue;
+
+    ResultType queryResult(query, tuple);
+
+    DEBUG_PRINT("Node %lu GraphStore::checkSubgraphQueries adding"
+      " queryResult %s from tuple %s\n", this->nodeId, 
+      queryResult.toString().c_str(), toString(tuple).c_str());
+
+    resultMap->add(queryResult, edgeRequests);  
+    
+    DEBUG_PRINT("Node %lu GraphStore::checkSubgraphQueries added"
+      " queryResult %s for tuple %s.  EdgeRequests.size() %lu\n", 
+      this->nodeId, 
+      queryResult.toString().c_str(), toString(tuple).c_str(), 
+      edgeRequests.size());
+  }
   #ifdef DEBUG
   std::string message = "Node " + boost::lexical_cast<std::string>(nodeId) + 
     " GraphStore::checkSubgraphQueries edgeRequests from tuple " +
@@ -598,12 +1262,32 @@ processEdgeRequests(std::list<EdgeRequestType> const& edgeRequests)
   
   // Don't want to issue more edge requests if we've been terminated.
   if (!terminated) {
+
+    // Partial results waiting on the same edges each make a request;
+    // one request covering all their time ranges gets them the same
+    // edges.
+    std::list<EdgeRequestType> coalesced;
+    if (edgeRequests.size() > 1) {
+      numEdgeRequestsCoalesced.fetch_add(coalesce(edgeRequests, coalesced));
+    }
+
+    // Edges the remote edge cache already has for requests it covers.
+    std::list<TupleType> cachedEdges;
     
-    for(auto edgeRequest : edgeRequests) {
+    for(auto edgeRequest : edgeRequests.size() > 1 ? coalesced :
+                                                     edgeRequests) {
 
       DEBUG_PRINT("Node %lu GraphStore::processEdgeRequests() processing"
         " edgeRequest %s\n", this->nodeId, edgeRequest.toString().c_str());
 
+      if (remoteEdgeCache && remoteEdgeCache->lookup(edgeRequest, 
+                                                     cachedEdges)) {
+        DEBUG_PRINT("Node %lu GraphStore::processEdgeRequests() answered"
+          " edgeRequest %s from the remote edge cache\n", this->nodeId,
+          edgeRequest.toString().c_str());
+        continue;
+      }
+
       if (isNull(edgeRequest.getTarget()) && isNull(edgeRequest.getSource()))
       {
         throw GraphStoreException("In GraphStore::processEdgeRequests, both the"
@@ -641,6 +1325,14 @@ processEdgeRequests(std::list<EdgeRequestType> const& edgeRequests)
         }
       }
     }
+
+    // The cached edges are matched against the partial results as if they
+    // had just arrived.  Results that have seen an edge before ignore it.
+    for (auto const& edge : cachedEdges) {
+      std::list<EdgeRequestType> moreEdgeRequests;
+      resultMap->process(edge, moreEdgeRequests);
+      processEdgeRequests(moreEdgeRequests);
+    }
   } else {
     DEBUG_PRINT("Node %lu GraphStore::processEdgeRequests() there are %lu "
       "edge requests but terminated\n", nodeId, edgeRequests.size());
@@ -661,18 +1353,311 @@ GraphStore<TupleType, Tuplizer, source, target, time, duration,
 sendEdgeRequest(EdgeRequestType const& edgeRequest,
   std::function<size_t(EdgeRequestType const&)> addressFunction)
 {
-  std::string message = edgeRequest.serialize();
   size_t node = addressFunction(edgeRequest);
+  if (summaries && !mayAnswer(edgeRequest, node)) {
+    DEBUG_PRINT("Node %lu->%lu GraphStore::sendEdgeRequest suppressed"
+      " EdgeRequest: %s\n", nodeId, node, edgeRequest.toString().c_str());
+    return;
+  }
+  std::string message = edgeRequest.serialize();
+
+  // The cache has to know about the request before any edges come back.
+  if (remoteEdgeCache) remoteEdgeCache->requested(edgeRequest);
 
   bool sent = requestCommunicator->send(message, node);
 
   if (!sent) { 
+    if (remoteEdgeCache) remoteEdgeCache->invalidate(edgeRequest);
     printf("Node %lu->%lu GraphStore::sendEdgeRequest failed"
       " sending EdgeRequest: %s\n",
       nodeId, node, edgeRequest.toString().c_str()); 
   }
 }
 
+template <typename TupleType, typename Tuplizer,
+          size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+bool
+GraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+mayAnswer(EdgeRequestType const& edgeRequest, size_t node)
+{
+  // The edge is on the node only if both of its ends are.
+  double from = edgeRequest.getStartTimeFirst();
+  double through = edgeRequest.getStartTimeSecond();
+  if (!isNull(edgeRequest.getSource()) &&
+      !summaries->mayHave(node, edgeRequest.getSource(), from, through))
+  {
+    return false;
+  }
+  if (!isNull(edgeRequest.getTarget()) &&
+      !summaries->mayHave(node, edgeRequest.getTarget(), from, through))
+  {
+    return false;
+  }
+  return true;
+}
+
+template <typename TupleType, typename Tuplizer,
+          size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+GraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+summarize(TupleType const& tuple)
+{
+  std::string message;
+  bool broadcast = summaries->observe(std::get<source>(tuple),
+                                      std::get<time>(tuple), message);
+  broadcast |= summaries->observe(std::get<target>(tuple),
+                                  std::get<time>(tuple), message);
+  if (!broadcast) return;
+
+  for (size_t i = 0; i < numNodes; i++) {
+    if (i == nodeId) continue;
+    if (!requestCommunicator->send(message, i)) {
+      printf("Node %lu->%lu GraphStore::summarize failed sending the vertex"
+        " summary\n", nodeId, i);
+    }
+  }
+}
+
+template <typename TupleType, typename Tuplizer,
+          size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+GraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+mirrorHubs(double currentTime)
+{
+  if (!hubMirror->due(currentTime)) return;
+
+  // The busiest vertices this node owns, as source or target.
+  size_t k = hubMirror->getMaxHubs();
+  std::vector<std::pair<SourceType, size_t>> candidates;
+  for (auto const& p : csr->getTopDegree(k)) {
+    if (sourceHash(p.first) % numNodes == nodeId) candidates.push_back(p);
+  }
+  for (auto const& p : csc->getTopDegree(k)) {
+    if (targetHash(p.first) % numNodes == nodeId) candidates.push_back(p);
+  }
+
+  auto leases = hubMirror->select(currentTime, candidates,
+    [this](SourceType const& vertex) {
+      return csr->getDegree(vertex) + csc->getDegree(vertex);
+    });
+
+  for (auto const& lease : leases) {
+    DEBUG_PRINT("Node %lu GraphStore::mirrorHubs mirroring %s from %f until"
+      " %f\n", nodeId, boost::lexical_cast<std::string>(lease.vertex).c_str(),
+      lease.from, lease.until);
+
+    std::vector<EdgeRequestType> requests;
+    if (sourceHash(lease.vertex) % numNodes == nodeId) {
+      EdgeRequestType request;
+      request.setSource(lease.vertex);
+      requests.push_back(request);
+    }
+    if (targetHash(lease.vertex) % numNodes == nodeId) {
+      EdgeRequestType request;
+      request.setTarget(lease.vertex);
+      requests.push_back(request);
+    }
+
+    for (auto& request : requests) {
+      request.setStartTimeFirst(lease.from);
+      request.setStartTimeSecond(lease.until);
+      request.setEndTimeFirst(lease.from);
+      request.setEndTimeSecond(lease.until);
+      for (size_t node = 0; node < numNodes; node++) {
+        if (node == nodeId) continue;
+        request.setReturn(node);
+
+        // Forwarding starts before the node is told, so that it never
+        // counts on edges that weren't sent.
+        edgeRequestMap->addRequest(request);
+        requestCommunicator->send(HubMirrorType::announce(
+          request.serialize()), node);
+      }
+    }
+  }
+}
+
+
+template <typename TupleType, typename Tuplizer, 
+          size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF, 
+          typename SourceEF, typename TargetEF> 
+void
+GraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+checkpoint(std::string filename)
+{
+  // A partial batch would otherwise be in neither the checkpoint nor
+  // anything restored from it.
+  waitForConsume();
+
+  std::string out;
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(checkpointMutex);
+    serialize(out, static_cast<uint64_t>(GRAPH_STORE_CHECKPOINT_MAGIC));
+    serialize(out, static_cast<uint64_t>(queries.size()));
+    csr->checkpoint(out);
+    csc->checkpoint(out);
+    typename ResultMapType::QueryListType queryList(queries.begin(),
+                                                    queries.end());
+    resultMap->checkpoint(out, queryList);
+    edgeRequestMap->checkpoint(out);
+  }
+
+  // Writing to disk doesn't need to hold up tuple processing.
+  std::string tmpFilename = filename + ".tmp";
+  std::ofstream file(tmpFilename, std::ios::binary | std::ios::trunc);
+  file.write(out.data(), out.size());
+  file.close();
+  if (!file || std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+    std::remove(tmpFilename.c_str());
+    throw GraphStoreException("GraphStore::checkpoint: unable to write " +
+      filename);
+  }
+  DEBUG_PRINT("Node %lu GraphStore::checkpoint wrote %lu bytes to %s\n",
+    nodeId, out.size(), filename.c_str());
+}
+
+template <typename TupleType, typename Tuplizer, 
+          size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF, 
+          typename SourceEF, typename TargetEF> 
+void
+GraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+restore(std::string filename, size_t numThreads)
+{
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    throw GraphStoreException("GraphStore::restore: unable to open " +
+      filename);
+  }
+  std::string in((std::istreambuf_iterator<char>(file)),
+                 std::istreambuf_iterator<char>());
+
+  std::unique_lock<std::shared_timed_mutex> lock(checkpointMutex);
+  char const* p = in.data();
+  char const* end = in.data() + in.size();
+  try {
+    uint64_t magic, numQueries;
+    deserialize(p, end, magic);
+    deserialize(p, end, numQueries);
+    if (magic != GRAPH_STORE_CHECKPOINT_MAGIC) {
+      throw GraphStoreException("GraphStore::restore: " + filename +
+        " is not a checkpoint");
+    }
+    if (numQueries != queries.size()) {
+      throw GraphStoreException("GraphStore::restore: checkpoint has " +
+        boost::lexical_cast<std::string>(numQueries) + " queries but " +
+        boost::lexical_cast<std::string>(queries.size()) +
+        " are registered");
+    }
+    csr->restore(p, end, numThreads);
+    csc->restore(p, end, numThreads);
+    typename ResultMapType::QueryListType queryList(queries.begin(),
+                                                    queries.end());
+    resultMap->restore(p, end, queryList, numThreads);
+    edgeRequestMap->restore(p, end, numThreads);
+  } catch (SerializationException const& e) {
+    throw GraphStoreException("GraphStore::restore: " + filename +
+      " is truncated or corrupt: " + e.what());
+  }
+}
+
+template <typename TupleType, typename Tuplizer, 
+          size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF, 
+          typename SourceEF, typename TargetEF> 
+void
+GraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+enforceMemoryBudget()
+{
+  std::unique_lock<std::mutex> lock(memoryBudgetMutex, std::try_to_lock);
+  if (!lock.owns_lock()) return;
+
+  if (!memoryBudget.overBudget()) {
+    // Grow the window back once we are at half the budget or less.
+    double window = csr->getWindow();
+    if (window < originalWindow && 
+        memoryBudget.getUsage() < memoryBudget.getBudget() / 2) 
+    {
+      window = std::min(originalWindow, window * 2);
+      csr->setWindow(window);
+      csc->setWindow(window);
+    }
+    return;
+  }
+
+  DEBUG_PRINT("Node %lu GraphStore::enforceMemoryBudget usage %lu budget "
+    "%lu\n", nodeId, memoryBudget.getUsage(), memoryBudget.getBudget());
+
+  if (memoryBudget.hasPolicy(MEMORY_POLICY_EVICT_OLDEST_RESULTS)) {
+    size_t excess = memoryBudget.getExcess();
+    size_t resultBytes = memoryBudget.getUsage(MemoryCategory::Results);
+    size_t evicted = resultMap->evictOldest(std::min(excess, resultBytes));
+    memoryBudget.recordResultsEvicted(evicted);
+  }
+
+  if (memoryBudget.overBudget() && 
+      memoryBudget.hasPolicy(MEMORY_POLICY_SHORTEN_WINDOW)) 
+  {
+    double window = csr->getWindow();
+    double minWindow = originalWindow * MEMORY_BUDGET_MIN_WINDOW_FRACTION;
+    if (window > minWindow) {
+      window = std::max(window / 2, minWindow);
+      csr->setWindow(window);
+      csc->setWindow(window);
+      memoryBudget.recordWindowShrink();
+    }
+    size_t shed = csr->removeExpiredEdges() + csc->removeExpiredEdges();
+    memoryBudget.recordEdgesShed(shed);
+  }
+}
+
+template <typename TupleType, typename Tuplizer, 
+          size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF, 
+          typename SourceEF, typename TargetEF> 
+void
+GraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+shedLoad()
+{
+  LoadSignals signals;
+  signals.totalLatency = consumePool->getTotalLatency();
+  signals.numCompleted = consumePool->getNumCompleted();
+  signals.queueLength = consumePool->getQueueLength();
+  signals.numIntermediateResults = resultMap->getNumIntermediateResults();
+
+  size_t toShed = loadShedder->adjust(signals);
+  if (toShed == 0) return;
+
+  std::map<typename ResultMapType::SubgraphQueryType const*, size_t> shed;
+  resultMap->shedFurthestFromCompletion(toShed, shed);
+  for (auto const& p : shed) {
+    DEBUG_PRINT("Node %lu GraphStore::shedLoad load %f shed %lu partial "
+      "results\n", nodeId, loadShedder->getLoad(), p.second);
+    auto it = queryIndex.find(p.first);
+    if (it != queryIndex.end()) loadShedder->evicted(it->second, p.second);
+  }
+}
 
 template <typename TupleType, typename Tuplizer, 
           size_t source, size_t target, 
@@ -687,27 +1672,41 @@ consume(TupleType const& tuple)
   DEBUG_PRINT("Node %lu GraphStore::consume processing tuple %s\n",
     nodeId, sam::toString(tuple).c_str());
 
-  DEBUG_PRINT("Node %lu GraphStore::consume about to launch async (total"
-    " asnyc threads right now %lu) for tuple %s\n",
-    nodeId, consumeThreadsActive.load(), toString(tuple).c_str());
-  if (cycled) {
-    futures[currentFuture].get();
-  }
+  DEBUG_PRINT("Node %lu GraphStore::consume queueing (queue length %lu,"
+    " active consume threads %lu) tuple %s\n",
+    nodeId, consumePool->getQueueLength(), consumeThreadsActive.load(),
+    toString(tuple).c_str());
 
-  futures[currentFuture] = std::async(std::launch::async, [this, &tuple]() {
-    return this->consumeDoesTheWork(tuple);
-  });
-  currentFuture++;
-  //auto _ = std::async(std::launch::async, [this, &tuple]() {
-  // return this->consumeDoesTheWork(tuple);
-  //});
-  if (currentFuture >= maxFutures) {
-    cycled = true;
-    currentFuture = 0;
-  }
+  consumeCount++;
 
+  if (summaries) summarize(tuple);
+  if (hubMirror) mirrorHubs(std::get<time>(tuple));
 
-  consumeCount++;
+  if (batchSize <= 1) {
+    // The caller's tuple may be gone by the time a worker gets to it, so
+    // the task keeps a copy.
+    consumePool->submit([this, tuple]() {
+      this->consumeDoesTheWork(tuple);
+    });
+    return true;
+  }
+
+  std::vector<TupleType> full;
+  {
+    std::lock_guard<std::mutex> lock(batchMutex);
+    batch.push_back(tuple);
+    if (batch.size() < batchSize &&
+        std::get<time>(tuple) - std::get<time>(batch.front()) < batchDelay)
+    {
+      return true;
+    }
+    full.swap(batch);
+    batch.reserve(batchSize);
+  }
+  auto tuples = std::make_shared<std::vector<TupleType>>(std::move(full));
+  consumePool->submit([this, tuples]() {
+    this->consumeBatchDoesTheWork(*tuples);
+  });
   
 
   return true;
@@ -724,6 +1723,7 @@ GraphStore<TupleType, Tuplizer, source, target, time, duration,
   SourceHF, TargetHF, SourceEF, TargetEF>::
 consumeDoesTheWork(TupleType const& tuple)
 {
+  std::shared_lock<std::shared_timed_mutex> checkpointLock(checkpointMutex);
   size_t previousCount = consumeThreadsActive.fetch_add(1);
   size_t warningLimit = 32;
   if (previousCount > warningLimit) {
@@ -790,6 +1790,18 @@ consumeDoesTheWork(TupleType const& tuple)
   DETAIL_TIMING_END_TOL2(nodeId, totalTimeConsumeProcessEdgeRequests, TOLERANCE,
                      "GraphStore::consumeDoesTheWork processEdgeRequests")
 
+  if (memoryBudget.getBudget() > 0 && 
+      memoryBudgetTicks.fetch_add(1) % MEMORY_BUDGET_CHECK_INTERVAL == 0) 
+  {
+    enforceMemoryBudget();
+  }
+
+  if (loadShedder &&
+      loadShedderTicks.fetch_add(1) % loadShedder->getInterval() == 0)
+  {
+    shedLoad();
+  }
+
   #ifdef TIMING
   auto timestamp_consume2 = std::chrono::high_resolution_clock::now();
   std::chrono::duration<double> time_space = 
@@ -824,6 +1836,158 @@ consumeDoesTheWork(TupleType const& tuple)
   return true;
 }
 
+template <typename TupleType, typename Tuplizer, 
+          size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF, 
+          typename SourceEF, typename TargetEF> 
+void
+GraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+flushBatch()
+{
+  std::vector<TupleType> full;
+  {
+    std::lock_guard<std::mutex> lock(batchMutex);
+    if (batch.empty()) return;
+    full.swap(batch);
+  }
+  auto tuples = std::make_shared<std::vector<TupleType>>(std::move(full));
+  consumePool->submit([this, tuples]() {
+    this->consumeBatchDoesTheWork(*tuples);
+  });
+}
+
+template <typename TupleType, typename Tuplizer, 
+          size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF, 
+          typename SourceEF, typename TargetEF> 
+void
+GraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+setBatchSize(size_t size)
+{
+  if (size == 0) {
+    throw GraphStoreException("GraphStore::setBatchSize: batch size must be"
+      " at least one");
+  }
+  flushBatch();
+  batchSize = size;
+}
+
+template <typename TupleType, typename Tuplizer, 
+          size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF, 
+          typename SourceEF, typename TargetEF> 
+void
+GraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+setBatchDelay(double delay)
+{
+  if (!(delay >= 0)) {
+    throw GraphStoreException("GraphStore::setBatchDelay: batch delay must "
+      "not be negative: " + boost::lexical_cast<std::string>(delay));
+  }
+  batchDelay = delay;
+}
+
+template <typename TupleType, typename Tuplizer, 
+          size_t source, size_t target, 
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF, 
+          typename SourceEF, typename TargetEF> 
+bool
+GraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+consumeBatchDoesTheWork(std::vector<TupleType> const& tuples)
+{
+  std::shared_lock<std::shared_timed_mutex> checkpointLock(checkpointMutex);
+  consumeThreadsActive.fetch_add(1);
+
+  #ifdef TIMING
+  auto timestamp_consume1 = std::chrono::high_resolution_clock::now();
+  #endif
+
+  // Give the tuples new ids
+  std::vector<TupleType> myTuples(tuples);
+  for (auto& myTuple : myTuples) {
+    std::get<0>(myTuple) = idGenerator.generate();
+  }
+
+  DEBUG_PRINT("Node %lu GraphStore::consumeBatchDoesTheWork %lu tuples\n",
+    nodeId, myTuples.size());
+
+  DETAIL_TIMING_BEG1
+  csc->addEdges(myTuples);
+  csr->addEdges(myTuples);
+  DETAIL_TIMING_END_TOL1(nodeId, totalTimeConsumeAddEdge, TOLERANCE, 
+                     "GraphStore::consumeBatchDoesTheWork addEdges")
+
+  std::list<EdgeRequestType> edgeRequests;
+  for (auto const& myTuple : myTuples) {
+    DETAIL_TIMING_BEG2
+    resultMap->process(myTuple, edgeRequests);
+    DETAIL_TIMING_END_TOL2(nodeId, totalTimeConsumeResultMapProcess,
+      TOLERANCE, "GraphStore::consumeBatchDoesTheWork resultMap->process")
+
+    DETAIL_TIMING_BEG2
+    edgeRequestMap->process(myTuple);
+    DETAIL_TIMING_END_TOL2(nodeId, totalTimeConsumeEdgeRequestMapProcess,
+      TOLERANCE, "GraphStore::consumeBatchDoesTheWork "
+      "edgeRequestMap->process")
+
+#ifdef DROP_QUERIES
+    if (dist(myRand) < keepQueries) {
+#endif
+      DETAIL_TIMING_BEG2
+      checkSubgraphQueries(myTuple, edgeRequests);
+      DETAIL_TIMING_END_TOL2(nodeId, totalTimeConsumeCheckSubgraphQueries,
+        TOLERANCE, "GraphStore::consumeBatchDoesTheWork "
+        "checkSubgraphQueries")
+#ifdef DROP_QUERIES
+    }
+#endif
+  }
+
+  // One round of edge requests for the whole batch.
+  DETAIL_TIMING_BEG2
+  processEdgeRequests(edgeRequests);
+  DETAIL_TIMING_END_TOL2(nodeId, totalTimeConsumeProcessEdgeRequests, TOLERANCE,
+                     "GraphStore::consumeBatchDoesTheWork processEdgeRequests")
+
+  if (memoryBudget.getBudget() > 0) {
+    size_t ticks = memoryBudgetTicks.fetch_add(myTuples.size());
+    if (ticks / MEMORY_BUDGET_CHECK_INTERVAL !=
+        (ticks + myTuples.size()) / MEMORY_BUDGET_CHECK_INTERVAL)
+    {
+      enforceMemoryBudget();
+    }
+  }
+
+  if (loadShedder) {
+    size_t ticks = loadShedderTicks.fetch_add(myTuples.size());
+    if (ticks / loadShedder->getInterval() !=
+        (ticks + myTuples.size()) / loadShedder->getInterval())
+    {
+      shedLoad();
+    }
+  }
+
+  #ifdef TIMING
+  auto timestamp_consume2 = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> time_space = 
+    std::chrono::duration_cast<std::chrono::duration<double>>(
+      timestamp_consume2 - timestamp_consume1);
+  totalTimeConsume += time_space.count();
+  #endif
+
+  numBatches.fetch_add(1);
+  consumeThreadsActive.fetch_add(-1);
+  return true;
+}
+
 template <typename TupleType, typename Tuplizer, 
           size_t source, size_t target, 
           size_t time, size_t duration,
@@ -840,6 +2004,16 @@ terminate()
 
     terminated = true;
 
+    // Finish the tuples we already have before telling the other nodes
+    // we are done.
+    try {
+      flushBatch();
+      consumePool->wait();
+    } catch (std::exception const& e) {
+      printf("Node %lu GraphStore::terminate error processing a tuple: %s\n",
+        nodeId, e.what());
+    }
+
     /*futuresLock.lock();
     for (size_t i = 0; i < MAX_NUM_FUTURES; i++) {
        printf("Node %lu i %lu MAX_NUM_FUTURES %lu\n", nodeId, i, 
@@ -914,16 +2088,16 @@ GraphStore(
              double keepQueries,
 #endif
              std::shared_ptr<FeatureMap> featureMap,
-             size_t maxFutures,
-             bool local)
+             size_t maxQueued,
+             bool local,
+             size_t numWorkers)
 {
   this->featureMap = featureMap;
 
-  if (maxFutures > MAX_NUM_FUTURES) {
-    std::string msg = "maxFutures must be less than " + 
-      boost::lexical_cast<std::string>(MAX_NUM_FUTURES);
-    throw GraphStoreException(msg);
+  if (maxQueued == 0) {
+    throw GraphStoreException("maxQueued must be at least one");
   }
+  consumePool = std::make_shared<ThreadPool>(numWorkers, maxQueued);
 
   sourceAddressFunction = [this](EdgeRequestType const& edgeRequest) {
     SourceType src = edgeRequest.getSource();
@@ -943,20 +2117,34 @@ GraphStore(
 
   edgePushCounter = 0;
   edgePushFails = 0;
+  numEdgeRequestsCoalesced = 0;
   consumeThreadsActive = 0;
 
+  originalWindow = timeWindow;
+  memoryBudgetTicks = 0;
+  loadShedderTicks = 0;
+  batchSize = GRAPH_STORE_DEFAULT_BATCH_SIZE;
+  batchDelay = GRAPH_STORE_DEFAULT_BATCH_DELAY;
+  numBatches = 0;
+
   csr = std::make_shared<csrType>(graphCapacity, timeWindow); 
   csc = std::make_shared<cscType>(graphCapacity, timeWindow); 
+  csr->setMemoryBudget(&memoryBudget);
+  csc->setMemoryBudget(&memoryBudget);
   
   resultMap = 
     std::make_shared< ResultMapType>( numNodes, nodeId, 
       tableCapacity, resultsCapacity, *csr, *csc);
+  resultMap->setMemoryBudget(&memoryBudget);
 
 
   typedef PushPull::FunctionType FunctionType;
 
   auto edgeCallback = [this](std::string str) 
   {
+    std::shared_lock<std::shared_timed_mutex> checkpointLock(
+      this->checkpointMutex);
+
     // We give the edge a new id that is unique to this node.
     size_t id = idGenerator.generate();
 
@@ -970,6 +2158,10 @@ GraphStore(
     // Add the edge to the graph
     //addEdge(tuple);
 
+    // Cached before it is processed, so that a partial result looking in
+    // the cache after this either finds it or is in place for process.
+    if (this->remoteEdgeCache) this->remoteEdgeCache->add(tuple);
+
     DEBUG_PRINT("Node %lu GraphStore::edgeCallback added edge %s\n",
       this->nodeId, sam::toString(tuple).c_str());
 
@@ -1011,9 +2203,12 @@ GraphStore(
 
   edgeRequestMap = std::make_shared< RequestMapType>( 
     numNodes, nodeId, tableCapacity, edgeCommunicator);
+  edgeRequestMap->setMemoryBudget(&memoryBudget);
 
   auto requestCallback = [this](std::string str)
   {
+    std::shared_lock<std::shared_timed_mutex> checkpointLock(
+      this->checkpointMutex);
       
     // When we get an edge request, we need to check against
     // the graph (existing matches) and add it to the list 
@@ -1025,11 +2220,50 @@ GraphStore(
     
     //generalLock.lock();
 
+    // Vertex summaries and hub announcements share the channel with edge
+    // requests.
+    if (SummariesType::isSummary(str)) {
+      if (summaries) summaries->receive(str);
+      return;
+    }
+    if (HubMirrorType::isAnnouncement(str)) {
+      if (hubMirror && remoteEdgeCache) {
+        remoteEdgeCache->extend(EdgeRequestType(hubMirror->received(str)));
+      }
+      return;
+    }
+
     EdgeRequestType request(str);
     DEBUG_PRINT("Node %lu GraphStore::requestCallback received an edge request"
       " length = %lu: %s %s\n", this->nodeId, str.size(), str.c_str(),
       request.toString().c_str());
 
+    #ifdef METRICS
+    if (summaries) {
+      double from = request.getStartTimeFirst();
+      double through = request.getStartTimeSecond();
+      if (isNull(request.getSource()) ||
+          !summaries->checkFalsePositive(request.getSource(), from, through))
+      {
+        if (!isNull(request.getTarget())) {
+          summaries->checkFalsePositive(request.getTarget(), from, through);
+        }
+      }
+    }
+    #endif
+
+    if (hubMirror) {
+      SourceType src = request.getSource();
+      TargetType trg = request.getTarget();
+      size_t n = this->numNodes;
+      if (!isNull(src) && sourceHash(src) % n == this->nodeId) {
+        hubMirror->requested(src);
+      }
+      if (!isNull(trg) && targetHash(trg) % n == this->nodeId) {
+        hubMirror->requested(trg);
+      }
+    }
+
     DETAIL_TIMING_BEG1
     edgeRequestMap->addRequest(request);
     DETAIL_TIMING_END_TOL1(this->nodeId, 
@@ -1078,6 +2312,8 @@ GraphStore<TupleType, Tuplizer, source, target, time, duration,
 ~GraphStore()
 {
   terminate();
+  consumePool->shutdown();
+  if (expansionPool) expansionPool->shutdown();
 
   delete requestCommunicator;
   delete edgeCommunicator;
@@ -0,0 +1,326 @@
+#ifndef SAM_HUB_MIRROR_HPP
+#define SAM_HUB_MIRROR_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+
+/// Default for the most vertices a node mirrors at once.
+#define HUB_MIRROR_DEFAULT_MAX_HUBS 16
+
+/// Default for how many edge requests per second make a vertex a hub.
+#define HUB_MIRROR_DEFAULT_MIN_REQUEST_RATE 10.0
+
+/// The most distinct vertices whose requests are counted per epoch.
+#define HUB_MIRROR_MAX_TRACKED 100000
+
+/// Default for how many seconds mirrored edges and announcements can be
+/// behind the stream and still be covered.
+#define HUB_MIRROR_DEFAULT_LATENESS 1.0
+
+namespace sam {
+
+class HubMirrorException : public std::runtime_error
+{
+public:
+  HubMirrorException(char const* message) :
+    std::runtime_error(message) {}
+  HubMirrorException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * Picks the hub vertices a node mirrors to the rest of the cluster.
+ *
+ * A few high degree vertices can cause most of the edge requests other
+ * nodes send.  Rather than answering each request, the owner of such a
+ * vertex forwards every new edge of it to every node for as long as the
+ * vertex is a hub, and tells them so.  A node that has been told can then
+ * answer requests for the vertex from its RemoteEdgeCache without a round
+ * trip.
+ *
+ * The owner counts the edge requests it gets for each of its vertices
+ * (requested).  Every epoch, select ranks the vertices whose request rate
+ * passed minRequestRate, or whose degree passed minDegree, and makes the
+ * top maxHubs hubs.  Each hub gets a lease: the owner promises to forward
+ * the vertex's edges with start times in [from, until], where from is the
+ * current time plus the allowed lateness (edges and the announcement
+ * travel on different channels, so the announcement has that long to
+ * arrive before the first covered edge) and until is two epochs on, so
+ * that a renewed lease overlaps the last one.
+ *
+ * Once a vertex is mirrored the other nodes stop asking for it, so its
+ * request count no longer says whether it is still busy.  A hub is renewed
+ * as long as it would be selected anyway or its degree is still at least
+ * half of what it was when it was promoted.  Hubs that aren't renewed are
+ * dropped and their leases run out on their own.
+ *
+ * Memory is bounded by maxHubs on the owner, HUB_MIRROR_MAX_TRACKED
+ * request counters per epoch, and the capacity of the RemoteEdgeCache on
+ * the other nodes.
+ */
+template <typename NodeType>
+class HubMirror
+{
+public:
+  /// A promise to forward the vertex's edges with start times in
+  /// [from, until].
+  struct Lease {
+    NodeType vertex;
+    double from;
+    double until;
+  };
+
+  typedef std::function<size_t(NodeType const&)> DegreeFunction;
+
+private:
+  size_t maxHubs;
+  double epochLength;
+  double minRequestRate;
+  size_t minDegree;
+  double lateness;
+
+  mutable std::mutex mutex;
+
+  /// Requests per vertex this epoch.
+  std::unordered_map<NodeType, size_t> requestCounts;
+  double epochStart = std::numeric_limits<double>::lowest();
+  std::atomic<double> nextEpoch;
+
+  /// The current hubs and their degree when they were promoted.
+  std::map<NodeType, size_t> hubs;
+
+  std::atomic<size_t> numPromoted;
+  std::atomic<size_t> numRenewed;
+  std::atomic<size_t> numDropped;
+  std::atomic<size_t> numUntracked;
+  std::atomic<size_t> numAnnouncementsReceived;
+
+public:
+  /**
+   * \param maxHubs The most vertices mirrored at once.
+   * \param epochLength How many seconds between hub selections.
+   * \param minRequestRate Edge requests per second that make a vertex a
+   *   hub.
+   * \param minDegree The degree that makes a vertex a hub.  Zero selects
+   *   by request rate only.
+   * \param lateness How many seconds behind the stream mirrored edges and
+   *   announcements can be and still be covered.
+   */
+  HubMirror(size_t maxHubs, double epochLength,
+            double minRequestRate = HUB_MIRROR_DEFAULT_MIN_REQUEST_RATE,
+            size_t minDegree = 0,
+            double lateness = HUB_MIRROR_DEFAULT_LATENESS) :
+    maxHubs(maxHubs), epochLength(epochLength),
+    minRequestRate(minRequestRate), minDegree(minDegree), lateness(lateness)
+  {
+    if (!(epochLength > 0)) {
+      throw HubMirrorException("HubMirror epoch length must be positive: " +
+        boost::lexical_cast<std::string>(epochLength));
+    }
+    if (!(minRequestRate > 0)) {
+      throw HubMirrorException("HubMirror minimum request rate must be "
+        "positive: " + boost::lexical_cast<std::string>(minRequestRate));
+    }
+    nextEpoch = std::numeric_limits<double>::lowest();
+    numPromoted = 0;
+    numRenewed = 0;
+    numDropped = 0;
+    numUntracked = 0;
+    numAnnouncementsReceived = 0;
+  }
+
+  /**
+   * Counts an edge request for one of this node's vertices.
+   */
+  void requested(NodeType const& vertex)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = requestCounts.find(vertex);
+    if (it != requestCounts.end()) {
+      it->second++;
+    } else if (requestCounts.size() < HUB_MIRROR_MAX_TRACKED) {
+      requestCounts[vertex] = 1;
+    } else {
+      numUntracked.fetch_add(1);
+    }
+  }
+
+  /**
+   * Returns true if it is time for select.  Cheap enough to call per
+   * tuple.
+   */
+  bool due(double currentTime) const { return currentTime >= nextEpoch; }
+
+  /**
+   * Picks the hubs for the next epoch and returns the leases to announce,
+   * for both newly promoted and renewed hubs.  The first call only starts
+   * the first epoch.
+   * \param currentTime The time of the latest tuple.
+   * \param candidates High degree vertices (e.g. from
+   *   CompressedSparse::getTopDegree), with their degrees.
+   * \param degreeOf Returns the current degree of a vertex.
+   */
+  std::vector<Lease> select(double currentTime,
+    std::vector<std::pair<NodeType, size_t>> const& candidates,
+    DegreeFunction degreeOf)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Lease> leases;
+    if (currentTime < nextEpoch) return leases;
+
+    if (epochStart == std::numeric_limits<double>::lowest()) {
+      epochStart = currentTime;
+      nextEpoch = currentTime + epochLength;
+      return leases;
+    }
+
+    double elapsed = std::max(currentTime - epochStart, epochLength);
+    size_t minRequests = static_cast<size_t>(minRequestRate * elapsed);
+    if (minRequests == 0) minRequests = 1;
+
+    // (requests, degree, vertex) for everything that qualifies.
+    std::vector<std::tuple<size_t, size_t, NodeType>> ranked;
+    std::set<NodeType> considered;
+    for (auto const& p : requestCounts) {
+      if (p.second >= minRequests) {
+        ranked.emplace_back(p.second, degreeOf(p.first), p.first);
+        considered.insert(p.first);
+      }
+    }
+    if (minDegree > 0) {
+      for (auto const& p : candidates) {
+        if (p.second >= minDegree && !considered.count(p.first)) {
+          auto it = requestCounts.find(p.first);
+          size_t count = it == requestCounts.end() ? 0 : it->second;
+          ranked.emplace_back(count, p.second, p.first);
+          considered.insert(p.first);
+        }
+      }
+    }
+
+    // Hubs keep their place while their degree holds up.
+    for (auto const& hub : hubs) {
+      if (considered.count(hub.first)) continue;
+      size_t degree = degreeOf(hub.first);
+      if (degree > 0 && 2 * degree >= hub.second) {
+        auto it = requestCounts.find(hub.first);
+        size_t count = it == requestCounts.end() ? 0 : it->second;
+        ranked.emplace_back(count, degree, hub.first);
+      }
+    }
+
+    std::sort(ranked.begin(), ranked.end(),
+      [](std::tuple<size_t, size_t, NodeType> const& a,
+         std::tuple<size_t, size_t, NodeType> const& b) {
+        if (std::get<0>(a) != std::get<0>(b)) {
+          return std::get<0>(a) > std::get<0>(b);
+        }
+        return std::get<1>(a) > std::get<1>(b);
+      });
+    if (ranked.size() > maxHubs) ranked.resize(maxHubs);
+
+    std::map<NodeType, size_t> newHubs;
+    size_t renewed = 0;
+    for (auto const& r : ranked) {
+      NodeType const& vertex = std::get<2>(r);
+      auto it = hubs.find(vertex);
+      if (it != hubs.end()) {
+        newHubs[vertex] = it->second;
+        renewed++;
+      } else {
+        newHubs[vertex] = std::get<1>(r);
+        numPromoted.fetch_add(1);
+      }
+      leases.push_back(Lease{vertex, currentTime + lateness,
+                             currentTime + 2 * epochLength + lateness});
+    }
+    numRenewed.fetch_add(renewed);
+    numDropped.fetch_add(hubs.size() - renewed);
+    hubs.swap(newHubs);
+
+    requestCounts.clear();
+    epochStart = currentTime;
+    nextEpoch = currentTime + epochLength;
+    return leases;
+  }
+
+  /**
+   * Returns true if the vertex is currently a hub.
+   */
+  bool isHub(NodeType const& vertex) const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hubs.count(vertex) > 0;
+  }
+
+  /**
+   * Wraps a serialized edge request as a hub announcement for the edge
+   * request channel.
+   */
+  static std::string announce(std::string const& request) {
+    return std::string(1, '\1') + request;
+  }
+
+  /**
+   * Returns true if the string received over the edge request channel is
+   * a hub announcement rather than an edge request.  Serialized edge
+   * requests start with a field tag, which is never '\1'.
+   */
+  static bool isAnnouncement(std::string const& str) {
+    return !str.empty() && str[0] == '\1';
+  }
+
+  /**
+   * Returns the serialized edge request inside an announcement.
+   * \throws HubMirrorException if it isn't an announcement.
+   */
+  std::string received(std::string const& announcement)
+  {
+    if (!isAnnouncement(announcement)) {
+      throw HubMirrorException("HubMirror::received Not a hub announcement");
+    }
+    numAnnouncementsReceived.fetch_add(1);
+    return announcement.substr(1);
+  }
+
+  size_t getNumHubs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hubs.size();
+  }
+
+  /// How many times a vertex became a hub.
+  size_t getNumPromoted() const { return numPromoted; }
+
+  /// How many times a hub's lease was renewed.
+  size_t getNumRenewed() const { return numRenewed; }
+
+  /// How many times a hub stopped being one.
+  size_t getNumDropped() const { return numDropped; }
+
+  /// Requests that weren't counted because too many vertices were tracked.
+  size_t getNumUntracked() const { return numUntracked; }
+
+  /// How many announcements other nodes sent this one.
+  size_t getNumAnnouncementsReceived() const {
+    return numAnnouncementsReceived;
+  }
+
+  size_t getMaxHubs() const { return maxHubs; }
+  double getEpochLength() const { return epochLength; }
+};
+
+}
+
+#endif
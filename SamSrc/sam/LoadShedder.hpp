@@ -0,0 +1,302 @@
+#ifndef SAM_LOAD_SHEDDER_HPP
+#define SAM_LOAD_SHEDDER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+
+/// Default for how many consumed tuples between adjustments.
+#define LOAD_SHEDDER_DEFAULT_INTERVAL 1000
+
+/// Factor a query's keep probability is multiplied by (once per unit of
+/// its share of the query starts) when overloaded.
+#define LOAD_SHEDDER_DECREASE 0.7
+
+/// How much each keep probability grows back per adjustment once the load
+/// is under LOAD_SHEDDER_RECOVER.
+#define LOAD_SHEDDER_INCREASE 0.05
+
+/// Keep probabilities grow back when the load is under this fraction of
+/// the limits.
+#define LOAD_SHEDDER_RECOVER 0.8
+
+/// Keep probabilities never go below this, so every query keeps some
+/// results and its yield can still be measured.
+#define LOAD_SHEDDER_MIN_KEEP 0.001
+
+namespace sam {
+
+class LoadShedderException : public std::runtime_error
+{
+public:
+  LoadShedderException(char const* message) :
+    std::runtime_error(message) {}
+  LoadShedderException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * What the load shedder looks at.  Latency and completed counts are
+ * cumulative (as the ThreadPool reports them); the shedder uses the change
+ * since the last adjustment.
+ */
+struct LoadSignals {
+  /// Total consume latency in seconds.
+  double totalLatency = 0;
+
+  /// Tuples whose latency is included in totalLatency.
+  size_t numCompleted = 0;
+
+  /// Tuples waiting to be consumed.
+  size_t queueLength = 0;
+
+  /// Partial results held.
+  size_t numIntermediateResults = 0;
+};
+
+/**
+ * Runtime overload control for subgraph queries, in place of the
+ * compile-time DROP_QUERIES flag.
+ *
+ * The load is the largest of mean consume latency over targetLatency,
+ * queue length over maxQueueLength, and partial results over
+ * maxIntermediateResults (limits of zero are ignored).  Every interval
+ * tuples, adjust() looks at the load:
+ *
+ * - Over 1, each query's keep probability for new starts is cut
+ *   multiplicatively, more for the queries that started more results in
+ *   the last interval (they are what fills the tables).
+ * - Under LOAD_SHEDDER_RECOVER, every keep probability grows back
+ *   additively.
+ * - If the partial results are over their limit, adjust() returns how
+ *   many to shed.  The caller sheds those furthest from completion (see
+ *   SubgraphQueryResultMap::shedFurthestFromCompletion), since they are the
+ *   least likely to pay off, and reports them with evicted().
+ *
+ * Recall is estimated per query from the fraction of starts kept and, for
+ * shed partial results, the query's completions per kept start: each shed
+ * result is assumed to have been worth as many completions as an average
+ * start.  It is an estimate, not a bound.
+ */
+class LoadShedder
+{
+private:
+  struct QueryState {
+    std::atomic<double> keep;
+    std::atomic<size_t> offered;
+    std::atomic<size_t> kept;
+    std::atomic<size_t> completed;
+    std::atomic<size_t> evicted;
+
+    /// kept at the last adjustment.
+    size_t keptBefore = 0;
+
+    QueryState() : keep(1), offered(0), kept(0), completed(0), evicted(0) {}
+  };
+
+  double targetLatency;
+  size_t maxQueueLength;
+  size_t maxIntermediateResults;
+  size_t interval;
+
+  std::vector<std::unique_ptr<QueryState>> queries;
+
+  std::mutex adjustMutex;
+  double latencyBefore = 0;
+  size_t completedBefore = 0;
+
+  std::atomic<double> load;
+  std::atomic<size_t> numAdjustments;
+  std::atomic<size_t> numOverloaded;
+
+  static std::mt19937& generator() {
+    static thread_local std::mt19937 gen(std::random_device{}());
+    return gen;
+  }
+
+  QueryState& state(size_t q) const {
+    if (q >= queries.size()) {
+      throw LoadShedderException("LoadShedder: no query " +
+        boost::lexical_cast<std::string>(q));
+    }
+    return *queries[q];
+  }
+
+public:
+  /**
+   * \param targetLatency Mean consume latency in seconds above which we are
+   *   overloaded.  Zero ignores latency.
+   * \param maxQueueLength Queue length above which we are overloaded.  Zero
+   *   ignores the queue.
+   * \param maxIntermediateResults Partial results above which we are
+   *   overloaded and shed results.  Zero ignores them.
+   * \param interval How many tuples between adjustments.
+   */
+  LoadShedder(double targetLatency, size_t maxQueueLength,
+              size_t maxIntermediateResults,
+              size_t interval = LOAD_SHEDDER_DEFAULT_INTERVAL) :
+    targetLatency(targetLatency), maxQueueLength(maxQueueLength),
+    maxIntermediateResults(maxIntermediateResults), interval(interval),
+    load(0), numAdjustments(0), numOverloaded(0)
+  {
+    if (targetLatency < 0 || (targetLatency == 0 && maxQueueLength == 0 &&
+                              maxIntermediateResults == 0))
+    {
+      throw LoadShedderException("LoadShedder needs at least one positive "
+        "limit");
+    }
+    if (interval == 0) {
+      throw LoadShedderException("LoadShedder interval must be at least one");
+    }
+  }
+
+  /**
+   * Adds a query, whose index is the number of queries added before it.
+   * Call before consuming tuples.
+   */
+  void addQuery() {
+    queries.push_back(std::unique_ptr<QueryState>(new QueryState()));
+  }
+
+  size_t getNumQueries() const { return queries.size(); }
+  size_t getInterval() const { return interval; }
+
+  /**
+   * Decides whether to start a result for query q.
+   */
+  bool admit(size_t q) {
+    QueryState& s = state(q);
+    s.offered.fetch_add(1, std::memory_order_relaxed);
+    double keep = s.keep.load(std::memory_order_relaxed);
+    if (keep < 1) {
+      std::uniform_real_distribution<double> dist(0, 1);
+      if (dist(generator()) >= keep) return false;
+    }
+    s.kept.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /// Counts a completed result of query q.
+  void completed(size_t q, size_t count = 1) {
+    state(q).completed.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  /// Counts partial results of query q that were shed.
+  void evicted(size_t q, size_t count) {
+    state(q).evicted.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  /**
+   * Updates the keep probabilities from the signals.  If another thread is
+   * already adjusting, returns right away.
+   * \return Returns how many partial results to shed.
+   */
+  size_t adjust(LoadSignals const& signals)
+  {
+    std::unique_lock<std::mutex> lock(adjustMutex, std::try_to_lock);
+    if (!lock.owns_lock()) return 0;
+    numAdjustments.fetch_add(1);
+
+    double current = 0;
+    size_t finished = signals.numCompleted - completedBefore;
+    if (targetLatency > 0 && finished > 0) {
+      double meanLatency = (signals.totalLatency - latencyBefore) / finished;
+      current = std::max(current, meanLatency / targetLatency);
+    }
+    latencyBefore = signals.totalLatency;
+    completedBefore = signals.numCompleted;
+    if (maxQueueLength > 0) {
+      current = std::max(current,
+        static_cast<double>(signals.queueLength) / maxQueueLength);
+    }
+    if (maxIntermediateResults > 0) {
+      current = std::max(current,
+        static_cast<double>(signals.numIntermediateResults) /
+        maxIntermediateResults);
+    }
+    load = current;
+
+    // Each query's share of the starts since the last adjustment.
+    std::vector<size_t> starts(queries.size());
+    size_t totalStarts = 0;
+    for (size_t q = 0; q < queries.size(); q++) {
+      size_t kept = queries[q]->kept;
+      starts[q] = kept - queries[q]->keptBefore;
+      queries[q]->keptBefore = kept;
+      totalStarts += starts[q];
+    }
+
+    if (current > 1) {
+      numOverloaded.fetch_add(1);
+      for (size_t q = 0; q < queries.size() && totalStarts > 0; q++) {
+        double share = static_cast<double>(starts[q]) * queries.size() /
+                       totalStarts;
+        double keep = queries[q]->keep * std::pow(LOAD_SHEDDER_DECREASE,
+                                                  share);
+        queries[q]->keep = std::max(keep, LOAD_SHEDDER_MIN_KEEP);
+      }
+    } else if (current < LOAD_SHEDDER_RECOVER) {
+      for (auto& s : queries) {
+        s->keep = std::min(1.0, s->keep + LOAD_SHEDDER_INCREASE);
+      }
+    }
+
+    if (maxIntermediateResults > 0 &&
+        signals.numIntermediateResults > maxIntermediateResults)
+    {
+      return signals.numIntermediateResults - maxIntermediateResults;
+    }
+    return 0;
+  }
+
+  /// The current probability of starting a result for query q.
+  double getKeepProbability(size_t q) const { return state(q).keep; }
+
+  size_t getNumOffered(size_t q) const { return state(q).offered; }
+  size_t getNumKept(size_t q) const { return state(q).kept; }
+  size_t getNumCompleted(size_t q) const { return state(q).completed; }
+  size_t getNumEvicted(size_t q) const { return state(q).evicted; }
+
+  /**
+   * The estimated fraction of query q's results that were found.
+   */
+  double getEstimatedRecall(size_t q) const {
+    QueryState const& s = state(q);
+    size_t offered = s.offered;
+    if (offered == 0) return 1;
+    double recall = static_cast<double>(s.kept) / offered;
+    size_t kept = s.kept;
+    size_t completed = s.completed;
+    size_t evicted = s.evicted;
+    // Without completions there is nothing to weigh shed results by.
+    if (kept > 0 && completed > 0 && evicted > 0) {
+      double lost = evicted * static_cast<double>(completed) / kept;
+      recall *= completed / (completed + lost);
+    }
+    return recall;
+  }
+
+  /// The estimated fraction of query q's results that were lost.
+  double getEstimatedRecallLoss(size_t q) const {
+    return 1 - getEstimatedRecall(q);
+  }
+
+  /// The load at the last adjustment (1 is at the limit).
+  double getLoad() const { return load; }
+
+  size_t getNumAdjustments() const { return numAdjustments; }
+
+  /// How many adjustments found the load over the limit.
+  size_t getNumOverloaded() const { return numOverloaded; }
+};
+
+}
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef SAM_MEMORY_BUDGET_HPP
+#define SAM_MEMORY_BUDGET_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <utility>
+
+/// Bytes of bookkeeping per std::list node (next and prev pointers).
+#define LIST_NODE_OVERHEAD (2 * sizeof(void*))
+
+/// Bytes of bookkeeping per std::map/std::set node (color, parent, left,
+/// right).
+#define TREE_NODE_OVERHEAD (4 * sizeof(void*))
+
+/// The edge window is never shortened below this fraction of the original.
+#define MEMORY_BUDGET_MIN_WINDOW_FRACTION 0.0625
+
+/// Once over budget, shed until usage is below this fraction of the budget.
+#define MEMORY_BUDGET_LOW_WATER 0.9
+
+/// How many tuples between attempts to get back under budget.  Evicting
+/// results and sweeping edges walk whole tables, so we don't do it on
+/// every tuple.
+#define MEMORY_BUDGET_CHECK_INTERVAL 64
+
+namespace sam {
+
+/**
+ * Heap bytes owned by a value beyond sizeof(value).  For strings this is
+ * zero when the string fits in the small string buffer.  We use the size
+ * rather than the capacity so that copies of a value (which may have less
+ * slack) are charged the same amount as the original.
+ */
+inline
+size_t heapBytes(std::string const& s)
+{
+  char const* data = s.data();
+  char const* object = reinterpret_cast<char const*>(&s);
+  if (data >= object && data < object + sizeof(s)) return 0;
+  return s.size() + 1;
+}
+
+template <typename T>
+size_t heapBytes(T const&)
+{
+  return 0;
+}
+
+template <typename... Ts>
+size_t heapBytes(std::tuple<Ts...> const& t);
+
+namespace memoryDetails {
+
+template <typename Tuple, size_t... I>
+size_t tupleHeapBytes(Tuple const& t, std::index_sequence<I...>)
+{
+  size_t total = 0;
+  // Expands to one heapBytes call per element.
+  int dummy[] = { 0, (total += heapBytes(std::get<I>(t)), 0)... };
+  (void)dummy;
+  return total;
+}
+
+} // end namespace memoryDetails
+
+template <typename... Ts>
+size_t heapBytes(std::tuple<Ts...> const& t)
+{
+  return memoryDetails::tupleHeapBytes(t, std::index_sequence_for<Ts...>());
+}
+
+/**
+ * What the budget is charging for.
+ */
+enum class MemoryCategory
+{
+  Edges = 0, ///> Edges in the CSR and CSC
+  Results = 1, ///> Intermediate results in the SubgraphQueryResultMap
+  Requests = 2 ///> Edge requests in the EdgeRequestMap
+};
+
+/**
+ * What to do when the budget is exceeded.  These are flags and can be
+ * or'ed together; they are applied in the order listed here.
+ */
+enum MemoryPolicy
+{
+  MEMORY_POLICY_NONE = 0,
+
+  /// Don't start new intermediate results while over budget.
+  MEMORY_POLICY_DROP_QUERY_STARTS = 1,
+
+  /// Evict the intermediate results that started earliest.
+  MEMORY_POLICY_EVICT_OLDEST_RESULTS = 2,
+
+  /// Halve the edge retention window (down to a floor) and sweep out edges
+  /// that fall outside of it.  The window grows back once usage drops.
+  MEMORY_POLICY_SHORTEN_WINDOW = 4
+};
+
+/**
+ * Byte accounting for the GraphStore.  The data structures charge and
+ * credit bytes as elements are stored and removed; the GraphStore checks
+ * overBudget() and applies the configured policies.  A budget of zero
+ * means unlimited (accounting still happens so usage can be reported).
+ */
+class MemoryBudget
+{
+private:
+  /// Pad the counters onto separate cache lines since they are updated by
+  /// every consume thread.
+  struct Counter {
+    std::atomic<int64_t> value;
+    char padding[64 - sizeof(std::atomic<int64_t>)];
+    Counter() : value(0) {}
+  };
+
+  Counter usage[3];
+
+  std::atomic<size_t> budget;
+  std::atomic<unsigned int> policies;
+
+  std::atomic<size_t> numWindowShrinks;
+  std::atomic<size_t> numResultsEvicted;
+  std::atomic<size_t> numQueryStartsDropped;
+  std::atomic<size_t> numEdgesShed;
+
+public:
+  /**
+   * \param budget The number of bytes allowed, or 0 for unlimited.
+   * \param policies MemoryPolicy flags or'ed together.
+   */
+  MemoryBudget(size_t budget = 0, unsigned int policies = MEMORY_POLICY_NONE) :
+    budget(budget), policies(policies), numWindowShrinks(0),
+    numResultsEvicted(0), numQueryStartsDropped(0), numEdgesShed(0)
+  {}
+
+  void add(MemoryCategory category, size_t bytes) {
+    usage[static_cast<size_t>(category)].value.fetch_add(bytes,
+      std::memory_order_relaxed);
+  }
+
+  void remove(MemoryCategory category, size_t bytes) {
+    usage[static_cast<size_t>(category)].value.fetch_sub(bytes,
+      std::memory_order_relaxed);
+  }
+
+  /**
+   * Returns the bytes currently charged to the category.
+   */
+  size_t getUsage(MemoryCategory category) const {
+    int64_t value = usage[static_cast<size_t>(category)].value.load(
+      std::memory_order_relaxed);
+    return value > 0 ? static_cast<size_t>(value) : 0;
+  }
+
+  /**
+   * Returns the bytes currently charged across all categories.
+   */
+  size_t getUsage() const {
+    return getUsage(MemoryCategory::Edges) +
+           getUsage(MemoryCategory::Results) +
+           getUsage(MemoryCategory::Requests);
+  }
+
+  size_t getBudget() const { return budget; }
+  void setBudget(size_t budget) { this->budget = budget; }
+
+  unsigned int getPolicies() const { return policies; }
+  void setPolicies(unsigned int policies) { this->policies = policies; }
+
+  bool hasPolicy(MemoryPolicy policy) const {
+    return (policies.load() & policy) != 0;
+  }
+
+  bool overBudget() const {
+    size_t b = budget.load();
+    return b > 0 && getUsage() > b;
+  }
+
+  /**
+   * Returns how many bytes need to be freed to get back under the low
+   * water mark, or zero if we are already there.
+   */
+  size_t getExcess() const {
+    size_t b = budget.load();
+    if (b == 0) return 0;
+    size_t lowWater = static_cast<size_t>(b * MEMORY_BUDGET_LOW_WATER);
+    size_t u = getUsage();
+    return u > lowWater ? u - lowWater : 0;
+  }
+
+  void recordWindowShrink() { numWindowShrinks.fetch_add(1); }
+  void recordResultsEvicted(size_t n) { numResultsEvicted.fetch_add(n); }
+  void recordQueryStartDropped() { numQueryStartsDropped.fetch_add(1); }
+  void recordEdgesShed(size_t n) { numEdgesShed.fetch_add(n); }
+
+  size_t getNumWindowShrinks() const { return numWindowShrinks; }
+  size_t getNumResultsEvicted() const { return numResultsEvicted; }
+  size_t getNumQueryStartsDropped() const { return numQueryStartsDropped; }
+  size_t getNumEdgesShed() const { return numEdgesShed; }
+};
+
+} // end namespace sam
+
+#endif
@@ -0,0 +1,355 @@
+#ifndef SAM_QUERY_NETWORK_HPP
+#define SAM_QUERY_NETWORK_HPP
+
+#include <sam/SubgraphQuery.hpp>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+
+/// The duration index only narrows down the time tests to evaluate, which
+/// are still evaluated exactly, so it errs on the side of including a test
+/// by this many seconds to be safe from rounding.
+#define QUERY_NETWORK_DURATION_SLACK 1e-3
+
+namespace sam {
+
+class QueryNetworkException : public std::runtime_error
+{
+public:
+  QueryNetworkException(char const* message) :
+    std::runtime_error(message) {}
+  QueryNetworkException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * Decides which registered queries a tuple starts a result for, without
+ * checking every query's first edge description separately.
+ *
+ * Whether a tuple matches the first edge description of a query depends
+ * only on three tests:
+ *  1) The time constraints of the first edge, relative to the start of
+ *     the query (which is the tuple's start or end time).
+ *  2) The vertex constraints on the source variable of the first edge.
+ *  3) The vertex constraints on the target variable of the first edge.
+ * Queries looking for the same kind of first edge often have identical
+ * tests, e.g. a set of detection queries that all start from any edge
+ * into a Top100 vertex.  The network is a trie with one level per test:
+ * queries with the same time test share a node at the first level, those
+ * that also have the same source test share a node at the second level,
+ * and so on.  The queries sit at the leaves.  A tuple is run down the trie
+ * and each test is evaluated once per node, so a test that fails prunes
+ * every query below it and a test common to many queries costs the same as
+ * for one.  Nodes whose vertex variable has no constraints pass without
+ * any work.
+ *
+ * The time test only ever depends on the tuple's duration: the start of
+ * the query is the tuple's start (or end) time, so the first edge's start
+ * and end time constraints amount to a range of durations.  The first
+ * level is kept sorted on the lower end of that range, and a tuple only
+ * reaches the time tests whose range could contain its duration.  A
+ * stream of short flows doesn't touch queries that start with a long one.
+ *
+ * Tests are evaluated with the first query added below the node.  Vertex
+ * tests are only shared between queries using the same feature map.
+ * Queries are added before tuples are matched; matching is read only and
+ * can be done by several threads at once.
+ */
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+class QueryNetwork
+{
+public:
+  typedef SubgraphQuery<TupleType, source, target, time, duration> QueryType;
+  typedef typename QueryType::NodeType NodeType;
+
+private:
+  /// The kinds of test, one per level of the trie.
+  enum class Test { Time, Source, Target };
+
+  struct Node {
+    /// Identifies the test, so that equal tests share the node.
+    std::string key;
+
+    /// The query whose first edge description the test is evaluated with.
+    std::shared_ptr<const QueryType> query;
+
+    /// True if there is nothing to check.
+    bool trivial = false;
+
+    /// For time tests, the range of durations that can pass.
+    double minDuration = 0;
+    double maxDuration = 0;
+
+    std::vector<std::shared_ptr<Node>> children;
+
+    /// Indices of the queries at a leaf.
+    std::vector<size_t> queries;
+  };
+
+  /// The first level of the trie, sorted on minDuration.
+  std::vector<std::shared_ptr<Node>> roots;
+
+  size_t numQueries = 0;
+  size_t numNodes = 0;
+
+  #ifdef METRICS
+  /// Number of tests evaluated (trivial ones aren't counted).
+  mutable std::atomic<size_t> totalTests;
+  #endif
+
+public:
+  QueryNetwork()
+  {
+    #ifdef METRICS
+    totalTests = 0;
+    #endif
+  }
+
+  /**
+   * Adds a query to the network.
+   * \param query The query, which must have been finalized.
+   * \return Returns the index reported by match for the query, which is
+   *   the number of queries added before it.
+   * \throws QueryNetworkException if the query isn't finalized.
+   */
+  size_t add(std::shared_ptr<const QueryType> query);
+
+  /**
+   * Finds the queries whose first edge description the tuple satisfies.
+   * \param tuple The tuple.
+   * \param matched The indices of the matching queries are appended to
+   *   this in increasing order.
+   * \return Returns the number of tests evaluated.
+   */
+  size_t match(TupleType const& tuple, std::vector<size_t>& matched) const;
+
+  /**
+   * The number of queries added.
+   */
+  size_t getNumQueries() const { return numQueries; }
+
+  /**
+   * The number of distinct tests, i.e. nodes in the trie.  Without any
+   * sharing this is three times the number of queries.
+   */
+  size_t getNumTests() const { return numNodes; }
+
+  #ifdef METRICS
+  size_t getTotalTests() const { return totalTests; }
+  #endif
+
+private:
+  /**
+   * Finds the node for the test among the given nodes, creating it if
+   * needed.
+   */
+  std::shared_ptr<Node> findOrCreate(std::vector<std::shared_ptr<Node>>& nodes,
+                                     Test test,
+                                     std::shared_ptr<const QueryType> query);
+
+  /**
+   * The key identifying a test of the first edge description of a query.
+   */
+  static std::string makeKey(Test test, QueryType const& query);
+
+  /**
+   * Evaluates the test of a node.
+   */
+  static bool passes(Test test, Node const& node, TupleType const& tuple);
+
+  /**
+   * Sets the range of durations that can pass the time test of a node.
+   */
+  static void setDurationRange(Node& node);
+};
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+size_t
+QueryNetwork<TupleType, source, target, time, duration>::
+add(std::shared_ptr<const QueryType> query)
+{
+  if (!query->isFinalized()) {
+    throw QueryNetworkException("QueryNetwork::add Tried to add a query that"
+      " had not been finalized");
+  }
+
+  auto timeNode = findOrCreate(roots, Test::Time, query);
+  auto sourceNode = findOrCreate(timeNode->children, Test::Source, query);
+  auto targetNode = findOrCreate(sourceNode->children, Test::Target, query);
+  size_t index = numQueries++;
+  targetNode->queries.push_back(index);
+  return index;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+size_t
+QueryNetwork<TupleType, source, target, time, duration>::
+match(TupleType const& tuple, std::vector<size_t>& matched) const
+{
+  size_t numTests = 0;
+  size_t numBefore = matched.size();
+  double tupleDuration = std::get<duration>(tuple);
+  for (auto const& timeNode : roots) {
+    if (timeNode->minDuration > tupleDuration) break;
+    if (timeNode->maxDuration < tupleDuration) continue;
+    numTests++;
+    if (!passes(Test::Time, *timeNode, tuple)) continue;
+    for (auto const& sourceNode : timeNode->children) {
+      if (!sourceNode->trivial) {
+        numTests++;
+        if (!passes(Test::Source, *sourceNode, tuple)) continue;
+      }
+      for (auto const& targetNode : sourceNode->children) {
+        if (!targetNode->trivial) {
+          numTests++;
+          if (!passes(Test::Target, *targetNode, tuple)) continue;
+        }
+        matched.insert(matched.end(), targetNode->queries.begin(),
+                       targetNode->queries.end());
+      }
+    }
+  }
+
+  // Leaves are in the order their first query was added, so results are
+  // started in registration order as they were before there was a network.
+  std::sort(matched.begin() + numBefore, matched.end());
+
+  #ifdef METRICS
+  totalTests.fetch_add(numTests);
+  #endif
+  return numTests;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+std::shared_ptr<
+  typename QueryNetwork<TupleType, source, target, time, duration>::Node>
+QueryNetwork<TupleType, source, target, time, duration>::
+findOrCreate(std::vector<std::shared_ptr<Node>>& nodes, Test test,
+             std::shared_ptr<const QueryType> query)
+{
+  std::string key = makeKey(test, *query);
+  for (auto& node : nodes) {
+    if (node->key == key) return node;
+  }
+
+  auto node = std::make_shared<Node>();
+  node->key = key;
+  node->query = query;
+  numNodes++;
+  if (test == Test::Time) {
+    setDurationRange(*node);
+    auto position = std::upper_bound(nodes.begin(), nodes.end(), node,
+      [](std::shared_ptr<Node> const& a, std::shared_ptr<Node> const& b) {
+        return a->minDuration < b->minDuration;
+      });
+    nodes.insert(position, node);
+    return node;
+  }
+
+  auto const& edge = query->getEdgeDescription(0);
+  std::string variable = (test == Test::Source) ? edge.getSource() :
+                                                  edge.getTarget();
+  node->trivial = query->getConstraints(variable).empty();
+  nodes.push_back(node);
+  return node;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+std::string
+QueryNetwork<TupleType, source, target, time, duration>::
+makeKey(Test test, QueryType const& query)
+{
+  auto const& edge = query.getEdgeDescription(0);
+  if (test == Test::Time) {
+    return std::string(query.zeroTimeRelativeToStart() ? "start " : "end ") +
+      boost::lexical_cast<std::string>(edge.startTimeRange.first) + " " +
+      boost::lexical_cast<std::string>(edge.startTimeRange.second) + " " +
+      boost::lexical_cast<std::string>(edge.endTimeRange.first) + " " +
+      boost::lexical_cast<std::string>(edge.endTimeRange.second);
+  }
+
+  std::string variable = (test == Test::Source) ? edge.getSource() :
+                                                  edge.getTarget();
+  auto const& constraints = query.getConstraints(variable);
+  if (constraints.empty()) return "";
+
+  std::string key = boost::lexical_cast<std::string>(
+    static_cast<void const*>(query.getFeatureMap().get()));
+  for (auto const& constraint : constraints) {
+    key += " " + toString(constraint.op) + " " + constraint.featureName;
+  }
+  return key;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+void
+QueryNetwork<TupleType, source, target, time, duration>::
+setDurationRange(Node& node)
+{
+  // With the query starting at the tuple's start time t, the tuple starts
+  // at t + 0 and ends at t + duration, so 0 has to be in the start time
+  // range and the duration in the end time range.  Starting at the end
+  // time t + duration, the tuple starts at (t + duration) - duration and
+  // ends at (t + duration) + 0, so it is the other way around.
+  auto const& edge = node.query->getEdgeDescription(0);
+  std::pair<double, double> fixed = edge.startTimeRange;
+  std::pair<double, double> range = edge.endTimeRange;
+  if (!node.query->zeroTimeRelativeToStart()) {
+    fixed = edge.endTimeRange;
+    range = std::make_pair(-edge.startTimeRange.second,
+                           -edge.startTimeRange.first);
+  }
+
+  double slack = QUERY_NETWORK_DURATION_SLACK;
+  if (fixed.first > slack || fixed.second < -slack) {
+    // Nothing can pass.
+    node.minDuration = std::numeric_limits<double>::max();
+    node.maxDuration = std::numeric_limits<double>::lowest();
+  } else {
+    node.minDuration = range.first - slack;
+    node.maxDuration = range.second + slack;
+  }
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+bool
+QueryNetwork<TupleType, source, target, time, duration>::
+passes(Test test, Node const& node, TupleType const& tuple)
+{
+  QueryType const& query = *node.query;
+  auto const& edge = query.getEdgeDescription(0);
+  switch (test)
+  {
+    case Test::Time:
+    {
+      double queryStart = std::get<time>(tuple);
+      if (!query.zeroTimeRelativeToStart()) {
+        queryStart += std::get<duration>(tuple);
+      }
+      return edge.satisfies(tuple, queryStart);
+    }
+    case Test::Source:
+      return query.satisfiesVertexConstraints(edge.getSource(),
+                                              std::get<source>(tuple));
+    case Test::Target:
+      return query.satisfiesVertexConstraints(edge.getTarget(),
+                                              std::get<target>(tuple));
+  }
+  return false;
+}
+
+}
+
+#endif
@@ -0,0 +1,414 @@
+#ifndef SAM_QUERY_PLANNER_HPP
+#define SAM_QUERY_PLANNER_HPP
+
+#include <sam/SubgraphQuery.hpp>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// One in this many tuples checked against a query updates the selectivity
+/// statistics.
+#define QUERY_PLANNER_SAMPLE_INTERVAL 16
+
+/// How many sampled tuples between re-plans.
+#define QUERY_PLANNER_REPLAN_INTERVAL 1024
+
+/// A plan is only replaced by one estimated to cost at most this fraction
+/// of it, so that the planner doesn't flip between two similar plans.
+#define QUERY_PLANNER_SWITCH_RATIO 0.5
+
+namespace sam {
+
+class QueryPlannerException : public std::runtime_error
+{
+public:
+  QueryPlannerException(char const* message) :
+    std::runtime_error(message) {}
+  QueryPlannerException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * Decides which edge description of a SubgraphQuery new results start
+ * from (the anchor).
+ *
+ * The edges of a match have to arrive in the order of the query's sorted
+ * edge descriptions, so the order the edges are matched in is fixed.  What
+ * can change is when a result is created.  With anchor 0 (the default) a
+ * result is created for every tuple that matches the first edge
+ * description and waits for the rest.  If the first edge description
+ * matches most of the traffic and a later one, k, matches little, that is
+ * a lot of partial results that mostly expire.  With anchor k nothing is
+ * stored until a tuple matches edge description k; the edges before it
+ * have already arrived, so they are looked up in the graph
+ * (SubgraphQueryResultMap::addAnchored).  Edge description k has to share
+ * a vertex with the first one so that the lookup can start from it.
+ *
+ * The planner samples tuples and keeps, for each edge description, the
+ * fraction that pass the constraints that don't depend on the rest of the
+ * match: the vertex constraints and the range of durations the time
+ * constraints allow.  Together with the mean degree of the graph that
+ * gives an estimate of the edges examined per tuple for each anchor: a
+ * stored partial result is examined by about degree later tuples before
+ * it is extended or expires, and a lookup in the graph examines about
+ * degree edges.  Every replanInterval samples the anchor with the lowest
+ * estimate is chosen, and the statistics are halved so that recent
+ * traffic counts the most.
+ *
+ * A match belongs to the plan that was in effect at the start time of its
+ * first edge, so a change of plan never loses or repeats a match: plans
+ * are kept as time segments until no match started in them can still
+ * complete.
+ *
+ * Planning needs the whole graph to be local, so it should only be enabled
+ * on a single node.
+ */
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+class QueryPlanner
+{
+public:
+  typedef SubgraphQuery<TupleType, source, target, time, duration>
+    QueryType;
+
+  /**
+   * The anchor used for matches whose first edge starts in [from, to).
+   */
+  struct Segment {
+    size_t anchor;
+    double from;
+    double to;
+  };
+
+private:
+  std::shared_ptr<const QueryType> query;
+  size_t numEdges;
+  bool enabled;
+
+  /// Whether each edge description can be an anchor.
+  std::vector<bool> anchorable;
+
+  /// The durations each edge description allows.
+  std::vector<std::pair<double, double>> durationRanges;
+
+  size_t sampleInterval = QUERY_PLANNER_SAMPLE_INTERVAL;
+  size_t replanInterval = QUERY_PLANNER_REPLAN_INTERVAL;
+
+  std::atomic<size_t> numChecked;
+
+  mutable std::mutex statsMutex;
+  double numSampled = 0;
+  size_t sampledSinceReplan = 0;
+  std::vector<double> numMatched;
+
+  mutable std::mutex planMutex;
+  std::vector<Segment> segments;
+
+  /// True while the only segment is anchor 0, so the common case doesn't
+  /// need planMutex.
+  std::atomic<bool> firstEdgeOnly;
+
+  std::atomic<size_t> currentAnchor;
+  std::atomic<size_t> numReplans;
+
+  bool matchesAlone(size_t i, TupleType const& tuple) const {
+    double d = std::get<duration>(tuple);
+    return d >= durationRanges[i].first && d <= durationRanges[i].second &&
+           query->satisfiesVertexConstraints(i, tuple);
+  }
+
+  double selectivity(size_t i) const {
+    return (numMatched[i] + 1) / (numSampled + 2);
+  }
+
+  double cost(size_t anchor, double meanDegree) const {
+    double degree = std::max(meanDegree, 1.0);
+
+    // Looking up the edges before the anchor.  prefixes is the number of
+    // partial matches per anchor tuple at each level.
+    double prefixes = 1;
+    double lookups = 0;
+    for (size_t i = 0; i < anchor; i++) {
+      lookups += prefixes * degree;
+      prefixes *= degree * selectivity(i);
+    }
+    double c = selectivity(anchor) * lookups;
+
+    // Storing the partial results from the anchor on.  The last edge
+    // completes a result, so nothing is stored for it.
+    double stored = selectivity(anchor) * prefixes;
+    for (size_t i = anchor; i + 1 < numEdges; i++) {
+      c += stored * degree;
+      stored *= degree * selectivity(i + 1);
+    }
+    return c;
+  }
+
+  void startSegment(size_t anchor, double now);
+
+public:
+  /**
+   * \param query The finalized query to plan for.
+   * \param enabled If false, the planner always uses anchor 0 and does no
+   *   work.
+   */
+  QueryPlanner(std::shared_ptr<const QueryType> query, bool enabled = true);
+
+  bool isEnabled() const { return enabled; }
+
+  /**
+   * True if results can be started from the ith edge description.
+   */
+  bool isAnchorable(size_t i) const { return anchorable[i]; }
+
+  /**
+   * Counts the tuple and, if it is sampled, adds it to the statistics.
+   * \return Returns true if it is time to call replan().
+   */
+  bool observe(TupleType const& tuple);
+
+  /**
+   * Picks the anchor with the lowest estimated cost.
+   * \param now The time of the tuple being processed; a new plan applies
+   *   to matches that start from then on.
+   * \param meanDegree The mean degree of the graph.
+   * \return Returns the anchor in effect.
+   */
+  size_t replan(double now, double meanDegree);
+
+  /**
+   * Sets the anchor for matches starting from now on, regardless of the
+   * statistics.
+   * \throws QueryPlannerException if the edge description can't be an
+   *   anchor.
+   */
+  void setAnchor(size_t anchor, double now);
+
+  /**
+   * The anchor for a match whose first edge starts at the given time.
+   */
+  size_t getAnchor(double firstEdgeTime) const;
+
+  /**
+   * Adds the segments with an anchor other than 0 that a tuple at the
+   * given time could complete through the anchor.
+   */
+  void getAnchoredSegments(double tupleTime,
+                           std::vector<Segment>& anchored) const;
+
+  /// The anchor for matches starting now.
+  size_t getCurrentAnchor() const { return currentAnchor; }
+  size_t getNumReplans() const { return numReplans; }
+  size_t getNumSegments() const {
+    std::lock_guard<std::mutex> lock(planMutex);
+    return segments.size();
+  }
+
+  /**
+   * The estimated fraction of tuples that match the ith edge description
+   * on their own.
+   */
+  double getSelectivity(size_t i) const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return selectivity(i);
+  }
+
+  /**
+   * The estimated edges examined per tuple when anchoring at the given
+   * edge description.
+   */
+  double getCost(size_t anchor, double meanDegree) const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return cost(anchor, meanDegree);
+  }
+
+  void setSampleInterval(size_t interval) {
+    sampleInterval = std::max(interval, size_t(1));
+  }
+  void setReplanInterval(size_t interval) {
+    replanInterval = std::max(interval, size_t(1));
+  }
+};
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+QueryPlanner<TupleType, source, target, time, duration>::
+QueryPlanner(std::shared_ptr<const QueryType> query, bool enabled) :
+  query(query), enabled(enabled), numChecked(0), firstEdgeOnly(true),
+  currentAnchor(0), numReplans(0)
+{
+  if (!query->isFinalized()) {
+    throw QueryPlannerException("QueryPlanner: the query has not been"
+      " finalized");
+  }
+  numEdges = query->size();
+  numMatched.resize(numEdges, 0);
+
+  auto const& first = query->getEdgeDescription(0);
+  for (size_t i = 0; i < numEdges; i++) {
+    auto const& edge = query->getEdgeDescription(i);
+    anchorable.push_back(i == 0 ||
+      edge.getSource() == first.getSource() ||
+      edge.getSource() == first.getTarget() ||
+      edge.getTarget() == first.getSource() ||
+      edge.getTarget() == first.getTarget());
+
+    // The end has to fall in the end range for some start in the start
+    // range.
+    durationRanges.push_back(std::make_pair(
+      edge.endTimeRange.first - edge.startTimeRange.second,
+      edge.endTimeRange.second - edge.startTimeRange.first));
+  }
+
+  segments.push_back(Segment{0, std::numeric_limits<double>::lowest(),
+                             std::numeric_limits<double>::max()});
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+bool
+QueryPlanner<TupleType, source, target, time, duration>::
+observe(TupleType const& tuple)
+{
+  if (!enabled || numEdges < 2) return false;
+  if (numChecked.fetch_add(1) % sampleInterval != 0) return false;
+
+  std::vector<bool> matched(numEdges);
+  for (size_t i = 0; i < numEdges; i++) {
+    matched[i] = matchesAlone(i, tuple);
+  }
+
+  std::lock_guard<std::mutex> lock(statsMutex);
+  numSampled += 1;
+  for (size_t i = 0; i < numEdges; i++) {
+    if (matched[i]) numMatched[i] += 1;
+  }
+  sampledSinceReplan++;
+  return sampledSinceReplan >= replanInterval;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+size_t
+QueryPlanner<TupleType, source, target, time, duration>::
+replan(double now, double meanDegree)
+{
+  size_t anchor = currentAnchor;
+  {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (sampledSinceReplan < replanInterval) return anchor;
+    sampledSinceReplan = 0;
+
+    size_t best = anchor;
+    double bestCost = cost(anchor, meanDegree);
+    double currentCost = bestCost;
+    for (size_t k = 0; k < numEdges; k++) {
+      if (!anchorable[k]) continue;
+      double c = cost(k, meanDegree);
+      if (c < bestCost) {
+        best = k;
+        bestCost = c;
+      }
+    }
+    if (best != anchor && bestCost < QUERY_PLANNER_SWITCH_RATIO * currentCost)
+    {
+      anchor = best;
+    }
+
+    numSampled /= 2;
+    for (auto& m : numMatched) m /= 2;
+  }
+  numReplans.fetch_add(1);
+
+  if (anchor != currentAnchor) {
+    DEBUG_PRINT("QueryPlanner::replan switching anchor from %lu to %lu at "
+      "%f\n", currentAnchor.load(), anchor, now);
+    startSegment(anchor, now);
+  }
+  return anchor;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+void
+QueryPlanner<TupleType, source, target, time, duration>::
+setAnchor(size_t anchor, double now)
+{
+  if (anchor >= numEdges || !anchorable[anchor]) {
+    throw QueryPlannerException("QueryPlanner::setAnchor: edge description "
+      + std::to_string(anchor) + " doesn't share a vertex with the first");
+  }
+  if (anchor != currentAnchor) startSegment(anchor, now);
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+void
+QueryPlanner<TupleType, source, target, time, duration>::
+startSegment(size_t anchor, double now)
+{
+  std::lock_guard<std::mutex> lock(planMutex);
+  Segment& last = segments.back();
+  now = std::max(now, last.from);
+  last.to = now;
+  segments.push_back(
+    Segment{anchor, now, std::numeric_limits<double>::max()});
+
+  // Drop segments that no match can still be completed in.  When the
+  // query's times are relative to the end of the first edge, that edge
+  // can have started any time before, so only the edge window limits how
+  // far back a match reaches and the segments are kept.
+  double horizon = query->zeroTimeRelativeToStart() ?
+    now - query->getMaxTimeExtent() : std::numeric_limits<double>::lowest();
+  size_t expired = 0;
+  while (expired + 1 < segments.size() && segments[expired].to < horizon) {
+    expired++;
+  }
+  segments.erase(segments.begin(), segments.begin() + expired);
+
+  currentAnchor = anchor;
+  firstEdgeOnly = segments.size() == 1 && anchor == 0;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+size_t
+QueryPlanner<TupleType, source, target, time, duration>::
+getAnchor(double firstEdgeTime) const
+{
+  if (firstEdgeOnly) return 0;
+  std::lock_guard<std::mutex> lock(planMutex);
+  for (auto const& segment : segments) {
+    if (firstEdgeTime < segment.to) return segment.anchor;
+  }
+  return segments.back().anchor;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+void
+QueryPlanner<TupleType, source, target, time, duration>::
+getAnchoredSegments(double tupleTime, std::vector<Segment>& anchored) const
+{
+  if (firstEdgeOnly) return;
+  double earliest = query->zeroTimeRelativeToStart() ?
+    tupleTime - query->getMaxTimeExtent() :
+    std::numeric_limits<double>::lowest();
+  std::lock_guard<std::mutex> lock(planMutex);
+  for (auto const& segment : segments) {
+    if (segment.anchor != 0 && segment.to > earliest &&
+        segment.from <= tupleTime)
+    {
+      anchored.push_back(segment);
+    }
+  }
+}
+
+} // end namespace sam
+
+#endif
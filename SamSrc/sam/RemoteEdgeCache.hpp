@@ -0,0 +1,517 @@
+#ifndef SAM_REMOTE_EDGE_CACHE_HPP
+#define SAM_REMOTE_EDGE_CACHE_HPP
+
+#include <sam/EdgeRequest.hpp>
+#include <sam/Null.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <boost/functional/hash.hpp>
+#include <boost/lexical_cast.hpp>
+
+/// The number of independently locked partitions of the cache.
+#define REMOTE_EDGE_CACHE_NUM_STRIPES 64
+
+/// Default for the most edges and keys the cache holds.
+#define REMOTE_EDGE_CACHE_DEFAULT_CAPACITY 100000
+
+namespace sam {
+
+class RemoteEdgeCacheException : public std::runtime_error
+{
+public:
+  RemoteEdgeCacheException(char const* message) :
+    std::runtime_error(message) {}
+  RemoteEdgeCacheException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * Keeps the edges other nodes send back for this node's edge requests, so
+ * that later partial results needing the same edges can be served without
+ * asking again.
+ *
+ * Edges are kept per key, where the key is what an edge request binds: its
+ * source, its target, or both (as in EdgeRequestMap).  Sending a request
+ * for a key (requested) starts a cache entry, and from then on every
+ * remote edge with that source, target, or both is added to it (add).
+ * The entry also records which start and end times it is complete for.
+ * The owner answers a request with the edges it has in the request's start
+ * and end time ranges and forwards new ones until the request expires, so
+ * after requesting start times [first, second] and end times [endFirst,
+ * end] the entry will hold every edge of the key with start time in
+ * [first, min(second, end)] and end time in [endFirst, end].  A request
+ * for the same key extends the start range when its end range matches,
+ * and otherwise keeps only what both requests are known to cover.
+ *
+ * Hub announcements (HubMirror) are recorded with extend instead.  The
+ * owner merges a renewed lease into the request it is already serving
+ * (EdgeRequestMap coalesces them), so as long as the leases overlap it
+ * forwards every edge in the union of their ranges, and the entry grows
+ * to that union in both start and end times.
+ *
+ * Before a request is sent, lookup checks whether the request's key, or for
+ * a request binding both vertices either vertex's key, covers its start
+ * and end times.  If so, the cached edges are returned instead and nothing
+ * is sent.  Edges still in flight are not lost: add is called before the
+ * edge is matched against the partial results, and the partial results
+ * are in place before lookup is called, so an edge missed by one is caught
+ * by the other.
+ *
+ * Edges older than the time window (relative to the latest remote edge)
+ * are dropped and the covered range shrinks with them.  When a partition
+ * holds more than its share of the capacity, the least recently used keys
+ * are evicted whole, coverage and all.
+ */
+template <typename TupleType, size_t source, size_t target, size_t time,
+          size_t duration>
+class RemoteEdgeCache
+{
+public:
+  typedef EdgeRequest<TupleType, source, target> EdgeRequestType;
+  typedef typename std::tuple_element<source, TupleType>::type SourceType;
+  typedef typename std::tuple_element<target, TupleType>::type TargetType;
+
+private:
+  /// Which of the source and target a key binds.
+  enum class KeyKind { Source, Target, SourceTarget };
+
+  struct Entry {
+    /// The start times the entry has every edge for.
+    double from = std::numeric_limits<double>::max();
+    double until = std::numeric_limits<double>::lowest();
+
+    /// The end times the entry has every edge for.
+    double endFrom = std::numeric_limits<double>::max();
+    double endUntil = std::numeric_limits<double>::lowest();
+
+    /// Edges in arrival order (roughly time order) and their fingerprints.
+    std::deque<TupleType> edges;
+    std::unordered_set<uint64_t> fingerprints;
+
+    /// Where the key is in the stripe's recency list.
+    std::list<std::string>::iterator position;
+  };
+
+  struct Stripe {
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+
+    /// Keys, most recently used first.
+    std::list<std::string> recency;
+
+    /// Edges plus keys held, which is what the capacity bounds.
+    size_t size = 0;
+  };
+
+  size_t capacity;
+  double window;
+
+  /// The latest start time of a remote edge.
+  std::atomic<double> currentTime;
+
+  Stripe stripes[REMOTE_EDGE_CACHE_NUM_STRIPES];
+
+  std::atomic<size_t> numHits;
+  std::atomic<size_t> numMisses;
+  std::atomic<size_t> numEdgesServed;
+  std::atomic<size_t> numEvicted;
+
+public:
+  /**
+   * \param capacity The most edges (and keys) the cache holds.
+   * \param window How long in seconds edges are kept, normally the time
+   *   window of the GraphStore.
+   */
+  RemoteEdgeCache(size_t capacity, double window) :
+    capacity(capacity), window(window)
+  {
+    if (capacity == 0) {
+      throw RemoteEdgeCacheException("RemoteEdgeCache capacity must be "
+        "positive");
+    }
+    if (!(window > 0)) {
+      throw RemoteEdgeCacheException("RemoteEdgeCache window must be "
+        "positive: " + boost::lexical_cast<std::string>(window));
+    }
+    currentTime = std::numeric_limits<double>::lowest();
+    numHits = 0;
+    numMisses = 0;
+    numEdgesServed = 0;
+    numEvicted = 0;
+  }
+
+  /**
+   * Records that the request is about to be sent.  Call before sending so
+   * that none of the edges coming back are missed.
+   */
+  void requested(EdgeRequestType const& request)
+  {
+    double first, second, endFirst, endSecond;
+    if (!getRanges(request, first, second, endFirst, endSecond)) return;
+
+    std::string key = makeKey(request);
+    Stripe& stripe = getStripe(key);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    Entry& entry = touch(stripe, key);
+
+    // The entry is complete for a box of start and end times, and so is
+    // the request.  The result has to stay within the two boxes.
+    bool empty = !(entry.from <= entry.until) ||
+                 !(entry.endFrom <= entry.endUntil);
+    bool startsOverlap = first <= entry.until && entry.from <= second;
+    bool endsOverlap = endFirst <= entry.endUntil &&
+                       entry.endFrom <= endSecond;
+    if (!empty && first <= entry.from && entry.until <= second &&
+        endFirst <= entry.endFrom && entry.endUntil <= endSecond)
+    {
+      // The request covers the entry.
+      set(entry, first, second, endFirst, endSecond);
+    } else if (!empty && entry.from <= first && second <= entry.until &&
+               entry.endFrom <= endFirst && endSecond <= entry.endUntil)
+    {
+      // The entry covers the request.
+    } else if (!empty && startsOverlap && endsOverlap) {
+      // Either start range, but only the end times both cover.
+      set(entry, std::min(entry.from, first), std::max(entry.until, second),
+          std::max(entry.endFrom, endFirst),
+          std::min(entry.endUntil, endSecond));
+    } else if (empty || second > entry.until) {
+      // Disjoint from what the entry has; the newer range wins.
+      set(entry, first, second, endFirst, endSecond);
+    }
+    evict(stripe, key);
+  }
+
+  /**
+   * Records a hub announcement, a request the owner merges with the ones
+   * it already serves for the key.  If the request's start and end ranges
+   * both overlap or touch the entry's, the entry grows to cover the union;
+   * otherwise a newer request replaces it as in requested.
+   */
+  void extend(EdgeRequestType const& request)
+  {
+    double first, second, endFirst, endSecond;
+    if (!getRanges(request, first, second, endFirst, endSecond)) return;
+
+    std::string key = makeKey(request);
+    Stripe& stripe = getStripe(key);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    Entry& entry = touch(stripe, key);
+
+    bool empty = !(entry.from <= entry.until) ||
+                 !(entry.endFrom <= entry.endUntil);
+    bool contiguous = first <= entry.until && entry.from <= second &&
+                      endFirst <= entry.endUntil && entry.endFrom <= endSecond;
+    if (!empty && contiguous) {
+      set(entry, std::min(entry.from, first), std::max(entry.until, second),
+          std::min(entry.endFrom, endFirst),
+          std::max(entry.endUntil, endSecond));
+    } else if (empty || second > entry.until) {
+      set(entry, first, second, endFirst, endSecond);
+    }
+    evict(stripe, key);
+  }
+
+  /**
+   * Forgets what the cache knows about the request's key, e.g. because the
+   * request couldn't be sent after all.
+   */
+  void invalidate(EdgeRequestType const& request)
+  {
+    std::string key = makeKey(request);
+    Stripe& stripe = getStripe(key);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.entries.find(key);
+    if (it != stripe.entries.end()) remove(stripe, it);
+  }
+
+  /**
+   * Adds a remote edge to the entries for its source, its target, and the
+   * pair, if there are any.
+   */
+  void add(TupleType const& edge)
+  {
+    double edgeTime = std::get<time>(edge);
+    double previous = currentTime.load();
+    while (edgeTime > previous &&
+           !currentTime.compare_exchange_weak(previous, edgeTime)) {}
+
+    SourceType const& src = std::get<source>(edge);
+    TargetType const& trg = std::get<target>(edge);
+    uint64_t fp = fingerprint(edge);
+    addTo(makeKey(KeyKind::Source, src, trg), edge, fp);
+    addTo(makeKey(KeyKind::Target, src, trg), edge, fp);
+    addTo(makeKey(KeyKind::SourceTarget, src, trg), edge, fp);
+  }
+
+  /**
+   * If the cache has every edge the request asks for, appends those with
+   * start and end times in the request's ranges to edges and returns true
+   * (a hit).  Otherwise returns false (a miss) and the request should be
+   * sent.
+   */
+  bool lookup(EdgeRequestType const& request, std::list<TupleType>& edges)
+  {
+    double first = request.getStartTimeFirst();
+    double second = request.getStartTimeSecond();
+    double endFirst = request.getEndTimeFirst();
+    double endSecond = request.getEndTimeSecond();
+    if (isNull(first) || isNull(second) || isNull(endFirst)) {
+      numMisses.fetch_add(1);
+      return false;
+    }
+
+    SourceType src = request.getSource();
+    TargetType trg = request.getTarget();
+    bool hasSource = !isNull(src);
+    bool hasTarget = !isNull(trg);
+
+    // A request binding both vertices is answered by the pair's entry or
+    // by either vertex's entry.
+    std::vector<std::string> keys;
+    keys.push_back(makeKey(request));
+    if (hasSource && hasTarget) {
+      keys.push_back(makeKey(KeyKind::Source, src, trg));
+      keys.push_back(makeKey(KeyKind::Target, src, trg));
+    }
+
+    double horizon = currentTime.load() - window;
+    for (auto const& key : keys) {
+      Stripe& stripe = getStripe(key);
+      std::lock_guard<std::mutex> lock(stripe.mutex);
+      auto it = stripe.entries.find(key);
+      if (it == stripe.entries.end()) continue;
+
+      Entry& entry = it->second;
+      trim(stripe, entry, horizon);
+      if (!(entry.from <= first && second <= entry.until &&
+            entry.endFrom <= endFirst && endSecond <= entry.endUntil))
+      {
+        continue;
+      }
+
+      size_t served = 0;
+      for (auto const& edge : entry.edges) {
+        double edgeTime = std::get<time>(edge);
+        double edgeEnd = edgeTime + std::get<duration>(edge);
+        if (edgeTime < first || edgeTime > second) continue;
+        if (edgeEnd < endFirst || edgeEnd > endSecond) continue;
+        if (hasSource && std::get<source>(edge) != src) continue;
+        if (hasTarget && std::get<target>(edge) != trg) continue;
+        edges.push_back(edge);
+        served++;
+      }
+      stripe.recency.splice(stripe.recency.begin(), stripe.recency,
+                            entry.position);
+      numHits.fetch_add(1);
+      numEdgesServed.fetch_add(served);
+      return true;
+    }
+
+    numMisses.fetch_add(1);
+    return false;
+  }
+
+  /// How many lookups were answered from the cache.
+  size_t getNumHits() const { return numHits; }
+
+  /// How many lookups had to be sent on.
+  size_t getNumMisses() const { return numMisses; }
+
+  /// The fraction of lookups answered from the cache.
+  double getHitRate() const {
+    size_t total = numHits + numMisses;
+    return total == 0 ? 0 : static_cast<double>(numHits) / total;
+  }
+
+  /// How many edges lookups returned.
+  size_t getNumEdgesServed() const { return numEdgesServed; }
+
+  /// How many keys were evicted to stay within the capacity.
+  size_t getNumEvicted() const { return numEvicted; }
+
+  /// The number of keys held.
+  size_t getNumKeys()
+  {
+    size_t n = 0;
+    for (auto& stripe : stripes) {
+      std::lock_guard<std::mutex> lock(stripe.mutex);
+      n += stripe.entries.size();
+    }
+    return n;
+  }
+
+  /// The number of edges held (an edge is held once per key).
+  size_t getNumEdges()
+  {
+    size_t n = 0;
+    for (auto& stripe : stripes) {
+      std::lock_guard<std::mutex> lock(stripe.mutex);
+      n += stripe.size - stripe.entries.size();
+    }
+    return n;
+  }
+
+  size_t getCapacity() const { return capacity; }
+  double getWindow() const { return window; }
+
+private:
+  static std::string makeKey(KeyKind kind, SourceType const& src,
+                             TargetType const& trg)
+  {
+    std::string key(1, static_cast<char>('0' + static_cast<int>(kind)));
+    if (kind != KeyKind::Target) {
+      key += boost::lexical_cast<std::string>(src);
+    }
+    key += '\0';
+    if (kind != KeyKind::Source) {
+      key += boost::lexical_cast<std::string>(trg);
+    }
+    return key;
+  }
+
+  static std::string makeKey(EdgeRequestType const& request)
+  {
+    SourceType src = request.getSource();
+    TargetType trg = request.getTarget();
+    if (!isNull(src) && !isNull(trg)) {
+      return makeKey(KeyKind::SourceTarget, src, trg);
+    } else if (!isNull(src)) {
+      return makeKey(KeyKind::Source, src, trg);
+    } else if (!isNull(trg)) {
+      return makeKey(KeyKind::Target, src, trg);
+    }
+    throw RemoteEdgeCacheException("RemoteEdgeCache got an edge request "
+      "with no source or target");
+  }
+
+  /**
+   * Fingerprints the source, target, time, and duration, like
+   * SubgraphQueryResult does for its seen edges.
+   */
+  static uint64_t fingerprint(TupleType const& edge) {
+    size_t seed = 0;
+    boost::hash_combine(seed, std::get<source>(edge));
+    boost::hash_combine(seed, std::get<target>(edge));
+    boost::hash_combine(seed, std::get<time>(edge));
+    boost::hash_combine(seed, std::get<duration>(edge));
+    return seed;
+  }
+
+  /**
+   * The start and end times a request will bring back every edge for.
+   * Start times are capped at the end of the end range, since an edge
+   * can't end before it starts.
+   * \return Returns false if the ranges are unset or empty.
+   */
+  static bool getRanges(EdgeRequestType const& request, double& first,
+                        double& second, double& endFirst, double& endSecond)
+  {
+    first = request.getStartTimeFirst();
+    second = std::min(request.getStartTimeSecond(),
+                      request.getEndTimeSecond());
+    endFirst = request.getEndTimeFirst();
+    endSecond = request.getEndTimeSecond();
+    return !isNull(first) && first <= second && !isNull(endFirst) &&
+           endFirst <= endSecond;
+  }
+
+  Stripe& getStripe(std::string const& key)
+  {
+    return stripes[std::hash<std::string>()(key) %
+                   REMOTE_EDGE_CACHE_NUM_STRIPES];
+  }
+
+  /// Caller holds the stripe lock.  Finds or creates the entry and makes
+  /// it the most recently used.
+  Entry& touch(Stripe& stripe, std::string const& key)
+  {
+    auto it = stripe.entries.find(key);
+    if (it != stripe.entries.end()) {
+      stripe.recency.splice(stripe.recency.begin(), stripe.recency,
+                            it->second.position);
+      return it->second;
+    }
+    stripe.recency.push_front(key);
+    Entry& entry = stripe.entries[key];
+    entry.position = stripe.recency.begin();
+    stripe.size++;
+    return entry;
+  }
+
+  /// Sets the start and end times the entry is complete for.
+  static void set(Entry& entry, double from, double until, double endFrom,
+                  double endUntil)
+  {
+    entry.from = from;
+    entry.until = until;
+    entry.endFrom = endFrom;
+    entry.endUntil = endUntil;
+  }
+
+  void addTo(std::string const& key, TupleType const& edge, uint64_t fp)
+  {
+    Stripe& stripe = getStripe(key);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.entries.find(key);
+    if (it == stripe.entries.end()) return;
+
+    Entry& entry = it->second;
+    trim(stripe, entry, currentTime.load() - window);
+    if (!entry.fingerprints.insert(fp).second) return;
+    entry.edges.push_back(edge);
+    stripe.size++;
+    evict(stripe, key);
+  }
+
+  /// Caller holds the stripe lock.  Drops edges older than the horizon.
+  void trim(Stripe& stripe, Entry& entry, double horizon)
+  {
+    while (!entry.edges.empty() &&
+           std::get<time>(entry.edges.front()) < horizon)
+    {
+      entry.fingerprints.erase(fingerprint(entry.edges.front()));
+      entry.edges.pop_front();
+      stripe.size--;
+    }
+    if (entry.from < horizon) entry.from = horizon;
+  }
+
+  /// Caller holds the stripe lock.  Evicts least recently used keys other
+  /// than keep until the stripe is within its share of the capacity.
+  void evict(Stripe& stripe, std::string const& keep)
+  {
+    size_t share = std::max<size_t>(1,
+      capacity / REMOTE_EDGE_CACHE_NUM_STRIPES);
+    while (stripe.size > share && stripe.recency.size() > 1) {
+      std::string const& victim = stripe.recency.back() == keep ?
+        *std::prev(stripe.recency.end(), 2) : stripe.recency.back();
+      remove(stripe, stripe.entries.find(victim));
+      numEvicted.fetch_add(1);
+    }
+  }
+
+  /// Caller holds the stripe lock.
+  void remove(Stripe& stripe,
+              typename std::unordered_map<std::string, Entry>::iterator it)
+  {
+    stripe.size -= it->second.edges.size() + 1;
+    stripe.recency.erase(it->second.position);
+    stripe.entries.erase(it);
+  }
+};
+
+}
+
+#endif
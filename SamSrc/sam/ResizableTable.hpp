@@ -0,0 +1,413 @@
+#ifndef SAM_RESIZABLE_TABLE_HPP
+#define SAM_RESIZABLE_TABLE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+
+/**
+ * The maximum number of mutexes guarding a ResizableTable.  Tables with a
+ * smaller initial capacity use one mutex per bucket.
+ */
+#define RESIZABLE_TABLE_MAX_STRIPES 1024
+
+/// Grow when there are more than this many elements per bucket.
+#define RESIZABLE_TABLE_MAX_LOAD 1.0
+
+/// Shrink when there are fewer than this many elements per bucket.
+#define RESIZABLE_TABLE_MIN_LOAD 0.125
+
+/// How many old buckets maintain() migrates while a resize is in progress.
+#define RESIZABLE_TABLE_MIGRATE_STEP 8
+
+namespace sam {
+
+/**
+ * Distribution of chain (bucket) lengths for a ResizableTable.
+ * histogram[0] is the number of empty buckets and histogram[k] for k > 0 is
+ * the number of buckets with length in [2^(k-1), 2^k).
+ */
+struct ChainLengthStats
+{
+  size_t numBuckets = 0;
+  size_t numElements = 0;
+  size_t maxLength = 0;
+  std::vector<size_t> histogram;
+
+  /// Average length of the non-empty chains, which is what a lookup scans.
+  double meanNonEmptyLength() const {
+    size_t nonEmpty = numBuckets - (histogram.size() > 0 ? histogram[0] : 0);
+    if (nonEmpty == 0) return 0;
+    return static_cast<double>(numElements) / nonEmpty;
+  }
+
+  std::string toString() const {
+    std::string str = "buckets " +
+      boost::lexical_cast<std::string>(numBuckets) + " elements " +
+      boost::lexical_cast<std::string>(numElements) + " max " +
+      boost::lexical_cast<std::string>(maxLength) + " histogram";
+    for (auto count : histogram) {
+      str += " " + boost::lexical_cast<std::string>(count);
+    }
+    return str;
+  }
+};
+
+/**
+ * A hash table of buckets (e.g. lists or vectors) guarded by a fixed set of
+ * mutex stripes that grows and shrinks by load factor.  Resizing is
+ * incremental: once a resize starts, old buckets are migrated to the new
+ * array either on demand (when a lookup lands on one that hasn't moved
+ * yet) or a few at a time in maintain().  Both the capacity and the number
+ * of stripes are powers of two, with the stripes dividing the capacity,
+ * so every element maps to the same stripe regardless of the table size.
+ * That is what lets a single stripe lock cover the old bucket and its new
+ * bucket(s) during migration.
+ *
+ * Callers own the elements' semantics; the table only needs to know how to
+ * recompute an element's hash when it moves it.  Callers must tell the
+ * table how many elements they add and remove so that the load factor is
+ * accurate.
+ *
+ * Usage mirrors the per-slot mutex arrays this replaces:
+ *
+ *   std::unique_lock<std::mutex> lock;
+ *   BucketType& bucket = table.lockBucket(hash, lock);
+ *   ... use bucket ...
+ *   lock.unlock();
+ *   table.maintain();
+ *
+ * maintain() must be called without holding any bucket lock.
+ */
+template <typename BucketType>
+class ResizableTable
+{
+public:
+  typedef typename BucketType::value_type ValueType;
+
+  /**
+   * Computes the hash of an element when it is migrated.  Returns false if
+   * the element should be dropped instead (e.g. an empty list).
+   */
+  typedef std::function<bool(ValueType const&, size_t&)> RehashFunction;
+
+private:
+  /// Current bucket array (the old array while a resize is in progress).
+  BucketType* buckets;
+  std::atomic<size_t> capacity;
+
+  /// New bucket array while a resize is in progress, otherwise null.
+  BucketType* newBuckets = nullptr;
+  size_t newCapacity = 0;
+
+  /// Which old buckets have been moved to newBuckets.
+  bool* migrated = nullptr;
+  std::atomic<size_t> nextToMigrate;
+  std::atomic<size_t> numMigrated;
+
+  /// Set (under all stripe locks) while newBuckets is in use.
+  std::atomic<bool> resizing;
+
+  /// Claimed by the one thread that gets to start a resize.
+  std::atomic<bool> resizeClaimed;
+
+  size_t numStripes;
+  std::mutex* stripes;
+
+  /// The table never shrinks below this.
+  size_t minCapacity;
+
+  std::atomic<size_t> numElements;
+  std::atomic<size_t> numResizes;
+
+  RehashFunction rehashFunction;
+
+public:
+  /**
+   * \param initialCapacity The starting number of buckets (rounded up to a
+   *   power of two).
+   * \param rehashFunction Recomputes an element's hash during migration.
+   */
+  ResizableTable(size_t initialCapacity, RehashFunction rehashFunction) :
+    nextToMigrate(0), numMigrated(0), resizing(false), resizeClaimed(false),
+    numElements(0), numResizes(0)
+  {
+    size_t cap = 1;
+    while (cap < initialCapacity) cap <<= 1;
+    capacity = cap;
+    numStripes = cap < RESIZABLE_TABLE_MAX_STRIPES ? cap :
+                                                     RESIZABLE_TABLE_MAX_STRIPES;
+    minCapacity = numStripes;
+    stripes = new std::mutex[numStripes];
+    buckets = new BucketType[cap];
+    this->rehashFunction = rehashFunction;
+  }
+
+  ~ResizableTable() {
+    delete[] buckets;
+    delete[] newBuckets;
+    delete[] migrated;
+    delete[] stripes;
+  }
+
+  /**
+   * Scrambles the hash so that hash functions with poor low bits (or keys
+   * that all map to this node, i.e. hash % numNodes == nodeId) still use
+   * the whole power-of-two table.
+   */
+  static size_t mix(size_t hash) {
+    uint64_t x = hash;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return static_cast<size_t>(x);
+  }
+
+  /**
+   * Locks the stripe for the hash and returns the bucket it maps to.  If a
+   * resize is in progress and the old bucket hasn't been migrated yet, it
+   * is migrated first.  The lock is held in the given unique_lock.
+   */
+  BucketType& lockBucket(size_t hash, std::unique_lock<std::mutex>& lock) {
+    size_t mixed = mix(hash);
+    lock = std::unique_lock<std::mutex>(stripes[mixed & (numStripes - 1)]);
+    return bucketFor(mixed);
+  }
+
+  /**
+   * The stripe that guards the hash's bucket.  It doesn't change when the
+   * table resizes, so keys can be grouped by stripe ahead of time.
+   */
+  size_t getStripe(size_t hash) const {
+    return mix(hash) & (numStripes - 1);
+  }
+
+  /**
+   * Locks stripe s, holding the lock in the given unique_lock.  Used with
+   * lockedBucket() to update several buckets of one stripe under a single
+   * lock acquisition.
+   */
+  void lockStripe(size_t s, std::unique_lock<std::mutex>& lock) {
+    lock = std::unique_lock<std::mutex>(stripes[s]);
+  }
+
+  /**
+   * Returns the bucket for the hash.  The caller must already hold the
+   * hash's stripe (getStripe(hash)) from lockStripe().
+   */
+  BucketType& lockedBucket(size_t hash) {
+    return bucketFor(mix(hash));
+  }
+
+  /**
+   * Moves the incremental resize along, or starts/finishes one if needed.
+   * Cheap when there is nothing to do.  Must not be called while holding a
+   * bucket lock.
+   */
+  void maintain() {
+    if (resizing.load()) {
+      size_t oldCapacity = capacity.load();
+      for (size_t i = 0; i < RESIZABLE_TABLE_MIGRATE_STEP; i++) {
+        size_t index = nextToMigrate.fetch_add(1);
+        if (index >= oldCapacity) break;
+        std::lock_guard<std::mutex> lock(stripes[index & (numStripes - 1)]);
+        // The resize may have finished since we looked.
+        if (resizing.load() && index < capacity.load() && !migrated[index]) {
+          migrateBucket(index);
+        }
+      }
+      if (numMigrated.load() >= oldCapacity) finishResize();
+      return;
+    }
+
+    size_t cap = capacity.load();
+    size_t n = numElements.load();
+    if (n > RESIZABLE_TABLE_MAX_LOAD * cap) {
+      startResize(cap * 2);
+    } else if (cap > minCapacity && n < RESIZABLE_TABLE_MIN_LOAD * cap) {
+      startResize(cap / 2);
+    }
+  }
+
+  /**
+   * Grows the table in one step (not incrementally) so that it can hold
+   * numElements without resizing again.  Meant for bulk loading; it holds
+   * every stripe lock while it moves the buckets.
+   */
+  void reserve(size_t numElements) {
+    // Let a resize that is already under way finish first.
+    while (resizing.load()) maintain();
+
+    size_t target = capacity.load();
+    while (RESIZABLE_TABLE_MAX_LOAD * target < numElements) target <<= 1;
+    if (target == capacity.load()) return;
+
+    bool expected = false;
+    if (!resizeClaimed.compare_exchange_strong(expected, true)) return;
+    lockAll();
+    size_t cap = capacity.load();
+    newCapacity = target;
+    newBuckets = new BucketType[newCapacity];
+    migrated = new bool[cap];
+    for (size_t i = 0; i < cap; i++) migrated[i] = false;
+    numMigrated = 0;
+    for (size_t i = 0; i < cap; i++) migrateBucket(i);
+    swapInNewBuckets();
+    unlockAll();
+    resizeClaimed = false;
+  }
+
+  /// Tell the table that count elements were added.
+  void added(size_t count = 1) { numElements.fetch_add(count); }
+
+  /// Tell the table that count elements were removed.
+  void removed(size_t count = 1) { numElements.fetch_sub(count); }
+
+  /// Number of elements according to added()/removed().
+  size_t size() const { return numElements.load(); }
+
+  /// Number of buckets.  During a resize this is the old capacity.
+  size_t getCapacity() const { return capacity.load(); }
+
+  /// How many resizes have completed.
+  size_t getNumResizes() const { return numResizes.load(); }
+
+  size_t getNumStripes() const { return numStripes; }
+
+  /**
+   * Calls func on every bucket belonging to stripes [beginStripe,
+   * endStripe), one stripe at a time with that stripe locked.  During a
+   * resize, both unmigrated old buckets and new buckets are visited.
+   */
+  void forEachBucket(size_t beginStripe, size_t endStripe,
+                     std::function<void(BucketType&)> func)
+  {
+    for (size_t s = beginStripe; s < endStripe; s++) {
+      std::lock_guard<std::mutex> lock(stripes[s]);
+      size_t cap = capacity.load();
+      for (size_t i = s; i < cap; i += numStripes) {
+        if (!resizing.load() || !migrated[i]) func(buckets[i]);
+      }
+      if (resizing.load()) {
+        for (size_t i = s; i < newCapacity; i += numStripes) {
+          func(newBuckets[i]);
+        }
+      }
+    }
+  }
+
+  void forEachBucket(std::function<void(BucketType&)> func) {
+    forEachBucket(0, numStripes, func);
+  }
+
+  /**
+   * Walks the table and returns the distribution of chain lengths.
+   * Linear in the number of buckets.
+   */
+  ChainLengthStats getChainLengthStats() {
+    ChainLengthStats stats;
+    forEachBucket([&stats](BucketType& bucket) {
+      size_t length = bucket.size();
+      size_t bin = 0;
+      while ((static_cast<size_t>(1) << bin) <= length) bin++;
+      if (stats.histogram.size() <= bin) stats.histogram.resize(bin + 1, 0);
+      stats.histogram[bin]++;
+      stats.numBuckets++;
+      stats.numElements += length;
+      if (length > stats.maxLength) stats.maxLength = length;
+    });
+    return stats;
+  }
+
+private:
+  /// Caller holds the stripe lock for mixed.
+  BucketType& bucketFor(size_t mixed) {
+    if (resizing.load()) {
+      size_t oldIndex = mixed & (capacity.load() - 1);
+      if (!migrated[oldIndex]) migrateBucket(oldIndex);
+      return newBuckets[mixed & (newCapacity - 1)];
+    }
+    return buckets[mixed & (capacity.load() - 1)];
+  }
+
+  /// Caller holds the stripe lock for oldIndex.
+  void migrateBucket(size_t oldIndex) {
+    BucketType& from = buckets[oldIndex];
+    size_t dropped = 0;
+    for (auto& element : from) {
+      size_t hash;
+      if (rehashFunction(element, hash)) {
+        newBuckets[mix(hash) & (newCapacity - 1)].push_back(
+          std::move(element));
+      } else {
+        dropped++;
+      }
+    }
+    BucketType().swap(from);
+    if (dropped > 0) removed(dropped);
+    migrated[oldIndex] = true;
+    numMigrated.fetch_add(1);
+  }
+
+  void lockAll() {
+    for (size_t s = 0; s < numStripes; s++) stripes[s].lock();
+  }
+
+  void unlockAll() {
+    for (size_t s = 0; s < numStripes; s++) stripes[s].unlock();
+  }
+
+  void startResize(size_t targetCapacity) {
+    bool expected = false;
+    if (!resizeClaimed.compare_exchange_strong(expected, true)) return;
+
+    lockAll();
+    size_t cap = capacity.load();
+    newCapacity = targetCapacity;
+    newBuckets = new BucketType[newCapacity];
+    migrated = new bool[cap];
+    for (size_t i = 0; i < cap; i++) migrated[i] = false;
+    nextToMigrate = 0;
+    numMigrated = 0;
+    resizing = true;
+    unlockAll();
+  }
+
+  void finishResize() {
+    lockAll();
+    // Several threads can see the last bucket migrate; only the first one
+    // through here does the swap.
+    if (!resizing.load() || numMigrated.load() < capacity.load()) {
+      unlockAll();
+      return;
+    }
+    swapInNewBuckets();
+    unlockAll();
+    resizeClaimed = false;
+  }
+
+  /// Caller holds all stripe locks and every old bucket has been migrated.
+  void swapInNewBuckets() {
+    delete[] buckets;
+    delete[] migrated;
+    buckets = newBuckets;
+    capacity = newCapacity;
+    newBuckets = nullptr;
+    migrated = nullptr;
+    newCapacity = 0;
+    numResizes.fetch_add(1);
+    resizing = false;
+  }
+};
+
+} // end namespace sam
+
+#endif
@@ -0,0 +1,366 @@
+#ifndef SAM_SEALED_SEGMENT_HPP
+#define SAM_SEALED_SEGMENT_HPP
+
+#include <sam/BloomFilter.hpp>
+#include <sam/Serialization.hpp>
+#include <sam/Util.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// False positive rate of the per-segment source vertex Bloom filters.
+#define SEALED_SEGMENT_BLOOM_FP_RATE 0.01
+
+#define SEALED_SEGMENT_MAGIC 0x53414d5345474d31ULL // "SAMSEGM1"
+
+namespace sam {
+
+class SealedSegmentException : public std::runtime_error
+{
+public:
+  SealedSegmentException(char const* message) :
+    std::runtime_error(message) {}
+  SealedSegmentException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * Fixed size header at the start of a segment file.  Offsets are from the
+ * start of the file.
+ */
+struct SealedSegmentHeader
+{
+  uint64_t magic;
+  uint64_t numEdges;
+  uint64_t numIndexEntries;
+  uint64_t numBloomWords;
+  uint64_t numBloomHashes;
+  uint64_t indexOffset;
+  uint64_t bloomOffset;
+  uint64_t recordsOffset;
+  uint64_t fileSize;
+  double minTime;
+  double maxTime;
+};
+
+/**
+ * One entry per distinct source hash.  The records for that hash are
+ * contiguous and ordered by time.
+ */
+struct SealedSegmentIndexEntry
+{
+  uint64_t hash;
+  uint64_t offset;
+  uint64_t count;
+};
+
+/**
+ * An immutable, memory-mapped file of edges covering a span of time.
+ * Edges are grouped by the hash of the vertex in the source field (which
+ * is the target for a CSC) and sorted by time within each group.  Each
+ * record is the edge time, the length of the encoded tuple, and the tuple
+ * encoded with sam::serialize.  A Bloom filter over the source hashes
+ * lets lookups skip segments that don't have the vertex without touching
+ * the index.
+ *
+ * The file is removed when the segment is destroyed.
+ */
+template <typename TupleType,
+          size_t source,
+          size_t time,
+          typename HF,
+          typename EF>
+class SealedSegment
+{
+public:
+  typedef typename std::tuple_element<source, TupleType>::type NodeType;
+
+private:
+  std::string filename;
+  char const* data = nullptr;
+  size_t size = 0;
+  SealedSegmentHeader header;
+  SealedSegmentIndexEntry const* index = nullptr;
+  BloomFilter bloom;
+  HF hash;
+  EF equal;
+
+  /**
+   * Opens and maps the file, checking that it is a segment.
+   */
+  void open();
+
+public:
+  /**
+   * Writes the edges to filename as a new segment and maps it.
+   * \param edges The edges to seal.  Sorted in place.
+   * \throws SealedSegmentException if the file can't be written.
+   */
+  SealedSegment(std::string filename, std::vector<TupleType>& edges);
+
+  ~SealedSegment();
+
+  SealedSegment(SealedSegment const&) = delete;
+  SealedSegment& operator=(SealedSegment const&) = delete;
+
+  /**
+   * Adds edges whose source equals src and whose time is in
+   * [minTime, maxTime] to foundEdges.
+   * \return Returns false if the Bloom filter ruled the segment out
+   *   without looking at the index.
+   */
+  bool findEdges(NodeType const& src, double minTime, double maxTime,
+                 std::list<TupleType>& foundEdges) const;
+
+  /**
+   * Counts the edges with time greater than or equal to minTime.  Linear
+   * in the number of edges but only reads the record headers.
+   */
+  size_t countEdges(double minTime) const;
+
+  /**
+   * Calls func on every edge, grouped by source hash and ordered by time
+   * within a group.
+   */
+  void forEachEdge(std::function<void(TupleType const&)> func) const;
+
+  size_t getNumEdges() const { return header.numEdges; }
+  size_t getNumVertices() const { return header.numIndexEntries; }
+  size_t getFileSize() const { return size; }
+  double getMinTime() const { return header.minTime; }
+  double getMaxTime() const { return header.maxTime; }
+  std::string const& getFilename() const { return filename; }
+};
+
+template <typename TupleType, size_t source, size_t time,
+          typename HF, typename EF>
+SealedSegment<TupleType, source, time, HF, EF>::SealedSegment(
+  std::string filename, std::vector<TupleType>& edges) :
+  filename(filename)
+{
+  // Group by source hash, then order by time.
+  std::sort(edges.begin(), edges.end(),
+    [this](TupleType const& a, TupleType const& b) {
+      size_t ha = this->hash(std::get<source>(a));
+      size_t hb = this->hash(std::get<source>(b));
+      if (ha != hb) return ha < hb;
+      return std::get<time>(a) < std::get<time>(b);
+    });
+
+  std::string records;
+  std::vector<SealedSegmentIndexEntry> entries;
+  BloomFilter filter = BloomFilter::forCapacity(edges.size(),
+    SEALED_SEGMENT_BLOOM_FP_RATE);
+  double minTime = std::numeric_limits<double>::max();
+  double maxTime = std::numeric_limits<double>::lowest();
+  std::string encoded;
+  for (auto const& edge : edges) {
+    size_t h = hash(std::get<source>(edge));
+    if (entries.empty() || entries.back().hash != h) {
+      entries.push_back(SealedSegmentIndexEntry{h, records.size(), 0});
+      filter.add(h);
+    }
+    entries.back().count++;
+
+    double t = std::get<time>(edge);
+    minTime = std::min(minTime, t);
+    maxTime = std::max(maxTime, t);
+
+    encoded.clear();
+    serialize(encoded, edge);
+    serialize(records, t);
+    serialize(records, static_cast<uint32_t>(encoded.size()));
+    records.append(encoded);
+  }
+
+  SealedSegmentHeader h;
+  h.magic = SEALED_SEGMENT_MAGIC;
+  h.numEdges = edges.size();
+  h.numIndexEntries = entries.size();
+  h.numBloomWords = filter.getWords().size();
+  h.numBloomHashes = filter.getNumHashes();
+  h.indexOffset = sizeof(SealedSegmentHeader);
+  h.bloomOffset = h.indexOffset +
+                  entries.size() * sizeof(SealedSegmentIndexEntry);
+  h.recordsOffset = h.bloomOffset + h.numBloomWords * sizeof(uint64_t);
+  h.fileSize = h.recordsOffset + records.size();
+  h.minTime = minTime;
+  h.maxTime = maxTime;
+
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw SealedSegmentException("SealedSegment: unable to create " +
+      filename);
+  }
+  out.write(reinterpret_cast<char const*>(&h), sizeof(h));
+  out.write(reinterpret_cast<char const*>(entries.data()),
+            entries.size() * sizeof(SealedSegmentIndexEntry));
+  out.write(reinterpret_cast<char const*>(filter.getWords().data()),
+            h.numBloomWords * sizeof(uint64_t));
+  out.write(records.data(), records.size());
+  out.close();
+  if (!out) {
+    std::remove(filename.c_str());
+    throw SealedSegmentException("SealedSegment: error writing " + filename);
+  }
+
+  open();
+}
+
+template <typename TupleType, size_t source, size_t time,
+          typename HF, typename EF>
+void
+SealedSegment<TupleType, source, time, HF, EF>::open()
+{
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw SealedSegmentException("SealedSegment: unable to open " + filename);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(SealedSegmentHeader))
+  {
+    ::close(fd);
+    throw SealedSegmentException("SealedSegment: " + filename +
+      " is too small to be a segment");
+  }
+  size = st.st_size;
+  void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping stays valid after the descriptor is closed.
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    throw SealedSegmentException("SealedSegment: unable to map " + filename);
+  }
+  data = static_cast<char const*>(mapped);
+
+  std::memcpy(&header, data, sizeof(header));
+  if (header.magic != SEALED_SEGMENT_MAGIC || header.fileSize != size) {
+    munmap(const_cast<char*>(data), size);
+    data = nullptr;
+    throw SealedSegmentException("SealedSegment: " + filename +
+      " is not a valid segment");
+  }
+  index = reinterpret_cast<SealedSegmentIndexEntry const*>(
+    data + header.indexOffset);
+
+  // The filter is small (about ten bits per vertex) so we copy it out of
+  // the mapping rather than teach BloomFilter about borrowed memory.
+  uint64_t const* words = reinterpret_cast<uint64_t const*>(
+    data + header.bloomOffset);
+  bloom = BloomFilter(std::vector<uint64_t>(words,
+    words + header.numBloomWords), header.numBloomHashes);
+}
+
+template <typename TupleType, size_t source, size_t time,
+          typename HF, typename EF>
+SealedSegment<TupleType, source, time, HF, EF>::~SealedSegment()
+{
+  if (data) {
+    munmap(const_cast<char*>(data), size);
+  }
+  std::remove(filename.c_str());
+}
+
+template <typename TupleType, size_t source, size_t time,
+          typename HF, typename EF>
+bool
+SealedSegment<TupleType, source, time, HF, EF>::findEdges(
+  NodeType const& src, double minTime, double maxTime,
+  std::list<TupleType>& foundEdges) const
+{
+  size_t h = hash(src);
+  if (!bloom.mayContain(h)) {
+    return false;
+  }
+  if (maxTime < header.minTime || minTime > header.maxTime) {
+    return true;
+  }
+
+  SealedSegmentIndexEntry const* end = index + header.numIndexEntries;
+  SealedSegmentIndexEntry const* entry = std::lower_bound(index, end, h,
+    [](SealedSegmentIndexEntry const& e, size_t h) { return e.hash < h; });
+  if (entry == end || entry->hash != h) {
+    return true;
+  }
+
+  char const* p = data + header.recordsOffset + entry->offset;
+  char const* recordsEnd = data + size;
+  for (size_t i = 0; i < entry->count; i++) {
+    double t;
+    uint32_t length;
+    deserialize(p, recordsEnd, t);
+    deserialize(p, recordsEnd, length);
+    if (t > maxTime) break; // Sorted by time within the group
+    if (t >= minTime) {
+      char const* q = p;
+      TupleType tuple;
+      deserialize(q, p + length, tuple);
+      // Different sources can share a hash.
+      if (equal(src, std::get<source>(tuple))) {
+        foundEdges.push_back(std::move(tuple));
+      }
+    }
+    p += length;
+  }
+  return true;
+}
+
+template <typename TupleType, size_t source, size_t time,
+          typename HF, typename EF>
+size_t
+SealedSegment<TupleType, source, time, HF, EF>::countEdges(
+  double minTime) const
+{
+  if (header.maxTime < minTime) return 0;
+  if (header.minTime >= minTime) return header.numEdges;
+
+  size_t count = 0;
+  char const* p = data + header.recordsOffset;
+  char const* recordsEnd = data + size;
+  for (size_t i = 0; i < header.numEdges; i++) {
+    double t;
+    uint32_t length;
+    deserialize(p, recordsEnd, t);
+    deserialize(p, recordsEnd, length);
+    if (t >= minTime) count++;
+    p += length;
+  }
+  return count;
+}
+
+template <typename TupleType, size_t source, size_t time,
+          typename HF, typename EF>
+void
+SealedSegment<TupleType, source, time, HF, EF>::forEachEdge(
+  std::function<void(TupleType const&)> func) const
+{
+  char const* p = data + header.recordsOffset;
+  char const* recordsEnd = data + size;
+  for (size_t i = 0; i < header.numEdges; i++) {
+    double t;
+    uint32_t length;
+    deserialize(p, recordsEnd, t);
+    deserialize(p, recordsEnd, length);
+    char const* q = p;
+    TupleType tuple;
+    deserialize(q, p + length, tuple);
+    func(tuple);
+    p += length;
+  }
+}
+
+} // end namespace sam
+
+#endif
@@ -0,0 +1,277 @@
+#ifndef SAM_SERIALIZATION_HPP
+#define SAM_SERIALIZATION_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <sam/Util.hpp>
+
+/**
+ * Compact binary encoding of tuples, used for on-disk edge segments and
+ * checkpoints.  Arithmetic fields are copied as is (native byte order),
+ * strings are a 32 bit length followed by the bytes, and containers are a
+ * 64 bit count followed by the elements.  The files are only read back on
+ * the machine that wrote them, so we don't bother with endianness.
+ */
+
+namespace sam {
+
+class SerializationException : public std::runtime_error
+{
+public:
+  SerializationException(char const* message) :
+    std::runtime_error(message) {}
+  SerializationException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * Appends the bytes of an arithmetic value to out.
+ */
+template <typename T>
+typename std::enable_if<std::is_arithmetic<T>::value>::type
+serialize(std::string& out, T const& value)
+{
+  out.append(reinterpret_cast<char const*>(&value), sizeof(T));
+}
+
+inline
+void serialize(std::string& out, std::string const& value)
+{
+  uint32_t length = static_cast<uint32_t>(value.size());
+  serialize(out, length);
+  out.append(value);
+}
+
+template <typename... Ts>
+void serialize(std::string& out, std::tuple<Ts...> const& t);
+
+template <typename T, typename A>
+void serialize(std::string& out, std::vector<T, A> const& v);
+
+template <typename K, typename V, typename C, typename A>
+void serialize(std::string& out, std::map<K, V, C, A> const& m);
+
+template <typename T, typename C, typename A>
+void serialize(std::string& out, std::set<T, C, A> const& s);
+
+/**
+ * Reads an arithmetic value from p, advancing p.
+ * \throws SerializationException if that would read past end.
+ */
+template <typename T>
+typename std::enable_if<std::is_arithmetic<T>::value>::type
+deserialize(char const*& p, char const* end, T& value)
+{
+  if (end - p < static_cast<std::ptrdiff_t>(sizeof(T))) {
+    throw SerializationException("deserialize: ran out of bytes reading a "
+      "value");
+  }
+  std::memcpy(&value, p, sizeof(T));
+  p += sizeof(T);
+}
+
+inline
+void deserialize(char const*& p, char const* end, std::string& value)
+{
+  uint32_t length;
+  deserialize(p, end, length);
+  if (end - p < static_cast<std::ptrdiff_t>(length)) {
+    throw SerializationException("deserialize: ran out of bytes reading a "
+      "string");
+  }
+  value.assign(p, length);
+  p += length;
+}
+
+template <typename... Ts>
+void deserialize(char const*& p, char const* end, std::tuple<Ts...>& t);
+
+template <typename T, typename A>
+void deserialize(char const*& p, char const* end, std::vector<T, A>& v);
+
+template <typename K, typename V, typename C, typename A>
+void deserialize(char const*& p, char const* end, std::map<K, V, C, A>& m);
+
+template <typename T, typename C, typename A>
+void deserialize(char const*& p, char const* end, std::set<T, C, A>& s);
+
+namespace serializationDetails {
+
+template <typename Tuple, size_t... I>
+void serializeTuple(std::string& out, Tuple const& t,
+                    std::index_sequence<I...>)
+{
+  // Expands to one serialize call per element, in order.
+  int dummy[] = { 0, (serialize(out, std::get<I>(t)), 0)... };
+  (void)dummy;
+}
+
+template <typename Tuple, size_t... I>
+void deserializeTuple(char const*& p, char const* end, Tuple& t,
+                      std::index_sequence<I...>)
+{
+  int dummy[] = { 0, (deserialize(p, end, std::get<I>(t)), 0)... };
+  (void)dummy;
+}
+
+} // end namespace serializationDetails
+
+template <typename... Ts>
+void serialize(std::string& out, std::tuple<Ts...> const& t)
+{
+  serializationDetails::serializeTuple(out, t,
+    std::index_sequence_for<Ts...>());
+}
+
+template <typename... Ts>
+void deserialize(char const*& p, char const* end, std::tuple<Ts...>& t)
+{
+  serializationDetails::deserializeTuple(p, end, t,
+    std::index_sequence_for<Ts...>());
+}
+
+template <typename T, typename A>
+void serialize(std::string& out, std::vector<T, A> const& v)
+{
+  serialize(out, static_cast<uint64_t>(v.size()));
+  for (auto const& element : v) serialize(out, element);
+}
+
+template <typename K, typename V, typename C, typename A>
+void serialize(std::string& out, std::map<K, V, C, A> const& m)
+{
+  serialize(out, static_cast<uint64_t>(m.size()));
+  for (auto const& p : m) {
+    serialize(out, p.first);
+    serialize(out, p.second);
+  }
+}
+
+template <typename T, typename C, typename A>
+void serialize(std::string& out, std::set<T, C, A> const& s)
+{
+  serialize(out, static_cast<uint64_t>(s.size()));
+  for (auto const& element : s) serialize(out, element);
+}
+
+template <typename T, typename A>
+void deserialize(char const*& p, char const* end, std::vector<T, A>& v)
+{
+  uint64_t n;
+  deserialize(p, end, n);
+  v.clear();
+  for (uint64_t i = 0; i < n; i++) {
+    T element;
+    deserialize(p, end, element);
+    v.push_back(std::move(element));
+  }
+}
+
+template <typename K, typename V, typename C, typename A>
+void deserialize(char const*& p, char const* end, std::map<K, V, C, A>& m)
+{
+  uint64_t n;
+  deserialize(p, end, n);
+  m.clear();
+  for (uint64_t i = 0; i < n; i++) {
+    K key;
+    V value;
+    deserialize(p, end, key);
+    deserialize(p, end, value);
+    m.emplace_hint(m.end(), std::move(key), std::move(value));
+  }
+}
+
+template <typename T, typename C, typename A>
+void deserialize(char const*& p, char const* end, std::set<T, C, A>& s)
+{
+  uint64_t n;
+  deserialize(p, end, n);
+  s.clear();
+  for (uint64_t i = 0; i < n; i++) {
+    T element;
+    deserialize(p, end, element);
+    s.emplace_hint(s.end(), std::move(element));
+  }
+}
+
+/**
+ * A record is a length-prefixed run of bytes (i.e. a serialized string).
+ * Sections of a checkpoint are a count followed by that many records,
+ * which lets the loader find every record in one cheap pass and then
+ * decode them in parallel.
+ */
+typedef std::pair<char const*, uint32_t> RecordType;
+
+/**
+ * Reads the count and record boundaries of a section, advancing p past
+ * it.  Nothing is copied.
+ */
+inline
+std::vector<RecordType> readRecords(char const*& p, char const* end)
+{
+  uint64_t n;
+  deserialize(p, end, n);
+  std::vector<RecordType> records;
+  records.reserve(n);
+  for (uint64_t i = 0; i < n; i++) {
+    uint32_t length;
+    deserialize(p, end, length);
+    if (end - p < static_cast<std::ptrdiff_t>(length)) {
+      throw SerializationException("readRecords: record runs past the end "
+        "of the input");
+    }
+    records.push_back(RecordType(p, length));
+    p += length;
+  }
+  return records;
+}
+
+/**
+ * Calls func on every record, splitting the records evenly across
+ * numThreads threads.  If func throws, the first exception is rethrown
+ * once all threads are done.
+ */
+inline
+void forEachRecordInParallel(std::vector<RecordType> const& records,
+                             size_t numThreads,
+                             std::function<void(char const*, char const*)> func)
+{
+  if (numThreads < 1) numThreads = 1;
+  std::vector<std::thread> threads;
+  std::vector<std::exception_ptr> errors(numThreads);
+  for (size_t t = 0; t < numThreads; t++) {
+    threads.push_back(std::thread([&records, &errors, &func, t, numThreads]() {
+      size_t beg = get_begin_index(records.size(), t, numThreads);
+      size_t end = get_end_index(records.size(), t, numThreads);
+      try {
+        for (size_t i = beg; i < end; i++) {
+          func(records[i].first, records[i].first + records[i].second);
+        }
+      } catch (...) {
+        errors[t] = std::current_exception();
+      }
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (auto const& error : errors) {
+    if (error) std::rethrow_exception(error);
+  }
+}
+
+} // end namespace sam
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef SAM_SHARDED_GRAPH_STORE_HPP
+#define SAM_SHARDED_GRAPH_STORE_HPP
+
+#include <sam/AbstractConsumer.hpp>
+#include <sam/GraphStore.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sam {
+
+/**
+ * Splits one node's share of the graph into shards, one per core, that
+ * share nothing.  Each shard is a full GraphStore (its own CSR, CSC,
+ * SubgraphQueryResultMap, EdgeRequestMap and consume queue) that owns a
+ * slice of this node's vertices.
+ *
+ * Shards are addressed exactly like nodes.  With N nodes and S shards per
+ * node there are N * S virtual nodes; shard s on node n is virtual node
+ * s * N + n, and a vertex belongs to virtual node hash % (N * S).  Because
+ * hash % (N * S) % N == hash % N, the vertices of a node are the same as
+ * without shards, so the producer's partitioning doesn't change.  Edge
+ * requests and edges between shards go through the same push/pull sockets
+ * as between nodes.
+ *
+ * consume() hands the tuple to the shard that owns its source and the
+ * shard that owns its target (once if they are the same), mirroring how
+ * the producer sends it to both owning nodes.  Each shard has a single
+ * worker by default, so its tables are never contended on the consume
+ * path.
+ */
+template <typename TupleType, typename Tuplizer,
+          size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+class ShardedGraphStore : public AbstractConsumer<TupleType>
+{
+public:
+  typedef GraphStore<TupleType, Tuplizer, source, target, time, duration,
+    SourceHF, TargetHF, SourceEF, TargetEF> ShardType;
+  typedef typename ShardType::QueryType QueryType;
+  typedef typename ShardType::ResultType ResultType;
+  typedef typename ShardType::SourceType SourceType;
+  typedef typename ShardType::TargetType TargetType;
+
+private:
+  size_t numNodes;
+  size_t nodeId;
+  std::vector<std::shared_ptr<ShardType>> shards;
+
+  SourceHF sourceHash;
+  TargetHF targetHash;
+
+  /// Tuples that neither endpoint of belongs to this node.
+  std::atomic<size_t> numMisrouted;
+
+  std::atomic<bool> terminated;
+
+public:
+  /**
+   * Creates numShards GraphStores.  The parameters are those of
+   * GraphStore; hostnames and nodeId are for the physical nodes.
+   * \param numShards How many shards this node has.  Every node in the
+   *   cluster must use the same number.
+   * \param maxQueued How many tuples can wait in each shard.
+   * \param workersPerShard How many threads process each shard's tuples.
+   */
+  ShardedGraphStore(
+             std::size_t numNodes,
+             std::size_t nodeId,
+             std::size_t numShards,
+             std::vector<std::string> hostnames,
+             size_t startingPort,
+             uint32_t hwm,
+             size_t graphCapacity,
+             size_t tableCapacity,
+             size_t resultsCapacity,
+             size_t numPushSockets,
+             size_t numPullThreads,
+             size_t timeout,
+             double timeWindow,
+#ifdef DROP_QUERIES
+             double keepQueries,
+#endif
+             std::shared_ptr<FeatureMap> featureMap,
+             size_t maxQueued = MAX_NUM_FUTURES,
+             bool local = false,
+             size_t workersPerShard = 1);
+
+  ~ShardedGraphStore() { terminate(); }
+
+  /**
+   * Registers the query with every shard.
+   */
+  void registerQuery(std::shared_ptr<QueryType> query) {
+    for (auto& shard : shards) shard->registerQuery(query);
+  }
+
+  /**
+   * Queues the tuple on the shards that own its source and target.
+   */
+  bool consume(TupleType const& tuple);
+
+  /**
+   * Terminates the shards in parallel; each waits for the others'
+   * terminate messages.
+   */
+  void terminate();
+
+  /**
+   * Blocks until every shard has processed the tuples consumed so far.
+   */
+  void waitForConsume() {
+    for (auto& shard : shards) shard->waitForConsume();
+  }
+
+  /**
+   * Sets the consume batch size of every shard.
+   */
+  void setBatchSize(size_t batchSize) {
+    for (auto& shard : shards) shard->setBatchSize(batchSize);
+  }
+
+  size_t getNumShards() const { return shards.size(); }
+  std::shared_ptr<ShardType> getShard(size_t i) const { return shards[i]; }
+
+  /**
+   * Which of this node's shards owns the vertex.  Only meaningful if the
+   * vertex belongs to this node.
+   */
+  size_t getSourceShard(SourceType const& src) const {
+    return (sourceHash(src) % (numNodes * shards.size())) / numNodes;
+  }
+  size_t getTargetShard(TargetType const& trg) const {
+    return (targetHash(trg) % (numNodes * shards.size())) / numNodes;
+  }
+
+  /**
+   * Totals over the shards.
+   */
+  size_t getNumResults() const {
+    size_t count = 0;
+    for (auto const& shard : shards) count += shard->getNumResults();
+    return count;
+  }
+  size_t getNumIntermediateResults() const {
+    size_t count = 0;
+    for (auto const& shard : shards) {
+      count += shard->getNumIntermediateResults();
+    }
+    return count;
+  }
+  size_t getNumEdges() const {
+    size_t count = 0;
+    for (auto const& shard : shards) count += shard->getNumEdges();
+    return count;
+  }
+  size_t getMemoryUsage() const {
+    size_t usage = 0;
+    for (auto const& shard : shards) usage += shard->getMemoryUsage();
+    return usage;
+  }
+
+  size_t getNumMisrouted() const { return numMisrouted; }
+};
+
+template <typename TupleType, typename Tuplizer,
+          size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+ShardedGraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+ShardedGraphStore(
+             std::size_t numNodes,
+             std::size_t nodeId,
+             std::size_t numShards,
+             std::vector<std::string> hostnames,
+             size_t startingPort,
+             uint32_t hwm,
+             size_t graphCapacity,
+             size_t tableCapacity,
+             size_t resultsCapacity,
+             size_t numPushSockets,
+             size_t numPullThreads,
+             size_t timeout,
+             double timeWindow,
+#ifdef DROP_QUERIES
+             double keepQueries,
+#endif
+             std::shared_ptr<FeatureMap> featureMap,
+             size_t maxQueued,
+             bool local,
+             size_t workersPerShard) :
+  numNodes(numNodes), nodeId(nodeId), numMisrouted(0), terminated(false)
+{
+  if (numShards == 0) {
+    throw GraphStoreException("ShardedGraphStore needs at least one shard");
+  }
+  if (hostnames.size() < numNodes) {
+    throw GraphStoreException("ShardedGraphStore needs a hostname per node");
+  }
+
+  size_t numVirtual = numNodes * numShards;
+  std::vector<std::string> virtualHostnames;
+  for (size_t v = 0; v < numVirtual; v++) {
+    virtualHostnames.push_back(hostnames[v % numNodes]);
+  }
+
+  // Several virtual nodes share a host, so ports have to be laid out the
+  // way the single host (local) mode does it: by virtual node id.  The
+  // range is unique across the cluster, so this works across hosts too.
+  bool virtualLocal = local || numShards > 1;
+
+  for (size_t s = 0; s < numShards; s++) {
+    shards.push_back(std::make_shared<ShardType>(
+      numVirtual, s * numNodes + nodeId, virtualHostnames, startingPort,
+      hwm, graphCapacity, tableCapacity, resultsCapacity, numPushSockets,
+      numPullThreads, timeout, timeWindow,
+#ifdef DROP_QUERIES
+      keepQueries,
+#endif
+      featureMap, maxQueued, virtualLocal, workersPerShard));
+  }
+}
+
+template <typename TupleType, typename Tuplizer,
+          size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+bool
+ShardedGraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+consume(TupleType const& tuple)
+{
+  size_t numVirtual = numNodes * shards.size();
+  size_t srcOwner = sourceHash(std::get<source>(tuple)) % numVirtual;
+  size_t trgOwner = targetHash(std::get<target>(tuple)) % numVirtual;
+
+  bool routed = false;
+  if (srcOwner % numNodes == nodeId) {
+    shards[srcOwner / numNodes]->consume(tuple);
+    routed = true;
+  }
+  if (trgOwner % numNodes == nodeId && trgOwner != srcOwner) {
+    shards[trgOwner / numNodes]->consume(tuple);
+    routed = true;
+  }
+  if (!routed) {
+    numMisrouted.fetch_add(1);
+  }
+
+  this->feedCount++;
+  return true;
+}
+
+template <typename TupleType, typename Tuplizer,
+          size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+ShardedGraphStore<TupleType, Tuplizer, source, target, time, duration,
+  SourceHF, TargetHF, SourceEF, TargetEF>::
+terminate()
+{
+  bool expected = false;
+  if (!terminated.compare_exchange_strong(expected, true)) return;
+
+  // A shard's pull threads wait for terminate messages from every other
+  // shard, so terminating them one after another would wait out the pull
+  // timeout for each.
+  std::vector<std::thread> threads;
+  for (auto& shard : shards) {
+    threads.push_back(std::thread([shard]() { shard->terminate(); }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+} // end namespace sam
+
+#endif
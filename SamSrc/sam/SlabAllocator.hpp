@@ -0,0 +1,402 @@
+#ifndef SAM_SLAB_ALLOCATOR_HPP
+#define SAM_SLAB_ALLOCATOR_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+/**
+ * The size of each slab that is requested from the global heap.  Each slab
+ * is carved up into equally sized blocks of a single size class.
+ */
+#define SLAB_SIZE 65536
+
+/**
+ * How many blocks move between a thread's cache and the central free lists
+ * at one time.
+ */
+#define SLAB_TRANSFER_BATCH 64
+
+/**
+ * Number of size classes.  Classes are powers of two starting at
+ * SLAB_MIN_BLOCK, so the largest block served from slabs is
+ * SLAB_MIN_BLOCK << (SLAB_NUM_CLASSES - 1).  Larger requests go straight to
+ * the global heap.
+ */
+#define SLAB_NUM_CLASSES 9
+#define SLAB_MIN_BLOCK 16
+
+/**
+ * How many operations a thread performs before folding its local counters
+ * into the global metrics.
+ */
+#define SLAB_METRICS_FLUSH 1024
+
+namespace sam {
+
+/**
+ * A snapshot of the allocation metrics across all threads.  heapAllocations
+ * counts every call that reached the global heap (new slabs plus requests
+ * too large for any size class), which is the number to watch when
+ * comparing heap traffic per tuple.
+ */
+struct SlabMetrics
+{
+  uint64_t allocations = 0;   ///> Blocks handed out by the allocator
+  uint64_t deallocations = 0; ///> Blocks given back to the allocator
+  uint64_t heapAllocations = 0; ///> Calls that went to the global heap
+  uint64_t heapBytes = 0; ///> Bytes requested from the global heap
+};
+
+namespace slabDetails {
+
+struct FreeBlock {
+  FreeBlock* next;
+};
+
+/**
+ * Returns the size class for a request of the given number of bytes, or
+ * SLAB_NUM_CLASSES if the request is too big to be served from a slab.
+ */
+inline
+size_t sizeClass(size_t bytes)
+{
+  size_t blockSize = SLAB_MIN_BLOCK;
+  for (size_t c = 0; c < SLAB_NUM_CLASSES; c++) {
+    if (bytes <= blockSize) return c;
+    blockSize <<= 1;
+  }
+  return SLAB_NUM_CLASSES;
+}
+
+inline
+size_t blockSize(size_t sizeClass)
+{
+  return static_cast<size_t>(SLAB_MIN_BLOCK) << sizeClass;
+}
+
+/**
+ * Global counters.  Threads accumulate locally and flush periodically so
+ * that the hot path doesn't touch shared cache lines.
+ */
+struct GlobalMetrics {
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> deallocations;
+  std::atomic<uint64_t> heapAllocations;
+  std::atomic<uint64_t> heapBytes;
+
+  GlobalMetrics() : allocations(0), deallocations(0), heapAllocations(0),
+                    heapBytes(0) {}
+};
+
+inline
+GlobalMetrics& globalMetrics()
+{
+  // Intentionally leaked so that it outlives any thread caches that are
+  // destroyed during program exit.
+  static GlobalMetrics* metrics = new GlobalMetrics();
+  return *metrics;
+}
+
+/**
+ * Free lists shared by all threads.  Thread caches return surplus blocks
+ * here (and everything they hold when the thread exits), and refill from
+ * here before carving a new slab.  Slabs themselves are never returned to
+ * the global heap; the arena only grows to the high-water mark.
+ */
+class CentralFreeLists
+{
+private:
+  std::mutex mutexes[SLAB_NUM_CLASSES];
+  FreeBlock* heads[SLAB_NUM_CLASSES];
+
+public:
+  CentralFreeLists() {
+    for (size_t c = 0; c < SLAB_NUM_CLASSES; c++) heads[c] = nullptr;
+  }
+
+  /**
+   * Pushes a chain of blocks (terminated by tail->next == nullptr) onto the
+   * central list for the size class.
+   */
+  void give(size_t c, FreeBlock* head, FreeBlock* tail) {
+    std::lock_guard<std::mutex> lock(mutexes[c]);
+    tail->next = heads[c];
+    heads[c] = head;
+  }
+
+  /**
+   * Takes up to max blocks from the central list for the size class.
+   * \param count Set to the number of blocks taken.
+   * \return Returns the head of the chain of blocks taken (may be null).
+   */
+  FreeBlock* take(size_t c, size_t max, size_t& count) {
+    std::lock_guard<std::mutex> lock(mutexes[c]);
+    FreeBlock* head = heads[c];
+    FreeBlock* last = nullptr;
+    count = 0;
+    FreeBlock* current = head;
+    while (current && count < max) {
+      last = current;
+      current = current->next;
+      count++;
+    }
+    if (last) last->next = nullptr;
+    heads[c] = current;
+    return head;
+  }
+};
+
+inline
+CentralFreeLists& centralFreeLists()
+{
+  static CentralFreeLists* central = new CentralFreeLists();
+  return *central;
+}
+
+/**
+ * Per-thread cache of free blocks for each size class.  Allocation and
+ * deallocation touch only this object unless the cache runs dry or grows
+ * past twice the transfer batch.
+ */
+class ThreadCache
+{
+private:
+  FreeBlock* heads[SLAB_NUM_CLASSES];
+  size_t counts[SLAB_NUM_CLASSES];
+
+  uint64_t localAllocations = 0;
+  uint64_t localDeallocations = 0;
+  size_t opsSinceFlush = 0;
+
+public:
+  ThreadCache() {
+    for (size_t c = 0; c < SLAB_NUM_CLASSES; c++) {
+      heads[c] = nullptr;
+      counts[c] = 0;
+    }
+  }
+
+  ~ThreadCache() {
+    // Hand everything we hold to the central lists so other threads can use
+    // it.  GraphStore threads come and go, so this matters.
+    for (size_t c = 0; c < SLAB_NUM_CLASSES; c++) {
+      if (heads[c]) {
+        FreeBlock* tail = heads[c];
+        while (tail->next) tail = tail->next;
+        centralFreeLists().give(c, heads[c], tail);
+        heads[c] = nullptr;
+        counts[c] = 0;
+      }
+    }
+    flushMetrics();
+  }
+
+  void* allocate(size_t c) {
+    if (!heads[c]) refill(c);
+    FreeBlock* block = heads[c];
+    heads[c] = block->next;
+    counts[c]--;
+    localAllocations++;
+    countOp();
+    return block;
+  }
+
+  void deallocate(void* p, size_t c) {
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    block->next = heads[c];
+    heads[c] = block;
+    counts[c]++;
+    localDeallocations++;
+    countOp();
+    if (counts[c] > 2 * SLAB_TRANSFER_BATCH) release(c);
+  }
+
+  void flushMetrics() {
+    GlobalMetrics& metrics = globalMetrics();
+    metrics.allocations.fetch_add(localAllocations,
+                                  std::memory_order_relaxed);
+    metrics.deallocations.fetch_add(localDeallocations,
+                                    std::memory_order_relaxed);
+    localAllocations = 0;
+    localDeallocations = 0;
+    opsSinceFlush = 0;
+  }
+
+private:
+  void countOp() {
+    if (++opsSinceFlush >= SLAB_METRICS_FLUSH) flushMetrics();
+  }
+
+  /**
+   * Gets more blocks for the size class, first from the central lists and
+   * then, if those are empty, by carving a fresh slab from the heap.
+   */
+  void refill(size_t c) {
+    size_t count = 0;
+    FreeBlock* head = centralFreeLists().take(c, SLAB_TRANSFER_BATCH, count);
+    if (head) {
+      heads[c] = head;
+      counts[c] = count;
+      return;
+    }
+
+    size_t size = blockSize(c);
+    size_t slabBytes = SLAB_SIZE < size ? size : SLAB_SIZE;
+    char* slab = static_cast<char*>(::operator new(slabBytes));
+    GlobalMetrics& metrics = globalMetrics();
+    metrics.heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    metrics.heapBytes.fetch_add(slabBytes, std::memory_order_relaxed);
+
+    // Keep one batch for this thread and hand the rest of the slab to the
+    // central lists.
+    size_t numBlocks = slabBytes / size;
+    for (size_t i = numBlocks; i > 0; i--) {
+      FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + (i - 1) * size);
+      block->next = heads[c];
+      heads[c] = block;
+    }
+    counts[c] = numBlocks;
+    if (numBlocks > SLAB_TRANSFER_BATCH) release(c);
+  }
+
+  /**
+   * Keeps the most recently freed batch of blocks (they are the most likely
+   * to be in cache) and moves the remainder to the central lists.
+   */
+  void release(size_t c) {
+    FreeBlock* last = heads[c];
+    for (size_t i = 1; i < SLAB_TRANSFER_BATCH; i++) last = last->next;
+    FreeBlock* head = last->next;
+    FreeBlock* tail = head;
+    while (tail->next) tail = tail->next;
+    last->next = nullptr;
+    counts[c] = SLAB_TRANSFER_BATCH;
+    centralFreeLists().give(c, head, tail);
+  }
+};
+
+inline
+ThreadCache& threadCache()
+{
+  static thread_local ThreadCache cache;
+  return cache;
+}
+
+} // end namespace slabDetails
+
+/**
+ * Allocates the given number of bytes from the calling thread's slab
+ * cache.  Requests larger than the largest size class go to the global
+ * heap.
+ */
+inline
+void* slabAllocate(size_t bytes)
+{
+  size_t c = slabDetails::sizeClass(bytes);
+  if (c == SLAB_NUM_CLASSES) {
+    slabDetails::GlobalMetrics& metrics = slabDetails::globalMetrics();
+    metrics.heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    metrics.heapBytes.fetch_add(bytes, std::memory_order_relaxed);
+    return ::operator new(bytes);
+  }
+  return slabDetails::threadCache().allocate(c);
+}
+
+/**
+ * Returns memory obtained with slabAllocate.  The block may be freed by a
+ * different thread than the one that allocated it; it simply joins the
+ * freeing thread's cache.
+ */
+inline
+void slabDeallocate(void* p, size_t bytes)
+{
+  if (!p) return;
+  size_t c = slabDetails::sizeClass(bytes);
+  if (c == SLAB_NUM_CLASSES) {
+    ::operator delete(p);
+    return;
+  }
+  slabDetails::threadCache().deallocate(p, c);
+}
+
+/**
+ * Returns how many bytes a request for the given size actually takes up,
+ * i.e. the block size of its size class.
+ */
+inline
+size_t slabUsableSize(size_t bytes)
+{
+  size_t c = slabDetails::sizeClass(bytes);
+  if (c == SLAB_NUM_CLASSES) return bytes;
+  return slabDetails::blockSize(c);
+}
+
+/**
+ * Returns the allocation metrics accumulated so far.  Counts still held
+ * locally by other threads (fewer than SLAB_METRICS_FLUSH per thread) are
+ * not included; the calling thread's counts are flushed first.
+ */
+inline
+SlabMetrics getSlabMetrics()
+{
+  slabDetails::threadCache().flushMetrics();
+  slabDetails::GlobalMetrics& global = slabDetails::globalMetrics();
+  SlabMetrics metrics;
+  metrics.allocations = global.allocations.load();
+  metrics.deallocations = global.deallocations.load();
+  metrics.heapAllocations = global.heapAllocations.load();
+  metrics.heapBytes = global.heapBytes.load();
+  return metrics;
+}
+
+/**
+ * An STL allocator backed by per-thread slabs with power-of-two size
+ * classes.  It is stateless, so all instances compare equal and containers
+ * can freely splice and swap.  Used for the node-based containers on the
+ * edge path (CompressedSparse, EdgeRequestMap, TemporalSet,
+ * SubgraphQueryResultMap) where individual global new/delete calls per
+ * edge dominated.
+ */
+template <typename T>
+class SlabAllocator
+{
+public:
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind {
+    typedef SlabAllocator<U> other;
+  };
+
+  SlabAllocator() noexcept {}
+
+  template <typename U>
+  SlabAllocator(SlabAllocator<U> const&) noexcept {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(slabAllocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) {
+    slabDeallocate(p, n * sizeof(T));
+  }
+};
+
+template <typename T, typename U>
+bool operator==(SlabAllocator<T> const&, SlabAllocator<U> const&)
+{
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(SlabAllocator<T> const&, SlabAllocator<U> const&)
+{
+  return false;
+}
+
+} // end namespace sam
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef SAM_SUBGRAPH_AGGREGATE_HPP
+#define SAM_SUBGRAPH_AGGREGATE_HPP
+
+#include <sam/FeatureMap.hpp>
+#include <sam/Features.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+
+/// The number of independently locked partitions of the per key counts.
+#define SUBGRAPH_AGGREGATE_NUM_STRIPES 64
+
+namespace sam {
+
+class SubgraphAggregateException : public std::runtime_error
+{
+public:
+  SubgraphAggregateException(char const* message) :
+    std::runtime_error(message) {}
+  SubgraphAggregateException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * Turns a subgraph query into a count-only query.  Instead of keeping and
+ * printing every complete result, the result map hands the result's
+ * variable bindings and start time to the aggregate and drops it.  The
+ * aggregate keeps running counts and publishes them to a FeatureMap, where
+ * they can be read like any other feature (including by the vertex
+ * constraints of other queries):
+ *
+ *  - The total number of matches, under key "" and feature name
+ *    identifier.
+ *  - For each variable added with countVariable(v), the number of matches
+ *    each vertex was bound to v in, under the vertex and feature name
+ *    identifier + "_" + v.
+ *  - If the bucket width is positive, the number of matches starting in
+ *    each time bucket, under the start of the bucket and feature name
+ *    identifier + "_bucket".
+ *
+ * Counts are cumulative, as there is no window over matches.  add can be
+ * called by several threads at once.
+ *
+ * An aggregate is attached to a query with SubgraphQuery::setAggregate
+ * before the query is finalized.
+ */
+template <typename NodeType>
+class SubgraphAggregate
+{
+private:
+  struct Stripe {
+    std::mutex mutex;
+    std::unordered_map<std::string, uint64_t> counts;
+  };
+
+  std::shared_ptr<FeatureMap> featureMap;
+  std::string identifier;
+  double bucketWidth;
+
+  /// The variables counted per vertex, and their slots once resolved.
+  std::vector<std::string> variables;
+  std::vector<size_t> slots;
+  bool resolved = false;
+
+  std::mutex totalMutex;
+  uint64_t total = 0;
+
+  /// Per vertex and per bucket counts, keyed by feature name and key.
+  Stripe stripes[SUBGRAPH_AGGREGATE_NUM_STRIPES];
+
+  std::atomic<uint64_t> numFailedUpdates;
+
+public:
+  /**
+   * \param featureMap The feature map the counts are published to.
+   * \param identifier The feature name of the total count, and prefix of
+   *   the other feature names.
+   * \param bucketWidth The width in seconds of the time buckets.  Zero
+   *   turns off counting per bucket.
+   */
+  SubgraphAggregate(std::shared_ptr<FeatureMap> featureMap,
+                    std::string identifier,
+                    double bucketWidth = 0) :
+    featureMap(featureMap), identifier(identifier), bucketWidth(bucketWidth)
+  {
+    if (!featureMap) {
+      throw SubgraphAggregateException("SubgraphAggregate needs a feature "
+        "map to publish counts to");
+    }
+    if (bucketWidth < 0) {
+      throw SubgraphAggregateException("SubgraphAggregate bucket width "
+        "can't be negative: " + boost::lexical_cast<std::string>(bucketWidth));
+    }
+    numFailedUpdates = 0;
+  }
+
+  /**
+   * Also count matches per vertex bound to the variable.
+   * \throws SubgraphAggregateException if the aggregate has already been
+   *   attached to a finalized query.
+   */
+  void countVariable(std::string const& variable)
+  {
+    if (resolved) {
+      throw SubgraphAggregateException("SubgraphAggregate::countVariable "
+        "Tried to add a variable after the query was finalized");
+    }
+    variables.push_back(variable);
+  }
+
+  /**
+   * Called by SubgraphQuery::finalize with the query's variables in slot
+   * order.
+   * \throws SubgraphAggregateException if a counted variable isn't in the
+   *   query.
+   */
+  void resolve(std::vector<std::string> const& queryVariables)
+  {
+    slots.clear();
+    for (auto const& variable : variables) {
+      auto it = std::find(queryVariables.begin(), queryVariables.end(),
+                          variable);
+      if (it == queryVariables.end()) {
+        throw SubgraphAggregateException("SubgraphAggregate::resolve "
+          "Variable " + variable + " isn't in the query");
+      }
+      slots.push_back(it - queryVariables.begin());
+    }
+    resolved = true;
+  }
+
+  /**
+   * Counts a complete match.
+   * \param bindings The vertices bound to the query's variables, by slot.
+   * \param startTime The start time of the match.
+   */
+  void add(std::vector<NodeType> const& bindings, double startTime)
+  {
+    {
+      std::lock_guard<std::mutex> lock(totalMutex);
+      total++;
+      publish("", identifier, total);
+    }
+
+    for (size_t i = 0; i < slots.size(); i++) {
+      increment(boost::lexical_cast<std::string>(bindings[slots[i]]),
+                identifier + "_" + variables[i]);
+    }
+
+    if (bucketWidth > 0) {
+      double bucket = std::floor(startTime / bucketWidth) * bucketWidth;
+      increment(boost::lexical_cast<std::string>(bucket),
+                identifier + "_bucket");
+    }
+  }
+
+  /**
+   * The total number of matches counted.
+   */
+  uint64_t getTotal()
+  {
+    std::lock_guard<std::mutex> lock(totalMutex);
+    return total;
+  }
+
+  /**
+   * The count kept under the key and feature name, or 0 if there is none.
+   */
+  uint64_t getCount(std::string const& key, std::string const& featureName)
+  {
+    std::string combined = featureName + '\0' + key;
+    Stripe& stripe = getStripe(combined);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.counts.find(combined);
+    return it == stripe.counts.end() ? 0 : it->second;
+  }
+
+  /**
+   * The number of counts that couldn't be published because the feature
+   * map was full.
+   */
+  uint64_t getNumFailedUpdates() const { return numFailedUpdates; }
+
+  std::string const& getIdentifier() const { return identifier; }
+  double getBucketWidth() const { return bucketWidth; }
+
+private:
+  Stripe& getStripe(std::string const& combined)
+  {
+    return stripes[std::hash<std::string>()(combined) %
+                   SUBGRAPH_AGGREGATE_NUM_STRIPES];
+  }
+
+  void increment(std::string const& key, std::string const& featureName)
+  {
+    std::string combined = featureName + '\0' + key;
+    Stripe& stripe = getStripe(combined);
+
+    // Publishing under the lock keeps a smaller count from overwriting a
+    // larger one.
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    uint64_t count = ++stripe.counts[combined];
+    publish(key, featureName, count);
+  }
+
+  void publish(std::string const& key, std::string const& featureName,
+               uint64_t count)
+  {
+    SingleFeature feature(static_cast<double>(count));
+    if (!featureMap->updateInsert(key, featureName, feature)) {
+      numFailedUpdates.fetch_add(1);
+    }
+  }
+};
+
+}
+
+#endif
@@ -14,6 +14,7 @@
 #include <type_traits>
 #include <sam/EdgeDescription.hpp>
 #include <sam/FeatureMap.hpp>
+#include <sam/SubgraphAggregate.hpp>
 #include <sam/VertexConstraintChecker.hpp>
 
 #define MAX_START_END_OFFSET 100
@@ -75,6 +76,14 @@ private:
   
   ///Sorted on startTime
   EdgeList sortedEdges; 
+
+  /// The vertex variables, in the order they first appear in sortedEdges.
+  /// A variable's index here is its slot in a result's bindings.
+  std::vector<std::string> variables;
+
+  /// The slots of the source and target variables of each sorted edge.
+  std::vector<size_t> sourceSlots;
+  std::vector<size_t> targetSlots;
   
   /// Max time between start and end time.
   double maxOffset = MAX_START_END_OFFSET; 
@@ -89,6 +98,12 @@ private:
 
   std::shared_ptr<const VertexConstraintChecker<SubgraphQueryType>> check;
 
+  /// The feature map the vertex constraints are checked against.
+  std::shared_ptr<const FeatureMap> featureMap;
+
+  /// If set, complete results are only counted (see setAggregate).
+  std::shared_ptr<SubgraphAggregate<NodeType>> aggregate;
+
   std::list<VertexConstraintExpression> emptyList;
 public:
   
@@ -197,6 +212,28 @@ public:
    */
   size_t size() const;
 
+  /**
+   * Returns the number of distinct vertex variables.  Variables are
+   * numbered (slotted) by finalize in the order they first appear in the
+   * sorted edges.
+   */
+  size_t getNumVariables() const { return variables.size(); }
+
+  /**
+   * Returns the name of the variable in the given slot.
+   */
+  std::string const& getVariable(size_t slot) const { return variables[slot]; }
+
+  /**
+   * Returns the slot of the source variable of the ith sorted edge.
+   */
+  size_t getSourceSlot(size_t index) const { return sourceSlots[index]; }
+
+  /**
+   * Returns the slot of the target variable of the ith sorted edge.
+   */
+  size_t getTargetSlot(size_t index) const { return targetSlots[index]; }
+
 
   /**
    * Returns the maximum extent of time that can pass from the start
@@ -234,8 +271,6 @@ public:
    */
   bool zeroTimeRelativeToStart() const;
 
-private:
- 
   /**
    * Checks whether the tuple satisfies any defined vertex constraints.
    * \param index Which edge are we considering.
@@ -244,6 +279,49 @@ private:
    */
   bool satisfiesVertexConstraints(size_t index, TupleType const& tuple) const;
 
+  /**
+   * Checks whether a vertex satisfies the constraints on a vertex variable.
+   * \param variable The vertex variable.
+   * \param vertex The vertex bound to it.
+   */
+  bool satisfiesVertexConstraints(std::string const& variable,
+                                  NodeType const& vertex) const
+  {
+    return check->check(variable, vertex);
+  }
+
+  /**
+   * Returns the feature map that vertex constraints are checked against.
+   */
+  std::shared_ptr<const FeatureMap> getFeatureMap() const {
+    return featureMap;
+  }
+
+  /**
+   * Makes this a count-only query: complete results are passed to the
+   * aggregate and then discarded, instead of being stored and printed.
+   *
+   * This method throws a SubgraphQueryException if the query has already
+   * been finalized.
+   */
+  void setAggregate(std::shared_ptr<SubgraphAggregate<NodeType>> aggregate)
+  {
+    if (finalized) {
+      throw SubgraphQueryException("SubgraphQuery::setAggregate Tried to set "
+        "the aggregate but the query had already been finalized.");
+    }
+    this->aggregate = aggregate;
+  }
+
+  /**
+   * Returns the aggregate of a count-only query, or null.
+   */
+  std::shared_ptr<SubgraphAggregate<NodeType>> getAggregate() const {
+    return aggregate;
+  }
+
+private:
+
   /**
    * Checks whether the tuple satisfies any defined edge constraints.
    * \param index Which edge are we considering.
@@ -261,7 +339,8 @@ private:
 template <typename TupleType, size_t source, size_t target, 
           size_t time, size_t duration>
 SubgraphQuery<TupleType, source, target, time, duration>::
-SubgraphQuery(std::shared_ptr<const FeatureMap> featureMap)
+SubgraphQuery(std::shared_ptr<const FeatureMap> featureMap) :
+  featureMap(featureMap)
 {
   check = std::make_shared<const VertexConstraintChecker<SubgraphQueryType>>(
             featureMap, this);  
@@ -402,6 +481,26 @@ void SubgraphQuery<TupleType, source, target, time, duration>::finalize()
       return i.startTimeRange.first < j.startTimeRange.first; 
     });
 
+  auto slot = [this](std::string const& variable) {
+    auto it = std::find(variables.begin(), variables.end(), variable);
+    if (it != variables.end()) return static_cast<size_t>(
+      it - variables.begin());
+    variables.push_back(variable);
+    return variables.size() - 1;
+  };
+  for (auto const& edge : sortedEdges) {
+    sourceSlots.push_back(slot(edge.getSource()));
+    targetSlots.push_back(slot(edge.getTarget()));
+  }
+
+  if (aggregate) {
+    try {
+      aggregate->resolve(variables);
+    } catch (SubgraphAggregateException const& e) {
+      throw SubgraphQueryException(e.what());
+    }
+  }
+
   if (zeroTimeRelativeToStart()) {
     maxTimeExtent = sortedEdges[sortedEdges.size()-1].endTimeRange.second 
                     - sortedEdges[0].startTimeRange.first;
@@ -6,7 +6,11 @@
 #include <sam/EdgeRequest.hpp>
 #include <sam/Util.hpp>
 #include <sam/VertexConstraintChecker.hpp>
-#include <set>
+#include <sam/MemoryBudget.hpp>
+#include <sam/Serialization.hpp>
+#include <boost/functional/hash.hpp>
+#include <algorithm>
+#include <cstdint>
 
 namespace sam {
 
@@ -30,6 +34,15 @@ public:
  * resides outside this class.
  *
  * The source and target fields need to be of the same type.
+ *
+ * There can be millions of partial results and every extension copies
+ * one, so the representation is kept small:
+ *  - Variables are bound by slot (see SubgraphQuery::getNumVariables)
+ *    rather than by name.
+ *  - Edges are kept in an immutable chain.  A result extended from another
+ *    points at the other's edges instead of copying them, so results that
+ *    share a prefix store it once and an extension copies one pointer.
+ *  - Seen edges are 64 bit fingerprints in a sorted vector.
  */
 template <typename TupleType, size_t source, size_t target, 
           size_t time, size_t duration>
@@ -51,11 +64,19 @@ private:
   /// The SubgraphQuery that this is a result for.
   std::shared_ptr<const SubgraphQueryType> subgraphQuery;
 
-  /// A mapping from the variable name to the bound value.
-  std::map<std::string, NodeType> var2BoundValue;
+  /// One edge of a result, linked to the edge matched before it.
+  struct EdgeNode {
+    TupleType edge;
+    std::shared_ptr<const EdgeNode> previous;
+  };
+
+  /// The value bound to each variable slot of the query, or
+  /// nullValue<NodeType>() if the variable isn't bound yet.
+  std::vector<NodeType> bindings;
 
-  /// A vector of edges that satisfied the edge descriptions.
-  std::vector<TupleType> resultEdges;
+  /// The last edge that satisfied an edge description.  The others are
+  /// reached through EdgeNode::previous.
+  std::shared_ptr<const EdgeNode> lastEdge;
 
   /// Index to current edge we are trying to satisfy.
   size_t currentEdge = 0;
@@ -75,9 +96,55 @@ private:
   /// same partial result.  For example, two edge requests can be produced
   /// return the same edge to this node.  When we try to map against the
   /// query result, the same edge will fulfill the same criteria twice.
-  /// We want to prevent that.  We create a string from time,source,target,
-  /// and then store them in this set so that we only see it once.
-  std::set<std::string> seenEdges;
+  /// We want to prevent that.  We fingerprint time, source, target, and
+  /// duration, and keep the fingerprints sorted so that we only see an
+  /// edge once.  Only edges that were added are recorded.  Two different
+  /// edges with the same fingerprint are taken to be the same edge, so an
+  /// edge is wrongly rejected with a probability of about
+  /// seenEdges.size() / 2^64.
+  std::vector<uint64_t> seenEdges;
+
+  /// The bytes charged to a memory budget for this result while it is
+  /// stored (see SubgraphQueryResultMap), so that exactly those are
+  /// credited when it is removed.
+  size_t chargedBytes = 0;
+
+  /**
+   * Returns the fingerprint of an edge for seenEdges.
+   */
+  static uint64_t fingerprint(TupleType const& edge) {
+    size_t seed = 0;
+    boost::hash_combine(seed, std::get<source>(edge));
+    boost::hash_combine(seed, std::get<target>(edge));
+    boost::hash_combine(seed, std::get<time>(edge));
+    boost::hash_combine(seed, std::get<duration>(edge));
+    return seed;
+  }
+
+  /**
+   * True if the fingerprint is in seenEdges.
+   */
+  bool hasSeenEdge(uint64_t key) const {
+    return std::binary_search(seenEdges.begin(), seenEdges.end(), key);
+  }
+
+  /**
+   * Adds the fingerprint to seenEdges.
+   * \return Returns false if it was already there.
+   */
+  bool insertSeenEdge(uint64_t key) {
+    auto it = std::lower_bound(seenEdges.begin(), seenEdges.end(), key);
+    if (it != seenEdges.end() && *it == key) return false;
+    seenEdges.insert(it, key);
+    return true;
+  }
+
+  /**
+   * Binds the variables of the current edge description to the edge's
+   * source and target into the given bindings.
+   * \return Returns false if the edge doesn't fit the existing bindings.
+   */
+  bool bind(TupleType const& edge, std::vector<NodeType>& newBindings) const;
 
 public:
   /**
@@ -97,8 +164,9 @@ public:
 
   /** 
    * Tries to add the edge to the subgraph query result. If successful
-   * returns true along with the new query result.  This result remains
-   * unchanged.  Returns false if adding doesn't work. 
+   * returns true along with the new query result.  This result only
+   * records the edge as seen, so that the same edge can't extend it
+   * twice.  Returns false if adding doesn't work.
    * \return Returns a pair where the first value is true if the netflow was 
    *   added.  False otherwise.  If it was added, the second value is the
    *   new result with the added edge.
@@ -152,6 +220,33 @@ public:
    */
   double getExpireTime() const;
 
+  /**
+   * Returns the time that the query started (the start time or end time of
+   * the first edge depending on the query).
+   */
+  double getStartTime() const { return startTime; }
+
+  /// The bytes charged to a memory budget for this result.
+  size_t getChargedBytes() const { return chargedBytes; }
+  void setChargedBytes(size_t bytes) { chargedBytes = bytes; }
+
+  /**
+   * Returns an estimate of the bytes used by this result, including what
+   * it owns on the heap.  Used for memory budget accounting.
+   */
+  size_t memoryUsage() const {
+    size_t bytes = sizeof(*this) + seenEdges.capacity() * sizeof(uint64_t) +
+                   bindings.capacity() * sizeof(NodeType);
+    for (auto const& binding : bindings) {
+      bytes += heapBytes(binding);
+    }
+    // Earlier edges are shared with the result this one was extended from.
+    if (lastEdge) {
+      bytes += sizeof(EdgeNode) + heapBytes(lastEdge->edge);
+    }
+    return bytes;
+  }
+
   /**
    * Returns the variable binding for the source of the current edge or
    * a null value using nullValue<NodeType>() if there is no variable
@@ -198,6 +293,11 @@ public:
               size_t numNodes) 
               const;
 
+  /**
+   * Returns the index of the edge description that is matched next.
+   */
+  size_t getCurrentEdge() const { return currentEdge; }
+
   /**
    * Returns true if the query has been satisfied.
    */
@@ -210,14 +310,8 @@ public:
    * Returns a string representation of the query result
    */
   std::string toString() const {
-    if (resultEdges.size() != currentEdge) {
-      std::string message = "resultEdges.size() was not equal to currentEdge " +
-        boost::lexical_cast<std::string>(resultEdges.size()) + " != " +
-        boost::lexical_cast<std::string>(currentEdge);
-      throw SubgraphQueryResultException(message); 
-    }
     std::string rString = "Result Edges: ";
-    for(TupleType const& t : resultEdges) {
+    for(TupleType const& t : getResultTuples()) {
       rString = rString + " ResultTuple " + 
         "Id " + boost::lexical_cast<std::string>(std::get<0>(t)) +
         " Time " + boost::lexical_cast<std::string>(std::get<time>(t)) +
@@ -227,9 +321,12 @@ public:
       //rString = rString + "ResultTuple " + sam::toString(t) + " ";  
     }
     rString += " startTime" + boost::lexical_cast<std::string>(startTime);
-    rString += " var2BoundValue ";
-    for(auto key : var2BoundValue) {
-      rString += key.first + "->" + key.second + " ";
+    rString += " bindings ";
+    for (size_t i = 0; i < bindings.size(); i++) {
+      if (!sam::isNull(bindings[i])) {
+        rString += subgraphQuery->getVariable(i) + "->" + 
+          boost::lexical_cast<std::string>(bindings[i]) + " ";
+      }
     }
     rString += " currentEdge: " + boost::lexical_cast<std::string>(currentEdge);
     rString += " numEdges: " + boost::lexical_cast<std::string>(numEdges);
@@ -239,10 +336,10 @@ public:
   /**
    * Returns true if none of the result edges have the given sam id.
    */
-  bool noSamId(size_t samId) 
+  bool noSamId(size_t samId) const
   {
-    for (TupleType const& t : resultEdges) {
-      if (std::get<0>(t) == samId) {
+    for (auto node = lastEdge.get(); node; node = node->previous.get()) {
+      if (std::get<0>(node->edge) == samId) {
         return false;
       }
     }
@@ -258,8 +355,88 @@ public:
     return subgraphQuery.get() == nullptr;
   }
 
+  /**
+   * Returns the edge that satisfied the ith edge description.
+   */
   TupleType getResultTuple(size_t i) const {
-    return resultEdges[i];
+    if (i >= currentEdge) {
+      throw SubgraphQueryResultException("SubgraphQueryResult::"
+        "getResultTuple index " + boost::lexical_cast<std::string>(i) +
+        " but only " + boost::lexical_cast<std::string>(currentEdge) +
+        " edges have been matched");
+    }
+    auto node = lastEdge.get();
+    for (size_t j = currentEdge - 1; j > i; j--) node = node->previous.get();
+    return node->edge;
+  }
+
+  /**
+   * Returns the edges matched so far, in order.
+   */
+  std::vector<TupleType> getResultTuples() const {
+    std::vector<TupleType> edges(currentEdge);
+    size_t i = currentEdge;
+    for (auto node = lastEdge.get(); node; node = node->previous.get()) {
+      edges[--i] = node->edge;
+    }
+    return edges;
+  }
+
+  /**
+   * Returns the vertices bound to the query's variables, by slot.  Unbound
+   * variables are null.
+   */
+  std::vector<NodeType> const& getBindings() const { return bindings; }
+
+  /**
+   * Returns the query this is a result for.
+   */
+  std::shared_ptr<const SubgraphQueryType> getSubgraphQuery() const {
+    return subgraphQuery;
+  }
+
+  /**
+   * Appends the state of this result (everything but the query) to out.
+   */
+  void checkpoint(std::string& out) const {
+    serialize(out, bindings);
+    serialize(out, getResultTuples());
+    serialize(out, static_cast<uint64_t>(currentEdge));
+    serialize(out, static_cast<uint64_t>(numEdges));
+    serialize(out, expireTime);
+    serialize(out, startTime);
+    serialize(out, seenEdges);
+  }
+
+  /**
+   * Replaces the state of this result with what checkpoint() wrote.
+   * \param query The query the result was for, which isn't written.
+   */
+  void restore(char const*& p, char const* end,
+               std::shared_ptr<const SubgraphQueryType> query)
+  {
+    subgraphQuery = query;
+    uint64_t current, total;
+    std::vector<TupleType> edges;
+    deserialize(p, end, bindings);
+    deserialize(p, end, edges);
+    deserialize(p, end, current);
+    deserialize(p, end, total);
+    deserialize(p, end, expireTime);
+    deserialize(p, end, startTime);
+    currentEdge = current;
+    numEdges = total;
+    if (numEdges != query->size() || currentEdge != edges.size() ||
+        bindings.size() != query->getNumVariables()) 
+    {
+      throw SubgraphQueryResultException("SubgraphQueryResult::restore: "
+        "the result doesn't fit the query it was restored with");
+    }
+    lastEdge = nullptr;
+    for (auto const& edge : edges) {
+      lastEdge = std::make_shared<const EdgeNode>(EdgeNode{edge, lastEdge});
+    }
+    deserialize(p, end, seenEdges);
   }
 
 private:
@@ -289,6 +466,7 @@ SubgraphQueryResult(std::shared_ptr<const SubgraphQueryType> query,
   }
  
   numEdges = subgraphQuery->size();
+  bindings.assign(subgraphQuery->getNumVariables(), nullValue<NodeType>());
 
   // If the query has start time defined relative to the start of the edge,
   // we set start time to be the start of the first edge.  Otherwise,
@@ -341,8 +519,8 @@ double
 SubgraphQueryResult<TupleType, source, target, time, duration>::
 getPreviousStartTime() const
 {
-  if (resultEdges.size() > 0) {
-    return std::get<time>(resultEdges.at(resultEdges.size() - 1));
+  if (lastEdge) {
+    return std::get<time>(lastEdge->edge);
   }
   return std::numeric_limits<double>::lowest();
 }
@@ -499,16 +677,42 @@ template <typename TupleType, size_t source, size_t target,
           size_t time, size_t duration>
 bool
 SubgraphQueryResult<TupleType, source, target, time, duration>::
-addEdgeInPlace(TupleType const& edge)
+bind(TupleType const& edge, std::vector<NodeType>& newBindings) const
 {
-  if (resultEdges.size() != currentEdge) {
-    std::string message = "addEdgeInPlace resultEdges.size() was not equal"
-      " to currentEdge " +
-      boost::lexical_cast<std::string>(resultEdges.size()) + " != " +
-      boost::lexical_cast<std::string>(currentEdge);
-    throw SubgraphQueryResultException(message); 
+  size_t src = subgraphQuery->getSourceSlot(currentEdge);
+  size_t trg = subgraphQuery->getTargetSlot(currentEdge);
+  NodeType const& edgeSource = std::get<source>(edge);
+  NodeType const& edgeTarget = std::get<target>(edge);
+
+  bool boundSrc = !sam::isNull(bindings[src]);
+  bool boundTrg = !sam::isNull(bindings[trg]);
+
+  if (boundSrc && edgeSource != bindings[src]) {
+    DEBUG_PRINT("SubgraphQueryResult::bind: edgeSource %s "
+      " did not match binding %s for tuple %s\n", 
+      edgeSource.c_str(), bindings[src].c_str(),
+      sam::toString(edge).c_str());
+    return false;
+  }
+  if (boundTrg && edgeTarget != bindings[trg]) {
+    DEBUG_PRINT("SubgraphQueryResult::bind: edgeTarget %s "
+      " did not match binding %s for tuple %s\n", 
+      edgeTarget.c_str(), bindings[trg].c_str(),
+      sam::toString(edge).c_str());
+    return false;
   }
 
+  if (!boundSrc) newBindings[src] = edgeSource;
+  if (!boundTrg) newBindings[trg] = edgeTarget;
+  return true;
+}
+
+template <typename TupleType, size_t source, size_t target, 
+          size_t time, size_t duration>
+bool
+SubgraphQueryResult<TupleType, source, target, time, duration>::
+addEdgeInPlace(TupleType const& edge)
+{
   if (currentEdge >= numEdges) {
     std::string message = "SubgraphQueryResult::addEdge Tried to add an edge " 
       "but the query has already been satisfied, i.e. currentEdge(" + 
@@ -524,86 +728,18 @@ addEdgeInPlace(TupleType const& edge)
     return false;
   }
 
-  // Checking against edge description constraints
-  /*
-  if (!edgeDescription.satisfies(edge, this->startTime)) {
+  if (!bind(edge, bindings)) {
     return false;
   }
 
-
-  DEBUG_PRINT("addEdgeInPlace src %s trg %s\n", src.c_str(), trg.c_str());
-  */
-
-  EdgeDescriptionType const& edgeDescription = 
-    subgraphQuery->getEdgeDescription(currentEdge);
-  std::string src = edgeDescription.getSource();
-  std::string trg = edgeDescription.getTarget();
-
-  // Case when the source has been bound but the target has not
-  if (var2BoundValue.count(src) > 0 &&
-      var2BoundValue.count(trg) == 0)
-  {
-    
-    NodeType edgeSource = std::get<source>(edge);
-    
-    if (edgeSource == var2BoundValue[src]) {
-      
-      NodeType edgeTarget = std::get<target>(edge);
-      var2BoundValue[trg] = edgeTarget;
-      
-    } else {
-      return false;
-    } 
-
-  } else if (var2BoundValue.count(src) == 0 && 
-             var2BoundValue.count(trg) > 0) {
-    
-    NodeType edgeTarget = std::get<target>(edge);
-    
-    if (edgeTarget == var2BoundValue[trg]) {
-      
-      NodeType edgeSource = std::get<source>(edge);
-      var2BoundValue[src] = edgeSource;
-        
-    } else {
-      return false;
-    } 
-  } else if (var2BoundValue.count(src) == 0 &&
-             var2BoundValue.count(trg) == 0)
-  { 
-    #ifdef DEBUG
-    printf("Setting %s->%s and %s->%s\n", src.c_str(), 
-      std::get<source>(edge).c_str(), trg.c_str(), 
-      std::get<target>(edge).c_str());
-    #endif
-
-    var2BoundValue[src] = std::get<source>(edge);
-    var2BoundValue[trg] = std::get<target>(edge);
-  } else {
-
-    NodeType edgeTarget = std::get<target>(edge);
-    NodeType edgeSource = std::get<target>(edge);
-
-    if (edgeTarget != var2BoundValue[trg] ||
-        edgeSource != var2BoundValue[src])
-    {
-      return false;
-    }
-  }
-
-  resultEdges.push_back(edge);
+  lastEdge = std::make_shared<const EdgeNode>(EdgeNode{edge, lastEdge});
   currentEdge++;
 
   #ifdef DEBUG
   printf("Add edge in place returning true\n");
   #endif
 
-  std::string edgeKey = 
-    boost::lexical_cast<std::string>(std::get<source>(edge)) +
-    boost::lexical_cast<std::string>(std::get<target>(edge)) +
-    boost::lexical_cast<std::string>(std::get<time>(edge)) +
-    boost::lexical_cast<std::string>(std::get<duration>(edge));
-  seenEdges.insert(edgeKey);
+  insertSeenEdge(fingerprint(edge));
   return true;
 }
 
@@ -613,18 +749,12 @@ std::pair<bool, SubgraphQueryResult<TupleType, source, target, time, duration>>
 SubgraphQueryResult<TupleType, source, target, time, duration>::
 addEdge(TupleType const& edge)
 {
-  // Create a string from the source, target, time, and duration.  Check to see
-  // if that is in seenEdges.  If not, add it and continue processing.  If
-  // so, do not continue processing.  This prevents duplicate subgraphs to
-  // be created.
-  std::string edgeKey = 
-    boost::lexical_cast<std::string>(std::get<source>(edge)) +
-    boost::lexical_cast<std::string>(std::get<target>(edge)) +
-    boost::lexical_cast<std::string>(std::get<time>(edge)) +
-    boost::lexical_cast<std::string>(std::get<duration>(edge));
-  if (seenEdges.count(edgeKey) < 1) {
-
-    seenEdges.insert(edgeKey);
+  // Fingerprint the source, target, time, and duration.  If we have seen
+  // the fingerprint, do not continue processing.  This prevents duplicate
+  // subgraphs to be created.  The fingerprint is recorded once the edge
+  // has been added.
+  uint64_t key = fingerprint(edge);
+  if (!hasSeenEdge(key)) {
 
     DEBUG_PRINT("SubgraphQueryResult::addEdge trying to add edge %s to result"
       " %s\n", sam::toString(edge).c_str(), toString().c_str());
@@ -641,7 +771,7 @@ addEdge(TupleType const& edge)
     // and also it fits the existing variable bindings.
 
     if (currentEdge >= 1) {
-      double previousTime = std::get<time>(resultEdges[currentEdge - 1]);
+      double previousTime = std::get<time>(lastEdge->edge);
       double currentTime = std::get<time>(edge); 
       
       if (currentTime <= previousTime) {
@@ -650,10 +780,6 @@ addEdge(TupleType const& edge)
       }
     }
 
-    // Checking against edge description constraints
-    //EdgeDescriptionType const& edgeDescription = 
-    //  subgraphQuery->getEdgeDescription(currentEdge);
-
     if (!subgraphQuery->satisfiesConstraints(currentEdge, edge, startTime)) {
       DEBUG_PRINT("SubgraphQueryResult::addEdge this tuple %s did not satisfy"
         " this edge constraings\n", sam::toString(edge).c_str());
@@ -661,111 +787,17 @@ addEdge(TupleType const& edge)
           SubgraphQueryResultType());
     }
 
-
-    /*if (!edgeDescription.satisfiesEdgeConstraints(
-          currentEdge, this->startTime)) {
-
-      DEBUG_PRINT("SubgraphQueryResult::addEdge this tuple %s did not satisfy"
-        " this edgeDescription %s\n", sam::toString(edge).c_str(), 
-        edgeDescription.toString().c_str());
-
+    SubgraphQueryResultType newResult(*this);
+    if (!bind(edge, newResult.bindings)) {
       return std::pair<bool, SubgraphQueryResultType>(false, 
         SubgraphQueryResultType());
     }
 
-    if (!subgraphQuery->satisfiesVertexConstraints(currentEdge, edge))
-    {
-      return std::pair<bool, SubgraphQueryResultType>(false,
-        SubgraphQueryResultType()); 
-    }*/
-   
-    /*std::string src = edgeDescription.getSource();
-    std::string trg = edgeDescription.getTarget();
-
-    VertexConstraintChecker<SubgraphQueryType> check(*featureMap, 
-                                                     *subgraphQuery);
-    if (!check(src, edgeSource)) {
-      return std::pair<bool, SubgraphQueryResultType>(false,
-        SubgraphQueryResultType()); 
-    }
-    if (!check(trg, edgeTarget)) {
-      return std::pair<bool, SubgraphQueryResultType>(false,
-        SubgraphQueryResultType()); 
-    }*/
-
-    SubgraphQueryResultType newResult(*this);
-
-    EdgeDescriptionType const& edgeDescription = 
-      subgraphQuery->getEdgeDescription(currentEdge);
-    std::string src = edgeDescription.getSource();
-    std::string trg = edgeDescription.getTarget();
-    NodeType edgeSource = std::get<source>(edge);
-    NodeType edgeTarget = std::get<target>(edge);
-
-    // Case when the source has been bound but the target has not
-    if (var2BoundValue.count(src) > 0 &&
-        var2BoundValue.count(trg) == 0)
-    {
-      
-      if (edgeSource == var2BoundValue.at(src)) {
-        
-        NodeType edgeTarget = std::get<target>(edge);
-        newResult.var2BoundValue[trg] = edgeTarget;
-        
-      } else {
-
-        DEBUG_PRINT("SubgraphQueryResult::addEdge: edgeSource %s "
-          " did not match var2BoundValue.at(src) %s for tuple %s\n", 
-          edgeSource.c_str(), var2BoundValue.at(src).c_str(),
-          sam::toString(edge).c_str());
-        return std::pair<bool, SubgraphQueryResultType>(false, 
-          SubgraphQueryResultType());
-      } 
-
-    } else if (var2BoundValue.count(src) == 0 && 
-               var2BoundValue.count(trg) > 0) 
-    {
-      
-      if (edgeTarget == var2BoundValue.at(trg)) {
-        
-        NodeType edgeSource = std::get<source>(edge);
-        newResult.var2BoundValue[src] = edgeSource;
-          
-      } else {
-        DEBUG_PRINT("SubgraphQueryResult::addEdge: edgeTarget %s "
-          " did not match var2BoundValue.at(trg) %s for tuple %s\n", 
-          edgeTarget.c_str(), var2BoundValue.at(trg).c_str(),
-          sam::toString(edge).c_str());
-
-        return std::pair<bool, SubgraphQueryResultType>(false, 
-          SubgraphQueryResultType());
-      } 
-    } else if (var2BoundValue.count(src) == 0 &&
-               var2BoundValue.count(trg) == 0)
-    { 
-      newResult.var2BoundValue[src] = edgeSource; 
-      newResult.var2BoundValue[trg] = edgeTarget;
-    } else {
-      
-      if (edgeTarget != var2BoundValue.at(trg) ||
-          edgeSource != var2BoundValue.at(src))
-      {
-        DEBUG_PRINT("SubgraphQueryResult::addEdge: edgeTarget %s "
-          " did not match var2BoundValue.at(trg) %s or edgeSource %s "
-          " dis not match var2BoundValue.at(src) %s for tuple %s\n", 
-          edgeTarget.c_str(), var2BoundValue.at(trg).c_str(),
-          edgeSource.c_str(), var2BoundValue.at(src).c_str(),
-          sam::toString(edge).c_str());
-
-
-
-        return std::pair<bool, SubgraphQueryResultType>(false,
-          SubgraphQueryResultType());
-      }
-
-    }
+    insertSeenEdge(key);
+    newResult.insertSeenEdge(key);
 
-    newResult.resultEdges.push_back(edge);
+    newResult.lastEdge = std::make_shared<const EdgeNode>(
+      EdgeNode{edge, lastEdge});
     newResult.currentEdge++;
 
     DEBUG_PRINT("SubgraphQueryResult::addEdge: Added edge %s, update query:"
@@ -797,13 +829,7 @@ getCurrentSource() const
     throw SubgraphQueryResultException(message);   
   }
 
-  std::string sourceVar = subgraphQuery->getEdgeDescription(
-                            currentEdge).getSource();
-  if (var2BoundValue.count(sourceVar) > 0) {
-    return var2BoundValue.at(sourceVar);
-  } else {
-    return nullValue<NodeType>();
-  }
+  return bindings[subgraphQuery->getSourceSlot(currentEdge)];
 }
 
 template <typename TupleType, size_t source, size_t target,
@@ -820,13 +846,7 @@ getCurrentTarget() const
     throw SubgraphQueryResultException(message);   
   }
 
-  std::string targetVar = subgraphQuery->getEdgeDescription(
-                            currentEdge).getTarget();
-  if (var2BoundValue.count(targetVar) > 0) {
-    return var2BoundValue.at(targetVar);
-  } else {
-    return nullValue<NodeType>();
-  }
+  return bindings[subgraphQuery->getTargetSlot(currentEdge)];
 }
 
 template <typename TupleType, size_t source, size_t target,
@@ -4,7 +4,25 @@
 #include <sam/SubgraphQueryResult.hpp>
 #include <sam/CompressedSparse.hpp>
 #include <sam/AbstractSubgraphPrinter.hpp>
+#include <sam/SlabAllocator.hpp>
+#include <sam/ResizableTable.hpp>
+#include <sam/MemoryBudget.hpp>
+#include <sam/Serialization.hpp>
+#include <sam/ThreadPool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
 #include <limits>
+#include <map>
+
+/// Default for how many partial results a processAgainstGraph level needs
+/// before it is expanded over the thread pool.
+#define SUBGRAPH_QUERY_RESULT_MAP_DEFAULT_PARALLEL_THRESHOLD 256
+
+/// How many partial results one expansion task extends at a time.
+#define SUBGRAPH_QUERY_RESULT_MAP_EXPANSION_CHUNK 32
 
 namespace sam {
 
@@ -40,6 +58,11 @@ public:
             TargetHF, TargetEF> CscType;
   typedef AbstractSubgraphPrinter<TupleType, source, target,
             time, duration> PrinterType;
+  typedef std::vector<QueryResultType, SlabAllocator<QueryResultType>>
+    ResultVectorType;
+  typedef typename QueryResultType::SubgraphQueryType SubgraphQueryType;
+  typedef std::vector<std::shared_ptr<const SubgraphQueryType>> QueryListType;
+  typedef std::function<void(QueryResultType const&)> CompletionListener;
 
 private:
   SourceHF sourceHash;
@@ -53,9 +76,6 @@ private:
   /// Reference to the compressed sparse column data structure
   CscType const& csc;
 
-  /// The size of the hash table storing intermediate query results.
-  size_t tableCapacity;
-
   /// The total number of query results that can be stored before
   /// results are overwritten.
   size_t resultCapacity;
@@ -67,18 +87,90 @@ private:
   /// The total number of query results
   std::atomic<uint64_t> numQueryResults; 
 
-  /// mutexes for each list element of alr.
-  std::mutex* mutexes;
-
-  /// An array of lists of results.  The first level is an 
-  /// array of size tableCapacity.  
-  std::vector<QueryResultType> *alr;
+  /// A hash table of vectors of intermediate results, with locks per
+  /// stripe of slots.  Grows and shrinks with the number of results.
+  ResizableTable<ResultVectorType>* alr;
 
   size_t numNodes;
   size_t nodeId;
 
   std::shared_ptr<PrinterType> printer;
 
+  /// Told about every complete result, if set.
+  CompletionListener completionListener;
+
+  /// Charged for every intermediate result stored, if set.
+  MemoryBudget* memoryBudget = nullptr;
+
+  /// Expands large processAgainstGraph levels in parallel, if set.
+  std::shared_ptr<ThreadPool> expansionPool;
+
+  /// How many partial results a level needs to use expansionPool.
+  size_t parallelThreshold =
+    SUBGRAPH_QUERY_RESULT_MAP_DEFAULT_PARALLEL_THRESHOLD;
+
+  std::atomic<size_t> numParallelLevels;
+  std::atomic<size_t> numExpansionTasks;
+
+  /// One level of processAgainstGraph split into chunks.  Shared with the
+  /// pool tasks, which may run after the level is done (they then find no
+  /// chunk left and return).
+  struct Expansion {
+    std::vector<QueryResultType*> frontier;
+    std::vector<std::list<QueryResultType>> extensions;
+    std::vector<size_t> work;
+    std::atomic<size_t> nextChunk;
+    std::atomic<size_t> chunksDone;
+    std::mutex mutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+  };
+
+  /**
+   * Charges a stored result to the memory budget: its size the first time,
+   * and what it grew by since after that (results grow in place as they
+   * are extended).  The total is kept with the result and is what credit
+   * gives back.
+   */
+  void charge(QueryResultType& result) {
+    if (memoryBudget) {
+      size_t bytes = result.memoryUsage();
+      if (bytes > result.getChargedBytes()) {
+        memoryBudget->add(MemoryCategory::Results,
+                          bytes - result.getChargedBytes());
+        result.setChargedBytes(bytes);
+      }
+    }
+  }
+
+  void credit(QueryResultType const& result) {
+    if (memoryBudget) {
+      memoryBudget->remove(MemoryCategory::Results,
+                           result.getChargedBytes());
+    }
+  }
+
+  /**
+   * Counts a complete result, keeps it in queryResults (unless the result
+   * capacity is zero), and hands it to the printer.  Results of count-only
+   * queries only go to the query's aggregate.
+   */
+  void completed(QueryResultType const& result) {
+    size_t index = numQueryResults.fetch_add(1);
+    if (completionListener) completionListener(result);
+    auto aggregate = result.getSubgraphQuery()->getAggregate();
+    if (aggregate) {
+      aggregate->add(result.getBindings(), result.getStartTime());
+      return;
+    }
+    if (resultCapacity > 0) {
+      queryResults[index % resultCapacity] = result;
+    }
+    if (printer) {
+      printer->print(result);
+    }
+  }
+
   #ifdef DETAIL_TIMING
   double totalTimeProcessAgainstGraph = 0;
   double totalAddSimpleTime = 0;
@@ -88,11 +180,13 @@ private:
   double totalTimeProcessProcessAgainstGraph = 0;
   double totalTimeProcessLoop1 = 0;
   double totalTimeProcessLoop2 = 0;
+  double totalTimeAddAnchored = 0;
   #endif
 
   #ifdef METRICS
   size_t totalResultsDeleted = 0;
   size_t totalResultsCreated = 0;
+  size_t totalAnchoredResults = 0;
   #endif
 
 public:
@@ -100,7 +194,8 @@ public:
    * Constructor.
    * \param numNodes How many nodes in the cluster.
    * \param nodeId The node id of this node.
-   * \param tableCapacity How many bins for intermediate query results.
+   * \param tableCapacity Initial number of bins for intermediate query 
+   *   results.  The table resizes itself based on load.
    * \param resultsCapacity How many completed queries can be stored.
    */
   SubgraphQueryResultMap( size_t numNodes,
@@ -137,6 +232,29 @@ public:
   void add(QueryResultType const& result, 
            std::list<EdgeRequestType>& edgeRequests);
 
+  /**
+   * Starts results for the query at a later edge description (the anchor)
+   * instead of the first; see QueryPlanner.  The tuple matches the anchor
+   * and is already in the graph.  The edges before the anchor arrived
+   * earlier, so they are looked up in the graph starting from the vertex
+   * the first edge shares with the anchor.  Each prefix that the tuple
+   * extends through the anchor is added with add(); prefixes that it
+   * doesn't are dropped rather than stored.
+   * \param query The query.
+   * \param anchor Index of the edge description the tuple is for (> 0).
+   * \param tuple The tuple.
+   * \param firstEdgeFrom Only use first edges starting at or after this.
+   * \param firstEdgeTo Only use first edges starting before this.
+   * \param edgeRequests Any result edge requests are added to this list.
+   * \return Returns a number representing the amount of work.
+   */
+  size_t addAnchored(std::shared_ptr<const SubgraphQueryType> query,
+                     size_t anchor,
+                     TupleType const& tuple,
+                     double firstEdgeFrom,
+                     double firstEdgeTo,
+                     std::list<EdgeRequestType>& edgeRequests);
+
   /**
    * Returns the number of completed results that have been created.
    */
@@ -157,11 +275,19 @@ public:
    * results may change during computation.
    */
   size_t getNumIntermediateResults() const {
-    size_t total = 0;
-    for(size_t i = 0; i < tableCapacity; i++) {
-      total += alr[i].size();
-    }
-    return total;
+    return alr->size();
+  }
+
+  /**
+   * Returns the current number of bins for intermediate results.
+   */
+  size_t getCapacity() const { return alr->getCapacity(); }
+
+  /**
+   * Returns the distribution of the number of intermediate results per bin.
+   */
+  ChainLengthStats getChainLengthStats() const {
+    return alr->getChainLengthStats();
   }
 
   size_t getResultCapacity() const {
@@ -169,6 +295,12 @@ public:
   }
 
   QueryResultType getResult(size_t index) const {
+    if (index >= resultCapacity) {
+      throw SubgraphQueryResultMapException("SubgraphQueryResultMap::"
+        "getResult index " + boost::lexical_cast<std::string>(index) +
+        " is past the result capacity " +
+        boost::lexical_cast<std::string>(resultCapacity));
+    }
     return queryResults[index];
   }
 
@@ -179,6 +311,87 @@ public:
     this->printer = printer;
   }
 
+  /**
+   * Calls the listener with every complete result, before it is handed
+   * off.  Called from the consume threads, so the listener has to be
+   * thread safe.  Call before processing tuples.
+   */
+  void setCompletionListener(CompletionListener listener) {
+    completionListener = listener;
+  }
+
+  /**
+   * Charges every intermediate result stored from now on to the given
+   * budget.  Call before adding results.
+   */
+  void setMemoryBudget(MemoryBudget* memoryBudget) {
+    this->memoryBudget = memoryBudget;
+  }
+
+  /**
+   * Expands the levels of processAgainstGraph with at least threshold
+   * partial results over the given pool.  The calling thread works on the
+   * level too, so the pool may be one whose tasks call process.  Call
+   * before processing tuples.
+   * \param pool The pool, or null to expand serially.
+   * \param threshold How many partial results a level needs.
+   */
+  void setExpansionPool(std::shared_ptr<ThreadPool> pool,
+    size_t threshold = SUBGRAPH_QUERY_RESULT_MAP_DEFAULT_PARALLEL_THRESHOLD)
+  {
+    if (threshold == 0) {
+      throw SubgraphQueryResultMapException("SubgraphQueryResultMap::"
+        "setExpansionPool: threshold must be at least one");
+    }
+    expansionPool = pool;
+    parallelThreshold = threshold;
+  }
+
+  /// How many processAgainstGraph levels were expanded over the pool.
+  size_t getNumParallelLevels() const { return numParallelLevels; }
+
+  /// How many tasks were handed to the pool for those levels.
+  size_t getNumExpansionTasks() const { return numExpansionTasks; }
+
+  /**
+   * Evicts the intermediate results that started earliest until at least
+   * the given number of bytes (as measured by memoryUsage()) is freed.
+   * Linear in the number of intermediate results.
+   * \return Returns the number of results evicted.
+   */
+  size_t evictOldest(size_t bytesToFree);
+
+  /**
+   * Evicts count intermediate results, those with the most edges left to
+   * find first and, among those, the ones that started earliest.  Linear
+   * in the number of intermediate results.
+   * \param count How many results to evict.
+   * \param evictedPerQuery Incremented by how many results of each query
+   *   were evicted.
+   * \return Returns the number of results evicted.
+   */
+  size_t shedFurthestFromCompletion(size_t count,
+    std::map<SubgraphQueryType const*, size_t>& evictedPerQuery);
+
+  /**
+   * Appends every intermediate result to out, one record per result.  A
+   * result's query is written as its index in queries.  Completed results
+   * have already been handed off and are not written.
+   * \throws SubgraphQueryResultMapException if a result's query isn't in
+   *   queries.
+   */
+  void checkpoint(std::string& out, QueryListType const& queries) const;
+
+  /**
+   * Loads what checkpoint() wrote, advancing p past it.  queries must be
+   * the same queries, in the same order, as were given to checkpoint().
+   * Results are decoded and inserted by numThreads threads.  No edge
+   * requests are generated; the ones that were outstanding when the
+   * checkpoint was taken are restored with the EdgeRequestMaps.
+   */
+  void restore(char const*& p, char const* end, QueryListType const& queries,
+               size_t numThreads);
+
   #ifdef DETAIL_TIMING
   // A number of methods that are only defined if we are collecting 
   // detailed timing information.
@@ -214,6 +427,9 @@ public:
   double getTotalTimeProcessLoop2() const {
     return totalTimeProcessLoop2;
   }
+  double getTotalTimeAddAnchored() const {
+    return totalTimeAddAnchored;
+  }
 
   #endif
 
@@ -222,6 +438,7 @@ public:
 
   size_t getTotalResultsDeleted() const { return totalResultsDeleted; }
   size_t getTotalResultsCreated() const { return totalResultsCreated; }
+  size_t getTotalAnchoredResults() const { return totalAnchoredResults; }
 
   #endif
 
@@ -234,21 +451,44 @@ private:
   std::function<bool(QueryResultType const&)> targetCheckFunction;
   std::function<bool(QueryResultType const&)> sourceTargetCheckFunction;
 
-  /**
-   * Adds a new intermediate result.  Doesn't check graphs.
-   * \param result The intermediate result to add.
-   * \param edgeRequests Any result edge requests are added to this list.
-   * \return Returns a number representing the amount of work.
-   */ 
-  size_t add_nocheck(QueryResultType const& result, 
-           std::list<EdgeRequestType>& edgeRequests);
-
   size_t process(TupleType const& tuple,
         std::list<EdgeRequestType>& edgeRequests,
         std::function<size_t(TupleType const&)> indexFunction, 
         std::function<bool(QueryResultType const&)> checkFunction );
 
   size_t processAgainstGraph(std::list<QueryResultType>& rehash);
+
+  /**
+   * Extends every result of one processAgainstGraph level, in chunks over
+   * expansionPool, and appends the extensions to next in the same order
+   * a serial pass would.
+   * \return Returns a number representing the amount of work.
+   */
+  size_t expandParallel(std::vector<QueryResultType*>& frontier,
+                        std::list<QueryResultType>& next);
+
+  /**
+   * Extends the chunks of the expansion not yet claimed by another thread.
+   */
+  void runChunks(std::shared_ptr<Expansion> expansion);
+
+  /**
+   * Stores the incomplete results, taking each stripe lock of the table
+   * once, and hands off the complete ones.
+   * \param results The results to add.
+   * \param edgeRequests Any result edge requests are added to this list.
+   * \return Returns a number representing the amount of work.
+   */
+  size_t addBatch(std::list<QueryResultType> const& results,
+                  std::list<EdgeRequestType>& edgeRequests);
+
+  /**
+   * Looks in the graph for edges that extend the result by its current
+   * edge and appends each extended result to extensions.
+   * \return Returns a number representing the amount of work.
+   */
+  size_t extendFromGraph(QueryResultType& result,
+                         std::list<QueryResultType>& extensions);
 };
 
 /// Constructor
@@ -268,7 +508,7 @@ SubgraphQueryResultMap<TupleType, source, target, time, duration,
 {
   sourceIndexFunction = [this](TupleType const& tuple) {
     SourceType src = std::get<source>(tuple);
-    size_t index = this->sourceHash(src) % this->tableCapacity;
+    size_t index = this->sourceHash(src);
     DEBUG_PRINT("Node %lu SubgraphQueryResultMap::sourceIndexFunction tuple "
      "%s index %lu \n", this->nodeId, sam::toString(tuple).c_str(), index)
     return index;
@@ -293,7 +533,7 @@ SubgraphQueryResultMap<TupleType, source, target, time, duration,
     DEBUG_PRINT("Node %lu SubgraphQueryResultMap::targetIndexFunction tuple "
       "%s\n", this->nodeId, sam::toString(tuple).c_str())
     TargetType trg = std::get<target>(tuple);
-    size_t index = this->targetHash(trg) % this->tableCapacity;
+    size_t index = this->targetHash(trg);
     DEBUG_PRINT("Node %lu SubgraphQueryResultMap::targetIndexFunction tuple "
       "%s index %lu\n", this->nodeId, sam::toString(tuple).c_str(), index)
     return index;
@@ -304,21 +544,33 @@ SubgraphQueryResultMap<TupleType, source, target, time, duration,
       "tuple %s\n", this->nodeId, sam::toString(tuple).c_str())
     SourceType src = std::get<source>(tuple);
     TargetType trg = std::get<target>(tuple);
-    return (this->targetHash(trg) * this->sourceHash(src)) 
-             % this->tableCapacity;
+    return this->targetHash(trg) * this->sourceHash(src);
   };
 
   this->numNodes = numNodes;
   this->nodeId = nodeId;
-  this->tableCapacity = tableCapacity;
   this->resultCapacity = resultCapacity;
   queryResults.resize(resultCapacity);
   
   numQueryResults = 0;
-
-  mutexes = new std::mutex[tableCapacity];
-
-  alr = new std::vector<QueryResultType>[tableCapacity];
+  numParallelLevels = 0;
+  numExpansionTasks = 0;
+
+  // Results are rehashed the same way SubgraphQueryResult::hash places
+  // them: by whichever of the next edge's source and target are bound.
+  alr = new ResizableTable<ResultVectorType>(tableCapacity,
+    [this](QueryResultType const& result, size_t& h) {
+      SourceType src = result.getCurrentSource();
+      TargetType trg = result.getCurrentTarget();
+      if (!isNull(src) && !isNull(trg)) {
+        h = this->sourceHash(src) * this->targetHash(trg);
+      } else if (!isNull(src)) {
+        h = this->sourceHash(src);
+      } else {
+        h = this->targetHash(trg);
+      }
+      return true;
+    });
 
 }
 
@@ -331,8 +583,7 @@ SubgraphQueryResultMap<TupleType, source, target, time, duration,
   SourceHF, TargetHF, SourceEF, TargetEF>::
 ~SubgraphQueryResultMap()
 {
-  delete[] mutexes;
-  delete[] alr;
+  delete alr;
 }
 
 template <typename TupleType, size_t source, size_t target,
@@ -355,59 +606,8 @@ add(QueryResultType const& result,
 
   processAgainstGraph(localQueryResults);
 
-  for (auto localQueryResult : localQueryResults) {
-    DEBUG_PRINT("Node %lu SubgraphQueryResultMap::add considering query result"
-      " %s\n", nodeId, localQueryResult.toString().c_str())
+  addBatch(localQueryResults, edgeRequests);
 
-    if (!localQueryResult.complete()) {
-
-      // The hash function also adds an edge request to the list if the
-      // thing we are looking for isn't going to come to this node.    
-      size_t newIndex = localQueryResult.hash(sourceHash, targetHash,
-                                    edgeRequests, nodeId, numNodes) 
-                                    % tableCapacity;
-      std::string requestString = "";
-      for(auto request : edgeRequests) {
-        requestString += request.toString() + "\n";
-      }
-      //DEBUG_PRINT("Node %lu SubgraphQueryResultMap::add result %s "
-      //  "edgeRequests.size() %lu edge requests %s\n", nodeId, 
-      //  localQueryResult.toString().c_str(), edgeRequests.size(), 
-      //  requestString.c_str())
-
-      // Determine which thread has the least amount of work and give it
-      // to that one.
-      //size_t minIndex = 0;
-      //size_t min = std::numeric_limits<size_t>::max();
-
-      //mutexes[newIndex].lock();
-      //size_t current_size = aalr[newIndex][i].size();
-      //mutexes[newIndex].unlock();
-      //if (current_size < min) {
-      //  min = current_size;
-      //  minIndex = i;
-      //}
-              
-      mutexes[newIndex].lock();
-      DEBUG_PRINT("Node %lu SubgraphQueryResultMap::add result %s "
-        " adding to alr[%lu]\n", nodeId, 
-        localQueryResult.toString().c_str(), newIndex);
-      alr[newIndex].push_back(localQueryResult);
-      mutexes[newIndex].unlock();
-
-      METRICS_INCREMENT(totalResultsCreated)
- 
-    } else {
-      DEBUG_PRINT("Node %lu Complete query! %s\n", nodeId, 
-        localQueryResult.toString().c_str());
-      size_t index = numQueryResults.fetch_add(1);
-      index = index % resultCapacity;
-      queryResults[index] = localQueryResult;
-      if (printer) {
-        printer->print(localQueryResult);
-      }
-    }
-  }
   DEBUG_PRINT("Node %lu exiting SubgraphQueryResultMap::add(result, csr, csc, "
     "edgeRequests)\n", nodeId);
 
@@ -415,70 +615,6 @@ add(QueryResultType const& result,
 }
 
 
-template <typename TupleType, size_t source, size_t target,
-          size_t time, size_t duration,
-          typename SourceHF, typename TargetHF,
-          typename SourceEF, typename TargetEF>
-size_t
-SubgraphQueryResultMap<TupleType, source, target, time, duration,
-  SourceHF, TargetHF, SourceEF, TargetEF>::
-add_nocheck(QueryResultType const& result, 
-    std::list<EdgeRequestType>& edgeRequests)
-{
-  DEBUG_PRINT("Node %lu SubgraphQueryResultMap::add edge request size %lu\n",
-    nodeId, edgeRequests.size());
-    
-  if (!result.complete()) {
-
-    // The hash function also adds an edge request to the list if the
-    // thing we are looking for isn't going to come to this node.    
-    size_t newIndex = result.hash(sourceHash, targetHash,
-                                  edgeRequests, nodeId, numNodes) 
-                                  % tableCapacity;
-    std::string requestString = "";
-    for(auto request : edgeRequests) {
-      requestString += request.toString() + "\n";
-    }
-    DEBUG_PRINT("Node %lu SubgraphQueryResultMap::add result %s "
-      "edgeRequests.size() %lu edge requests %s\n", nodeId, 
-      result.toString().c_str(), edgeRequests.size(), requestString.c_str());
-    
-    // Determine which thread has the least amount of work and give it
-    // to that one.
-    //size_t minIndex = 0;
-    //size_t min = std::numeric_limits<size_t>::max();
-    //for(size_t i = 0; i < numThreads; i++) {
-    //  mutexes[newIndex][i].lock();
-    //  size_t current_size = aalr[newIndex][i].size();
-    //  mutexes[newIndex][i].unlock();
-    //  if (current_size < min) {
-    //    min = current_size;
-    //    minIndex = i;
-    //  }
-    //}
-     
-    mutexes[newIndex].lock();
-    alr[newIndex].push_back(result);
-    mutexes[newIndex].unlock(); 
-
-    METRICS_INCREMENT(totalResultsCreated)
-
-  } else {
-    DEBUG_PRINT("Node %lu Complete query! %s\n", nodeId, 
-      result.toString().c_str());
-    size_t index = numQueryResults.fetch_add(1);
-    index = index % resultCapacity;
-    queryResults[index] = result;
-    if (printer) {
-      printer->print(result);
-    }
-  }
-
-  return 1;
-}
-
-
-
 template <typename TupleType, size_t source, size_t target,
           size_t time, size_t duration,
           typename SourceHF, typename TargetHF,
@@ -515,6 +651,153 @@ process(TupleType const& tuple,
   return workProcessSource + workProcessTarget + workProcessSourceTarget;
 }
 
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+size_t 
+SubgraphQueryResultMap<TupleType, source, target, time, duration,
+                       SourceHF, TargetHF, SourceEF, TargetEF>::
+extendFromGraph(QueryResultType& result,
+                std::list<QueryResultType>& extensions)
+{
+  size_t totalWork = 0;
+  std::list<TupleType> foundEdges;
+  csr.findEdges(result.getCurrentSource(),
+                result.getCurrentTarget(),
+                result.getCurrentStartTimeFirst(),
+                result.getCurrentStartTimeSecond(),
+                result.getCurrentEndTimeFirst(),
+                result.getCurrentEndTimeSecond(),
+                foundEdges);
+
+  DEBUG_PRINT("Node %lu SubgraphQueryResultMap::extendFromGraph "
+    "number of found edges from csr: %lu\n", nodeId, foundEdges.size());
+
+  csc.findEdges(result.getCurrentTarget(),
+                result.getCurrentSource(),
+                result.getCurrentStartTimeFirst(),
+                result.getCurrentStartTimeSecond(),
+                result.getCurrentEndTimeFirst(),
+                result.getCurrentEndTimeSecond(),
+                foundEdges);
+
+  DEBUG_PRINT("Node %lu SubgraphQueryResultMap::extendFromGraph "
+    "number of found edges from csr and csc: %lu\n", nodeId,
+    foundEdges.size());
+
+  for (auto const& edge : foundEdges) {
+    totalWork += 1;
+
+    DEBUG_PRINT("Node %lu SubgraphQueryResultMap::extendFromGraph "
+      "considering found edge %s for query result %s\n",
+      nodeId, sam::toString(edge).c_str(), result.toString().c_str());
+
+    std::pair<bool, QueryResultType> p = result.addEdge(edge);
+    if (p.first) {
+      DEBUG_PRINT("Node %lu SubgraphQueryResultMap::extendFromGraph "
+        "Created a new QueryResult: %s\n", nodeId,
+        p.second.toString().c_str());
+      extensions.push_back(p.second);
+    }
+  }
+  return totalWork;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+size_t 
+SubgraphQueryResultMap<TupleType, source, target, time, duration,
+                       SourceHF, TargetHF, SourceEF, TargetEF>::
+addAnchored(std::shared_ptr<const SubgraphQueryType> query,
+            size_t anchor,
+            TupleType const& tuple,
+            double firstEdgeFrom,
+            double firstEdgeTo,
+            std::list<EdgeRequestType>& edgeRequests)
+{
+  DETAIL_TIMING_BEG1
+
+  if (anchor == 0 || anchor >= query->size()) {
+    throw SubgraphQueryResultMapException("SubgraphQueryResultMap::"
+      "addAnchored: anchor " + std::to_string(anchor) + " is not a later "
+      "edge of the query");
+  }
+
+  // The first edge is found through the vertex it shares with the anchor.
+  auto const& first = query->getEdgeDescription(0);
+  auto const& anchorEdge = query->getEdgeDescription(anchor);
+  SourceType vertex;
+  bool firstBySource;
+  if (first.getSource() == anchorEdge.getSource() ||
+      first.getSource() == anchorEdge.getTarget())
+  {
+    firstBySource = true;
+    vertex = first.getSource() == anchorEdge.getSource() ?
+      std::get<source>(tuple) : std::get<target>(tuple);
+  } else if (first.getTarget() == anchorEdge.getSource() ||
+             first.getTarget() == anchorEdge.getTarget())
+  {
+    firstBySource = false;
+    vertex = first.getTarget() == anchorEdge.getSource() ?
+      std::get<source>(tuple) : std::get<target>(tuple);
+  } else {
+    throw SubgraphQueryResultMapException("SubgraphQueryResultMap::"
+      "addAnchored: the anchor doesn't share a vertex with the first edge");
+  }
+
+  double tupleTime = std::get<time>(tuple);
+  // The extent bounds the start of the first edge only when the query's
+  // times are relative to its start; relative to its end, a long first
+  // edge can start any time before.
+  double from = query->zeroTimeRelativeToStart() ?
+    std::max(firstEdgeFrom, tupleTime - query->getMaxTimeExtent()) :
+    firstEdgeFrom;
+  double lowest = std::numeric_limits<double>::lowest();
+  double highest = std::numeric_limits<double>::max();
+  std::list<TupleType> candidates;
+  if (firstBySource) {
+    csr.findEdges(vertex, nullValue<TargetType>(), from, tupleTime,
+                  lowest, highest, candidates);
+  } else {
+    csc.findEdges(vertex, nullValue<SourceType>(), from, tupleTime,
+                  lowest, highest, candidates);
+  }
+
+  size_t totalWork = candidates.size();
+  std::list<QueryResultType> prefixes;
+  for (auto const& candidate : candidates) {
+    double candidateTime = std::get<time>(candidate);
+    if (candidateTime >= firstEdgeTo) continue;
+    double queryStart = query->zeroTimeRelativeToStart() ? candidateTime :
+      candidateTime + std::get<duration>(candidate);
+    if (query->satisfiesConstraints(0, candidate, queryStart)) {
+      prefixes.push_back(QueryResultType(query, candidate));
+    }
+  }
+
+  // Fill in the edges before the anchor from the graph, then the anchor
+  // has to be this tuple.  Older tuples that match the anchor already had
+  // their turn.
+  for (auto prefix = prefixes.begin(); prefix != prefixes.end(); ++prefix) {
+    if (prefix->getCurrentEdge() < anchor) {
+      totalWork += extendFromGraph(*prefix, prefixes);
+    } else if (prefix->noSamId(std::get<0>(tuple))) {
+      totalWork++;
+      std::pair<bool, QueryResultType> p = prefix->addEdge(tuple);
+      if (p.first) {
+        METRICS_INCREMENT(totalAnchoredResults)
+        add(p.second, edgeRequests);
+      }
+    }
+  }
+
+  DETAIL_TIMING_END1(totalTimeAddAnchored);
+  return totalWork;
+}
+
 template <typename TupleType, size_t source, size_t target,
           size_t time, size_t duration,
           typename SourceHF, typename TargetHF,
@@ -526,7 +809,6 @@ processAgainstGraph(std::list<QueryResultType>& rehash)
 {
   DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph rehash size"
     " %lu at begining\n", nodeId, rehash.size());
-  auto frontier = rehash.begin();
 
   #ifdef DEBUG
   size_t iter = 0;
@@ -534,110 +816,33 @@ processAgainstGraph(std::list<QueryResultType>& rehash)
 
   size_t totalWork = 0;
 
-  // Put a placemarker at the end so we know when to stop iterating.
-  // The default constructor makes an object that is easy to tell that it
-  // is null.
-  rehash.push_back(QueryResultType());
-
+  // Each level extends the results the previous level created; the new
+  // results go to the end of the rehash list.
+  auto frontier = rehash.begin();
+  std::vector<QueryResultType*> incomplete;
   while (frontier != rehash.end()) {
     
     DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph "
       "rehash size %lu at beginning of while\n", nodeId, rehash.size());
-    
-    for (; !frontier->isNull(); ++frontier) 
-    {
-      DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph in "
-        "frontier for loop\n", this->nodeId);
-      // Only look at the graph if the result is not complete.
-      if (!frontier->complete()) {
-        std::list<TupleType> foundEdges;
-        //try {
-          csr.findEdges(frontier->getCurrentSource(),
-                      frontier->getCurrentTarget(),
-                      frontier->getCurrentStartTimeFirst(),
-                      frontier->getCurrentStartTimeSecond(),
-                      frontier->getCurrentEndTimeFirst(),
-                      frontier->getCurrentEndTimeSecond(),
-                      foundEdges);
-        //} catch (std::exception e) {
-        //  printf("e.what %s\n", e.what());
-        //  std::string message = "SubgraphQueryResultMap::"
-        //    "processAgainstGraph csr caught exception: " + std::string(e.what());
-        //  throw SubgraphQueryResultMapException(message);
-        //}
-
-        DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph "
-          "iter %lu number of found edges from csr: %lu\n", nodeId, iter, 
-          foundEdges.size());
-
-        for (auto edge : foundEdges) {
-          totalWork += 1;
-         
-          DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph "
-            "iter %luconsidering found edge %s for query result %s\n",
-            nodeId, iter, sam::toString(edge).c_str(), 
-            frontier->toString().c_str());
-          
-          std::pair<bool, QueryResultType> p = frontier->addEdge(edge);
-          if (p.first) {
-            DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph "
-              "iter %lu Created a new QueryResult: %s\n", nodeId, iter,
-              p.second.toString().c_str());
-            // push the new result to the end of the rehash list.
-            rehash.push_back(p.second);
-          }
-        }
 
-        foundEdges.clear();
-
-        //try {
-          csc.findEdges(frontier->getCurrentTarget(),
-                      frontier->getCurrentSource(),
-                      frontier->getCurrentStartTimeFirst(),
-                      frontier->getCurrentStartTimeSecond(),
-                      frontier->getCurrentEndTimeFirst(),
-                      frontier->getCurrentEndTimeSecond(),
-                      foundEdges);
-        //} catch (std::exception e) {
-        //  printf("e.what %s\n", e.what());
-        //  std::string message = "SubgraphQueryResultMap::"
-        //    "processAgainstGraph csc caught exception: " + std::string(e.what());
-        //  throw SubgraphQueryResultMapException(message);
-        //}
-
-        DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph "
-          "iter %lu number of found edges from csc: %lu\n", nodeId, iter, 
-          foundEdges.size());
-
-        for (auto edge : foundEdges) {
-          totalWork += 1;
-         
-          DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph "
-            "iter %luconsidering found edge %s for query result %s\n",
-            nodeId, iter, sam::toString(edge).c_str(), 
-            frontier->toString().c_str());
-          
-          std::pair<bool, QueryResultType> p = frontier->addEdge(edge);
-          if (p.first) {
-            DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph "
-              "iter %lu Created a new QueryResult: %s\n", nodeId, iter,
-              p.second.toString().c_str());
-            // push the new result to the end of the rehash list.
-            rehash.push_back(p.second);
-          }
-        }
-
-        DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph at" 
-          " end of for loop over found edges\n", nodeId);
+    // Only look at the graph if the result is not complete.
+    incomplete.clear();
+    for (; frontier != rehash.end(); ++frontier) {
+      if (!frontier->complete()) incomplete.push_back(&*frontier);
+    }
 
+    std::list<QueryResultType> next;
+    if (expansionPool && incomplete.size() >= parallelThreshold) {
+      totalWork += expandParallel(incomplete, next);
+    } else {
+      for (QueryResultType* result : incomplete) {
+        totalWork += extendFromGraph(*result, next);
       }
     }
-    //At this point frontier should be pointing at a null element.
-    //Get rid of it and go to the next element (if there is one, otherwise
-    //we exit from the while loop).
-    frontier = rehash.erase(frontier);
-    
-    rehash.push_back(QueryResultType());
+
+    if (next.empty()) break;
+    frontier = next.begin();
+    rehash.splice(rehash.end(), next);
     
     DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph"
       " rehash size %lu after processing frontier (iteration %lu)\n", 
@@ -646,19 +851,154 @@ processAgainstGraph(std::list<QueryResultType>& rehash)
     iter++;
     #endif
   }
-  // Get rid of the null element
-  rehash.pop_back();
   DEBUG_PRINT("Node %lu SubgraphQueryResultMap::processAgainstGraph exiting "
     "rehash size %lu totalWork %lu\n", nodeId, rehash.size(), totalWork);
-      
-  #ifdef DEBUG
-  iter++;
-  #endif
 
   return totalWork;
 
 }
 
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+size_t 
+SubgraphQueryResultMap<TupleType, source, target, time, duration,
+                       SourceHF, TargetHF, SourceEF, TargetEF>::
+expandParallel(std::vector<QueryResultType*>& frontier,
+               std::list<QueryResultType>& next)
+{
+  size_t chunk = SUBGRAPH_QUERY_RESULT_MAP_EXPANSION_CHUNK;
+  size_t numChunks = (frontier.size() + chunk - 1) / chunk;
+
+  auto expansion = std::make_shared<Expansion>();
+  expansion->frontier.swap(frontier);
+  expansion->extensions.resize(numChunks);
+  expansion->work.resize(numChunks, 0);
+  expansion->nextChunk = 0;
+  expansion->chunksDone = 0;
+
+  // The calling thread takes chunks too, so it never waits on a task that
+  // is still queued behind it.
+  size_t numTasks = std::min(expansionPool->getNumWorkers(), numChunks - 1);
+  for (size_t i = 0; i < numTasks; i++) {
+    expansionPool->submit([this, expansion]() { runChunks(expansion); });
+  }
+  runChunks(expansion);
+
+  {
+    std::unique_lock<std::mutex> lock(expansion->mutex);
+    expansion->done.wait(lock, [&expansion, numChunks]() {
+      return expansion->chunksDone.load() == numChunks;
+    });
+  }
+  numParallelLevels.fetch_add(1);
+  numExpansionTasks.fetch_add(numTasks);
+
+  frontier.swap(expansion->frontier);
+  if (expansion->error) std::rethrow_exception(expansion->error);
+
+  size_t totalWork = 0;
+  for (size_t c = 0; c < numChunks; c++) {
+    totalWork += expansion->work[c];
+    next.splice(next.end(), expansion->extensions[c]);
+  }
+  DEBUG_PRINT("Node %lu SubgraphQueryResultMap::expandParallel frontier %lu "
+    "chunks %lu tasks %lu new results %lu\n", nodeId, frontier.size(),
+    numChunks, numTasks, next.size());
+  return totalWork;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+SubgraphQueryResultMap<TupleType, source, target, time, duration,
+                       SourceHF, TargetHF, SourceEF, TargetEF>::
+runChunks(std::shared_ptr<Expansion> expansion)
+{
+  size_t chunk = SUBGRAPH_QUERY_RESULT_MAP_EXPANSION_CHUNK;
+  size_t numChunks = expansion->extensions.size();
+  while (true) {
+    size_t c = expansion->nextChunk.fetch_add(1);
+    if (c >= numChunks) return;
+
+    size_t end = std::min((c + 1) * chunk, expansion->frontier.size());
+    try {
+      for (size_t i = c * chunk; i < end; i++) {
+        expansion->work[c] += extendFromGraph(*expansion->frontier[i],
+                                              expansion->extensions[c]);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(expansion->mutex);
+      if (!expansion->error) expansion->error = std::current_exception();
+    }
+
+    if (expansion->chunksDone.fetch_add(1) + 1 == numChunks) {
+      std::lock_guard<std::mutex> lock(expansion->mutex);
+      expansion->done.notify_all();
+    }
+  }
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+size_t
+SubgraphQueryResultMap<TupleType, source, target, time, duration,
+                       SourceHF, TargetHF, SourceEF, TargetEF>::
+addBatch(std::list<QueryResultType> const& results,
+         std::list<EdgeRequestType>& edgeRequests)
+{
+  // (stripe, hash, result) for the incomplete results.  The hash function
+  // also adds an edge request to the list if the thing we are looking for
+  // isn't going to come to this node.
+  std::vector<std::tuple<size_t, size_t, QueryResultType const*>> order;
+  for (auto const& result : results) {
+    if (!result.complete()) {
+      size_t h = result.hash(sourceHash, targetHash, edgeRequests, nodeId,
+                             numNodes);
+      order.emplace_back(alr->getStripe(h), h, &result);
+    } else {
+      DEBUG_PRINT("Node %lu Complete query! %s\n", nodeId, 
+        result.toString().c_str());
+      completed(result);
+    }
+  }
+
+  // Group by stripe, keeping the order within a group.
+  std::stable_sort(order.begin(), order.end(),
+    [](std::tuple<size_t, size_t, QueryResultType const*> const& a,
+       std::tuple<size_t, size_t, QueryResultType const*> const& b) {
+      return std::get<0>(a) < std::get<0>(b);
+    });
+
+  size_t g = 0;
+  while (g < order.size()) {
+    size_t stripe = std::get<0>(order[g]);
+    std::unique_lock<std::mutex> lock;
+    alr->lockStripe(stripe, lock);
+    for (; g < order.size() && std::get<0>(order[g]) == stripe; g++) {
+      QueryResultType const& result = *std::get<2>(order[g]);
+      DEBUG_PRINT("Node %lu SubgraphQueryResultMap::addBatch result %s "
+        "adding to alr hash %lu\n", nodeId, result.toString().c_str(),
+        std::get<1>(order[g]));
+      ResultVectorType& bucket = alr->lockedBucket(std::get<1>(order[g]));
+      bucket.push_back(result);
+      bucket.back().setChargedBytes(0);
+      charge(bucket.back());
+      METRICS_INCREMENT(totalResultsCreated)
+    }
+    lock.unlock();
+  }
+  alr->added(order.size());
+  alr->maintain();
+
+  return results.size();
+}
+
 template <typename TupleType, size_t source, size_t target,
           size_t time, size_t duration,
           typename SourceHF, typename TargetHF,
@@ -674,7 +1014,7 @@ process(TupleType const& tuple,
 {
   DETAIL_TIMING_BEG1
 
-  size_t index = indexFunction(tuple);
+  size_t h = indexFunction(tuple);
 
   std::list<QueryResultType> rehash;
   
@@ -686,17 +1026,20 @@ process(TupleType const& tuple,
 
   size_t totalWork = 0;
 
-  mutexes[index].lock();
+  std::unique_lock<std::mutex> lock;
+  ResultVectorType& results = alr->lockBucket(h, lock);
   DEBUG_PRINT("Node %lu SubgraphQueryResultMap::process(tuple, "
-    "edgeRequests, indexFunction, checkFunction) alr[%lu].size() %lu "
-    "tuple %s\n", nodeId, index, alr[index].size(), toString(tuple).c_str());
+    "edgeRequests, indexFunction, checkFunction) results.size() %lu "
+    "tuple %s\n", nodeId, results.size(), toString(tuple).c_str());
     
-  for(auto l = this->alr[index].begin();
-        l != this->alr[index].end(); ) 
+  size_t numExpired = 0;
+  for(auto l = results.begin(); l != results.end(); ) 
   {
     totalWork++;
     if (l->isExpired(currentTime)) {
-      l = this->alr[index].erase(l);
+      credit(*l);
+      l = results.erase(l);
+      numExpired++;
       METRICS_INCREMENT(this->totalResultsDeleted)
     } else {
       if (checkFunction(*l)) {
@@ -715,6 +1058,7 @@ process(TupleType const& tuple,
           
           std::pair<bool, QueryResultType> p = l->addEdge(tuple);
           if (p.first) {
+            charge(*l);
 
             DEBUG_PRINT("Node %lu SubgraphQueryResultMap::process added "
               "tuple %s to result %s\n", nodeId, toString(tuple).c_str(),
@@ -730,7 +1074,9 @@ process(TupleType const& tuple,
     ++l;
     }
   }
-  mutexes[index].unlock();
+  lock.unlock();
+  alr->removed(numExpired);
+  alr->maintain();
   DEBUG_PRINT("Node %lu SubgraphQueryResultMap::process total work after for "
     "loop %lu\n", nodeId, totalWork);
  
@@ -745,13 +1091,7 @@ process(TupleType const& tuple,
   DETAIL_TIMING_END2(totalTimeProcessProcessAgainstGraph)
 
   DETAIL_TIMING_BEG2
-  size_t addWork = 0;
-  for (QueryResultType& result : rehash) {
-    DEBUG_PRINT("Node %lu SubgraphQueryResultMap::process rehashing " 
-           "query result %s\n", nodeId, result.toString().c_str());
-    
-    addWork += add_nocheck(result, edgeRequests);
-  }
+  size_t addWork = addBatch(rehash, edgeRequests);
   DEBUG_PRINT("Node %lu SubgraphQueryResultMap::process addWork %lu"
     " rehash size %lu\n", nodeId, addWork, rehash.size());
   DETAIL_TIMING_END2(totalTimeProcessLoop2)
@@ -762,6 +1102,210 @@ process(TupleType const& tuple,
   return totalWork;
 }
 
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+SubgraphQueryResultMap<TupleType, source, target, time, duration,
+                       SourceHF, TargetHF, SourceEF, TargetEF>::
+checkpoint(std::string& out, QueryListType const& queries) const
+{
+  std::map<SubgraphQueryType const*, uint32_t> queryIndex;
+  for (size_t i = 0; i < queries.size(); i++) {
+    queryIndex[queries[i].get()] = static_cast<uint32_t>(i);
+  }
+
+  size_t countOffset = out.size();
+  uint64_t numResults = 0;
+  serialize(out, numResults);
+
+  std::string record;
+  alr->forEachBucket([&](ResultVectorType& results) {
+    for (auto const& result : results) {
+      auto it = queryIndex.find(result.getSubgraphQuery().get());
+      if (it == queryIndex.end()) {
+        throw SubgraphQueryResultMapException("SubgraphQueryResultMap::"
+          "checkpoint: found a result for a query that isn't registered");
+      }
+      record.clear();
+      serialize(record, it->second);
+      result.checkpoint(record);
+      serialize(out, record);
+      numResults++;
+    }
+  });
+
+  std::memcpy(&out[countOffset], &numResults, sizeof(numResults));
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+void
+SubgraphQueryResultMap<TupleType, source, target, time, duration,
+                       SourceHF, TargetHF, SourceEF, TargetEF>::
+restore(char const*& p, char const* end, QueryListType const& queries,
+        size_t numThreads)
+{
+  std::vector<RecordType> records = readRecords(p, end);
+  alr->reserve(alr->size() + records.size());
+
+  forEachRecordInParallel(records, numThreads,
+    [this, &queries](char const* q, char const* recordEnd) {
+      uint32_t index;
+      deserialize(q, recordEnd, index);
+      if (index >= queries.size()) {
+        throw SubgraphQueryResultMapException("SubgraphQueryResultMap::"
+          "restore: result refers to query " +
+          boost::lexical_cast<std::string>(index) + " but only " +
+          boost::lexical_cast<std::string>(queries.size()) +
+          " are registered");
+      }
+      QueryResultType result;
+      result.restore(q, recordEnd, queries[index]);
+
+      // The requests hash() would make are already out there.
+      std::list<EdgeRequestType> edgeRequests;
+      size_t h = result.hash(this->sourceHash, this->targetHash,
+                             edgeRequests, this->nodeId, this->numNodes);
+      std::unique_lock<std::mutex> lock;
+      ResultVectorType& results = this->alr->lockBucket(h, lock);
+      results.push_back(result);
+      this->alr->added();
+      this->charge(results.back());
+      lock.unlock();
+      this->alr->maintain();
+    });
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+size_t 
+SubgraphQueryResultMap<TupleType, source, target, time, duration,
+                       SourceHF, TargetHF, SourceEF, TargetEF>::
+evictOldest(size_t bytesToFree)
+{
+  // First pass: find the start time cutoff that frees enough bytes.
+  std::vector<std::pair<double, size_t>> sizes;
+  alr->forEachBucket([&sizes](ResultVectorType& results) {
+    for (auto const& result : results) {
+      sizes.push_back(std::make_pair(result.getStartTime(), 
+                                     result.memoryUsage()));
+    }
+  });
+  if (sizes.size() == 0 || bytesToFree == 0) return 0;
+
+  std::sort(sizes.begin(), sizes.end());
+  size_t freed = 0;
+  size_t numToEvict = 0;
+  while (numToEvict < sizes.size() && freed < bytesToFree) {
+    freed += sizes[numToEvict].second;
+    numToEvict++;
+  }
+  double cutoff = sizes[numToEvict - 1].first;
+
+  // Second pass: evict everything that started before the cutoff, plus as
+  // many at the cutoff as we counted.
+  size_t atCutoff = 0;
+  for (size_t i = 0; i < numToEvict; i++) {
+    if (sizes[i].first == cutoff) atCutoff++;
+  }
+  size_t evicted = 0;
+  alr->forEachBucket([this, cutoff, &atCutoff, &evicted]
+                     (ResultVectorType& results) 
+  {
+    size_t removed = 0;
+    for (auto l = results.begin(); l != results.end(); ) {
+      bool evict = l->getStartTime() < cutoff;
+      if (!evict && l->getStartTime() == cutoff && atCutoff > 0) {
+        atCutoff--;
+        evict = true;
+      }
+      if (evict) {
+        credit(*l);
+        l = results.erase(l);
+        removed++;
+        METRICS_INCREMENT(this->totalResultsDeleted)
+      } else {
+        ++l;
+      }
+    }
+    this->alr->removed(removed);
+    evicted += removed;
+  });
+  alr->maintain();
+  return evicted;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration,
+          typename SourceHF, typename TargetHF,
+          typename SourceEF, typename TargetEF>
+size_t
+SubgraphQueryResultMap<TupleType, source, target, time, duration,
+                       SourceHF, TargetHF, SourceEF, TargetEF>::
+shedFurthestFromCompletion(size_t count,
+  std::map<SubgraphQueryType const*, size_t>& evictedPerQuery)
+{
+  // First pass: find the (edges left, start time) cutoff.  Results sort
+  // most edges left first, then earliest start.
+  typedef std::pair<size_t, double> KeyType;
+  auto key = [](QueryResultType const& result) {
+    return KeyType(result.getSubgraphQuery()->size() -
+                   result.getCurrentEdge(), -result.getStartTime());
+  };
+  std::vector<KeyType> keys;
+  alr->forEachBucket([&keys, &key](ResultVectorType& results) {
+    for (auto const& result : results) {
+      keys.push_back(key(result));
+    }
+  });
+  if (keys.size() == 0 || count == 0) return 0;
+
+  size_t numToEvict = std::min(count, keys.size());
+  std::nth_element(keys.begin(), keys.begin() + (numToEvict - 1), keys.end(),
+    std::greater<KeyType>());
+  KeyType cutoff = keys[numToEvict - 1];
+  size_t atCutoff = 0;
+  for (size_t i = 0; i < numToEvict; i++) {
+    if (keys[i] == cutoff) atCutoff++;
+  }
+
+  // Second pass: evict everything past the cutoff, plus as many at the
+  // cutoff as we counted.
+  size_t evicted = 0;
+  alr->forEachBucket([this, cutoff, &key, &atCutoff, &evicted,
+                      &evictedPerQuery](ResultVectorType& results)
+  {
+    size_t removed = 0;
+    for (auto l = results.begin(); l != results.end(); ) {
+      KeyType k = key(*l);
+      bool evict = k > cutoff;
+      if (!evict && k == cutoff && atCutoff > 0) {
+        atCutoff--;
+        evict = true;
+      }
+      if (evict) {
+        evictedPerQuery[l->getSubgraphQuery().get()]++;
+        credit(*l);
+        l = results.erase(l);
+        removed++;
+        METRICS_INCREMENT(this->totalResultsDeleted)
+      } else {
+        ++l;
+      }
+    }
+    this->alr->removed(removed);
+    evicted += removed;
+  });
+  alr->maintain();
+  return evicted;
+}
+
 }
 
 
@@ -0,0 +1,499 @@
+#ifndef SAM_SUBGRAPH_RESULT_SINK_HPP
+#define SAM_SUBGRAPH_RESULT_SINK_HPP
+
+#include <sam/AbstractSubgraphPrinter.hpp>
+#include <sam/Serialization.hpp>
+#include <sam/Util.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/// How many results can wait for the writer thread.  When the queue is
+/// full, results are dropped (and counted) rather than making the matching
+/// thread wait.
+#define SUBGRAPH_RESULT_SINK_DEFAULT_CAPACITY 65536
+
+/// The writer thread writes at most this many results per write call.
+#define SUBGRAPH_RESULT_SINK_BATCH_SIZE 256
+
+/// Milliseconds between fsyncs of the output file.
+#define SUBGRAPH_RESULT_SINK_DEFAULT_SYNC_INTERVAL 1000
+
+/// Microseconds the writer thread sleeps when there is nothing to write.
+#define SUBGRAPH_RESULT_SINK_IDLE_SLEEP 200
+
+namespace sam {
+
+class SubgraphResultSinkException : public std::runtime_error
+{
+public:
+  SubgraphResultSinkException(char const* message) :
+    std::runtime_error(message) {}
+  SubgraphResultSinkException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * The output formats of a SubgraphResultSink.
+ *
+ * Binary - Each result is a 32 bit length followed by that many bytes:
+ *   the start time of the result (a double) and the result's edges as a
+ *   vector of tuples, both in the encoding of Serialization.hpp.  Read
+ *   back with SubgraphResultSink::readBinary.
+ *
+ * JsonLines - One JSON object per line with the start time and the id,
+ *   source, target, time, and duration of each edge.
+ */
+enum class SinkFormat
+{
+  Binary,
+  JsonLines
+};
+
+/**
+ * A subgraph printer that takes results off the matching threads.
+ *
+ * print() copies the result onto a lock-free queue and returns; it never
+ * waits on a lock or on I/O.  A writer thread takes results off the queue
+ * in batches, hands each to the subscribers, and appends the batch to the
+ * output file with one write call.  The file is fsynced every syncInterval
+ * milliseconds, and when the sink is flushed or destroyed.
+ *
+ * Results that arrive while the queue is full are dropped and counted
+ * (getNumDropped), so a slow disk or subscriber shows up as drops rather
+ * than as matching slowing down.
+ *
+ * Interrupted and short writes are retried.  If a write fails, the file is
+ * truncated back to the end of the last complete batch and nothing more
+ * is written to it (getWriteFailed); subscribers still get every result.
+ *
+ * Subscribers run on the writer thread, one result at a time, and should
+ * be quick.  Pass an empty file name to only deliver to subscribers.
+ *
+ * Completed results are also kept in GraphStore's cyclic results buffer
+ * unless it was given a result capacity of zero.
+ */
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+class SubgraphResultSink :
+  public AbstractSubgraphPrinter<TupleType, source, target, time, duration>
+{
+public:
+  typedef typename AbstractSubgraphPrinter<TupleType, source, target, time,
+    duration>::ResultType ResultType;
+  typedef std::function<void(ResultType const&)> SubscriberType;
+  /// Has the signature of ::write.
+  typedef std::function<ssize_t(int, void const*, size_t)> WriteFunctionType;
+
+private:
+  SinkFormat format;
+  int fd = -1;
+  size_t syncInterval;
+
+  boost::lockfree::queue<ResultType*> queue;
+
+  std::mutex subscriberMutex;
+  std::vector<SubscriberType> subscribers;
+  /// Guarded by subscriberMutex.
+  WriteFunctionType writeFunction;
+
+  /// Bytes of complete batches in the file.
+  off_t fileSize = 0;
+
+  std::thread writer;
+  std::atomic<bool> running;
+
+  std::atomic<size_t> numPublished; ///> Results put on the queue.
+  std::atomic<size_t> numDropped; ///> Results dropped because it was full.
+  std::atomic<size_t> numWritten; ///> Results taken off the queue and output.
+  std::atomic<size_t> numSyncs;
+  std::atomic<size_t> numWriteErrors;
+  std::atomic<bool> writeFailed;
+
+  /**
+   * The writer thread.
+   */
+  void run();
+
+  /**
+   * Writes out everything on the queue.
+   * \return Returns the number of results written.
+   */
+  size_t drain(std::vector<ResultType*>& batch, std::string& buffer);
+
+  /**
+   * Writes all of the buffer, retrying interrupted and short writes.
+   * \return Returns false if a write failed.
+   */
+  bool writeAll(WriteFunctionType const& write, std::string const& buffer);
+
+  void sync();
+
+  void appendBinary(ResultType const& result, std::string& buffer) const;
+  void appendJson(ResultType const& result, std::string& buffer) const;
+
+public:
+  /**
+   * \param fileLocation Where to write results; truncated if it exists.
+   *   If empty, results only go to subscribers.
+   * \param format The format of the file.
+   * \param capacity How many results can wait to be written.
+   * \param syncInterval Milliseconds between fsyncs.
+   * \throws SubgraphResultSinkException if the file can't be opened.
+   */
+  SubgraphResultSink(std::string fileLocation,
+    SinkFormat format = SinkFormat::Binary,
+    size_t capacity = SUBGRAPH_RESULT_SINK_DEFAULT_CAPACITY,
+    size_t syncInterval = SUBGRAPH_RESULT_SINK_DEFAULT_SYNC_INTERVAL);
+
+  ~SubgraphResultSink();
+
+  /**
+   * Publishes the result.  Doesn't block.
+   */
+  void print(ResultType const& result);
+
+  /**
+   * Adds a function that is called with each result on the writer thread.
+   */
+  void subscribe(SubscriberType subscriber) {
+    std::lock_guard<std::mutex> lock(subscriberMutex);
+    subscribers.push_back(subscriber);
+  }
+
+  /**
+   * Replaces the call used to write the file, e.g. to simulate a failing
+   * disk in tests.
+   */
+  void setWriteFunction(WriteFunctionType function) {
+    std::lock_guard<std::mutex> lock(subscriberMutex);
+    writeFunction = function;
+  }
+
+  /**
+   * Waits until every result published so far has been written, then
+   * syncs the file.
+   */
+  void flush();
+
+  size_t getNumPublished() const { return numPublished; }
+  size_t getNumDropped() const { return numDropped; }
+  size_t getNumWritten() const { return numWritten; }
+  size_t getNumSyncs() const { return numSyncs; }
+  size_t getNumWriteErrors() const { return numWriteErrors; }
+
+  /// True once a write has failed and the file is no longer written.
+  bool getWriteFailed() const { return writeFailed; }
+
+  /**
+   * Reads a file written in the Binary format.
+   * \param fileLocation The file.
+   * \param callback Called with the start time and edges of each result.
+   * \return Returns the number of results read.
+   * \throws SubgraphResultSinkException if the file can't be read and
+   *   SerializationException if it is truncated.
+   */
+  static size_t readBinary(std::string fileLocation,
+    std::function<void(double, std::vector<TupleType> const&)> callback);
+};
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+SubgraphResultSink<TupleType, source, target, time, duration>::
+SubgraphResultSink(std::string fileLocation, SinkFormat format,
+                   size_t capacity, size_t syncInterval) :
+  format(format), syncInterval(syncInterval), queue(capacity),
+  writeFunction([](int fd, void const* p, size_t n) {
+    return ::write(fd, p, n);
+  }),
+  running(true), numPublished(0), numDropped(0), numWritten(0),
+  numSyncs(0), numWriteErrors(0), writeFailed(false)
+{
+  if (capacity == 0) {
+    throw SubgraphResultSinkException("SubgraphResultSink: capacity must be"
+      " at least one");
+  }
+  if (fileLocation != "") {
+    fd = ::open(fileLocation.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      throw SubgraphResultSinkException("SubgraphResultSink: couldn't open " +
+        fileLocation + " for writing results");
+    }
+  }
+  writer = std::thread([this]() { run(); });
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+SubgraphResultSink<TupleType, source, target, time, duration>::
+~SubgraphResultSink()
+{
+  running = false;
+  writer.join();
+  if (fd >= 0) {
+    sync();
+    ::close(fd);
+  }
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+void
+SubgraphResultSink<TupleType, source, target, time, duration>::
+print(ResultType const& result)
+{
+  ResultType* copy = new ResultType(result);
+  if (queue.bounded_push(copy)) {
+    numPublished.fetch_add(1);
+  } else {
+    delete copy;
+    numDropped.fetch_add(1);
+  }
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+void
+SubgraphResultSink<TupleType, source, target, time, duration>::
+run()
+{
+  typedef std::chrono::steady_clock ClockType;
+  std::vector<ResultType*> batch;
+  std::string buffer;
+  auto lastSync = ClockType::now();
+  bool dirty = false;
+
+  while (running) {
+    if (drain(batch, buffer) > 0) {
+      dirty = true;
+    } else {
+      std::this_thread::sleep_for(
+        std::chrono::microseconds(SUBGRAPH_RESULT_SINK_IDLE_SLEEP));
+    }
+    if (dirty && ClockType::now() - lastSync >=
+        std::chrono::milliseconds(syncInterval))
+    {
+      sync();
+      lastSync = ClockType::now();
+      dirty = false;
+    }
+  }
+
+  // Anything published before the sink was destroyed is still written.
+  drain(batch, buffer);
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+size_t
+SubgraphResultSink<TupleType, source, target, time, duration>::
+drain(std::vector<ResultType*>& batch, std::string& buffer)
+{
+  size_t total = 0;
+  while (true) {
+    batch.clear();
+    buffer.clear();
+    ResultType* result;
+    while (batch.size() < SUBGRAPH_RESULT_SINK_BATCH_SIZE &&
+           queue.pop(result))
+    {
+      batch.push_back(result);
+    }
+    if (batch.empty()) return total;
+
+    WriteFunctionType write;
+    {
+      std::lock_guard<std::mutex> lock(subscriberMutex);
+      for (ResultType* r : batch) {
+        for (auto& subscriber : subscribers) {
+          subscriber(*r);
+        }
+      }
+      write = writeFunction;
+    }
+
+    if (fd >= 0 && !writeFailed) {
+      for (ResultType* r : batch) {
+        if (format == SinkFormat::Binary) {
+          appendBinary(*r, buffer);
+        } else {
+          appendJson(*r, buffer);
+        }
+      }
+      if (writeAll(write, buffer)) {
+        fileSize += buffer.size();
+      } else {
+        // Don't leave part of a result at the end of the file.
+        numWriteErrors.fetch_add(1);
+        writeFailed = true;
+        if (::ftruncate(fd, fileSize) != 0) {
+          DEBUG_PRINT("SubgraphResultSink::drain couldn't truncate to %ld "
+            "bytes\n", static_cast<long>(fileSize));
+        }
+      }
+    }
+
+    for (ResultType* r : batch) delete r;
+    numWritten.fetch_add(batch.size());
+    total += batch.size();
+  }
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+bool
+SubgraphResultSink<TupleType, source, target, time, duration>::
+writeAll(WriteFunctionType const& write, std::string const& buffer)
+{
+  char const* p = buffer.data();
+  size_t left = buffer.size();
+  while (left > 0) {
+    ssize_t n = write(fd, p, left);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      DEBUG_PRINT("SubgraphResultSink::writeAll couldn't write %lu bytes\n",
+        left);
+      return false;
+    }
+    p += n;
+    left -= n;
+  }
+  return true;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+void
+SubgraphResultSink<TupleType, source, target, time, duration>::
+sync()
+{
+  if (fd >= 0) {
+    ::fsync(fd);
+    numSyncs.fetch_add(1);
+  }
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+void
+SubgraphResultSink<TupleType, source, target, time, duration>::
+flush()
+{
+  size_t published = numPublished;
+  while (numWritten < published) {
+    std::this_thread::sleep_for(
+      std::chrono::microseconds(SUBGRAPH_RESULT_SINK_IDLE_SLEEP));
+  }
+  sync();
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+void
+SubgraphResultSink<TupleType, source, target, time, duration>::
+appendBinary(ResultType const& result, std::string& buffer) const
+{
+  std::string record;
+  serialize(record, result.getStartTime());
+  serialize(record, result.getResultTuples());
+  serialize(buffer, static_cast<uint32_t>(record.size()));
+  buffer += record;
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+void
+SubgraphResultSink<TupleType, source, target, time, duration>::
+appendJson(ResultType const& result, std::string& buffer) const
+{
+  auto quote = [](std::string const& s) {
+    std::string quoted = "\"";
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        quoted += '\\';
+        quoted += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        quoted += escaped;
+      } else {
+        quoted += c;
+      }
+    }
+    return quoted + "\"";
+  };
+
+  buffer += "{\"start\":" +
+    boost::lexical_cast<std::string>(result.getStartTime()) + ",\"edges\":[";
+  std::vector<TupleType> edges = result.getResultTuples();
+  for (size_t i = 0; i < edges.size(); i++) {
+    TupleType const& edge = edges[i];
+    if (i > 0) buffer += ",";
+    buffer += "{\"id\":" +
+      boost::lexical_cast<std::string>(std::get<0>(edge)) +
+      ",\"source\":" +
+      quote(boost::lexical_cast<std::string>(std::get<source>(edge))) +
+      ",\"target\":" +
+      quote(boost::lexical_cast<std::string>(std::get<target>(edge))) +
+      ",\"time\":" + boost::lexical_cast<std::string>(std::get<time>(edge)) +
+      ",\"duration\":" +
+      boost::lexical_cast<std::string>(std::get<duration>(edge)) + "}";
+  }
+  buffer += "]}\n";
+}
+
+template <typename TupleType, size_t source, size_t target,
+          size_t time, size_t duration>
+size_t
+SubgraphResultSink<TupleType, source, target, time, duration>::
+readBinary(std::string fileLocation,
+  std::function<void(double, std::vector<TupleType> const&)> callback)
+{
+  std::ifstream in(fileLocation, std::ios::binary);
+  if (!in) {
+    throw SubgraphResultSinkException("SubgraphResultSink::readBinary: "
+      "couldn't open " + fileLocation);
+  }
+  std::string contents((std::istreambuf_iterator<char>(in)),
+                        std::istreambuf_iterator<char>());
+
+  char const* p = contents.data();
+  char const* end = p + contents.size();
+  size_t count = 0;
+  while (p < end) {
+    uint32_t length;
+    deserialize(p, end, length);
+    if (end - p < static_cast<std::ptrdiff_t>(length)) {
+      throw SerializationException("SubgraphResultSink::readBinary: "
+        "truncated result");
+    }
+    char const* recordEnd = p + length;
+    double startTime;
+    std::vector<TupleType> edges;
+    deserialize(p, recordEnd, startTime);
+    deserialize(p, recordEnd, edges);
+    p = recordEnd;
+    callback(startTime, edges);
+    count++;
+  }
+  return count;
+}
+
+}
+
+#endif
@@ -0,0 +1,404 @@
+#ifndef SAM_TEMPORAL_MOTIF_COUNTER_HPP
+#define SAM_TEMPORAL_MOTIF_COUNTER_HPP
+
+#include <sam/AbstractConsumer.hpp>
+#include <sam/BaseComputation.hpp>
+#include <sam/FeatureMap.hpp>
+#include <sam/FeatureProducer.hpp>
+#include <sam/Features.hpp>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <boost/lexical_cast.hpp>
+
+/// Default seed of the sampling in TemporalMotifCounter.
+#define TEMPORAL_MOTIF_COUNTER_DEFAULT_SEED 1
+
+namespace sam {
+
+class TemporalMotifCounterException : public std::runtime_error
+{
+public:
+  TemporalMotifCounterException(char const* message) :
+    std::runtime_error(message) {}
+  TemporalMotifCounterException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * Counts small temporal motifs in a stream of edges without going through
+ * subgraph queries.  All of a motif's edges have strictly increasing times
+ * and start less than delta seconds after the first (so a motif is what
+ * RunTrianglesComplex's query, with starttime(e) < delta, would match):
+ *
+ *  - Triangles: x -> y, y -> z, z -> x (the RunTrianglesComplex query).
+ *  - Wedges: x -> y, y -> z with x != z.
+ *  - 2-cycles: x -> y, y -> x.
+ *
+ * Self-loops are ignored.
+ *
+ * Each motif is counted when its last edge arrives, from the edges of the
+ * last delta seconds.  Those are kept as sorted adjacency: for every
+ * vertex, a map from neighbor to the times of the edges with it, in and
+ * out.  The triangles closed by z -> x are
+ * found by intersecting the out-neighbors of x with the in-neighbors of z
+ * (leapfrog over the two maps) and counting the time ordered pairs for
+ * each common neighbor; wedges and 2-cycles are a binary search in one
+ * list.  Nothing is kept per partial match, which is where the general
+ * matcher spends its time.
+ *
+ * The counts are cumulative, like SubgraphAggregate's, and are published
+ * to the FeatureMap:
+ *
+ *  - The totals under key "" and feature names identifier + "_triangles",
+ *    identifier + "_wedges", and identifier + "_cycles".
+ *  - Per vertex under the same feature names: the triangles and 2-cycles
+ *    the vertex is in, and the wedges centered on it.
+ *
+ * With a sampling probability p under 1, only a fraction p of the edges
+ * are kept in the window (every edge is still checked as the last edge of
+ * a motif), and a motif found is counted as 1 / p^k, where k is the number
+ * of its kept edges (2 for triangles, 1 for the others).  The counts are
+ * then unbiased estimates, for streams too fast to count exactly.
+ *
+ * Edges can arrive somewhat out of time order, e.g. from several
+ * ZeroMQPushPull threads.  A late edge is inserted at its time, and edges
+ * expire delta seconds after the latest edge seen.  A late edge only
+ * counts the motifs it is the last edge of; those it is an earlier edge
+ * of were looked for before it arrived and are missed.  Edges more than
+ * delta seconds late aren't kept.  getNumLate says how many edges were
+ * late, so the counts are exact when it is zero.
+ *
+ * consume can be called by several threads; the tuples are counted one at
+ * a time.
+ */
+template <typename TupleType, size_t source, size_t target, size_t time>
+class TemporalMotifCounter : public AbstractConsumer<TupleType>,
+                             public BaseComputation,
+                             public FeatureProducer
+{
+public:
+  typedef typename std::tuple_element<source, TupleType>::type NodeType;
+
+private:
+  /// The edges of a vertex in the window, by neighbor and in time order.
+  struct Adjacency {
+    std::map<NodeType, std::deque<double>> neighbors;
+    std::deque<double> times;
+  };
+
+  double delta;
+  double samplingProbability;
+
+  std::unordered_map<NodeType, Adjacency> out;
+  std::unordered_map<NodeType, Adjacency> in;
+
+  /// The kept edges in time order, to expire them.
+  std::deque<std::tuple<NodeType, NodeType, double>> window;
+
+  /// The latest time of an edge.
+  double latest = std::numeric_limits<double>::lowest();
+
+  std::mt19937 generator;
+  std::uniform_real_distribution<double> distribution;
+  mutable std::mutex mutex;
+
+  /// Counts by motif feature name and vertex ("" for the total).
+  std::map<std::string, std::unordered_map<std::string, double>> counts;
+
+  std::string trianglesName;
+  std::string wedgesName;
+  std::string cyclesName;
+
+  std::atomic<size_t> numFailedUpdates;
+  std::atomic<size_t> numLate;
+
+  /// How many edges of the list are before t.
+  static size_t countBefore(std::deque<double> const& times, double t) {
+    return std::lower_bound(times.begin(), times.end(), t) - times.begin();
+  }
+
+  /// Adds t after the times not greater than it.
+  static void insertSorted(std::deque<double>& times, double t) {
+    times.insert(std::upper_bound(times.begin(), times.end(), t), t);
+  }
+
+  /// Removes the kept edges that are too old to be in a motif ending at t
+  /// or later.
+  void expire(double t);
+
+  /// Removes the oldest time of the edge from the adjacency.
+  static void removeOldest(std::unordered_map<NodeType, Adjacency>& adjacency,
+                           NodeType const& vertex, NodeType const& neighbor);
+
+  /// Adds count to the motif count of each of the vertices.
+  void add(std::string const& name, double count,
+           std::initializer_list<NodeType const*> vertices);
+
+  /// Adds count to the motif count of one vertex, or the total for "".
+  void add(std::string const& name, std::string const& key, double count);
+
+public:
+  /**
+   * \param delta How many seconds all of a motif's edges fall within.
+   * \param nodeId The node this runs on.
+   * \param featureMap Where the counts are published.
+   * \param identifier The prefix of the feature names.
+   * \param samplingProbability The fraction of edges kept in the window.
+   *   One counts exactly.
+   * \param seed Seed for the sampling.
+   */
+  TemporalMotifCounter(double delta,
+                       size_t nodeId,
+                       std::shared_ptr<FeatureMap> featureMap,
+                       std::string identifier,
+                       double samplingProbability = 1,
+                       unsigned seed = TEMPORAL_MOTIF_COUNTER_DEFAULT_SEED);
+
+  /**
+   * Counts the motifs the tuple is the last edge of, then adds the tuple
+   * to the window (if it is sampled).  Subscribers are notified with the
+   * number of triangles the tuple closed.
+   */
+  bool consume(TupleType const& tuple);
+
+  void terminate() {}
+
+  /// The count of a motif for a vertex (or its total for ""), or 0.
+  double getCount(std::string const& name, std::string const& key) const;
+
+  double getNumTriangles() const { return getCount(trianglesName, ""); }
+  double getNumWedges() const { return getCount(wedgesName, ""); }
+  double getNumCycles() const { return getCount(cyclesName, ""); }
+
+  std::string const& getTrianglesName() const { return trianglesName; }
+  std::string const& getWedgesName() const { return wedgesName; }
+  std::string const& getCyclesName() const { return cyclesName; }
+
+  /// How many edges are kept in the window.
+  size_t getNumEdgesInWindow() const { return window.size(); }
+
+  double getDelta() const { return delta; }
+  double getSamplingProbability() const { return samplingProbability; }
+
+  /// Counts that couldn't be published because the feature map was full.
+  size_t getNumFailedUpdates() const { return numFailedUpdates; }
+
+  /// Edges that arrived after a later edge.
+  size_t getNumLate() const { return numLate; }
+};
+
+template <typename TupleType, size_t source, size_t target, size_t time>
+TemporalMotifCounter<TupleType, source, target, time>::
+TemporalMotifCounter(double delta,
+                     size_t nodeId,
+                     std::shared_ptr<FeatureMap> featureMap,
+                     std::string identifier,
+                     double samplingProbability,
+                     unsigned seed) :
+  BaseComputation(nodeId, featureMap, identifier),
+  delta(delta), samplingProbability(samplingProbability),
+  generator(seed), distribution(0, 1),
+  trianglesName(identifier + "_triangles"),
+  wedgesName(identifier + "_wedges"),
+  cyclesName(identifier + "_cycles"),
+  numFailedUpdates(0), numLate(0)
+{
+  if (delta <= 0) {
+    throw TemporalMotifCounterException("TemporalMotifCounter delta must be "
+      "positive: " + boost::lexical_cast<std::string>(delta));
+  }
+  if (samplingProbability <= 0 || samplingProbability > 1) {
+    throw TemporalMotifCounterException("TemporalMotifCounter sampling "
+      "probability must be in (0, 1]: " +
+      boost::lexical_cast<std::string>(samplingProbability));
+  }
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time>
+bool
+TemporalMotifCounter<TupleType, source, target, time>::
+consume(TupleType const& tuple)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  this->feedCount++;
+
+  NodeType const& u = std::get<source>(tuple);
+  NodeType const& v = std::get<target>(tuple);
+  double t = std::get<time>(tuple);
+  if (t < latest) {
+    numLate.fetch_add(1);
+  } else {
+    latest = t;
+    expire(t);
+  }
+
+  double p = samplingProbability;
+  double triangles = 0;
+
+  if (u != v) {
+    // 2-cycles v -> u, u -> v.
+    auto o = out.find(v);
+    if (o != out.end()) {
+      auto it = o->second.neighbors.find(u);
+      if (it != o->second.neighbors.end()) {
+        size_t n = countBefore(it->second, t);
+        if (n > 0) {
+          add(cyclesName, "", n / p);
+          add(cyclesName, n / p, {&u, &v});
+        }
+      }
+    }
+
+    // Wedges x -> u, u -> v, centered on u.
+    auto i = in.find(u);
+    if (i != in.end()) {
+      size_t n = countBefore(i->second.times, t);
+      auto it = i->second.neighbors.find(v);
+      if (it != i->second.neighbors.end()) n -= countBefore(it->second, t);
+      if (n > 0) {
+        add(wedgesName, "", n / p);
+        add(wedgesName, n / p, {&u});
+      }
+    }
+
+    // Triangles v -> y, y -> u, u -> v: the common neighbors y of the
+    // out-edges of v and the in-edges of u.
+    auto a = out.find(v);
+    auto b = in.find(u);
+    if (a != out.end() && b != in.end()) {
+      auto const& first = a->second.neighbors;
+      auto const& second = b->second.neighbors;
+      auto x = first.begin();
+      auto y = second.begin();
+      while (x != first.end() && y != second.end()) {
+        if (x->first < y->first) {
+          x = first.lower_bound(y->first);
+        } else if (y->first < x->first) {
+          y = second.lower_bound(x->first);
+        } else {
+          if (x->first != u && x->first != v) {
+            // Pairs of v -> y before y -> u before t.
+            size_t pairs = 0;
+            auto const& t0 = x->second;
+            auto const& t1 = y->second;
+            size_t k = 0;
+            for (double t1Time : t1) {
+              if (!(t1Time < t)) break;
+              while (k < t0.size() && t0[k] < t1Time) k++;
+              pairs += k;
+            }
+            if (pairs > 0) {
+              double count = pairs / (p * p);
+              triangles += count;
+              add(trianglesName, count, {&x->first});
+            }
+          }
+          ++x;
+          ++y;
+        }
+      }
+      if (triangles > 0) {
+        add(trianglesName, triangles, {&u, &v});
+        add(trianglesName, "", triangles);
+      }
+    }
+  }
+
+  if (u != v && t > latest - delta &&
+      (p >= 1 || distribution(generator) < p))
+  {
+    Adjacency& o = out[u];
+    insertSorted(o.neighbors[v], t);
+    insertSorted(o.times, t);
+    Adjacency& i = in[v];
+    insertSorted(i.neighbors[u], t);
+    insertSorted(i.times, t);
+    auto later = std::upper_bound(window.begin(), window.end(), t,
+      [](double t, std::tuple<NodeType, NodeType, double> const& edge) {
+        return t < std::get<2>(edge);
+      });
+    window.emplace(later, u, v, t);
+  }
+
+  notifySubscribers(std::get<0>(tuple), triangles);
+  return true;
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time>
+void
+TemporalMotifCounter<TupleType, source, target, time>::
+expire(double t)
+{
+  // The window is in time order, and so are the adjacency lists, so the
+  // oldest edge is at the front of its lists too.
+  while (!window.empty() && std::get<2>(window.front()) <= t - delta) {
+    auto const& edge = window.front();
+    removeOldest(out, std::get<0>(edge), std::get<1>(edge));
+    removeOldest(in, std::get<1>(edge), std::get<0>(edge));
+    window.pop_front();
+  }
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time>
+void
+TemporalMotifCounter<TupleType, source, target, time>::
+removeOldest(std::unordered_map<NodeType, Adjacency>& adjacency,
+             NodeType const& vertex, NodeType const& neighbor)
+{
+  auto a = adjacency.find(vertex);
+  Adjacency& adj = a->second;
+  auto n = adj.neighbors.find(neighbor);
+  n->second.pop_front();
+  if (n->second.empty()) adj.neighbors.erase(n);
+  adj.times.pop_front();
+  if (adj.times.empty()) adjacency.erase(a);
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time>
+void
+TemporalMotifCounter<TupleType, source, target, time>::
+add(std::string const& name, double count,
+    std::initializer_list<NodeType const*> vertices)
+{
+  for (auto vertex : vertices) {
+    add(name, boost::lexical_cast<std::string>(*vertex), count);
+  }
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time>
+void
+TemporalMotifCounter<TupleType, source, target, time>::
+add(std::string const& name, std::string const& key, double count)
+{
+  double& total = counts[name][key];
+  total += count;
+  SingleFeature feature(total);
+  if (!this->featureMap->updateInsert(key, name, feature)) {
+    numFailedUpdates.fetch_add(1);
+  }
+}
+
+template <typename TupleType, size_t source, size_t target, size_t time>
+double
+TemporalMotifCounter<TupleType, source, target, time>::
+getCount(std::string const& name, std::string const& key) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  auto c = counts.find(name);
+  if (c == counts.end()) return 0;
+  auto it = c->second.find(key);
+  return it == c->second.end() ? 0 : it->second;
+}
+
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include <map>
 #include <list>
 #include <sam/Util.hpp>
+#include <sam/SlabAllocator.hpp>
 
 namespace sam {
 
@@ -24,8 +25,9 @@ class TemporalSet
 {
 public:
   typedef std::pair<K, TimeType> PairType;
-  typedef std::list<PairType> ListType;
-  typedef std::map<K, TimeType> MapType;
+  typedef std::list<PairType, SlabAllocator<PairType>> ListType;
+  typedef std::map<K, TimeType, std::less<K>,
+    SlabAllocator<std::pair<K const, TimeType>>> MapType;
 
 private:
 
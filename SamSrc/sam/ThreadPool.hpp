@@ -0,0 +1,371 @@
+#ifndef SAM_THREAD_POOL_HPP
+#define SAM_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Default bound on the number of tasks waiting in a ThreadPool.  Matches
+ * the number of outstanding futures GraphStore::consume used to allow.
+ */
+#define THREAD_POOL_DEFAULT_MAX_QUEUED 1028
+
+namespace sam {
+
+class ThreadPoolException : public std::runtime_error
+{
+public:
+  ThreadPoolException(char const* message) :
+    std::runtime_error(message) {}
+  ThreadPoolException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * A fixed set of worker threads that run submitted tasks.
+ *
+ * Each worker has its own deque.  Submissions are spread round robin over
+ * the deques (a task submitted from a worker goes on that worker's deque).
+ * A worker runs its own tasks oldest first and, when it runs out, steals
+ * the newest task from another worker, so one slow task doesn't hold up
+ * the ones queued behind it.
+ *
+ * At most maxQueued tasks wait at a time; submit() blocks until there is
+ * room, which pushes back on the producer the same way waiting on the
+ * oldest future did.  Tasks that submit more tasks aren't held to the
+ * bound.
+ *
+ * If a task throws, the first exception is kept and rethrown by wait().
+ */
+class ThreadPool
+{
+public:
+  typedef std::function<void()> TaskType;
+
+private:
+  typedef std::chrono::steady_clock ClockType;
+
+  struct Task {
+    TaskType func;
+    ClockType::time_point submitted;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  size_t maxQueued;
+
+  /// Tasks sitting in a deque.  Incremented before the push so that it
+  /// never goes past maxQueued.
+  std::atomic<size_t> queued;
+
+  /// Tasks submitted but not finished (queued plus running).
+  std::atomic<size_t> pending;
+
+  std::atomic<size_t> nextWorker;
+  std::atomic<bool> stopping;
+
+  /// Sleeping threads register here before checking their condition, so
+  /// that the other side only takes stateMutex when someone is waiting.
+  std::mutex stateMutex;
+  std::condition_variable workAvailable;
+  std::condition_variable spaceAvailable;
+  std::condition_variable allDone;
+  std::atomic<size_t> idleWorkers;
+  std::atomic<size_t> blockedSubmitters;
+  std::atomic<size_t> waiters;
+
+  std::mutex errorMutex;
+  std::exception_ptr firstError;
+
+  std::atomic<size_t> numCompleted;
+  std::atomic<size_t> numFailed;
+  std::atomic<size_t> numStolen;
+  std::atomic<size_t> maxQueueLength;
+  std::atomic<uint64_t> totalLatencyNs;
+  std::atomic<uint64_t> maxLatencyNs;
+
+  /// Which pool and worker the calling thread belongs to, if any.
+  static std::pair<ThreadPool const*, size_t>& currentWorker() {
+    static thread_local std::pair<ThreadPool const*, size_t> current(
+      nullptr, 0);
+    return current;
+  }
+
+  bool popOwn(size_t i, Task& task);
+  bool steal(size_t i, Task& task);
+  void run(size_t i);
+  void finish(Task const& task);
+
+public:
+  /**
+   * Starts the workers.
+   * \param numWorkers How many worker threads.  Zero means one per
+   *   hardware thread.
+   * \param maxQueued How many tasks can wait before submit() blocks.
+   */
+  ThreadPool(size_t numWorkers = 0,
+             size_t maxQueued = THREAD_POOL_DEFAULT_MAX_QUEUED);
+
+  /**
+   * Runs whatever is still queued and joins the workers.
+   */
+  ~ThreadPool();
+
+  ThreadPool(ThreadPool const&) = delete;
+  ThreadPool& operator=(ThreadPool const&) = delete;
+
+  /**
+   * Queues the task, blocking while maxQueued tasks are waiting.
+   * \throws ThreadPoolException if the pool is shutting down.
+   */
+  void submit(TaskType task);
+
+  /**
+   * Blocks until every submitted task has finished.
+   * \throws Rethrows the first exception thrown by a task since the last
+   *   wait(), if any.
+   */
+  void wait();
+
+  /**
+   * Stops accepting tasks, runs the ones already queued, and joins the
+   * workers.  Called by the destructor.
+   */
+  void shutdown();
+
+  size_t getNumWorkers() const { return workers.size(); }
+  size_t getMaxQueued() const { return maxQueued; }
+
+  /// Number of tasks waiting to run.
+  size_t getQueueLength() const { return queued; }
+
+  /// The most tasks that have been waiting at once.
+  size_t getMaxQueueLength() const { return maxQueueLength; }
+
+  /// Number of tasks submitted but not yet finished.
+  size_t getNumPending() const { return pending; }
+
+  size_t getNumCompleted() const { return numCompleted; }
+  size_t getNumFailed() const { return numFailed; }
+
+  /// How many tasks were run by a worker other than the one they were
+  /// queued on.
+  size_t getNumStolen() const { return numStolen; }
+
+  /// Task latency is from submit() to the task finishing, in seconds.
+  double getTotalLatency() const { return totalLatencyNs * 1e-9; }
+  double getMaxLatency() const { return maxLatencyNs * 1e-9; }
+  double getMeanLatency() const {
+    size_t n = numCompleted;
+    return n > 0 ? getTotalLatency() / n : 0;
+  }
+};
+
+inline
+ThreadPool::ThreadPool(size_t numWorkers, size_t maxQueued) :
+  maxQueued(maxQueued), queued(0), pending(0), nextWorker(0),
+  stopping(false), idleWorkers(0), blockedSubmitters(0), waiters(0),
+  numCompleted(0), numFailed(0), numStolen(0), maxQueueLength(0),
+  totalLatencyNs(0), maxLatencyNs(0)
+{
+  if (numWorkers == 0) {
+    numWorkers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (maxQueued == 0) {
+    throw ThreadPoolException("ThreadPool: maxQueued must be at least one");
+  }
+  for (size_t i = 0; i < numWorkers; i++) {
+    workers.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+  for (size_t i = 0; i < numWorkers; i++) {
+    threads.push_back(std::thread([this, i]() { this->run(i); }));
+  }
+}
+
+inline
+ThreadPool::~ThreadPool()
+{
+  shutdown();
+}
+
+inline
+void ThreadPool::submit(TaskType task)
+{
+  if (stopping) {
+    throw ThreadPoolException("ThreadPool::submit called after shutdown");
+  }
+
+  // Reserve a place in the queue, waiting for one if need be.  Workers
+  // don't wait, since they may be the ones that would make room.
+  auto const& current = currentWorker();
+  bool fromWorker = current.first == this;
+  size_t q = queued.load();
+  while (true) {
+    if (q < maxQueued || fromWorker) {
+      if (queued.compare_exchange_weak(q, q + 1)) break;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(stateMutex);
+    blockedSubmitters.fetch_add(1);
+    spaceAvailable.wait(lock, [this]() {
+      return queued.load() < maxQueued || stopping.load();
+    });
+    blockedSubmitters.fetch_sub(1);
+    if (stopping) {
+      throw ThreadPoolException("ThreadPool::submit called after shutdown");
+    }
+    q = queued.load();
+  }
+
+  size_t length = q + 1;
+  size_t longest = maxQueueLength.load();
+  while (length > longest &&
+         !maxQueueLength.compare_exchange_weak(longest, length)) {}
+
+  pending.fetch_add(1);
+
+  size_t i = fromWorker ? current.second :
+             nextWorker.fetch_add(1) % workers.size();
+  {
+    std::lock_guard<std::mutex> lock(workers[i]->mutex);
+    workers[i]->tasks.push_back(Task{std::move(task), ClockType::now()});
+  }
+
+  if (idleWorkers.load() > 0) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    workAvailable.notify_one();
+  }
+}
+
+inline
+void ThreadPool::wait()
+{
+  {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    waiters.fetch_add(1);
+    allDone.wait(lock, [this]() { return pending.load() == 0; });
+    waiters.fetch_sub(1);
+  }
+
+  std::exception_ptr error;
+  {
+    std::lock_guard<std::mutex> lock(errorMutex);
+    std::swap(error, firstError);
+  }
+  if (error) std::rethrow_exception(error);
+}
+
+inline
+void ThreadPool::shutdown()
+{
+  {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (stopping) return;
+    stopping = true;
+    workAvailable.notify_all();
+    spaceAvailable.notify_all();
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+inline
+bool ThreadPool::popOwn(size_t i, Task& task)
+{
+  std::lock_guard<std::mutex> lock(workers[i]->mutex);
+  if (workers[i]->tasks.empty()) return false;
+  task = std::move(workers[i]->tasks.front());
+  workers[i]->tasks.pop_front();
+  return true;
+}
+
+inline
+bool ThreadPool::steal(size_t i, Task& task)
+{
+  for (size_t k = 1; k < workers.size(); k++) {
+    Worker& victim = *workers[(i + k) % workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.back());
+      victim.tasks.pop_back();
+      numStolen.fetch_add(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+inline
+void ThreadPool::run(size_t i)
+{
+  currentWorker() = std::make_pair(this, i);
+  Task task;
+  while (true) {
+    if (popOwn(i, task) || steal(i, task)) {
+      queued.fetch_sub(1);
+      if (blockedSubmitters.load() > 0) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        spaceAvailable.notify_all();
+      }
+
+      try {
+        task.func();
+      } catch (...) {
+        numFailed.fetch_add(1);
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!firstError) firstError = std::current_exception();
+      }
+      finish(task);
+      task.func = nullptr;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(stateMutex);
+    idleWorkers.fetch_add(1);
+    // queued can be ahead of the deques while a submit is in progress.
+    workAvailable.wait_for(lock, std::chrono::milliseconds(10), [this]() {
+      return queued.load() > 0 || stopping.load();
+    });
+    idleWorkers.fetch_sub(1);
+    if (stopping && queued.load() == 0) break;
+  }
+}
+
+inline
+void ThreadPool::finish(Task const& task)
+{
+  uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    ClockType::now() - task.submitted).count();
+  totalLatencyNs.fetch_add(latency);
+  uint64_t longest = maxLatencyNs.load();
+  while (latency > longest &&
+         !maxLatencyNs.compare_exchange_weak(longest, latency)) {}
+  numCompleted.fetch_add(1);
+
+  if (pending.fetch_sub(1) == 1 && waiters.load() > 0) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    allDone.notify_all();
+  }
+}
+
+} // end namespace sam
+
+#endif
@@ -65,9 +65,9 @@ public:
       variable.c_str(), vertex.c_str());
 
     // lambda function that checks that the 
-    auto existsVertex = [vertex](Feature const * feature)->bool {
+    auto existsVertex = [&vertex](Feature const * feature)->bool {
       auto topKFeature = static_cast<TopKFeature const *>(feature);
-      auto keys = topKFeature->getKeys();
+      auto const& keys = topKFeature->getKeys();
       auto it = std::find(keys.begin(), keys.end(), vertex);
       if (it != keys.end()) {
         return true;
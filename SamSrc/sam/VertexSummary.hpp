@@ -0,0 +1,374 @@
+#ifndef SAM_VERTEX_SUMMARY_HPP
+#define SAM_VERTEX_SUMMARY_HPP
+
+#include <sam/BloomFilter.hpp>
+#include <sam/Serialization.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/// Default number of distinct vertices a node sees per window, used to
+/// size the filters.
+#define VERTEX_SUMMARY_DEFAULT_EXPECTED_VERTICES 100000
+
+/// Default false positive rate the filters are sized for.
+#define VERTEX_SUMMARY_DEFAULT_FP_RATE 0.01
+
+/// Default for how many seconds out of order a tuple can arrive and still
+/// be covered by the summaries.
+#define VERTEX_SUMMARY_DEFAULT_LATENESS 1.0
+
+namespace sam {
+
+class VertexSummaryException : public std::runtime_error
+{
+public:
+  VertexSummaryException(char const* message) :
+    std::runtime_error(message) {}
+  VertexSummaryException(std::string message) :
+    std::runtime_error(message) {}
+};
+
+/**
+ * Summaries of the vertices each node of the cluster has seen, used to
+ * drop edge requests that are certain to come back empty.
+ *
+ * Each node (as owner) records the vertices of the tuples it consumes in a
+ * Bloom filter per epoch.  Whenever the tuple times move into a new epoch,
+ * the filters of the epochs still within the time window are or'ed into a
+ * summary that is broadcast to the other nodes.  The summary states that
+ * the owner has seen no tuple with any vertex outside the filter between
+ * its covered times, from the start of the oldest epoch to the start of
+ * the new one less the allowed lateness.  Tuples are assumed to arrive in
+ * time order, as they are everywhere else in the GraphStore, give or take
+ * the lateness; tuples later than that are counted (getNumLate).
+ *
+ * A node (as requester) about to send an edge request checks the summary
+ * of the node it sends to.  The request is dropped only if the range of
+ * start times it asks for lies within the summary's covered times and the
+ * filter rules out the vertex; requests that could still be answered by
+ * future edges are always sent.  Bloom filters have no false negatives,
+ * so no matches are lost.
+ *
+ * To report how well the filters work, the owner also keeps the exact
+ * vertex sets when METRICS is defined.  A received request that was
+ * covered by the owner's last summary but whose vertex the owner never saw
+ * got past a requester's filter as a false positive.  Summed over the
+ * cluster, the false positive rate is falsePositives / (falsePositives +
+ * suppressed).
+ *
+ * Summaries travel over the edge request channel.  They start with a zero
+ * byte, which a serialized EdgeRequest never does (protobuf has no field
+ * number 0).  Like Serialization.hpp they use native byte order, so the
+ * nodes need to share it.
+ */
+template <typename NodeType, typename HF>
+class VertexSummaries
+{
+private:
+  /// A summary received from another node.
+  struct Summary {
+    double coveredFrom = 0;
+    double coveredThrough = 0;
+    BloomFilter filter;
+  };
+
+  /// The vertices seen during one epoch.
+  struct Epoch {
+    long index = 0;
+    BloomFilter filter;
+    #ifdef METRICS
+    std::unordered_set<NodeType, HF> vertices;
+    #endif
+  };
+
+  size_t numNodes;
+  size_t nodeId;
+  double epochLength;
+  double window;
+  size_t expectedVertices;
+  double fpRate;
+  double lateness;
+  HF hash;
+
+  /// Owner side: the epochs within the window, oldest first.
+  mutable std::mutex ownerMutex;
+  std::deque<Epoch> epochs;
+
+  /// The summary last broadcast by this node.
+  Summary advertised;
+  bool hasAdvertised = false;
+  #ifdef METRICS
+  std::unordered_set<NodeType, HF> advertisedVertices;
+  #endif
+
+  /// Requester side: the latest summary from each node.
+  std::mutex summaryMutex;
+  std::vector<std::shared_ptr<const Summary>> summaries;
+
+  std::atomic<size_t> numChecked;
+  std::atomic<size_t> numSuppressed;
+  std::atomic<size_t> numFalsePositives;
+  std::atomic<size_t> numSent;
+  std::atomic<size_t> numReceived;
+  std::atomic<size_t> numLate;
+
+public:
+  /**
+   * \param numNodes The number of nodes in the cluster.
+   * \param nodeId The id of this node.
+   * \param epochLength How many seconds of tuples go into one epoch, and so
+   *   how often summaries are broadcast.
+   * \param window How long (in seconds) edges are kept.  Epochs are part
+   *   of a summary until they are this old.
+   * \param expectedVertices The number of distinct vertices expected per
+   *   window, for sizing the filters.
+   * \param fpRate The false positive rate the filters are sized for.
+   * \param lateness How many seconds out of order tuples may arrive.
+   */
+  VertexSummaries(size_t numNodes, size_t nodeId, double epochLength,
+                  double window,
+                  size_t expectedVertices =
+                    VERTEX_SUMMARY_DEFAULT_EXPECTED_VERTICES,
+                  double fpRate = VERTEX_SUMMARY_DEFAULT_FP_RATE,
+                  double lateness = VERTEX_SUMMARY_DEFAULT_LATENESS) :
+    numNodes(numNodes), nodeId(nodeId), epochLength(epochLength),
+    window(window), expectedVertices(expectedVertices), fpRate(fpRate),
+    lateness(lateness), summaries(numNodes)
+  {
+    if (epochLength <= 0) {
+      throw VertexSummaryException("VertexSummaries epoch length must be "
+        "positive");
+    }
+    if (fpRate <= 0 || fpRate >= 1) {
+      throw VertexSummaryException("VertexSummaries false positive rate must "
+        "be between 0 and 1");
+    }
+    numChecked = 0;
+    numSuppressed = 0;
+    numFalsePositives = 0;
+    numSent = 0;
+    numReceived = 0;
+    numLate = 0;
+  }
+
+  /**
+   * Records that this node consumed a tuple with the vertex.
+   * \param vertex A source or target of the tuple.
+   * \param time The time of the tuple.
+   * \param message If the tuple starts a new epoch, set to the summary to
+   *   broadcast.
+   * \return Returns true if message was set.
+   */
+  bool observe(NodeType const& vertex, double time, std::string& message);
+
+  /**
+   * Returns true if the string received over the edge request channel is
+   * a summary rather than an edge request.
+   */
+  static bool isSummary(std::string const& str) {
+    return !str.empty() && str[0] == '\0';
+  }
+
+  /**
+   * Takes in a summary broadcast by another node.
+   * \throws VertexSummaryException if the summary is malformed.
+   */
+  void receive(std::string const& message);
+
+  /**
+   * Checks whether an edge request for the vertex, sent to the node, could
+   * return anything.  Counted as checked, and as suppressed if not.
+   * \param node The node the request would go to.
+   * \param vertex The vertex of the request (source or target).
+   * \param from The earliest start time of the requested edges.
+   * \param through The latest start time of the requested edges.
+   * \return Returns false only if the node has certainly not seen an edge
+   *   with the vertex in that time range.
+   */
+  bool mayHave(size_t node, NodeType const& vertex, double from,
+               double through);
+
+  /**
+   * Owner side: checks whether a received request got past a filter as a
+   * false positive, and counts it if so.  Only tracked with METRICS.
+   */
+  bool checkFalsePositive(NodeType const& vertex, double from,
+                          double through);
+
+  size_t getNumChecked() const { return numChecked; }
+  size_t getNumSuppressed() const { return numSuppressed; }
+  size_t getNumFalsePositives() const { return numFalsePositives; }
+  size_t getNumSent() const { return numSent; }
+  size_t getNumReceived() const { return numReceived; }
+
+  /**
+   * The number of tuples that arrived after a summary covering their time
+   * had been broadcast.
+   */
+  size_t getNumLate() const { return numLate; }
+
+  /**
+   * The false positive rate expected from how full the last broadcast
+   * filter is.
+   */
+  double getEstimatedFalsePositiveRate() const {
+    std::lock_guard<std::mutex> lock(ownerMutex);
+    return hasAdvertised ? advertised.filter.estimatedFalsePositiveRate() : 0;
+  }
+
+private:
+  BloomFilter makeFilter() const {
+    return BloomFilter::forCapacity(expectedVertices, fpRate);
+  }
+
+  static bool covers(Summary const& summary, double from, double through) {
+    return summary.coveredFrom <= from && through < summary.coveredThrough;
+  }
+};
+
+template <typename NodeType, typename HF>
+bool VertexSummaries<NodeType, HF>::
+observe(NodeType const& vertex, double time, std::string& message)
+{
+  long index = static_cast<long>(std::floor(time / epochLength));
+  bool broadcast = false;
+
+  std::lock_guard<std::mutex> lock(ownerMutex);
+  if (epochs.empty()) {
+    epochs.push_back(Epoch{index, makeFilter()});
+  } else if (index > epochs.back().index) {
+    // Everything before this epoch has been seen, so the epochs we have
+    // are complete.  Keep the ones within the window and advertise them.
+    double start = index * epochLength;
+    while (!epochs.empty() &&
+           (epochs.front().index + 1) * epochLength <= start - window)
+    {
+      epochs.pop_front();
+    }
+
+    advertised.filter = makeFilter();
+    advertised.coveredFrom = epochs.empty() ? start :
+                             epochs.front().index * epochLength;
+    advertised.coveredThrough = std::max(advertised.coveredFrom,
+                                         start - lateness);
+    #ifdef METRICS
+    advertisedVertices.clear();
+    #endif
+    for (auto const& epoch : epochs) {
+      advertised.filter.merge(epoch.filter);
+      #ifdef METRICS
+      advertisedVertices.insert(epoch.vertices.begin(), epoch.vertices.end());
+      #endif
+    }
+    hasAdvertised = true;
+
+    message.assign(1, '\0');
+    serialize(message, static_cast<uint64_t>(nodeId));
+    serialize(message, advertised.coveredFrom);
+    serialize(message, advertised.coveredThrough);
+    serialize(message, static_cast<uint64_t>(
+      advertised.filter.getNumHashes()));
+    serialize(message, advertised.filter.getWords());
+    numSent.fetch_add(1);
+    broadcast = true;
+
+    epochs.push_back(Epoch{index, makeFilter()});
+  }
+
+  // Late tuples go into the newest epoch, which isn't advertised yet.
+  if (hasAdvertised && time < advertised.coveredThrough) {
+    numLate.fetch_add(1);
+  }
+  Epoch& epoch = epochs.back();
+  epoch.filter.add(hash(vertex));
+  #ifdef METRICS
+  epoch.vertices.insert(vertex);
+  #endif
+  return broadcast;
+}
+
+template <typename NodeType, typename HF>
+void VertexSummaries<NodeType, HF>::
+receive(std::string const& message)
+{
+  if (!isSummary(message)) {
+    throw VertexSummaryException("VertexSummaries::receive Not a summary");
+  }
+
+  auto summary = std::make_shared<Summary>();
+  uint64_t node = 0;
+  uint64_t numHashes = 0;
+  std::vector<uint64_t> words;
+  char const* p = message.data() + 1;
+  char const* end = message.data() + message.size();
+  try {
+    deserialize(p, end, node);
+    deserialize(p, end, summary->coveredFrom);
+    deserialize(p, end, summary->coveredThrough);
+    deserialize(p, end, numHashes);
+    deserialize(p, end, words);
+  } catch (SerializationException const& e) {
+    throw VertexSummaryException(std::string("VertexSummaries::receive ") +
+      e.what());
+  }
+  if (node >= numNodes) {
+    throw VertexSummaryException("VertexSummaries::receive Summary from "
+      "unknown node " + std::to_string(node));
+  }
+  summary->filter = BloomFilter(std::move(words), numHashes);
+
+  std::lock_guard<std::mutex> lock(summaryMutex);
+  auto& current = summaries[node];
+  // Summaries can overtake each other; keep the most recent.
+  if (!current || current->coveredThrough <= summary->coveredThrough) {
+    current = summary;
+  }
+  numReceived.fetch_add(1);
+}
+
+template <typename NodeType, typename HF>
+bool VertexSummaries<NodeType, HF>::
+mayHave(size_t node, NodeType const& vertex, double from, double through)
+{
+  std::shared_ptr<const Summary> summary;
+  {
+    std::lock_guard<std::mutex> lock(summaryMutex);
+    summary = summaries[node];
+  }
+  if (!summary || !covers(*summary, from, through)) return true;
+
+  numChecked.fetch_add(1);
+  if (summary->filter.mayContain(hash(vertex))) return true;
+  numSuppressed.fetch_add(1);
+  return false;
+}
+
+template <typename NodeType, typename HF>
+bool VertexSummaries<NodeType, HF>::
+checkFalsePositive(NodeType const& vertex, double from, double through)
+{
+  #ifdef METRICS
+  std::lock_guard<std::mutex> lock(ownerMutex);
+  if (hasAdvertised && covers(advertised, from, through) &&
+      advertisedVertices.count(vertex) == 0)
+  {
+    numFalsePositives.fetch_add(1);
+    return true;
+  }
+  #endif
+  return false;
+}
+
+}
+
+#endif
@@ -0,0 +1,181 @@
+#define BOOST_TEST_MAIN TestBatchInsert
+
+#include <boost/test/unit_test.hpp>
+#include <chrono>
+#include <limits>
+#include <list>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sam/CompressedSparse.hpp>
+#include <sam/GraphStore.hpp>
+#include <sam/VastNetflow.hpp>
+#include <sam/VastNetflowGenerators.hpp>
+
+using namespace sam;
+
+typedef GraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                   TimeSeconds, DurationSeconds,
+                   StringHashFunction, StringHashFunction,
+                   StringEqualityFunction, StringEqualityFunction>
+        GraphStoreType;
+
+typedef GraphStoreType::QueryType QueryType;
+typedef GraphStoreType::ResultMapType::CsrType CsrType;
+
+/**
+ * Two edges into the same vertex, the second starting after the first.
+ */
+std::shared_ptr<QueryType> makeQuery(std::shared_ptr<FeatureMap> featureMap)
+{
+  auto query = std::make_shared<QueryType>(featureMap);
+  EdgeExpression y2x("nodey", "e1", "nodex");
+  EdgeExpression z2x("nodez", "e2", "nodex");
+  TimeEdgeExpression startE1(EdgeFunction::StartTime, "e1",
+                             EdgeOperator::Assignment, 0);
+  TimeEdgeExpression startE2(EdgeFunction::StartTime, "e2",
+                             EdgeOperator::GreaterThan, 0);
+  query->addExpression(startE1);
+  query->addExpression(startE2);
+  query->addExpression(y2x);
+  query->addExpression(z2x);
+  query->finalize();
+  return query;
+}
+
+BOOST_AUTO_TEST_CASE( test_add_edges )
+{
+  CsrType single(1000, 100);
+  CsrType batched(1000, 100);
+
+  // Random edges plus a vertex with many out edges.
+  RandomGenerator generator;
+  std::vector<VastNetflow> netflows;
+  size_t n = 5000;
+  for (size_t i = 0; i < n; i++) {
+    VastNetflow netflow = makeNetflow(i, generator.generate(i * 0.001));
+    if (i % 10 == 0) std::get<SourceIp>(netflow) = "10.0.0.1";
+    netflows.push_back(netflow);
+  }
+
+  for (auto const& netflow : netflows) single.addEdge(netflow);
+  size_t batchSize = 128;
+  for (size_t i = 0; i < n; i += batchSize) {
+    std::vector<VastNetflow> batch(netflows.begin() + i,
+      netflows.begin() + std::min(n, i + batchSize));
+    batched.addEdges(batch);
+  }
+
+  BOOST_CHECK_EQUAL(batched.countEdges(), single.countEdges());
+  BOOST_CHECK_EQUAL(batched.getNumVertices(), single.getNumVertices());
+  BOOST_CHECK_EQUAL(batched.getDegree("10.0.0.1"), n / 10);
+
+  // Edges from one source stay in arrival order.
+  double inf = std::numeric_limits<double>::max();
+  std::list<VastNetflow> found;
+  batched.findEdges("10.0.0.1", nullValue<std::string>(), 0, inf, 0, inf,
+                    found);
+  BOOST_CHECK_EQUAL(found.size(), n / 10);
+  size_t previous = 0;
+  bool ordered = true;
+  for (auto const& edge : found) {
+    if (std::get<SamGeneratedId>(edge) < previous) ordered = false;
+    previous = std::get<SamGeneratedId>(edge);
+  }
+  BOOST_CHECK(ordered);
+
+  // An empty batch is fine.
+  std::vector<VastNetflow> empty;
+  BOOST_CHECK_EQUAL(batched.addEdges(empty), 0);
+}
+
+/**
+ * Runs the double edge query over n edges into one vertex with the given
+ * batch size and returns the number of results.
+ */
+size_t countDoubleEdgeResults(size_t batchSize, size_t port, size_t n,
+                              size_t& numBatches)
+{
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+
+  GraphStoreType* graphStore = new GraphStoreType(1, 0, hostnames, port,
+    1000, 1000, 1000, 100000, 1, 1, 100, 1000, featureMap, 100, true, 1);
+  graphStore->setBatchSize(batchSize);
+  BOOST_CHECK_EQUAL(graphStore->getBatchSize(), batchSize);
+  graphStore->registerQuery(makeQuery(featureMap));
+
+  UniformDestPort generator("192.168.0.2", 1);
+  for (size_t i = 0; i < n; i++) {
+    graphStore->consume(makeNetflow(i, generator.generate(i * 0.01)));
+  }
+  graphStore->waitForConsume();
+
+  size_t numResults = graphStore->getNumResults();
+  numBatches = graphStore->getNumBatches();
+  graphStore->terminate();
+  delete graphStore;
+  return numResults;
+}
+
+BOOST_AUTO_TEST_CASE( test_batched_consume )
+{
+  // Every pair of edges (in time order) is a result, whether or not they
+  // were added to the graph in the same batch.
+  size_t n = 200;
+  size_t numBatches = 0;
+  size_t single = countDoubleEdgeResults(1, 10300, n, numBatches);
+  BOOST_CHECK_EQUAL(single, n * (n - 1) / 2);
+  BOOST_CHECK_EQUAL(numBatches, 0);
+
+  // 200 isn't a multiple of 64, so the last batch is flushed by
+  // waitForConsume.
+  size_t batched = countDoubleEdgeResults(64, 10310, n, numBatches);
+  BOOST_CHECK_EQUAL(batched, single);
+  BOOST_CHECK_EQUAL(numBatches, (n + 63) / 64);
+
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  GraphStoreType graphStore(1, 0, hostnames, 10320, 1000, 1000, 1000, 1000,
+    1, 1, 100, 1000, featureMap, 100, true, 1);
+  BOOST_CHECK_EQUAL(graphStore.getBatchSize(), GRAPH_STORE_DEFAULT_BATCH_SIZE);
+  BOOST_CHECK_THROW(graphStore.setBatchSize(0), GraphStoreException);
+  BOOST_CHECK_EQUAL(graphStore.getBatchDelay(),
+                    GRAPH_STORE_DEFAULT_BATCH_DELAY);
+  BOOST_CHECK_THROW(graphStore.setBatchDelay(-1), GraphStoreException);
+  graphStore.terminate();
+}
+
+BOOST_AUTO_TEST_CASE( test_batch_delay )
+{
+  // A slow stream doesn't fill the batch, but a tuple a second past the
+  // oldest one waiting hands the batch off.
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  GraphStoreType graphStore(1, 0, hostnames, 10330, 1000, 1000, 1000, 1000,
+    1, 1, 100, 1000, featureMap, 100, true, 1);
+  graphStore.setBatchSize(1000);
+  graphStore.setBatchDelay(1);
+  graphStore.registerQuery(makeQuery(featureMap));
+
+  // Times 0, 0.25, ..., 2.5: batches are handed off at 1 and 2.25.
+  UniformDestPort generator("192.168.0.2", 1);
+  size_t n = 11;
+  for (size_t i = 0; i < n; i++) {
+    graphStore.consume(makeNetflow(i, generator.generate(i * 0.25)));
+  }
+  for (size_t i = 0; i < 1000 && graphStore.getNumBatches() < 2; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  BOOST_CHECK_EQUAL(graphStore.getNumBatches(), 2);
+  BOOST_CHECK(graphStore.getNumResults() > 0);
+
+  // The rest wait for the next one, or for waitForConsume.
+  graphStore.waitForConsume();
+  BOOST_CHECK_EQUAL(graphStore.getNumBatches(), 3);
+  BOOST_CHECK_EQUAL(graphStore.getNumResults(), n * (n - 1) / 2);
+  graphStore.terminate();
+}
@@ -0,0 +1,143 @@
+#define BOOST_TEST_MAIN TestBatchMatcher
+
+#include <boost/test/unit_test.hpp>
+#include <random>
+#include <string>
+#include <vector>
+#include <sam/BatchMatcher.hpp>
+#include <sam/Util.hpp>
+#include <sam/VastNetflow.hpp>
+
+using namespace sam;
+
+typedef BatchMatcher<VastNetflow, SourceIp, DestIp, TimeSeconds,
+                     DurationSeconds> MatcherType;
+typedef MatcherType::QueryType QueryType;
+typedef MatcherType::ResultType ResultType;
+
+/**
+ * A query for edges v0 -> v1 -> ... -> v{n-1} in increasing time within
+ * window, closed by v{n-1} -> v0 if cycle is set.
+ */
+std::shared_ptr<QueryType> makeQuery(std::shared_ptr<FeatureMap> featureMap,
+                                     size_t n, bool cycle, double window)
+{
+  auto query = std::make_shared<QueryType>(featureMap);
+  size_t numEdges = cycle ? n : n - 1;
+  for (size_t i = 0; i < numEdges; i++) {
+    std::string e = "e" + std::to_string(i);
+    query->addExpression(EdgeExpression("v" + std::to_string(i), e,
+                                        "v" + std::to_string((i + 1) % n)));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, e,
+      i == 0 ? EdgeOperator::Assignment : EdgeOperator::GreaterThan, 0));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, e,
+      EdgeOperator::LessThan, window));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::EndTime, e,
+      EdgeOperator::LessThan, window));
+  }
+  query->finalize();
+  return query;
+}
+
+/**
+ * Random edges with no duration among numVertices vertices, 100 a second.
+ */
+std::vector<VastNetflow> randomEdges(size_t n, size_t numVertices)
+{
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<size_t> vertex(0, numVertices - 1);
+  std::vector<VastNetflow> edges;
+  for (size_t i = 0; i < n; i++) {
+    std::string str = std::to_string(1 + i * 0.01) +
+      ",parseDate,dateTimeStr,ipLayerProtocol,ipLayerProtocolCode,"
+      "10.0.0." + std::to_string(vertex(gen)) +
+      ",10.0.0." + std::to_string(vertex(gen)) +
+      ",29986,1900,1,1,0,1,1,1,1,1,1,1";
+    edges.push_back(makeNetflow(i, str));
+  }
+  return edges;
+}
+
+BOOST_AUTO_TEST_CASE( test_triangles )
+{
+  // The same triangles as the serial checker, whatever the number of
+  // threads.
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  double window = 1.005;
+  auto query = makeQuery(featureMap, 3, true, window);
+  std::vector<VastNetflow> edges = randomEdges(5000, 30);
+
+  size_t expected = numTriangles<VastNetflow, SourceIp, DestIp, TimeSeconds,
+                                 DurationSeconds>(edges, window);
+  BOOST_CHECK(expected > 0);
+
+  MatcherType serial(edges, 1);
+  MatcherType parallel(edges, 4);
+  BOOST_CHECK_EQUAL(serial.getNumEdges(), edges.size());
+  BOOST_CHECK_EQUAL(serial.getNumVertices(), 30);
+  BOOST_CHECK_EQUAL(serial.match(query), expected);
+  BOOST_CHECK_EQUAL(parallel.match(query), expected);
+  BOOST_CHECK_EQUAL(parallel.getNumMatches(), expected);
+  BOOST_CHECK_EQUAL(serial.getNumEdgesExamined(),
+                    parallel.getNumEdgesExamined());
+}
+
+BOOST_AUTO_TEST_CASE( test_order )
+{
+  // Matches come in the order of their first edge, so one thread and four
+  // give the same list.
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = makeQuery(featureMap, 4, true, 1);
+  std::vector<VastNetflow> edges = randomEdges(3000, 20);
+
+  std::vector<std::string> serialMatches;
+  std::vector<std::string> parallelMatches;
+  MatcherType serial(edges, 1);
+  MatcherType parallel(edges, 4);
+  size_t n = serial.match(query, [&serialMatches](ResultType const& r) {
+    serialMatches.push_back(MatcherType::signature(r.getResultTuples()));
+  });
+  parallel.match(query, [&parallelMatches](ResultType const& r) {
+    parallelMatches.push_back(MatcherType::signature(r.getResultTuples()));
+  });
+  BOOST_CHECK(n > 0);
+  BOOST_CHECK_EQUAL(serialMatches.size(), n);
+  BOOST_CHECK(serialMatches == parallelMatches);
+
+  // The chain query finds every 4-cycle plus the paths that don't close.
+  auto path = makeQuery(featureMap, 4, false, 1);
+  BOOST_CHECK(serial.match(path) > n);
+}
+
+BOOST_AUTO_TEST_CASE( test_exact )
+{
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = makeQuery(featureMap, 3, true, 10);
+
+  std::vector<std::string> lines = {
+    "3,parseDate,dateTimeStr,ipLayerProtocol,ipLayerProtocolCode,"
+      "b,c,29986,1900,1,1,0,1,1,1,1,1,1,1",
+    "1,parseDate,dateTimeStr,ipLayerProtocol,ipLayerProtocolCode,"
+      "a,b,29986,1900,1,1,0,1,1,1,1,1,1,1",
+    "5,parseDate,dateTimeStr,ipLayerProtocol,ipLayerProtocolCode,"
+      "c,a,29986,1900,1,1,0,1,1,1,1,1,1,1",
+    "20,parseDate,dateTimeStr,ipLayerProtocol,ipLayerProtocolCode,"
+      "c,a,29986,1900,1,1,0,1,1,1,1,1,1,1",
+  };
+  std::vector<VastNetflow> edges;
+  for (size_t i = 0; i < lines.size(); i++) {
+    edges.push_back(makeNetflow(i, lines[i]));
+  }
+
+  // The file order doesn't matter, and the edge at 20 is out of the window.
+  MatcherType matcher(edges, 2);
+  std::vector<std::string> matches;
+  BOOST_CHECK_EQUAL(matcher.match(query, [&matches](ResultType const& r) {
+    matches.push_back(MatcherType::signature(r.getResultTuples()));
+  }), 1);
+  BOOST_CHECK_EQUAL(matches.size(), 1);
+  BOOST_CHECK_EQUAL(matches[0], "a b 1;b c 3;c a 5;");
+
+  auto unfinalized = std::make_shared<QueryType>(featureMap);
+  BOOST_CHECK_THROW(matcher.match(unfinalized), BatchMatcherException);
+}
@@ -0,0 +1,229 @@
+#define BOOST_TEST_MAIN TestCheckpoint
+
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <limits>
+#include <list>
+#include <string>
+#include <vector>
+#include <sam/CompressedSparse.hpp>
+#include <sam/GraphStore.hpp>
+#include <sam/SubgraphQueryResultMap.hpp>
+#include <sam/VastNetflow.hpp>
+#include <sam/VastNetflowGenerators.hpp>
+
+using namespace sam;
+
+typedef GraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                   TimeSeconds, DurationSeconds,
+                   StringHashFunction, StringHashFunction,
+                   StringEqualityFunction, StringEqualityFunction>
+        GraphStoreType;
+
+typedef GraphStoreType::ResultMapType MapType;
+typedef GraphStoreType::QueryType QueryType;
+typedef MapType::QueryResultType QueryResultType;
+typedef MapType::EdgeRequestType EdgeRequestType;
+typedef MapType::CsrType CsrType;
+typedef MapType::CscType CscType;
+
+/**
+ * The double edge query from TestGraphStore: two edges into the same
+ * vertex, the second starting after the first.
+ */
+std::shared_ptr<QueryType> makeQuery(std::shared_ptr<FeatureMap> featureMap)
+{
+  auto query = std::make_shared<QueryType>(featureMap);
+  EdgeExpression y2x("nodey", "e1", "nodex");
+  EdgeExpression z2x("nodez", "e2", "nodex");
+  TimeEdgeExpression startE1(EdgeFunction::StartTime, "e1",
+                             EdgeOperator::Assignment, 0);
+  TimeEdgeExpression startE2(EdgeFunction::StartTime, "e2",
+                             EdgeOperator::GreaterThan, 0);
+  query->addExpression(startE1);
+  query->addExpression(startE2);
+  query->addExpression(y2x);
+  query->addExpression(z2x);
+  query->finalize();
+  return query;
+}
+
+BOOST_AUTO_TEST_CASE( test_graph_checkpoint )
+{
+  CsrType csr(1000, 100);
+  RandomGenerator generator;
+  size_t n = 10000;
+  for (size_t i = 0; i < n; i++) {
+    csr.addEdge(makeNetflow(i, generator.generate(i * 0.001)));
+  }
+  // A vertex with more than one edge.
+  UniformDestPort repeated("192.168.0.2", 1);
+  for (size_t i = 0; i < 10; i++) {
+    VastNetflow netflow = makeNetflow(n + i, repeated.generate(10 + i * 0.1));
+    std::get<SourceIp>(netflow) = "10.0.0.1";
+    csr.addEdge(netflow);
+  }
+
+  std::string bytes;
+  csr.checkpoint(bytes);
+
+  CsrType restored(16, 1);
+  char const* p = bytes.data();
+  restored.restore(p, bytes.data() + bytes.size(), 4);
+  BOOST_CHECK(p == bytes.data() + bytes.size());
+  BOOST_CHECK_EQUAL(restored.getWindow(), 100);
+  BOOST_CHECK_EQUAL(restored.countEdges(), csr.countEdges());
+  BOOST_CHECK(restored.getCapacity() >= n / 2);
+
+  double inf = std::numeric_limits<double>::max();
+  std::list<VastNetflow> found;
+  restored.findEdges("10.0.0.1", nullValue<std::string>(), 0, inf, 0, inf,
+                     found);
+  BOOST_CHECK_EQUAL(found.size(), 10);
+
+  // Restoring into a graph that already has edges is an error.
+  p = bytes.data();
+  BOOST_CHECK_THROW(restored.restore(p, bytes.data() + bytes.size(), 4),
+                    CompressedSparseException);
+
+  // So is a truncated checkpoint.
+  CsrType truncated(16, 1);
+  p = bytes.data();
+  BOOST_CHECK_THROW(truncated.restore(p, bytes.data() + bytes.size() / 2, 4),
+                    SerializationException);
+}
+
+BOOST_AUTO_TEST_CASE( test_result_map_checkpoint )
+{
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  MapType::QueryListType queries;
+  queries.push_back(makeQuery(featureMap));
+
+  CsrType csr(1000, 100);
+  CscType csc(1000, 100);
+  MapType map(1, 0, 1000, 1000, csr, csc);
+
+  UniformDestPort generator("192.168.0.2", 1);
+  std::list<EdgeRequestType> edgeRequests;
+  size_t n = 100;
+  for (size_t i = 0; i < n; i++) {
+    VastNetflow netflow = makeNetflow(i, generator.generate(i * 0.01));
+    map.add(QueryResultType(queries[0], netflow), edgeRequests);
+  }
+
+  std::string bytes;
+  map.checkpoint(bytes, queries);
+
+  CsrType csr2(1000, 100);
+  CscType csc2(1000, 100);
+  MapType restored(1, 0, 16, 1000, csr2, csc2);
+  char const* p = bytes.data();
+  restored.restore(p, bytes.data() + bytes.size(), queries, 4);
+  BOOST_CHECK_EQUAL(restored.getNumIntermediateResults(), n);
+
+  // A later edge into the same vertex completes every restored result.
+  VastNetflow last = makeNetflow(n, generator.generate(n * 0.01));
+  map.process(last, edgeRequests);
+  restored.process(last, edgeRequests);
+  BOOST_CHECK_EQUAL(map.getNumResults(), n);
+  BOOST_CHECK_EQUAL(restored.getNumResults(), n);
+
+  // The query list has to match.
+  MapType::QueryListType noQueries;
+  MapType other(1, 0, 16, 1000, csr2, csc2);
+  p = bytes.data();
+  BOOST_CHECK_THROW(other.restore(p, bytes.data() + bytes.size(),
+                                  noQueries, 4),
+                    SubgraphQueryResultMapException);
+  BOOST_CHECK_THROW(map.checkpoint(bytes, noQueries),
+                    SubgraphQueryResultMapException);
+}
+
+BOOST_AUTO_TEST_CASE( test_graph_store_checkpoint )
+{
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+
+  GraphStoreType* graphStore0 = new GraphStoreType(1, 0, hostnames, 10000,
+    1000, 1000, 1000, 1000, 1, 1, 1000, 100, featureMap, 1, true);
+  graphStore0->registerQuery(makeQuery(featureMap));
+
+  UniformDestPort generator("192.168.0.2", 1);
+  size_t n = 100;
+  std::vector<VastNetflow> netflows;
+  for (size_t i = 0; i < n; i++) {
+    netflows.push_back(makeNetflow(i, generator.generate(i * 0.01)));
+  }
+  for (auto const& netflow : netflows) {
+    graphStore0->consume(netflow);
+  }
+  // Let the last consume finish.
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::string filename = "TestCheckpoint_graph_store.ckpt";
+  graphStore0->checkpoint(filename);
+
+  GraphStoreType* graphStore1 = new GraphStoreType(1, 0, hostnames, 10010,
+    1000, 1000, 1000, 1000, 1, 1, 1000, 100, featureMap, 1, true);
+  graphStore1->registerQuery(makeQuery(featureMap));
+  graphStore1->restore(filename, 4);
+
+  BOOST_CHECK_EQUAL(graphStore1->getNumIntermediateResults(),
+                    graphStore0->getNumIntermediateResults());
+  BOOST_CHECK_EQUAL(
+    graphStore1->getMemoryBudget().getUsage(MemoryCategory::Edges),
+    graphStore0->getMemoryBudget().getUsage(MemoryCategory::Edges));
+
+  // The query list has to match.
+  GraphStoreType* graphStore2 = new GraphStoreType(1, 0, hostnames, 10020,
+    1000, 1000, 1000, 1000, 1, 1, 1000, 100, featureMap, 1, true);
+  BOOST_CHECK_THROW(graphStore2->restore(filename, 4), GraphStoreException);
+  BOOST_CHECK_THROW(graphStore2->restore("no_such_checkpoint", 4),
+                    GraphStoreException);
+
+  graphStore0->terminate();
+  graphStore1->terminate();
+  graphStore2->terminate();
+  delete graphStore0;
+  delete graphStore1;
+  delete graphStore2;
+  std::remove(filename.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( test_checkpoint_pending_batch )
+{
+  // Tuples waiting for a batch to fill up are processed before the
+  // snapshot, so they are in it.
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+
+  GraphStoreType graphStore0(1, 0, hostnames, 10030,
+    1000, 1000, 1000, 1000, 1, 1, 1000, 100, featureMap, 1, true);
+  graphStore0.setBatchSize(64);
+  graphStore0.registerQuery(makeQuery(featureMap));
+
+  UniformDestPort generator("192.168.0.2", 1);
+  size_t n = 100;
+  for (size_t i = 0; i < n; i++) {
+    graphStore0.consume(makeNetflow(i, generator.generate(i * 0.001)));
+  }
+
+  std::string filename = "TestCheckpoint_pending_batch.ckpt";
+  graphStore0.checkpoint(filename);
+  BOOST_CHECK_EQUAL(graphStore0.getNumBatches(), 2);
+
+  GraphStoreType graphStore1(1, 0, hostnames, 10040,
+    1000, 1000, 1000, 1000, 1, 1, 1000, 100, featureMap, 1, true);
+  graphStore1.registerQuery(makeQuery(featureMap));
+  graphStore1.restore(filename, 4);
+
+  // Every edge starts a result waiting for its second edge.
+  BOOST_CHECK_EQUAL(graphStore0.getNumIntermediateResults(), n);
+  BOOST_CHECK_EQUAL(graphStore1.getNumIntermediateResults(), n);
+
+  graphStore0.terminate();
+  graphStore1.terminate();
+  std::remove(filename.c_str());
+}
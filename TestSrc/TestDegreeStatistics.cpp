@@ -0,0 +1,127 @@
+#define BOOST_TEST_MAIN TestDegreeStatistics
+
+#include <boost/test/unit_test.hpp>
+#include <boost/lexical_cast.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sam/CompressedSparse.hpp>
+#include <sam/DegreeStatistics.hpp>
+#include <sam/VastNetflow.hpp>
+#include <sam/VastNetflowGenerators.hpp>
+
+using namespace sam;
+
+typedef CompressedSparse<VastNetflow, SourceIp, DestIp, TimeSeconds,
+                         DurationSeconds, StringHashFunction,
+                         StringEqualityFunction> CsrType;
+
+BOOST_AUTO_TEST_CASE( test_degree_statistics )
+{
+  DegreeStatistics<int> stats;
+
+  // Vertex 1 gets degree 1, vertex 2 degree 3, vertex 3 degree 4.
+  stats.update(1, 0, 1);
+  for (size_t d = 0; d < 3; d++) stats.update(2, d, d + 1);
+  for (size_t d = 0; d < 4; d++) stats.update(3, d, d + 1);
+
+  BOOST_CHECK_EQUAL(stats.getNumEdges(), 8);
+  BOOST_CHECK_EQUAL(stats.getNumVertices(), 3);
+  std::vector<size_t> h = stats.getHistogram();
+  BOOST_CHECK_EQUAL(h.size(), 4);
+  BOOST_CHECK_EQUAL(h[1], 1); // degree 1
+  BOOST_CHECK_EQUAL(h[2], 1); // degree 3
+  BOOST_CHECK_EQUAL(h[3], 1); // degree 4
+
+  // Removing every edge of vertex 1 drops it.
+  stats.update(1, 1, 0);
+  BOOST_CHECK_EQUAL(stats.getNumVertices(), 2);
+  BOOST_CHECK_EQUAL(stats.getHistogram()[1], 0);
+
+  // Candidates are bounded, and the low degree vertices are the ones
+  // that get pushed out.
+  for (int v = 100; v < 100 + 2 * DEGREE_TOP_CANDIDATES; v++) {
+    stats.update(v, 0, 2);
+  }
+  auto candidates = stats.getCandidates();
+  BOOST_CHECK_EQUAL(candidates.size(), DEGREE_TOP_CANDIDATES);
+  bool sawThree = false;
+  for (auto const& p : candidates) {
+    BOOST_CHECK(p.second >= 2);
+    if (p.first == 3) sawThree = true;
+  }
+  BOOST_CHECK(sawThree);
+
+  // Refreshing with exact degrees drops vertices that went to zero.
+  std::vector<std::pair<int, size_t>> exact;
+  exact.push_back(std::make_pair(3, 0));
+  stats.refreshCandidates(exact);
+  BOOST_CHECK_EQUAL(stats.getCandidates().size(), DEGREE_TOP_CANDIDATES - 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_graph_degrees )
+{
+  CsrType csr(100, 1000);
+  size_t numThreads = 4;
+  size_t numPerThread = 1000;
+
+  // Every thread adds edges out of 10.0.0.0 plus one edge from each of
+  // its own vertices.
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads; t++) {
+    threads.push_back(std::thread([&csr, t, numPerThread]() {
+      UniformDestPort generator("192.168.0.1", 1);
+      for (size_t i = 0; i < numPerThread; i++) {
+        VastNetflow netflow = makeNetflow(t * numPerThread + i,
+                                          generator.generate(i * 0.001));
+        if (i % 2 == 0) {
+          std::get<SourceIp>(netflow) = "10.0.0.0";
+        } else {
+          std::get<SourceIp>(netflow) = "10.1." +
+            boost::lexical_cast<std::string>(t) + "." +
+            boost::lexical_cast<std::string>(i);
+        }
+        csr.addEdge(netflow);
+      }
+    }));
+  }
+  for (auto& thread : threads) thread.join();
+
+  size_t n = numThreads * numPerThread;
+  BOOST_CHECK_EQUAL(csr.countEdges(), n);
+  BOOST_CHECK_EQUAL(csr.countEdgesInWindow(), n);
+  BOOST_CHECK_EQUAL(csr.getNumVertices(), n / 2 + 1);
+  BOOST_CHECK_EQUAL(csr.getDegree("10.0.0.0"), n / 2);
+  BOOST_CHECK_EQUAL(csr.getDegree("10.1.0.1"), 1);
+  BOOST_CHECK_EQUAL(csr.getDegree("10.9.9.9"), 0);
+  BOOST_CHECK(csr.getMeanChainLength() > 0);
+
+  std::vector<size_t> h = csr.getDegreeHistogram();
+  BOOST_CHECK_EQUAL(h[1], n / 2);
+  size_t hubBin = 0;
+  while ((static_cast<size_t>(1) << hubBin) <= n / 2) hubBin++;
+  BOOST_CHECK_EQUAL(h.size(), hubBin + 1);
+  BOOST_CHECK_EQUAL(h[hubBin], 1);
+
+  auto top = csr.getTopDegree(3);
+  BOOST_CHECK_EQUAL(top.size(), 3);
+  BOOST_CHECK_EQUAL(top[0].first, "10.0.0.0");
+  BOOST_CHECK_EQUAL(top[0].second, n / 2);
+  BOOST_CHECK_EQUAL(top[1].second, 1);
+
+  // Moving time forward and sweeping removes everything but the newest
+  // edge, and the counters follow.
+  UniformDestPort generator("192.168.0.1", 1);
+  VastNetflow late = makeNetflow(n, generator.generate(5000));
+  csr.addEdge(late);
+  csr.removeExpiredEdges();
+  BOOST_CHECK_EQUAL(csr.countEdges(), 1);
+  BOOST_CHECK_EQUAL(csr.countEdgesInWindow(), 1);
+  BOOST_CHECK_EQUAL(csr.getNumVertices(), 1);
+  BOOST_CHECK_EQUAL(csr.getDegree("10.0.0.0"), 0);
+  // The hub is no longer reported.  The new vertex may not be either,
+  // since it never passed the degrees of the (now stale) candidates.
+  for (auto const& p : csr.getTopDegree(3)) {
+    BOOST_CHECK(p.first != "10.0.0.0");
+  }
+}
@@ -95,3 +95,49 @@ BOOST_FIXTURE_TEST_CASE( test_zmq, F)
                     edgeRequest2.getEndTimeSecond());
 
 }
+
+BOOST_FIXTURE_TEST_CASE( test_coalesce, F )
+{
+  // Same edges, to the same node, over a later time range.
+  EdgeRequestType later(edgeRequest);
+  later.setStartTimeFirst(1.5);
+  later.setStartTimeSecond(4.0);
+  later.setEndTimeFirst(1.5);
+  later.setEndTimeSecond(5.0);
+
+  // Same edges to another node.
+  EdgeRequestType otherReturn(edgeRequest);
+  otherReturn.setReturn(0);
+
+  // Another source.
+  EdgeRequestType otherSource(edgeRequest);
+  otherSource.setSource("192.168.0.3");
+
+  BOOST_CHECK(edgeRequest.coalescesWith(later));
+  BOOST_CHECK(!edgeRequest.coalescesWith(otherReturn));
+  BOOST_CHECK(!edgeRequest.coalescesWith(otherSource));
+
+  std::list<EdgeRequestType> requests = {edgeRequest, otherReturn, later,
+                                         otherSource, later};
+  std::list<EdgeRequestType> coalesced;
+  BOOST_CHECK_EQUAL(coalesce(requests, coalesced), 2);
+  BOOST_CHECK_EQUAL(coalesced.size(), 3);
+
+  EdgeRequestType const& merged = coalesced.front();
+  BOOST_CHECK_EQUAL(merged.getReturn(), returnNode);
+  BOOST_CHECK_EQUAL(merged.getStartTimeFirst(), 1.0);
+  BOOST_CHECK_EQUAL(merged.getStartTimeSecond(), 4.0);
+  BOOST_CHECK_EQUAL(merged.getEndTimeFirst(), 1.0);
+  BOOST_CHECK_EQUAL(merged.getEndTimeSecond(), 5.0);
+  BOOST_CHECK_EQUAL(std::next(coalesced.begin())->getReturn(), 0);
+  BOOST_CHECK_EQUAL(coalesced.back().getSource(), "192.168.0.3");
+  BOOST_CHECK_EQUAL(coalesced.back().getEndTimeSecond(), endTimeSecond);
+
+  // An unset bound stays unset.
+  EdgeRequestType unbounded(edgeRequest);
+  unbounded.setEndTimeSecond(nullValue<double>());
+  EdgeRequestType copy(edgeRequest);
+  copy.merge(unbounded);
+  BOOST_CHECK(isNull(copy.getEndTimeSecond()));
+  BOOST_CHECK_EQUAL(copy.getStartTimeSecond(), startTimeSecond);
+}
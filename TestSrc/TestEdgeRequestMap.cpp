@@ -171,3 +171,138 @@ BOOST_AUTO_TEST_CASE( test_edge_request_map )
   delete edgeCommunicator1;
 
 }
+
+BOOST_AUTO_TEST_CASE( test_coalescing )
+{
+  // Requests for the same edges by the same node are stored once, and
+  // tuples are forwarded until the latest of their expiries.
+  size_t numNodes = 2;
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  hostnames.push_back("localhost");
+  size_t startingPort = 10640;
+  auto noopFunction = [](std::string const& str) {};
+  std::vector<PushPull::FunctionType> functions;
+  functions.push_back(noopFunction);
+  PushPull* edgeCommunicator0 = new PushPull(numNodes, 0, 1, 1, hostnames,
+    1000, functions, startingPort, -1, true);
+  PushPull* edgeCommunicator1 = new PushPull(numNodes, 1, 1, 1, hostnames,
+    1000, functions, startingPort, -1, true);
+
+  MapType map(numNodes, 0, 1000, edgeCommunicator0);
+
+  auto makeRequest = [](std::string target, int returnNode, double first,
+                        double second)
+  {
+    EdgeRequestType request;
+    request.setTarget(target);
+    request.setReturn(returnNode);
+    request.setStartTimeFirst(first);
+    request.setStartTimeSecond(second);
+    request.setEndTimeFirst(first);
+    request.setEndTimeSecond(second);
+    return request;
+  };
+
+  // Node 1 asks for edges into 192.168.0.2 over overlapping time ranges.
+  for (size_t i = 0; i < 10; i++) {
+    map.addRequest(makeRequest("192.168.0.2", 1, i, i + 10));
+  }
+  BOOST_CHECK_EQUAL(map.getNumRequests(), 1);
+  BOOST_CHECK_EQUAL(map.getNumCoalesced(), 9);
+
+  // Another target, or the same target for another node, are separate.
+  map.addRequest(makeRequest("192.168.0.4", 1, 0, 10));
+  map.addRequest(makeRequest("192.168.0.2", 0, 0, 10));
+  BOOST_CHECK_EQUAL(map.getNumRequests(), 3);
+  BOOST_CHECK_EQUAL(map.getNumCoalesced(), 9);
+
+  // An edge from a vertex node 1 doesn't own, past the first request's
+  // expiry but not the last one's.
+  std::string str = "15,parseDate,dateTimeStr,ipLayerProtocol,"
+    "ipLayerProtocolCode,192.168.0.4,192.168.0.2,29986,1900,"
+    "1,1,1,1,1,1,1,1,1,1";
+  VastNetflow netflow = makeNetflow(0, str);
+  size_t viewed = map.process(netflow);
+  BOOST_CHECK_EQUAL(map.getTotalEdgePushes(), 1);
+  // One request in the target's bucket instead of ten.
+  BOOST_CHECK(viewed <= 3);
+
+  map.terminate();
+  edgeCommunicator1->terminate();
+  delete edgeCommunicator0;
+  delete edgeCommunicator1;
+}
+
+BOOST_AUTO_TEST_CASE( test_expiry )
+{
+  // Requests for keys no tuple touches are still removed once the tuples'
+  // time passes their expiry.
+  size_t numNodes = 2;
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  hostnames.push_back("localhost");
+  size_t startingPort = 10650;
+  auto noopFunction = [](std::string const& str) {};
+  std::vector<PushPull::FunctionType> functions;
+  functions.push_back(noopFunction);
+  PushPull* edgeCommunicator0 = new PushPull(numNodes, 0, 1, 1, hostnames,
+    1000, functions, startingPort, -1, true);
+  PushPull* edgeCommunicator1 = new PushPull(numNodes, 1, 1, 1, hostnames,
+    1000, functions, startingPort, -1, true);
+
+  MapType map(numNodes, 0, 16, edgeCommunicator0);
+
+  // Targets, sources, and pairs, expiring at 1, 2, ..., 100.
+  size_t n = 100;
+  for (size_t i = 0; i < n; i++) {
+    EdgeRequestType request;
+    std::string vertex = "10.0." + std::to_string(i / 256) + "." +
+                         std::to_string(i % 256);
+    if (i % 3 != 1) request.setTarget(vertex);
+    if (i % 3 != 0) request.setSource(vertex);
+    request.setReturn(1);
+    request.setEndTimeFirst(0);
+    request.setEndTimeSecond(i + 1);
+    map.addRequest(request);
+  }
+  // A request that never expires.
+  EdgeRequestType forever;
+  forever.setTarget("192.168.0.100");
+  forever.setReturn(1);
+  map.addRequest(forever);
+
+  BOOST_CHECK_EQUAL(map.getNumRequests(), n + 1);
+  BOOST_CHECK_EQUAL(map.getNumKeys(), n + 1);
+
+  // The same vertex as a source, a target, and a pair are three keys that
+  // still spread out over the slots.
+  ChainLengthStats stats = map.getChainLengthStats();
+  BOOST_CHECK(stats.maxLength <= 8);
+
+  std::string str = "50.5,parseDate,dateTimeStr,ipLayerProtocol,"
+    "ipLayerProtocolCode,192.168.0.4,192.168.0.2,29986,1900,"
+    "1,1,1,1,1,1,1,1,1,1";
+  VastNetflow netflow = makeNetflow(0, str);
+  map.process(netflow);
+  BOOST_CHECK_EQUAL(map.getNumExpired(), 50);
+  BOOST_CHECK_EQUAL(map.getNumRequests(), n + 1 - 50);
+  BOOST_CHECK_EQUAL(map.getNumKeys(), n + 1 - 50);
+
+  // Several steps are needed to work through a large backlog.
+  size_t removed = 0;
+  for (size_t i = 0; i < 10; i++) removed += map.expire(1000);
+  BOOST_CHECK_EQUAL(removed, 50);
+  BOOST_CHECK_EQUAL(map.getNumRequests(), 1);
+  BOOST_CHECK_EQUAL(map.getNumKeys(), 1);
+
+  // The tuple didn't match any key, so no requests were viewed.
+  BOOST_CHECK_EQUAL(map.getTotalTuplesProcessed(), 1);
+  BOOST_CHECK_EQUAL(map.getTotalEdgeRequestsViewed(), 0);
+  BOOST_CHECK_EQUAL(map.getEdgeRequestsViewedPerTuple(), 0);
+
+  map.terminate();
+  edgeCommunicator1->terminate();
+  delete edgeCommunicator0;
+  delete edgeCommunicator1;
+}
@@ -0,0 +1,231 @@
+#define BOOST_TEST_MAIN TestGenericJoin
+
+#include <boost/test/unit_test.hpp>
+#include <random>
+#include <string>
+#include <vector>
+#include <sam/GenericJoin.hpp>
+#include <sam/GraphStore.hpp>
+#include <sam/VastNetflow.hpp>
+
+using namespace sam;
+
+typedef GenericJoin<VastNetflow, SourceIp, DestIp, TimeSeconds,
+                    DurationSeconds, StringHashFunction, StringHashFunction,
+                    StringEqualityFunction, StringEqualityFunction> JoinType;
+typedef JoinType::QueryType QueryType;
+typedef JoinType::ResultType ResultType;
+typedef std::vector<std::string> ListType;
+
+/**
+ * A query for edges v0 -> v1 -> ... -> v{n-1} in increasing time within
+ * window, closed by v{n-1} -> v0 if cycle is set.
+ */
+std::shared_ptr<QueryType> makeQuery(std::shared_ptr<FeatureMap> featureMap,
+                                     size_t n, bool cycle, double window)
+{
+  auto query = std::make_shared<QueryType>(featureMap);
+  size_t numEdges = cycle ? n : n - 1;
+  for (size_t i = 0; i < numEdges; i++) {
+    std::string e = "e" + std::to_string(i);
+    query->addExpression(EdgeExpression("v" + std::to_string(i), e,
+                                        "v" + std::to_string((i + 1) % n)));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, e,
+      i == 0 ? EdgeOperator::Assignment : EdgeOperator::GreaterThan, 0));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, e,
+      EdgeOperator::LessThan, window));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::EndTime, e,
+      EdgeOperator::LessThan, window));
+  }
+  query->finalize();
+  return query;
+}
+
+VastNetflow makeEdge(double time, std::string src, std::string trg,
+                     double duration = 1)
+{
+  std::string str = std::to_string(time) +
+    ",parseDate,dateTimeStr,ipLayerProtocol,ipLayerProtocolCode," +
+    src + "," + trg + ",29986,1900,1,1," + std::to_string(duration) +
+    ",1,1,1,1,1,1,1";
+  return makeNetflow(0, str);
+}
+
+BOOST_AUTO_TEST_CASE( test_intersect )
+{
+  ListType a = {"a", "c", "d", "f", "k"};
+  ListType b = {"b", "c", "f", "g", "k", "m"};
+  ListType c = {"c", "e", "f", "k", "z"};
+  ListType empty;
+  ListType out;
+
+  JoinType::intersect({&a, &b, &c}, out);
+  BOOST_CHECK(out == ListType({"c", "f", "k"}));
+
+  JoinType::intersect({&c, &a}, out);
+  BOOST_CHECK(out == ListType({"c", "f", "k"}));
+
+  JoinType::intersect({&a}, out);
+  BOOST_CHECK(out == a);
+
+  JoinType::intersect({&a, &empty}, out);
+  BOOST_CHECK(out.empty());
+
+  ListType d = {"a", "d"};
+  ListType e = {"b", "m"};
+  JoinType::intersect({&d, &e}, out);
+  BOOST_CHECK(out.empty());
+}
+
+BOOST_AUTO_TEST_CASE( test_supports )
+{
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  BOOST_CHECK(JoinType::supports(*makeQuery(featureMap, 3, true, 10)));
+  BOOST_CHECK(JoinType::supports(*makeQuery(featureMap, 4, true, 10)));
+  BOOST_CHECK(!JoinType::supports(*makeQuery(featureMap, 3, false, 10)));
+}
+
+BOOST_AUTO_TEST_CASE( test_four_cycle )
+{
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = makeQuery(featureMap, 4, true, 10);
+  JoinType::CsrType csr(1000, 100);
+  JoinType::CscType csc(1000, 100);
+  JoinType join(csr, csc);
+
+  // Two ways around from a to d (through b and through c), then back to a,
+  // plus edges that break the order or the window.
+  std::vector<VastNetflow> edges = {
+    makeEdge(1, "a", "b"),
+    makeEdge(1.5, "a", "c"),
+    makeEdge(2, "b", "c"),
+    makeEdge(2.5, "c", "d"),
+    makeEdge(3, "a", "e"),
+    makeEdge(3.5, "e", "c"),
+    makeEdge(4, "d", "a"),
+    makeEdge(20, "d", "a"),
+  };
+
+  std::vector<ResultType> results;
+  auto emit = [&results](ResultType const& r) { results.push_back(r); };
+  for (size_t i = 0; i < edges.size(); i++) {
+    std::get<SamGeneratedId>(edges[i]) = i + 1;
+    csr.addEdge(edges[i]);
+    csc.addEdge(edges[i]);
+    join.matchLast(query, edges[i], emit);
+  }
+
+  // a -> b -> c -> d -> a is in order; a -> e -> c -> d -> a isn't (e -> c
+  // comes after c -> d), and the edge at 20 is out of the window.
+  BOOST_CHECK_EQUAL(results.size(), 1);
+  BOOST_CHECK_EQUAL(join.getNumMatches(), 1);
+  auto tuples = results[0].getResultTuples();
+  BOOST_CHECK_EQUAL(std::get<SourceIp>(tuples[1]), "b");
+  BOOST_CHECK_EQUAL(std::get<SourceIp>(tuples[2]), "c");
+  BOOST_CHECK_EQUAL(std::get<SourceIp>(tuples[3]), "d");
+
+  // Any edge can close the cycle, so every one was joined.
+  BOOST_CHECK_EQUAL(join.getNumJoins(), 8);
+  BOOST_CHECK(join.getNumIntersections() > 0);
+
+  BOOST_CHECK_THROW(join.matchLast(makeQuery(featureMap, 1, true, 10),
+                                   edges[0], emit),
+                    GenericJoinException);
+}
+
+BOOST_AUTO_TEST_CASE( test_end_relative )
+{
+  // A triangle whose times are measured from the end of its first edge,
+  // which lasts longer than the query's time extent.
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(EdgeExpression("x", "e0", "y"));
+  query->addExpression(EdgeExpression("y", "e1", "z"));
+  query->addExpression(EdgeExpression("z", "e2", "x"));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::EndTime, "e0",
+                                          EdgeOperator::Assignment, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+                                          EdgeOperator::GreaterThan, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+                                          EdgeOperator::LessThan, 10));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::GreaterThan, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::LessThan, 10));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::EndTime, "e2",
+                                          EdgeOperator::LessThan, 10));
+  query->finalize();
+  BOOST_CHECK(!query->zeroTimeRelativeToStart());
+
+  JoinType::CsrType csr(1000, 100);
+  JoinType::CscType csc(1000, 100);
+  JoinType join(csr, csc);
+  std::vector<VastNetflow> edges = {
+    makeEdge(0, "a", "b", 20),
+    makeEdge(21, "b", "c"),
+    makeEdge(22, "c", "a"),
+  };
+
+  std::vector<ResultType> results;
+  auto emit = [&results](ResultType const& r) { results.push_back(r); };
+  for (size_t i = 0; i < edges.size(); i++) {
+    std::get<SamGeneratedId>(edges[i]) = i + 1;
+    csr.addEdge(edges[i]);
+    csc.addEdge(edges[i]);
+    join.matchLast(query, edges[i], emit);
+  }
+  BOOST_CHECK_EQUAL(results.size(), 1);
+  BOOST_CHECK_EQUAL(join.getNumMatches(), 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_graph_store_triangles )
+{
+  typedef GraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                     TimeSeconds, DurationSeconds,
+                     StringHashFunction, StringHashFunction,
+                     StringEqualityFunction, StringEqualityFunction>
+          GraphStoreType;
+
+  // The same edges go to a GraphStore keeping partial results and to one
+  // joining, and both find the same triangles.
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  GraphStoreType incremental(1, 0, hostnames, 10680, 1000, 1000, 1000, 1000,
+    1, 1, 100, 1000, featureMap, 100, true, 1);
+  GraphStoreType joined(1, 0, hostnames, 10690, 1000, 1000, 1000, 1000,
+    1, 1, 100, 1000, featureMap, 100, true, 1);
+
+  auto triangle = makeQuery(featureMap, 3, true, 2);
+  auto path = makeQuery(featureMap, 3, false, 2);
+  incremental.registerQuery(triangle);
+  joined.registerQuery(triangle);
+  joined.setGenericJoin(true);
+  joined.registerQuery(path);
+  BOOST_CHECK(joined.getGenericJoin());
+  BOOST_CHECK(joined.usesGenericJoin(0));
+  BOOST_CHECK(!joined.usesGenericJoin(1));
+
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<size_t> vertex(0, 19);
+  size_t n = 2000;
+  for (size_t i = 0; i < n; i++) {
+    std::string src = "10.0.0." + std::to_string(vertex(gen));
+    std::string trg = "10.0.0." + std::to_string(vertex(gen));
+    if (src == trg) continue;
+    VastNetflow edge = makeEdge(1 + i * 0.01, src, trg);
+    incremental.consume(edge);
+    joined.consume(edge);
+  }
+  incremental.waitForConsume();
+  joined.waitForConsume();
+
+  // The path query isn't cyclic, so it is still matched incrementally.
+  size_t numTriangles = incremental.getNumResults();
+  BOOST_CHECK(numTriangles > 0);
+  BOOST_CHECK_EQUAL(joined.getGenericJoin()->getNumMatches(), numTriangles);
+  BOOST_CHECK(joined.getNumResults() > numTriangles);
+
+  incremental.terminate();
+  joined.terminate();
+}
@@ -0,0 +1,144 @@
+#define BOOST_TEST_MAIN TestHubMirror
+
+#include <boost/test/unit_test.hpp>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <sam/GraphStore.hpp>
+#include <sam/HubMirror.hpp>
+#include <sam/RemoteEdgeCache.hpp>
+#include <sam/VastNetflow.hpp>
+
+using namespace sam;
+
+typedef HubMirror<std::string> MirrorType;
+typedef std::vector<std::pair<std::string, size_t>> CandidatesType;
+
+BOOST_AUTO_TEST_CASE( test_select )
+{
+  // Epochs of 10 seconds, hubs at 1 request per second or degree 100.
+  MirrorType mirror(2, 10, 1, 100, 0.5);
+  std::map<std::string, size_t> degrees;
+  auto degreeOf = [&degrees](std::string const& v) { return degrees[v]; };
+
+  // The first call starts the first epoch.
+  BOOST_CHECK(mirror.due(0));
+  BOOST_CHECK(mirror.select(0, CandidatesType(), degreeOf).empty());
+  BOOST_CHECK(!mirror.due(5));
+
+  // a and b pass 10 requests in 10 seconds, c doesn't, and d has the
+  // degree.  Only the top two are kept.
+  for (size_t i = 0; i < 30; i++) mirror.requested("a");
+  for (size_t i = 0; i < 20; i++) mirror.requested("b");
+  for (size_t i = 0; i < 5; i++) mirror.requested("c");
+  degrees["a"] = 10;
+  degrees["b"] = 10;
+  degrees["d"] = 500;
+  CandidatesType candidates = {{"d", 500}};
+
+  BOOST_CHECK(mirror.due(10));
+  auto leases = mirror.select(10, candidates, degreeOf);
+  BOOST_CHECK_EQUAL(leases.size(), 2);
+  BOOST_CHECK_EQUAL(leases[0].vertex, "a");
+  BOOST_CHECK_EQUAL(leases[1].vertex, "b");
+  BOOST_CHECK_EQUAL(leases[0].from, 10.5);
+  BOOST_CHECK_EQUAL(leases[0].until, 30.5);
+  BOOST_CHECK(mirror.isHub("a"));
+  BOOST_CHECK(!mirror.isHub("c"));
+  BOOST_CHECK(!mirror.isHub("d"));
+  BOOST_CHECK_EQUAL(mirror.getNumPromoted(), 2);
+
+  // The next epoch nobody asks for a or b anymore (they are mirrored).  a
+  // keeps its degree and is renewed, b's degree fell by more than half so
+  // it is dropped for d.
+  degrees["b"] = 4;
+  leases = mirror.select(20, candidates, degreeOf);
+  BOOST_CHECK_EQUAL(leases.size(), 2);
+  BOOST_CHECK(mirror.isHub("a"));
+  BOOST_CHECK(!mirror.isHub("b"));
+  BOOST_CHECK(mirror.isHub("d"));
+  BOOST_CHECK_EQUAL(mirror.getNumHubs(), 2);
+  BOOST_CHECK_EQUAL(mirror.getNumRenewed(), 1);
+  BOOST_CHECK_EQUAL(mirror.getNumDropped(), 1);
+  BOOST_CHECK_EQUAL(mirror.getNumPromoted(), 3);
+
+  // A renewed lease overlaps the last one.
+  for (auto const& lease : leases) {
+    if (lease.vertex == "a") BOOST_CHECK(lease.from < 30.5);
+  }
+
+  // Everything cools down.
+  degrees.clear();
+  BOOST_CHECK(mirror.select(30, CandidatesType(), degreeOf).empty());
+  BOOST_CHECK_EQUAL(mirror.getNumHubs(), 0);
+  BOOST_CHECK_EQUAL(mirror.getNumDropped(), 3);
+
+  BOOST_CHECK_THROW(MirrorType(2, 0), HubMirrorException);
+  BOOST_CHECK_THROW(MirrorType(2, 10, 0), HubMirrorException);
+}
+
+BOOST_AUTO_TEST_CASE( test_announcement )
+{
+  // An announcement received on the other node makes its remote edge cache
+  // answer requests for the hub.
+  typedef RemoteEdgeCache<VastNetflow, SourceIp, DestIp, TimeSeconds,
+                          DurationSeconds> CacheType;
+  typedef CacheType::EdgeRequestType EdgeRequestType;
+
+  EdgeRequestType request;
+  request.setTarget("10.0.0.1");
+  request.setReturn(1);
+  request.setStartTimeFirst(10.5);
+  request.setStartTimeSecond(30.5);
+  request.setEndTimeFirst(10.5);
+  request.setEndTimeSecond(30.5);
+  std::string announcement = MirrorType::announce(request.serialize());
+
+  BOOST_CHECK(MirrorType::isAnnouncement(announcement));
+  BOOST_CHECK(!MirrorType::isAnnouncement(request.serialize()));
+  typedef VertexSummaries<std::string, StringHashFunction> SummariesType;
+  BOOST_CHECK(!SummariesType::isSummary(announcement));
+
+  MirrorType mirror(2, 10);
+  CacheType cache(1000, 100);
+  cache.requested(EdgeRequestType(mirror.received(announcement)));
+  BOOST_CHECK_EQUAL(mirror.getNumAnnouncementsReceived(), 1);
+  BOOST_CHECK_THROW(mirror.received(request.serialize()), HubMirrorException);
+
+  std::string str = "12,parseDate,dateTimeStr,ipLayerProtocol,"
+    "ipLayerProtocolCode,10.0.0.2,10.0.0.1,29986,1900,1,1,1,1,1,1,1,1,1,1";
+  cache.add(makeNetflow(0, str));
+
+  EdgeRequestType later(request);
+  later.setStartTimeFirst(11);
+  later.setStartTimeSecond(21);
+  std::list<VastNetflow> edges;
+  BOOST_CHECK(cache.lookup(later, edges));
+  BOOST_CHECK_EQUAL(edges.size(), 1);
+
+  // Before the lease starts it isn't covered.
+  EdgeRequestType earlier(request);
+  earlier.setStartTimeFirst(5);
+  BOOST_CHECK(!cache.lookup(earlier, edges));
+}
+
+BOOST_AUTO_TEST_CASE( test_single_node_graph_store )
+{
+  typedef GraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                     TimeSeconds, DurationSeconds,
+                     StringHashFunction, StringHashFunction,
+                     StringEqualityFunction, StringEqualityFunction>
+          GraphStoreType;
+
+  // A single node has nobody to mirror to.
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  GraphStoreType graphStore(1, 0, hostnames, 10670, 1000, 1000, 1000, 1000,
+    1, 1, 100, 1000, featureMap, 100, true, 1);
+  graphStore.setHubMirroring();
+  BOOST_CHECK(!graphStore.getHubMirror());
+  BOOST_CHECK(!graphStore.getRemoteEdgeCache());
+  graphStore.terminate();
+}
@@ -0,0 +1,185 @@
+#define BOOST_TEST_MAIN TestLoadShedder
+
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+#include <sam/GraphStore.hpp>
+#include <sam/LoadShedder.hpp>
+#include <sam/VastNetflow.hpp>
+
+using namespace sam;
+
+BOOST_AUTO_TEST_CASE( test_adjust )
+{
+  LoadShedder shedder(0, 0, 100);
+  shedder.addQuery();
+  shedder.addQuery();
+
+  // Nothing is dropped until an adjustment says so.
+  for (size_t i = 0; i < 90; i++) BOOST_CHECK(shedder.admit(0));
+  for (size_t i = 0; i < 10; i++) BOOST_CHECK(shedder.admit(1));
+
+  // Twice the partial results allowed: shed the excess, and cut the query
+  // that started most of them harder.
+  LoadSignals signals;
+  signals.numIntermediateResults = 200;
+  BOOST_CHECK_EQUAL(shedder.adjust(signals), 100);
+  BOOST_CHECK_EQUAL(shedder.getLoad(), 2);
+  BOOST_CHECK_EQUAL(shedder.getNumOverloaded(), 1);
+  double keep0 = shedder.getKeepProbability(0);
+  double keep1 = shedder.getKeepProbability(1);
+  BOOST_CHECK(keep0 < keep1);
+  BOOST_CHECK(keep1 < 1);
+
+  // Fewer starts are kept.
+  size_t kept = 0;
+  for (size_t i = 0; i < 10000; i++) kept += shedder.admit(0);
+  BOOST_CHECK(kept > 10000 * keep0 * 0.8);
+  BOOST_CHECK(kept < 10000 * keep0 * 1.2);
+  BOOST_CHECK_EQUAL(shedder.getNumOffered(0), 10090);
+  BOOST_CHECK_EQUAL(shedder.getNumKept(0), 90 + kept);
+
+  // At the limit nothing changes; under it the probabilities grow back.
+  signals.numIntermediateResults = 90;
+  BOOST_CHECK_EQUAL(shedder.adjust(signals), 0);
+  BOOST_CHECK_EQUAL(shedder.getKeepProbability(1), keep1);
+  signals.numIntermediateResults = 10;
+  for (size_t i = 0; i < 100; i++) shedder.adjust(signals);
+  BOOST_CHECK_EQUAL(shedder.getKeepProbability(0), 1);
+  BOOST_CHECK_EQUAL(shedder.getKeepProbability(1), 1);
+  BOOST_CHECK_EQUAL(shedder.getNumAdjustments(), 102);
+
+  BOOST_CHECK_THROW(shedder.admit(2), LoadShedderException);
+  BOOST_CHECK_THROW(LoadShedder(0, 0, 0), LoadShedderException);
+  BOOST_CHECK_THROW(LoadShedder(1, 0, 0, 0), LoadShedderException);
+}
+
+BOOST_AUTO_TEST_CASE( test_latency_and_queue )
+{
+  LoadShedder shedder(0.01, 100, 0);
+  shedder.addQuery();
+  shedder.admit(0);
+
+  // 100 tuples took 2 seconds in all: 0.02 each, twice the target.
+  LoadSignals signals;
+  signals.totalLatency = 2;
+  signals.numCompleted = 100;
+  shedder.adjust(signals);
+  BOOST_CHECK_CLOSE(shedder.getLoad(), 2, 0.001);
+  BOOST_CHECK(shedder.getKeepProbability(0) < 1);
+
+  // Only the change since the last adjustment counts.
+  signals.totalLatency = 2.5;
+  signals.numCompleted = 200;
+  signals.queueLength = 50;
+  shedder.adjust(signals);
+  BOOST_CHECK_CLOSE(shedder.getLoad(), 0.5, 0.001);
+
+  signals.queueLength = 300;
+  shedder.adjust(signals);
+  BOOST_CHECK_CLOSE(shedder.getLoad(), 3, 0.001);
+
+  // The keep probability has a floor.
+  for (size_t i = 0; i < 100; i++) {
+    for (size_t j = 0; j < 10000; j++) shedder.admit(0);
+    shedder.adjust(signals);
+  }
+  BOOST_CHECK_EQUAL(shedder.getKeepProbability(0), LOAD_SHEDDER_MIN_KEEP);
+}
+
+BOOST_AUTO_TEST_CASE( test_recall )
+{
+  LoadShedder shedder(0, 0, 10);
+  shedder.addQuery();
+  BOOST_CHECK_EQUAL(shedder.getEstimatedRecall(0), 1);
+
+  for (size_t i = 0; i < 100; i++) shedder.admit(0);
+  LoadSignals signals;
+  signals.numIntermediateResults = 1000;
+  shedder.adjust(signals);
+  for (size_t i = 0; i < 100; i++) shedder.admit(0);
+
+  // Some of the starts were kept, and they gave 1 result per start.
+  double kept = shedder.getNumKept(0);
+  double startFraction = kept / 200;
+  BOOST_CHECK_CLOSE(shedder.getEstimatedRecall(0), startFraction, 0.001);
+  shedder.completed(0, kept);
+  BOOST_CHECK_CLOSE(shedder.getEstimatedRecall(0), startFraction, 0.001);
+
+  // As many shed partial results as starts kept loses about half of the
+  // remaining results.
+  shedder.evicted(0, kept);
+  BOOST_CHECK_CLOSE(shedder.getEstimatedRecall(0), startFraction / 2, 0.001);
+  BOOST_CHECK_CLOSE(shedder.getEstimatedRecallLoss(0),
+                    1 - startFraction / 2, 0.001);
+}
+
+BOOST_AUTO_TEST_CASE( test_graph_store )
+{
+  typedef GraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                     TimeSeconds, DurationSeconds,
+                     StringHashFunction, StringHashFunction,
+                     StringEqualityFunction, StringEqualityFunction>
+          GraphStoreType;
+  typedef GraphStoreType::QueryType QueryType;
+
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  GraphStoreType graphStore(1, 0, hostnames, 10670, 1000, 1000, 1000, 1000,
+    1, 1, 100, 1000, featureMap, 100, true, 1);
+
+  // x -> y, then y -> z.  Every edge into the hub starts a result that
+  // waits for an edge out of it, which never comes.
+  double queryTimeWindow = 100;
+  EdgeExpression x2y("nodex", "e0", "nodey");
+  EdgeExpression y2z("nodey", "e1", "nodez");
+  TimeEdgeExpression startE0First(EdgeFunction::StartTime, "e0",
+                                  EdgeOperator::Assignment, 0);
+  TimeEdgeExpression startE1First(EdgeFunction::StartTime, "e1",
+                                  EdgeOperator::GreaterThan, 0);
+  TimeEdgeExpression startE0Second(EdgeFunction::StartTime, "e0",
+                                   EdgeOperator::LessThan, queryTimeWindow);
+  TimeEdgeExpression startE1Second(EdgeFunction::StartTime, "e1",
+                                   EdgeOperator::LessThan, queryTimeWindow);
+  TimeEdgeExpression endE0Second(EdgeFunction::EndTime, "e0",
+                                 EdgeOperator::LessThan, queryTimeWindow);
+  TimeEdgeExpression endE1Second(EdgeFunction::EndTime, "e1",
+                                 EdgeOperator::LessThan, queryTimeWindow);
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(x2y);
+  query->addExpression(y2z);
+  query->addExpression(startE0First);
+  query->addExpression(startE1First);
+  query->addExpression(startE0Second);
+  query->addExpression(startE1Second);
+  query->addExpression(endE0Second);
+  query->addExpression(endE1Second);
+  query->finalize();
+
+  size_t maxResults = 100;
+  size_t interval = 10;
+  graphStore.setLoadShedding(0, 0, maxResults, interval);
+  graphStore.registerQuery(query);
+
+  size_t n = 2000;
+  for (size_t i = 0; i < n; i++) {
+    std::string str = std::to_string(1 + i * 0.01) +
+      ",parseDate,dateTimeStr,ipLayerProtocol,ipLayerProtocolCode,"
+      "10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256) +
+      ",hub,29986,1900,1,1,1,1,1,1,1,1,1,1";
+    graphStore.consume(makeNetflow(0, str));
+  }
+  graphStore.waitForConsume();
+
+  auto shedder = graphStore.getLoadShedder();
+  BOOST_CHECK_EQUAL(shedder->getNumQueries(), 1);
+  BOOST_CHECK_EQUAL(shedder->getNumOffered(0), n);
+  BOOST_CHECK(shedder->getNumKept(0) < n);
+  BOOST_CHECK(shedder->getNumEvicted(0) > 0);
+  BOOST_CHECK(shedder->getKeepProbability(0) < 1);
+  BOOST_CHECK(graphStore.getNumIntermediateResults() <= maxResults + interval);
+  BOOST_CHECK(shedder->getEstimatedRecallLoss(0) > 0);
+
+  graphStore.terminate();
+}
@@ -0,0 +1,178 @@
+#define BOOST_TEST_MAIN TestMemoryBudget
+
+#include <boost/test/unit_test.hpp>
+#include <sam/MemoryBudget.hpp>
+#include <sam/CompressedSparse.hpp>
+#include <sam/SubgraphQuery.hpp>
+#include <sam/SubgraphQueryResultMap.hpp>
+#include <sam/VastNetflow.hpp>
+#include <sam/VastNetflowGenerators.hpp>
+
+using namespace sam;
+
+typedef SubgraphQueryResultMap<VastNetflow, SourceIp, DestIp,
+  TimeSeconds, DurationSeconds, StringHashFunction, StringHashFunction,
+  StringEqualityFunction, StringEqualityFunction> MapType;
+
+typedef SubgraphQuery<VastNetflow, SourceIp, DestIp, TimeSeconds,
+  DurationSeconds> QueryType;
+
+typedef MapType::QueryResultType QueryResultType;
+typedef MapType::EdgeRequestType EdgeRequestType;
+typedef MapType::CscType CscType;
+typedef MapType::CsrType CsrType;
+
+BOOST_AUTO_TEST_CASE( test_heap_bytes )
+{
+  std::string small = "a";
+  std::string big(100, 'a');
+  BOOST_CHECK_EQUAL(heapBytes(small), 0);
+  BOOST_CHECK_EQUAL(heapBytes(big), 101);
+  BOOST_CHECK_EQUAL(heapBytes(5.0), 0);
+
+  std::tuple<int, std::string, std::string> t(1, small, big);
+  BOOST_CHECK_EQUAL(heapBytes(t), 101);
+}
+
+BOOST_AUTO_TEST_CASE( test_budget )
+{
+  MemoryBudget budget(1000, MEMORY_POLICY_DROP_QUERY_STARTS |
+                            MEMORY_POLICY_SHORTEN_WINDOW);
+  BOOST_CHECK(budget.hasPolicy(MEMORY_POLICY_DROP_QUERY_STARTS));
+  BOOST_CHECK(budget.hasPolicy(MEMORY_POLICY_SHORTEN_WINDOW));
+  BOOST_CHECK(!budget.hasPolicy(MEMORY_POLICY_EVICT_OLDEST_RESULTS));
+
+  budget.add(MemoryCategory::Edges, 600);
+  budget.add(MemoryCategory::Results, 300);
+  BOOST_CHECK(!budget.overBudget());
+  budget.add(MemoryCategory::Requests, 200);
+  BOOST_CHECK(budget.overBudget());
+  BOOST_CHECK_EQUAL(budget.getUsage(), 1100);
+  BOOST_CHECK_EQUAL(budget.getExcess(), 200);
+
+  budget.remove(MemoryCategory::Edges, 600);
+  BOOST_CHECK(!budget.overBudget());
+  BOOST_CHECK_EQUAL(budget.getUsage(MemoryCategory::Edges), 0);
+  BOOST_CHECK_EQUAL(budget.getExcess(), 0);
+
+  // Zero means no limit.
+  MemoryBudget unlimited;
+  unlimited.add(MemoryCategory::Edges, 1000000);
+  BOOST_CHECK(!unlimited.overBudget());
+}
+
+BOOST_AUTO_TEST_CASE( test_graph_accounting )
+{
+  MemoryBudget budget;
+  double window = 100;
+  CsrType csr(1000, window);
+  csr.setMemoryBudget(&budget);
+
+  UniformDestPort generator("192.168.0.2", 1);
+  size_t n = 1000;
+  for (size_t i = 0; i < n; i++) {
+    csr.addEdge(makeNetflow(i, generator.generate(i * 0.01)));
+  }
+  size_t full = budget.getUsage(MemoryCategory::Edges);
+  BOOST_CHECK(full > n * sizeof(VastNetflow));
+
+  // Shorten the window so that all but the last edge are outside of it.
+  csr.setWindow(0.001);
+  size_t removed = csr.removeExpiredEdges();
+  BOOST_CHECK_EQUAL(removed, n - 1);
+  // The per-source lists stay around until they are migrated, so usage
+  // doesn't go all the way down.
+  BOOST_CHECK(budget.getUsage(MemoryCategory::Edges) < full / 2);
+  BOOST_CHECK_EQUAL(csr.countEdges(), 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_evict_oldest )
+{
+  MemoryBudget budget;
+  CsrType csr(1000, 100);
+  CscType csc(1000, 100);
+  MapType map(1, 0, 1000, 1000, csr, csc);
+  map.setMemoryBudget(&budget);
+
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = std::make_shared<QueryType>(featureMap);
+  EdgeExpression y2x("nodey", "e1", "nodex");
+  EdgeExpression z2x("nodez", "e2", "nodex");
+  TimeEdgeExpression startE1(EdgeFunction::StartTime, "e1",
+                             EdgeOperator::Assignment, 0);
+  TimeEdgeExpression startE2(EdgeFunction::StartTime, "e2",
+                             EdgeOperator::GreaterThan, 0);
+  query->addExpression(startE1);
+  query->addExpression(startE2);
+  query->addExpression(y2x);
+  query->addExpression(z2x);
+  query->finalize();
+
+  UniformDestPort generator("192.168.0.2", 1);
+  std::list<EdgeRequestType> edgeRequests;
+  size_t n = 100;
+  for (size_t i = 0; i < n; i++) {
+    VastNetflow netflow = makeNetflow(i, generator.generate(i * 0.01));
+    QueryResultType result(query, netflow);
+    map.add(result, edgeRequests);
+  }
+  BOOST_CHECK_EQUAL(map.getNumIntermediateResults(), n);
+  size_t full = budget.getUsage(MemoryCategory::Results);
+  BOOST_CHECK(full > 0);
+
+  // Evicting about half the bytes evicts about half the results.
+  size_t evicted = map.evictOldest(full / 2);
+  BOOST_CHECK(evicted >= n / 2 - 1 && evicted <= n / 2 + 1);
+  BOOST_CHECK_EQUAL(map.getNumIntermediateResults(), n - evicted);
+
+  // Evicting everything should bring the accounting back to zero.
+  map.evictOldest(full);
+  BOOST_CHECK_EQUAL(map.getNumIntermediateResults(), 0);
+  BOOST_CHECK_EQUAL(budget.getUsage(MemoryCategory::Results), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_results_grow_in_place )
+{
+  // Stored results remember the tuples they were extended by, so they grow
+  // while stored.  Removing them credits exactly what was charged.
+  MemoryBudget budget;
+  CsrType csr(1000, 100);
+  CscType csc(1000, 100);
+  MapType map(1, 0, 1000, 1000, csr, csc);
+  map.setMemoryBudget(&budget);
+
+  // Usage is clamped at zero, so an amount charged by someone else shows
+  // whether too much is credited.
+  size_t other = 1 << 20;
+  budget.add(MemoryCategory::Results, other);
+
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(EdgeExpression("nodey", "e1", "nodex"));
+  query->addExpression(EdgeExpression("nodez", "e2", "nodex"));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+                                          EdgeOperator::Assignment, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::GreaterThan, 0));
+  query->finalize();
+
+  UniformDestPort generator("192.168.0.2", 1);
+  std::list<EdgeRequestType> edgeRequests;
+  size_t n = 20;
+  for (size_t i = 0; i < n; i++) {
+    VastNetflow netflow = makeNetflow(i, generator.generate(i * 0.01));
+    map.add(QueryResultType(query, netflow), edgeRequests);
+  }
+  size_t stored = budget.getUsage(MemoryCategory::Results) - other;
+
+  // Each later tuple into the same vertex extends every stored result.
+  for (size_t i = n; i < 2 * n; i++) {
+    map.process(makeNetflow(i, generator.generate(i * 0.01)), edgeRequests);
+  }
+  BOOST_CHECK(map.getNumIntermediateResults() >= n);
+  BOOST_CHECK(budget.getUsage(MemoryCategory::Results) - other > stored);
+
+  map.evictOldest(std::numeric_limits<size_t>::max());
+  BOOST_CHECK_EQUAL(map.getNumIntermediateResults(), 0);
+  BOOST_CHECK_EQUAL(budget.getUsage(MemoryCategory::Results), other);
+}
@@ -0,0 +1,258 @@
+#define BOOST_TEST_MAIN TestQueryNetwork
+
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+#include <sam/GraphStore.hpp>
+#include <sam/QueryNetwork.hpp>
+#include <sam/VastNetflow.hpp>
+#include <sam/VastNetflowGenerators.hpp>
+
+using namespace sam;
+
+typedef GraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                   TimeSeconds, DurationSeconds,
+                   StringHashFunction, StringHashFunction,
+                   StringEqualityFunction, StringEqualityFunction>
+        GraphStoreType;
+
+typedef GraphStoreType::QueryType QueryType;
+typedef GraphStoreType::NetworkType NetworkType;
+
+/**
+ * Two edges into the same vertex nodex.
+ * \param relativeToEnd If true, the query starts at the end of the first
+ *   edge, otherwise at its start.
+ * \param window The second edge starts within this many seconds.
+ * \param targetIn If not empty, nodex has to be in this feature.
+ * \param sourceNotIn If not empty, nodey must not be in this feature.
+ */
+std::shared_ptr<QueryType> makeQuery(std::shared_ptr<FeatureMap> featureMap,
+                                     bool relativeToEnd, double window,
+                                     std::string targetIn,
+                                     std::string sourceNotIn)
+{
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(EdgeExpression("nodey", "e1", "nodex"));
+  query->addExpression(EdgeExpression("nodez", "e2", "nodex"));
+  query->addExpression(TimeEdgeExpression(
+    relativeToEnd ? EdgeFunction::EndTime : EdgeFunction::StartTime, "e1",
+    EdgeOperator::Assignment, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::GreaterThan, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::LessThan, window));
+  if (targetIn != "") {
+    query->addExpression(VertexConstraintExpression("nodex",
+      VertexOperator::In, targetIn));
+  }
+  if (sourceNotIn != "") {
+    query->addExpression(VertexConstraintExpression("nodey",
+      VertexOperator::NotIn, sourceNotIn));
+  }
+  query->finalize();
+  return query;
+}
+
+BOOST_AUTO_TEST_CASE( test_sharing )
+{
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  NetworkType network;
+
+  // Only later edges differ, so the first edge tests are shared.
+  BOOST_CHECK_EQUAL(network.add(makeQuery(featureMap, false, 10, "", "")), 0);
+  BOOST_CHECK_EQUAL(network.add(makeQuery(featureMap, false, 20, "", "")), 1);
+  BOOST_CHECK_EQUAL(network.getNumTests(), 3);
+
+  // A different time test.
+  network.add(makeQuery(featureMap, true, 10, "", ""));
+  BOOST_CHECK_EQUAL(network.getNumTests(), 6);
+
+  // Same time and source tests, different target test.
+  network.add(makeQuery(featureMap, false, 10, "top", ""));
+  BOOST_CHECK_EQUAL(network.getNumTests(), 7);
+
+  // Same time test, different source test.
+  network.add(makeQuery(featureMap, false, 10, "top", "top"));
+  BOOST_CHECK_EQUAL(network.getNumTests(), 9);
+  network.add(makeQuery(featureMap, false, 10, "top", "top"));
+  BOOST_CHECK_EQUAL(network.getNumTests(), 9);
+  BOOST_CHECK_EQUAL(network.getNumQueries(), 6);
+
+  // Another feature map doesn't share vertex tests.
+  auto otherMap = std::make_shared<FeatureMap>(1000);
+  network.add(makeQuery(otherMap, false, 10, "top", "top"));
+  BOOST_CHECK_EQUAL(network.getNumTests(), 11);
+
+  auto unfinalized = std::make_shared<QueryType>(featureMap);
+  BOOST_CHECK_THROW(network.add(unfinalized), QueryNetworkException);
+}
+
+BOOST_AUTO_TEST_CASE( test_match_equivalence )
+{
+  // The network matches exactly the queries whose first edge description
+  // the tuple satisfies.
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  RandomPoolGenerator generator(10);
+  std::vector<VastNetflow> netflows;
+  for (size_t i = 0; i < 500; i++) {
+    netflows.push_back(makeNetflow(i, generator.generate(i * 0.1)));
+  }
+
+  std::vector<std::string> keys;
+  std::vector<double> frequencies;
+  for (size_t i = 0; i < 3; i++) {
+    keys.push_back(std::get<DestIp>(netflows[i]));
+    frequencies.push_back(0.1);
+  }
+  TopKFeature feature(keys, frequencies);
+  featureMap->updateInsert("", "top", feature);
+
+  std::vector<std::shared_ptr<QueryType>> queries;
+  for (bool relativeToEnd : {false, true}) {
+    for (std::string targetIn : {"", "top", "missing"}) {
+      for (std::string sourceNotIn : {"", "top"}) {
+        queries.push_back(makeQuery(featureMap, relativeToEnd, 10,
+                                    targetIn, sourceNotIn));
+        queries.push_back(makeQuery(featureMap, relativeToEnd, 20,
+                                    targetIn, sourceNotIn));
+      }
+    }
+  }
+  NetworkType network;
+  for (auto query : queries) network.add(query);
+  BOOST_CHECK_EQUAL(network.getNumTests(), 2 * (1 + 2 + 3 * 2));
+
+  size_t totalMatched = 0;
+  size_t totalTests = 0;
+  for (auto const& netflow : netflows) {
+    std::vector<size_t> expected;
+    for (size_t q = 0; q < queries.size(); q++) {
+      double queryStart = std::get<TimeSeconds>(netflow);
+      if (!queries[q]->zeroTimeRelativeToStart()) {
+        queryStart += std::get<DurationSeconds>(netflow);
+      }
+      if (queries[q]->satisfiesConstraints(0, netflow, queryStart)) {
+        expected.push_back(q);
+      }
+    }
+    std::vector<size_t> matched;
+    totalTests += network.match(netflow, matched);
+    BOOST_CHECK(matched == expected);
+    totalMatched += matched.size();
+  }
+  BOOST_CHECK(totalMatched > 0);
+  // Far fewer tests than checking each query's first edge.
+  BOOST_CHECK(totalTests < netflows.size() * queries.size());
+}
+
+BOOST_AUTO_TEST_CASE( test_graph_store_many_queries )
+{
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+
+  std::vector<std::string> keys;
+  std::vector<double> frequencies;
+  keys.push_back("192.168.0.2");
+  frequencies.push_back(1);
+  TopKFeature feature(keys, frequencies);
+  featureMap->updateInsert("", "top", feature);
+
+  GraphStoreType* graphStore = new GraphStoreType(1, 0, hostnames, 10500,
+    1000, 1000, 1000, 100000, 1, 1, 100, 1000, featureMap, 100, true, 1);
+
+  size_t numQueries = 12;
+  for (size_t i = 0; i < numQueries - 2; i++) {
+    graphStore->registerQuery(makeQuery(featureMap, false, 10, "", ""));
+  }
+  graphStore->registerQuery(makeQuery(featureMap, false, 10, "top", ""));
+  graphStore->registerQuery(makeQuery(featureMap, false, 10, "missing",
+                                      ""));
+  BOOST_CHECK_EQUAL(graphStore->getNetwork().getNumQueries(), numQueries);
+  BOOST_CHECK_EQUAL(graphStore->getNetwork().getNumTests(), 5);
+
+  UniformDestPort generator("192.168.0.2", 1);
+  size_t n = 100;
+  for (size_t i = 0; i < n; i++) {
+    graphStore->consume(makeNetflow(i, generator.generate(i * 0.01)));
+  }
+  graphStore->waitForConsume();
+
+  // Every pair of edges for every query but the one on a missing feature.
+  BOOST_CHECK_EQUAL(graphStore->getNumResults(),
+                    (numQueries - 1) * n * (n - 1) / 2);
+
+  graphStore->terminate();
+  delete graphStore;
+}
+
+/**
+ * A single edge query whose edge lasts between minDuration and
+ * maxDuration seconds.
+ */
+std::shared_ptr<QueryType> makeDurationQuery(
+  std::shared_ptr<FeatureMap> featureMap, bool relativeToEnd,
+  double minDuration, double maxDuration)
+{
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(EdgeExpression("nodey", "e1", "nodex"));
+  if (relativeToEnd) {
+    query->addExpression(TimeEdgeExpression(EdgeFunction::EndTime, "e1",
+                                            EdgeOperator::Assignment, 0));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+      EdgeOperator::GreaterThan, -maxDuration));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+      EdgeOperator::LessThan, -minDuration));
+  } else {
+    query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+                                            EdgeOperator::Assignment, 0));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::EndTime, "e1",
+      EdgeOperator::GreaterThan, minDuration));
+    query->addExpression(TimeEdgeExpression(EdgeFunction::EndTime, "e1",
+      EdgeOperator::LessThan, maxDuration));
+  }
+  query->finalize();
+  return query;
+}
+
+BOOST_AUTO_TEST_CASE( test_duration_index )
+{
+  // Queries for edges of 0-1, 1-2, ... 9-10 seconds.  A tuple only reaches
+  // the time tests for durations near its own.
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  std::vector<std::shared_ptr<QueryType>> queries;
+  for (size_t k = 0; k < 10; k++) {
+    queries.push_back(makeDurationQuery(featureMap, k % 2 == 1, k, k + 1));
+  }
+  NetworkType network;
+  for (auto query : queries) network.add(query);
+  BOOST_CHECK_EQUAL(network.getNumTests(), 30);
+
+  RandomGenerator generator;
+  size_t totalTests = 0;
+  size_t totalMatched = 0;
+  size_t n = 1000;
+  for (size_t i = 0; i < n; i++) {
+    VastNetflow netflow = makeNetflow(i, generator.generate(1000 + i * 0.1));
+    std::get<DurationSeconds>(netflow) = (i % 120) * 0.1;
+
+    std::vector<size_t> expected;
+    for (size_t q = 0; q < queries.size(); q++) {
+      double queryStart = std::get<TimeSeconds>(netflow);
+      if (!queries[q]->zeroTimeRelativeToStart()) {
+        queryStart += std::get<DurationSeconds>(netflow);
+      }
+      if (queries[q]->satisfiesConstraints(0, netflow, queryStart)) {
+        expected.push_back(q);
+      }
+    }
+    std::vector<size_t> matched;
+    totalTests += network.match(netflow, matched);
+    BOOST_CHECK(matched == expected);
+    totalMatched += matched.size();
+  }
+  BOOST_CHECK(totalMatched > 0);
+  // At most two ranges are near any duration.
+  BOOST_CHECK(totalTests <= 2 * n);
+}
@@ -0,0 +1,264 @@
+#define BOOST_TEST_MAIN TestQueryPlanner
+
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+#include <sam/GraphStore.hpp>
+#include <sam/QueryPlanner.hpp>
+#include <sam/VastNetflow.hpp>
+#include <sam/VastNetflowGenerators.hpp>
+
+using namespace sam;
+
+typedef GraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                   TimeSeconds, DurationSeconds,
+                   StringHashFunction, StringHashFunction,
+                   StringEqualityFunction, StringEqualityFunction>
+        GraphStoreType;
+
+typedef GraphStoreType::QueryType QueryType;
+typedef GraphStoreType::PlannerType PlannerType;
+
+/**
+ * Two edges into the same vertex.  The second has to start within 10
+ * seconds of the first and end 15 to 20 seconds after it, so it needs a
+ * duration of at least 5 seconds.
+ */
+std::shared_ptr<QueryType> makeLongSecondQuery(
+  std::shared_ptr<FeatureMap> featureMap)
+{
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(EdgeExpression("nodey", "e1", "nodex"));
+  query->addExpression(EdgeExpression("nodez", "e2", "nodex"));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+                                          EdgeOperator::Assignment, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::GreaterThan, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::LessThan, 10));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::EndTime, "e2",
+                                          EdgeOperator::GreaterThan, 15));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::EndTime, "e2",
+                                          EdgeOperator::LessThan, 20));
+  query->finalize();
+  return query;
+}
+
+/**
+ * n edges into one vertex, every 25th of them long.
+ */
+std::vector<VastNetflow> makeNetflows(size_t n)
+{
+  UniformDestPort generator("192.168.0.2", 1);
+  std::vector<VastNetflow> netflows;
+  for (size_t i = 0; i < n; i++) {
+    VastNetflow netflow = makeNetflow(i, generator.generate(i * 0.01));
+    std::get<DurationSeconds>(netflow) = (i % 25 == 0) ? 8 : 1;
+    netflows.push_back(netflow);
+  }
+  return netflows;
+}
+
+BOOST_AUTO_TEST_CASE( test_planner_statistics )
+{
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = makeLongSecondQuery(featureMap);
+  PlannerType planner(query);
+  planner.setSampleInterval(1);
+  planner.setReplanInterval(500);
+  BOOST_CHECK(planner.isAnchorable(1));
+
+  bool due = false;
+  for (auto const& netflow : makeNetflows(500)) {
+    due = planner.observe(netflow);
+  }
+  BOOST_CHECK(due);
+  BOOST_CHECK(planner.getSelectivity(0) > 0.9);
+  BOOST_CHECK(planner.getSelectivity(1) < 0.1);
+  BOOST_CHECK(planner.getCost(1, 100) < planner.getCost(0, 100));
+
+  BOOST_CHECK_EQUAL(planner.replan(5, 100), 1);
+  BOOST_CHECK_EQUAL(planner.getCurrentAnchor(), 1);
+  BOOST_CHECK_EQUAL(planner.getNumReplans(), 1);
+  BOOST_CHECK_EQUAL(planner.getAnchor(4.9), 0);
+  BOOST_CHECK_EQUAL(planner.getAnchor(5), 1);
+
+  // A tuple at time 6 can complete matches from both segments, but only
+  // the anchored one is handled by addAnchored.
+  std::vector<PlannerType::Segment> anchored;
+  planner.getAnchoredSegments(6, anchored);
+  BOOST_CHECK_EQUAL(anchored.size(), 1);
+  BOOST_CHECK_EQUAL(anchored[0].anchor, 1);
+  BOOST_CHECK_EQUAL(anchored[0].from, 5);
+
+  // A path x -> y -> z -> w can't be anchored at its last edge.
+  auto path = std::make_shared<QueryType>(featureMap);
+  path->addExpression(EdgeExpression("x", "e1", "y"));
+  path->addExpression(EdgeExpression("y", "e2", "z"));
+  path->addExpression(EdgeExpression("z", "e3", "w"));
+  path->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+                                         EdgeOperator::Assignment, 0));
+  path->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                         EdgeOperator::GreaterThan, 0));
+  path->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e3",
+                                         EdgeOperator::GreaterThan, 1));
+  path->finalize();
+  PlannerType pathPlanner(path);
+  BOOST_CHECK(pathPlanner.isAnchorable(1));
+  BOOST_CHECK(!pathPlanner.isAnchorable(2));
+  BOOST_CHECK_THROW(pathPlanner.setAnchor(2, 0), QueryPlannerException);
+}
+
+/**
+ * Runs the query over the netflows and returns the number of results.
+ */
+size_t countResults(std::shared_ptr<QueryType> query,
+                    std::vector<VastNetflow> const& netflows,
+                    size_t port, bool planning, size_t forcedAnchor,
+                    size_t& anchor, size_t& maxIntermediate)
+{
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+
+  GraphStoreType* graphStore = new GraphStoreType(1, 0, hostnames, port,
+    1000, 1000, 1000, 100000, 1, 1, 100, 1000, featureMap, 100, true, 1);
+  graphStore->setQueryPlanning(planning);
+  graphStore->registerQuery(query);
+  auto planner = graphStore->getPlanner(0);
+  planner->setSampleInterval(1);
+  planner->setReplanInterval(200);
+  if (forcedAnchor > 0) {
+    planner->setReplanInterval(1000000);
+    planner->setAnchor(forcedAnchor, std::get<TimeSeconds>(netflows[0]));
+  }
+
+  maxIntermediate = 0;
+  for (auto const& netflow : netflows) {
+    graphStore->consume(netflow);
+    graphStore->waitForConsume();
+    maxIntermediate = std::max(maxIntermediate,
+      graphStore->getNumIntermediateResults());
+  }
+
+  size_t numResults = graphStore->getNumResults();
+  anchor = planner->getCurrentAnchor();
+  graphStore->terminate();
+  delete graphStore;
+  return numResults;
+}
+
+BOOST_AUTO_TEST_CASE( test_replanning_keeps_results )
+{
+  // The planner starts at the first edge and moves to the second once it
+  // has seen that long edges are rare; the results are the same.
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = makeLongSecondQuery(featureMap);
+  std::vector<VastNetflow> netflows = makeNetflows(3000);
+
+  size_t anchor = 0;
+  size_t plainIntermediate = 0;
+  size_t plannedIntermediate = 0;
+  size_t plain = countResults(query, netflows, 10400, false, 0, anchor,
+                              plainIntermediate);
+  BOOST_CHECK_EQUAL(anchor, 0);
+  BOOST_CHECK(plain > 0);
+
+  size_t planned = countResults(query, netflows, 10410, true, 0, anchor,
+                                plannedIntermediate);
+  BOOST_CHECK_EQUAL(anchor, 1);
+  BOOST_CHECK_EQUAL(planned, plain);
+  BOOST_CHECK(plannedIntermediate <= plainIntermediate);
+}
+
+BOOST_AUTO_TEST_CASE( test_anchored_triangles )
+{
+  // Triangles x -> y -> z -> x started from the last edge match the same
+  // triangles as starting from the first.
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(EdgeExpression("x", "e0", "y"));
+  query->addExpression(EdgeExpression("y", "e1", "z"));
+  query->addExpression(EdgeExpression("z", "e2", "x"));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e0",
+                                          EdgeOperator::Assignment, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+                                          EdgeOperator::GreaterThan, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::GreaterThan, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e0",
+                                          EdgeOperator::LessThan, 2));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+                                          EdgeOperator::LessThan, 2));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::LessThan, 2));
+  query->finalize();
+
+  RandomPoolGenerator generator(20);
+  std::vector<VastNetflow> netflows;
+  for (size_t i = 0; i < 2000; i++) {
+    netflows.push_back(makeNetflow(i, generator.generate(i * 0.01)));
+  }
+
+  size_t anchor = 0;
+  size_t maxIntermediate = 0;
+  size_t plain = countResults(query, netflows, 10420, false, 0, anchor,
+                              maxIntermediate);
+  BOOST_CHECK(plain > 0);
+  size_t anchored = countResults(query, netflows, 10430, true, 2, anchor,
+                                 maxIntermediate);
+  BOOST_CHECK_EQUAL(anchor, 2);
+  BOOST_CHECK_EQUAL(anchored, plain);
+}
+
+BOOST_AUTO_TEST_CASE( test_anchored_end_relative )
+{
+  // Times relative to the end of a first edge that lasts much longer than
+  // the query's extent.  The anchored lookup has to reach back to its
+  // start.
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(EdgeExpression("nodey", "e1", "nodex"));
+  query->addExpression(EdgeExpression("nodez", "e2", "nodex"));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::EndTime, "e1",
+                                          EdgeOperator::Assignment, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::GreaterThan, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::LessThan, 2));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::EndTime, "e2",
+                                          EdgeOperator::LessThan, 3));
+  query->finalize();
+  BOOST_CHECK(!query->zeroTimeRelativeToStart());
+
+  std::vector<VastNetflow> netflows;
+  netflows.push_back(makeNetflow(0, "1,parseDate,dateTimeStr,"
+    "ipLayerProtocol,ipLayerProtocolCode,192.168.0.1,192.168.0.2,29986,"
+    "1900,1,1,100,1,1,1,1,1,1,1"));
+  for (size_t i = 1; i < 100; i++) {
+    netflows.push_back(makeNetflow(i, boost::lexical_cast<std::string>(
+      1 + i) + ",parseDate,dateTimeStr,ipLayerProtocol,ipLayerProtocolCode,"
+      "192.168.0.3,10.0.0." + boost::lexical_cast<std::string>(i) +
+      ",29986,1900,1,1,1,1,1,1,1,1,1,1"));
+  }
+  netflows.push_back(makeNetflow(100, "102,parseDate,dateTimeStr,"
+    "ipLayerProtocol,ipLayerProtocolCode,192.168.0.5,192.168.0.2,29986,"
+    "1900,1,1,0.5,1,1,1,1,1,1,1"));
+
+  size_t anchor = 0;
+  size_t maxIntermediate = 0;
+  size_t plain = countResults(query, netflows, 10700, false, 0, anchor,
+                              maxIntermediate);
+  BOOST_CHECK_EQUAL(plain, 1);
+  size_t anchored = countResults(query, netflows, 10710, true, 1, anchor,
+                                 maxIntermediate);
+  BOOST_CHECK_EQUAL(anchor, 1);
+  BOOST_CHECK_EQUAL(anchored, plain);
+
+  // The segment stays in use however long ago it started.
+  PlannerType planner(query);
+  planner.setAnchor(1, 1);
+  std::vector<PlannerType::Segment> anchored2;
+  planner.getAnchoredSegments(1000, anchored2);
+  BOOST_CHECK_EQUAL(anchored2.size(), 1);
+}
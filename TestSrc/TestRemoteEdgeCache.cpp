@@ -0,0 +1,227 @@
+#define BOOST_TEST_MAIN TestRemoteEdgeCache
+
+#include <boost/test/unit_test.hpp>
+#include <list>
+#include <string>
+#include <vector>
+#include <sam/GraphStore.hpp>
+#include <sam/RemoteEdgeCache.hpp>
+#include <sam/VastNetflow.hpp>
+
+using namespace sam;
+
+typedef RemoteEdgeCache<VastNetflow, SourceIp, DestIp, TimeSeconds,
+                        DurationSeconds> CacheType;
+typedef CacheType::EdgeRequestType EdgeRequestType;
+
+VastNetflow makeEdge(std::string src, std::string trg, double time,
+                     double duration = 1)
+{
+  std::string str = boost::lexical_cast<std::string>(time) +
+    ",parseDate,dateTimeStr,ipLayerProtocol,ipLayerProtocolCode," +
+    src + "," + trg + ",29986,1900,1,1," +
+    boost::lexical_cast<std::string>(duration) + ",1,1,1,1,1,1,1";
+  return makeNetflow(0, str);
+}
+
+/**
+ * A request for start times in [first, second] and end times in
+ * [endFirst, endSecond], which default to the start times.
+ */
+EdgeRequestType makeRequest(std::string src, std::string trg, double first,
+                            double second,
+                            double endFirst = nullValue<double>(),
+                            double endSecond = nullValue<double>())
+{
+  EdgeRequestType request;
+  if (src != "") request.setSource(src);
+  if (trg != "") request.setTarget(trg);
+  request.setReturn(0);
+  request.setStartTimeFirst(first);
+  request.setStartTimeSecond(second);
+  request.setEndTimeFirst(isNull(endFirst) ? first : endFirst);
+  request.setEndTimeSecond(isNull(endSecond) ? second : endSecond);
+  return request;
+}
+
+BOOST_AUTO_TEST_CASE( test_cache )
+{
+  CacheType cache(1000, 100);
+  std::list<VastNetflow> edges;
+
+  // Nothing has been requested, so nothing is covered.
+  auto request = makeRequest("", "10.0.0.1", 0, 10);
+  BOOST_CHECK(!cache.lookup(request, edges));
+  BOOST_CHECK_EQUAL(cache.getNumMisses(), 1);
+
+  // Edges for keys that weren't requested aren't kept.
+  cache.add(makeEdge("10.0.0.2", "10.0.0.1", 1));
+  BOOST_CHECK_EQUAL(cache.getNumEdges(), 0);
+
+  // Request edges into 10.0.0.1 with start times in [0, 10].  The owner
+  // sends back what it has, including a duplicate.
+  cache.requested(request);
+  cache.add(makeEdge("10.0.0.2", "10.0.0.1", 1));
+  cache.add(makeEdge("10.0.0.3", "10.0.0.1", 5));
+  cache.add(makeEdge("10.0.0.3", "10.0.0.1", 5));
+  cache.add(makeEdge("10.0.0.3", "10.0.0.4", 6));
+  BOOST_CHECK_EQUAL(cache.getNumEdges(), 2);
+  BOOST_CHECK_EQUAL(cache.getNumKeys(), 1);
+
+  // A later partial result needing some of the same edges is served.
+  BOOST_CHECK(cache.lookup(makeRequest("", "10.0.0.1", 2, 8), edges));
+  BOOST_CHECK_EQUAL(edges.size(), 1);
+  BOOST_CHECK_EQUAL(std::get<SourceIp>(edges.front()), "10.0.0.3");
+  BOOST_CHECK_EQUAL(cache.getNumHits(), 1);
+
+  // So is one for a pair within the target's entry.
+  edges.clear();
+  BOOST_CHECK(cache.lookup(makeRequest("10.0.0.2", "10.0.0.1", 0, 10),
+                           edges));
+  BOOST_CHECK_EQUAL(edges.size(), 1);
+  BOOST_CHECK_EQUAL(cache.getNumEdgesServed(), 2);
+
+  // But not one reaching past what was requested, or for another key.
+  BOOST_CHECK(!cache.lookup(makeRequest("", "10.0.0.1", 5, 15), edges));
+  BOOST_CHECK(!cache.lookup(makeRequest("10.0.0.1", "", 0, 10), edges));
+  BOOST_CHECK_EQUAL(cache.getNumMisses(), 3);
+
+  // An overlapping request extends the start times covered, for the end
+  // times both requests cover.
+  cache.requested(makeRequest("", "10.0.0.1", 5, 15, 0, 20));
+  BOOST_CHECK(cache.lookup(makeRequest("", "10.0.0.1", 0, 15, 0, 10), edges));
+  BOOST_CHECK(!cache.lookup(makeRequest("", "10.0.0.1", 0, 15), edges));
+
+  // Invalidating forgets the key.
+  cache.invalidate(request);
+  BOOST_CHECK(!cache.lookup(request, edges));
+  BOOST_CHECK_EQUAL(cache.getNumKeys(), 0);
+  BOOST_CHECK_EQUAL(cache.getNumEdges(), 0);
+
+  BOOST_CHECK_THROW(CacheType(0, 100), RemoteEdgeCacheException);
+  BOOST_CHECK_THROW(CacheType(10, 0), RemoteEdgeCacheException);
+}
+
+BOOST_AUTO_TEST_CASE( test_window )
+{
+  // Edges (and coverage) older than the window are dropped.
+  CacheType cache(1000, 10);
+  cache.requested(makeRequest("10.0.0.1", "", 0, 100));
+  for (size_t i = 0; i < 30; i++) {
+    cache.add(makeEdge("10.0.0.1", "10.0.0.2", i));
+  }
+
+  std::list<VastNetflow> edges;
+  BOOST_CHECK(!cache.lookup(makeRequest("10.0.0.1", "", 0, 29), edges));
+  BOOST_CHECK(cache.lookup(makeRequest("10.0.0.1", "", 19, 29, 19, 30),
+                           edges));
+  BOOST_CHECK_EQUAL(edges.size(), 11);
+  BOOST_CHECK(cache.getNumEdges() <= 11);
+}
+
+BOOST_AUTO_TEST_CASE( test_end_times )
+{
+  // The owner only sends edges ending in the request's end range, so a
+  // request with a narrow end range doesn't cover one with a wider one.
+  CacheType cache(1000, 100);
+  std::list<VastNetflow> edges;
+  cache.requested(makeRequest("", "10.0.0.1", 0, 10, 0, 5));
+  cache.add(makeEdge("10.0.0.2", "10.0.0.1", 1));
+  cache.add(makeEdge("10.0.0.3", "10.0.0.1", 2, 2));
+
+  // Forwarded for another request, say.
+  cache.add(makeEdge("10.0.0.4", "10.0.0.1", 3, 10));
+
+  BOOST_CHECK(!cache.lookup(makeRequest("", "10.0.0.1", 0, 10, 0, 20),
+                            edges));
+  BOOST_CHECK(!cache.lookup(makeRequest("", "10.0.0.1", 0, 10), edges));
+
+  // Nothing starts after it ends, so the entry covers start times up to 5.
+  // Within it, only the edges ending in range are served.
+  BOOST_CHECK(cache.lookup(makeRequest("", "10.0.0.1", 0, 5, 3, 5), edges));
+  BOOST_CHECK_EQUAL(edges.size(), 1);
+  BOOST_CHECK_EQUAL(std::get<SourceIp>(edges.front()), "10.0.0.3");
+
+  // A request covering the entry's times replaces them.
+  cache.requested(makeRequest("", "10.0.0.1", 0, 10, 0, 20));
+  edges.clear();
+  BOOST_CHECK(cache.lookup(makeRequest("", "10.0.0.1", 0, 10, 0, 20),
+                           edges));
+  BOOST_CHECK_EQUAL(edges.size(), 3);
+
+  // One with a narrower end range doesn't shrink them.
+  cache.requested(makeRequest("", "10.0.0.1", 0, 10, 0, 5));
+  BOOST_CHECK(cache.lookup(makeRequest("", "10.0.0.1", 0, 10, 0, 20),
+                           edges));
+}
+
+BOOST_AUTO_TEST_CASE( test_renewed_lease )
+{
+  // A hub lease is renewed every epoch (10 seconds here) for the next two
+  // epochs, starting one second of lateness on.  The owner merges the
+  // renewals, so the entry covers their union.
+  CacheType cache(1000, 100);
+  std::list<VastNetflow> edges;
+  for (size_t i = 0; i < 3; i++) {
+    double now = 10 * i;
+    cache.extend(makeRequest("", "10.0.0.1", now + 1, now + 21));
+  }
+  cache.add(makeEdge("10.0.0.2", "10.0.0.1", 5, 30));
+  cache.add(makeEdge("10.0.0.3", "10.0.0.1", 25, 1));
+
+  BOOST_CHECK(cache.lookup(makeRequest("", "10.0.0.1", 2, 30, 5, 40),
+                           edges));
+  BOOST_CHECK_EQUAL(edges.size(), 2);
+  BOOST_CHECK(!cache.lookup(makeRequest("", "10.0.0.1", 0, 30, 0, 40),
+                            edges));
+  BOOST_CHECK(!cache.lookup(makeRequest("", "10.0.0.1", 2, 30, 5, 50),
+                            edges));
+
+  // After a gap, the new lease replaces the old one.
+  cache.extend(makeRequest("", "10.0.0.1", 61, 81));
+  BOOST_CHECK(!cache.lookup(makeRequest("", "10.0.0.1", 2, 30, 5, 40),
+                            edges));
+  BOOST_CHECK(cache.lookup(makeRequest("", "10.0.0.1", 61, 81), edges));
+}
+
+BOOST_AUTO_TEST_CASE( test_capacity )
+{
+  // Least recently used keys are evicted to stay within the capacity.
+  size_t capacity = 2 * REMOTE_EDGE_CACHE_NUM_STRIPES;
+  CacheType cache(capacity, 1000);
+  size_t n = 10 * capacity;
+  for (size_t i = 0; i < n; i++) {
+    std::string vertex = "10.0." + std::to_string(i / 256) + "." +
+                         std::to_string(i % 256);
+    cache.requested(makeRequest("", vertex, 0, 100));
+    cache.add(makeEdge("10.1.0.1", vertex, 1));
+  }
+  BOOST_CHECK(cache.getNumKeys() + cache.getNumEdges() <= capacity);
+  BOOST_CHECK(cache.getNumEvicted() > 0);
+
+  // The most recent key survives.
+  std::list<VastNetflow> edges;
+  std::string last = "10.0." + std::to_string((n - 1) / 256) + "." +
+                     std::to_string((n - 1) % 256);
+  BOOST_CHECK(cache.lookup(makeRequest("", last, 0, 100), edges));
+  BOOST_CHECK_EQUAL(edges.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_single_node_graph_store )
+{
+  typedef GraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                     TimeSeconds, DurationSeconds,
+                     StringHashFunction, StringHashFunction,
+                     StringEqualityFunction, StringEqualityFunction>
+          GraphStoreType;
+
+  // A single node never sends edge requests, so there is nothing to cache.
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  GraphStoreType graphStore(1, 0, hostnames, 10660, 1000, 1000, 1000, 1000,
+    1, 1, 100, 1000, featureMap, 100, true, 1);
+  graphStore.setRemoteEdgeCache();
+  BOOST_CHECK(!graphStore.getRemoteEdgeCache());
+  graphStore.terminate();
+}
@@ -0,0 +1,155 @@
+#define BOOST_TEST_MAIN TestResizableTable
+
+#include <sam/ResizableTable.hpp>
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <list>
+#include <thread>
+#include <vector>
+
+using namespace sam;
+
+typedef std::list<size_t> BucketType;
+typedef ResizableTable<BucketType> TableType;
+
+/**
+ * Keys are their own hash.
+ */
+struct F
+{
+  TableType* table;
+
+  F() {
+    table = new TableType(4, [](size_t const& key, size_t& h) {
+      h = key;
+      return true;
+    });
+  }
+
+  ~F() {
+    delete table;
+  }
+
+  void insert(size_t key) {
+    std::unique_lock<std::mutex> lock;
+    table->lockBucket(key, lock).push_back(key);
+    table->added();
+    lock.unlock();
+    table->maintain();
+  }
+
+  bool contains(size_t key) {
+    std::unique_lock<std::mutex> lock;
+    BucketType& bucket = table->lockBucket(key, lock);
+    for (auto k : bucket) {
+      if (k == key) return true;
+    }
+    return false;
+  }
+
+  size_t remove(size_t key) {
+    std::unique_lock<std::mutex> lock;
+    BucketType& bucket = table->lockBucket(key, lock);
+    size_t count = 0;
+    for (auto it = bucket.begin(); it != bucket.end(); ) {
+      if (*it == key) {
+        it = bucket.erase(it);
+        count++;
+      } else {
+        ++it;
+      }
+    }
+    lock.unlock();
+    table->removed(count);
+    table->maintain();
+    return count;
+  }
+};
+
+BOOST_FIXTURE_TEST_CASE( test_grow, F )
+{
+  BOOST_CHECK_EQUAL(table->getCapacity(), 4);
+  size_t n = 10000;
+  for (size_t i = 0; i < n; i++) {
+    insert(i);
+  }
+
+  // Every key is still findable, whether or not a resize is in progress.
+  for (size_t i = 0; i < n; i++) {
+    BOOST_CHECK(contains(i));
+  }
+  BOOST_CHECK_EQUAL(table->size(), n);
+  BOOST_CHECK(table->getCapacity() >= n / 2);
+  BOOST_CHECK(table->getNumResizes() > 0);
+
+  ChainLengthStats stats = table->getChainLengthStats();
+  BOOST_CHECK_EQUAL(stats.numElements, n);
+  BOOST_CHECK(stats.maxLength < 20);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_shrink, F )
+{
+  size_t n = 10000;
+  for (size_t i = 0; i < n; i++) {
+    insert(i);
+  }
+  size_t bigCapacity = table->getCapacity();
+
+  for (size_t i = 0; i < n - 10; i++) {
+    BOOST_CHECK_EQUAL(remove(i), 1);
+  }
+  // Migration is spread over later operations.
+  for (size_t i = 0; i < n; i++) {
+    table->maintain();
+  }
+  BOOST_CHECK(table->getCapacity() < bigCapacity);
+  for (size_t i = n - 10; i < n; i++) {
+    BOOST_CHECK(contains(i));
+  }
+  BOOST_CHECK_EQUAL(table->getChainLengthStats().numElements, 10);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_threads, F )
+{
+  size_t numThreads = 8;
+  size_t numPerThread = 10000;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads; t++) {
+    threads.push_back(std::thread([this, t, numPerThread]() {
+      for (size_t i = 0; i < numPerThread; i++) {
+        size_t key = t * numPerThread + i;
+        insert(key);
+        BOOST_CHECK(contains(key));
+      }
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  size_t count = 0;
+  table->forEachBucket([&count](BucketType& bucket) {
+    count += bucket.size();
+  });
+  BOOST_CHECK_EQUAL(count, numThreads * numPerThread);
+  BOOST_CHECK_EQUAL(table->size(), numThreads * numPerThread);
+}
+
+BOOST_AUTO_TEST_CASE( test_drop_on_migrate )
+{
+  // Odd keys are dropped when their bucket is migrated.
+  TableType table(1, [](size_t const& key, size_t& h) {
+    h = key;
+    return key % 2 == 0;
+  });
+  for (size_t i = 0; i < 100; i++) {
+    std::unique_lock<std::mutex> lock;
+    table.lockBucket(i, lock).push_back(i);
+    table.added();
+    lock.unlock();
+    table.maintain();
+  }
+  for (size_t i = 0; i < 100; i++) table.maintain();
+  BOOST_CHECK(table.size() < 100);
+  BOOST_CHECK_EQUAL(table.size(), table.getChainLengthStats().numElements);
+}
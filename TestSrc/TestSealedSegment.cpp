@@ -0,0 +1,192 @@
+#define BOOST_TEST_MAIN TestSealedSegment
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <limits>
+#include <list>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sam/BloomFilter.hpp>
+#include <sam/CompressedSparse.hpp>
+#include <sam/SealedSegment.hpp>
+#include <sam/Serialization.hpp>
+#include <sam/VastNetflow.hpp>
+#include <sam/VastNetflowGenerators.hpp>
+#include <sam/Util.hpp>
+
+using namespace sam;
+
+typedef SealedSegment<VastNetflow, DestIp, TimeSeconds,
+  StringHashFunction, StringEqualityFunction> SegmentType;
+
+typedef CompressedSparse<VastNetflow,
+   DestIp, SourceIp, TimeSeconds, DurationSeconds,
+   StringHashFunction, StringEqualityFunction> GraphType;
+
+BOOST_AUTO_TEST_CASE( test_serialization )
+{
+  UniformDestPort generator("192.168.0.1", 1);
+  VastNetflow netflow = makeNetflow(7, generator.generate(12.5));
+
+  std::string bytes;
+  serialize(bytes, netflow);
+  VastNetflow copy;
+  char const* p = bytes.data();
+  deserialize(p, bytes.data() + bytes.size(), copy);
+  BOOST_CHECK(p == bytes.data() + bytes.size());
+  BOOST_CHECK(copy == netflow);
+
+  // Truncated input is an error, not a crash.
+  p = bytes.data();
+  BOOST_CHECK_THROW(deserialize(p, bytes.data() + bytes.size() - 1, copy),
+                    SerializationException);
+}
+
+BOOST_AUTO_TEST_CASE( test_bloom_filter )
+{
+  BloomFilter filter = BloomFilter::forCapacity(1000, 0.01);
+  for (size_t i = 0; i < 1000; i++) {
+    filter.add(i);
+  }
+  for (size_t i = 0; i < 1000; i++) {
+    BOOST_CHECK(filter.mayContain(i));
+  }
+  size_t falsePositives = 0;
+  for (size_t i = 1000; i < 11000; i++) {
+    if (filter.mayContain(i)) falsePositives++;
+  }
+  BOOST_CHECK(falsePositives < 300);
+  BOOST_CHECK(filter.estimatedFalsePositiveRate() < 0.03);
+
+  BloomFilter copy(filter.getWords(), filter.getNumHashes());
+  BOOST_CHECK(copy.mayContain(5));
+}
+
+BOOST_AUTO_TEST_CASE( test_segment )
+{
+  std::vector<VastNetflow> edges;
+  size_t numVertices = 10;
+  for (size_t i = 0; i < 100; i++) {
+    std::string dest = "10.0.0." +
+      boost::lexical_cast<std::string>(i % numVertices);
+    UniformDestPort generator(dest, 1);
+    edges.push_back(makeNetflow(i, generator.generate(i)));
+  }
+
+  std::string filename = "TestSealedSegment_test_segment.seg";
+  {
+    SegmentType segment(filename, edges);
+    BOOST_CHECK_EQUAL(segment.getNumEdges(), 100);
+    BOOST_CHECK_EQUAL(segment.getNumVertices(), numVertices);
+    BOOST_CHECK_EQUAL(segment.getMinTime(), 0);
+    BOOST_CHECK_EQUAL(segment.getMaxTime(), 99);
+
+    std::list<VastNetflow> found;
+    BOOST_CHECK(segment.findEdges("10.0.0.3", 0, 1000, found));
+    BOOST_CHECK_EQUAL(found.size(), 10);
+    double last = -1;
+    for (auto const& edge : found) {
+      BOOST_CHECK_EQUAL(std::get<DestIp>(edge), "10.0.0.3");
+      BOOST_CHECK(std::get<TimeSeconds>(edge) > last);
+      last = std::get<TimeSeconds>(edge);
+    }
+
+    found.clear();
+    segment.findEdges("10.0.0.3", 50, 80, found);
+    BOOST_CHECK_EQUAL(found.size(), 3);
+
+    found.clear();
+    segment.findEdges("10.0.1.3", 0, 1000, found);
+    BOOST_CHECK_EQUAL(found.size(), 0);
+
+    BOOST_CHECK_EQUAL(segment.countEdges(50), 50);
+  }
+
+  // The file goes away with the segment.
+  std::ifstream in(filename);
+  BOOST_CHECK(!in.good());
+}
+
+BOOST_AUTO_TEST_CASE( test_tiered_graph )
+{
+  double window = 10000;
+  GraphType graph(1000, window);
+  graph.setTieredStorage("TestSealedSegment_test_tiered_graph", 100);
+
+  UniformDestPort generator("192.168.0.1", 1);
+  size_t n = 1000;
+  for (size_t i = 0; i < n; i++) {
+    graph.addEdge(makeNetflow(i, generator.generate(i)));
+  }
+
+  BOOST_CHECK(graph.getNumSegments() > 0);
+  BOOST_CHECK(graph.getNumSealedEdges() > n / 2);
+  BOOST_CHECK_EQUAL(graph.countEdges(), n);
+
+  // Every edge is found exactly once across the two tiers.
+  double inf = std::numeric_limits<double>::max();
+  std::list<VastNetflow> found;
+  graph.findEdges("192.168.0.1", nullValue<std::string>(), 0, inf,
+                  0, inf, found);
+  BOOST_CHECK_EQUAL(found.size(), n);
+  std::set<size_t> ids;
+  for (auto const& edge : found) {
+    ids.insert(std::get<SamGeneratedId>(edge));
+  }
+  BOOST_CHECK_EQUAL(ids.size(), n);
+
+  // A time range entirely on disk.
+  found.clear();
+  graph.findEdges("192.168.0.1", nullValue<std::string>(), 10, 19,
+                  0, inf, found);
+  BOOST_CHECK_EQUAL(found.size(), 10);
+
+  // A vertex that isn't there is turned away by the Bloom filters.
+  found.clear();
+  size_t skips = graph.getNumSegmentBloomSkips();
+  graph.findEdges("10.1.1.1", nullValue<std::string>(), 0, inf,
+                  0, inf, found);
+  BOOST_CHECK_EQUAL(found.size(), 0);
+  BOOST_CHECK(graph.getNumSegmentBloomSkips() > skips);
+
+  // Edges for time that has already been sealed are dropped.
+  graph.addEdge(makeNetflow(n, generator.generate(0)));
+  BOOST_CHECK_EQUAL(graph.getNumLateEdges(), 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_lookup_during_seal )
+{
+  // Lookups racing with seals still find every edge added before them,
+  // each once.
+  double window = 100000;
+  GraphType graph(1000, window);
+  graph.setTieredStorage("TestSealedSegment_test_lookup_during_seal", 10);
+
+  UniformDestPort generator("192.168.0.1", 1);
+  size_t n = 5000;
+  std::atomic<size_t> added(0);
+  std::thread writer([&graph, &generator, &added, n]() {
+    for (size_t i = 0; i < n; i++) {
+      graph.addEdge(makeNetflow(i, generator.generate(i)));
+      added = i + 1;
+    }
+  });
+
+  double inf = std::numeric_limits<double>::max();
+  size_t numLookups = 0;
+  size_t numWrong = 0;
+  while (added < n) {
+    size_t a = added;
+    if (a == 0) continue;
+    std::list<VastNetflow> found;
+    graph.findEdges("192.168.0.1", nullValue<std::string>(), 0, a - 1,
+                    0, inf, found);
+    if (found.size() != a) numWrong++;
+    numLookups++;
+  }
+  writer.join();
+
+  BOOST_CHECK(graph.getNumSegments() > 0);
+  BOOST_CHECK_EQUAL(numWrong, 0);
+}
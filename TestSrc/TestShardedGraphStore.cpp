@@ -0,0 +1,89 @@
+#define BOOST_TEST_MAIN TestShardedGraphStore
+
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+#include <sam/ShardedGraphStore.hpp>
+#include <sam/VastNetflowGenerators.hpp>
+
+using namespace sam;
+
+typedef ShardedGraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                          TimeSeconds, DurationSeconds,
+                          StringHashFunction, StringHashFunction,
+                          StringEqualityFunction, StringEqualityFunction>
+        ShardedType;
+
+typedef ShardedType::QueryType QueryType;
+
+///
+/// A single edge query matches every edge.  Each match is made by the
+/// shard owning the edge's source, so none are lost or counted twice.
+///
+BOOST_AUTO_TEST_CASE( test_sharded_single_edge_match )
+{
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  size_t numShards = 4;
+
+  ShardedType* graphStore = new ShardedType(1, 0, numShards, hostnames,
+    10100, 1000, 1000, 1000, 10000, 1, 1, 100, 100, featureMap);
+  BOOST_CHECK_EQUAL(graphStore->getNumShards(), numShards);
+
+  auto query = std::make_shared<QueryType>(featureMap);
+  EdgeExpression y2x("nodey", "e1", "nodex");
+  TimeEdgeExpression startY2X(EdgeFunction::StartTime, "e1",
+                              EdgeOperator::Assignment, 0);
+  query->addExpression(startY2X);
+  query->addExpression(y2x);
+  query->finalize();
+  graphStore->registerQuery(query);
+
+  RandomGenerator generator;
+  size_t n = 1000;
+  std::vector<VastNetflow> netflows;
+  for (size_t i = 0; i < n; i++) {
+    netflows.push_back(makeNetflow(i, generator.generate()));
+  }
+  for (auto const& netflow : netflows) {
+    graphStore->consume(netflow);
+  }
+  graphStore->waitForConsume();
+
+  BOOST_CHECK_EQUAL(graphStore->getNumResults(), n);
+  BOOST_CHECK_EQUAL(graphStore->getNumMisrouted(), 0);
+
+  // Every edge lands on the shard(s) owning its endpoints.
+  size_t expectedEdges = 0;
+  std::vector<size_t> perShard(numShards, 0);
+  for (auto const& netflow : netflows) {
+    size_t s = graphStore->getSourceShard(std::get<SourceIp>(netflow));
+    size_t t = graphStore->getTargetShard(std::get<DestIp>(netflow));
+    perShard[s]++;
+    if (t != s) perShard[t]++;
+    expectedEdges += (t != s) ? 2 : 1;
+  }
+  BOOST_CHECK_EQUAL(graphStore->getNumEdges(), expectedEdges);
+  for (size_t s = 0; s < numShards; s++) {
+    BOOST_CHECK_EQUAL(graphStore->getShard(s)->getNumEdges(), perShard[s]);
+    // With random addresses every shard should get some.
+    BOOST_CHECK(perShard[s] > 0);
+  }
+
+  graphStore->terminate();
+  graphStore->terminate();
+  delete graphStore;
+}
+
+BOOST_AUTO_TEST_CASE( test_sharded_arguments )
+{
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+
+  BOOST_CHECK_THROW(ShardedType(1, 0, 0, hostnames, 10200, 1000, 1000, 1000,
+    1000, 1, 1, 100, 100, featureMap), GraphStoreException);
+  BOOST_CHECK_THROW(ShardedType(2, 0, 2, hostnames, 10200, 1000, 1000, 1000,
+    1000, 1, 1, 100, 100, featureMap), GraphStoreException);
+}
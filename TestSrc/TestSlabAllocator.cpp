@@ -0,0 +1,99 @@
+#define BOOST_TEST_MAIN TestSlabAllocator
+
+#include <sam/SlabAllocator.hpp>
+#include <boost/test/unit_test.hpp>
+#include <list>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace sam;
+
+BOOST_AUTO_TEST_CASE( test_size_classes )
+{
+  BOOST_CHECK_EQUAL(slabDetails::sizeClass(1), 0);
+  BOOST_CHECK_EQUAL(slabDetails::sizeClass(16), 0);
+  BOOST_CHECK_EQUAL(slabDetails::sizeClass(17), 1);
+  BOOST_CHECK_EQUAL(slabDetails::sizeClass(4096), SLAB_NUM_CLASSES - 1);
+  BOOST_CHECK_EQUAL(slabDetails::sizeClass(4097), SLAB_NUM_CLASSES);
+}
+
+BOOST_AUTO_TEST_CASE( test_reuse )
+{
+  // Freeing a block and allocating the same size again should not go to
+  // the heap.
+  void* p = slabAllocate(100);
+  slabDeallocate(p, 100);
+  uint64_t heapBefore = getSlabMetrics().heapAllocations;
+  void* q = slabAllocate(100);
+  BOOST_CHECK_EQUAL(p, q);
+  BOOST_CHECK_EQUAL(getSlabMetrics().heapAllocations, heapBefore);
+  slabDeallocate(q, 100);
+}
+
+BOOST_AUTO_TEST_CASE( test_large )
+{
+  uint64_t heapBefore = getSlabMetrics().heapAllocations;
+  void* p = slabAllocate(10000);
+  BOOST_CHECK_EQUAL(getSlabMetrics().heapAllocations, heapBefore + 1);
+  slabDeallocate(p, 10000);
+}
+
+BOOST_AUTO_TEST_CASE( test_containers )
+{
+  std::list<std::string, SlabAllocator<std::string>> l;
+  std::vector<int, SlabAllocator<int>> v;
+  std::map<int, int, std::less<int>,
+           SlabAllocator<std::pair<int const, int>>> m;
+
+  for (int i = 0; i < 10000; i++) {
+    l.push_back(std::to_string(i));
+    v.push_back(i);
+    m[i] = i;
+  }
+  BOOST_CHECK_EQUAL(l.size(), 10000);
+  BOOST_CHECK_EQUAL(l.back(), "9999");
+  BOOST_CHECK_EQUAL(v[5000], 5000);
+  BOOST_CHECK_EQUAL(m[1234], 1234);
+
+  // The heap is only touched once per slab, not once per element.
+  SlabMetrics metrics = getSlabMetrics();
+  BOOST_CHECK(metrics.heapAllocations < metrics.allocations / 10);
+}
+
+BOOST_AUTO_TEST_CASE( test_cross_thread )
+{
+  // Blocks allocated in one thread and freed in another end up back in
+  // circulation.
+  int numElements = 100000;
+  std::list<int, SlabAllocator<int>>* l =
+    new std::list<int, SlabAllocator<int>>();
+
+  std::thread producer([l, numElements]() {
+    for (int i = 0; i < numElements; i++) {
+      l->push_back(i);
+    }
+  });
+  producer.join();
+
+  std::thread consumer([l]() {
+    delete l;
+  });
+  consumer.join();
+
+  uint64_t heapBefore = getSlabMetrics().heapAllocations;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.push_back(std::thread([numElements]() {
+      std::list<int, SlabAllocator<int>> local;
+      for (int i = 0; i < numElements / 4; i++) {
+        local.push_back(i);
+      }
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  BOOST_CHECK_EQUAL(getSlabMetrics().heapAllocations, heapBefore);
+}
@@ -0,0 +1,140 @@
+#define BOOST_TEST_MAIN TestSubgraphAggregate
+
+#include <boost/test/unit_test.hpp>
+#include <map>
+#include <string>
+#include <vector>
+#include <sam/GraphStore.hpp>
+#include <sam/SubgraphAggregate.hpp>
+#include <sam/VastNetflow.hpp>
+#include <sam/VastNetflowGenerators.hpp>
+
+using namespace sam;
+
+typedef GraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                   TimeSeconds, DurationSeconds,
+                   StringHashFunction, StringHashFunction,
+                   StringEqualityFunction, StringEqualityFunction>
+        GraphStoreType;
+
+typedef GraphStoreType::QueryType QueryType;
+typedef SubgraphAggregate<std::string> AggregateType;
+
+/**
+ * Counts the results it is asked to print.
+ */
+class CountingPrinter : public GraphStoreType::PrinterType
+{
+  size_t& count;
+public:
+  CountingPrinter(size_t& count) : count(count) {}
+  void print(ResultType const&) { count++; }
+};
+
+/**
+ * Two edges into the same vertex nodex, the second within 10 seconds of
+ * the first.
+ */
+std::shared_ptr<QueryType> makeQuery(std::shared_ptr<FeatureMap> featureMap,
+                                     std::shared_ptr<AggregateType> aggregate)
+{
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(EdgeExpression("nodey", "e1", "nodex"));
+  query->addExpression(EdgeExpression("nodez", "e2", "nodex"));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+                                          EdgeOperator::Assignment, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::GreaterThan, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::LessThan, 10));
+  if (aggregate) query->setAggregate(aggregate);
+  query->finalize();
+  return query;
+}
+
+BOOST_AUTO_TEST_CASE( test_aggregate )
+{
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  AggregateType aggregate(featureMap, "pairs", 10);
+  aggregate.countVariable("x");
+  std::vector<std::string> variables = {"x", "y"};
+  aggregate.resolve(variables);
+  BOOST_CHECK_THROW(aggregate.countVariable("y"), SubgraphAggregateException);
+
+  aggregate.add({"a", "b"}, 1);
+  aggregate.add({"a", "c"}, 12);
+  aggregate.add({"b", "c"}, 15);
+
+  BOOST_CHECK_EQUAL(aggregate.getTotal(), 3);
+  BOOST_CHECK_EQUAL(featureMap->at("", "pairs")->getValue(), 3);
+  BOOST_CHECK_EQUAL(aggregate.getCount("a", "pairs_x"), 2);
+  BOOST_CHECK_EQUAL(featureMap->at("a", "pairs_x")->getValue(), 2);
+  BOOST_CHECK_EQUAL(featureMap->at("b", "pairs_x")->getValue(), 1);
+  BOOST_CHECK(!featureMap->exists("c", "pairs_x"));
+  BOOST_CHECK_EQUAL(featureMap->at("0", "pairs_bucket")->getValue(), 1);
+  BOOST_CHECK_EQUAL(featureMap->at("10", "pairs_bucket")->getValue(), 2);
+  BOOST_CHECK_EQUAL(aggregate.getNumFailedUpdates(), 0);
+
+  BOOST_CHECK_THROW(AggregateType(featureMap, "pairs", -1),
+                    SubgraphAggregateException);
+  BOOST_CHECK_THROW(AggregateType(nullptr, "pairs"),
+                    SubgraphAggregateException);
+
+  // Counting a variable the query doesn't have.
+  auto missing = std::make_shared<AggregateType>(featureMap, "missing");
+  missing->countVariable("nodew");
+  BOOST_CHECK_THROW(makeQuery(featureMap, missing), SubgraphQueryException);
+}
+
+BOOST_AUTO_TEST_CASE( test_count_only_query )
+{
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+
+  auto aggregate = std::make_shared<AggregateType>(featureMap, "pairs", 0.25);
+  aggregate->countVariable("nodex");
+  aggregate->countVariable("nodey");
+
+  GraphStoreType* graphStore = new GraphStoreType(1, 0, hostnames, 10610,
+    1000, 1000, 1000, 100000, 1, 1, 100, 1000, featureMap, 100, true, 1);
+  graphStore->registerQuery(makeQuery(featureMap, aggregate));
+
+  size_t numPrinted = 0;
+  graphStore->setPrinter(std::make_shared<CountingPrinter>(numPrinted));
+
+  UniformDestPort generator("192.168.0.2", 1);
+  size_t n = 100;
+  std::map<std::string, size_t> expectedPerSource;
+  for (size_t i = 0; i < n; i++) {
+    VastNetflow netflow = makeNetflow(i, generator.generate(i * 0.01));
+    // Each edge pairs with every later one.
+    expectedPerSource[std::get<SourceIp>(netflow)] += n - 1 - i;
+    graphStore->consume(netflow);
+  }
+  graphStore->waitForConsume();
+
+  size_t expected = n * (n - 1) / 2;
+  BOOST_CHECK_EQUAL(graphStore->getNumResults(), expected);
+  BOOST_CHECK_EQUAL(aggregate->getTotal(), expected);
+  BOOST_CHECK_EQUAL(numPrinted, 0);
+  BOOST_CHECK_EQUAL(featureMap->at("", "pairs")->getValue(), expected);
+  BOOST_CHECK_EQUAL(featureMap->at("192.168.0.2", "pairs_nodex")->getValue(),
+                    expected);
+  for (auto const& p : expectedPerSource) {
+    BOOST_CHECK_EQUAL(aggregate->getCount(p.first, "pairs_nodey"), p.second);
+  }
+
+  // Matches start at i * 0.01, so each 0.25 second bucket holds the
+  // matches of 25 first edges.
+  size_t bucketTotal = 0;
+  for (size_t b = 0; b < 4; b++) {
+    std::string key = boost::lexical_cast<std::string>(b * 0.25);
+    bucketTotal += aggregate->getCount(key, "pairs_bucket");
+  }
+  BOOST_CHECK_EQUAL(bucketTotal, expected);
+  BOOST_CHECK_EQUAL(aggregate->getNumFailedUpdates(), 0);
+
+  graphStore->terminate();
+  delete graphStore;
+}
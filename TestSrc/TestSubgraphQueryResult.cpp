@@ -216,3 +216,75 @@ BOOST_FIXTURE_TEST_CASE( test_watering_hole, F )
   BOOST_CHECK_EQUAL(pair.second.getExpireTime(), expireTime); 
   
 }
+
+BOOST_FIXTURE_TEST_CASE( test_bindings_and_shared_edges, F )
+{
+  // target1 e1 bait
+  // target1 e2 controller
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(*startTimeExpressionE1);
+  query->addExpression(*targetE1Bait);
+  query->addExpression(*startTimeExpressionE2_begin);
+  query->addExpression(*startTimeExpressionE2_end);
+  query->addExpression(*targetE2Controller);
+  query->finalize();
+
+  // Variables are slotted in the order they appear.
+  BOOST_CHECK_EQUAL(query->getNumVariables(), 3);
+  BOOST_CHECK_EQUAL(query->getVariable(0), "target1");
+  BOOST_CHECK_EQUAL(query->getSourceSlot(0), 0);
+  BOOST_CHECK_EQUAL(query->getTargetSlot(0), 1);
+  BOOST_CHECK_EQUAL(query->getSourceSlot(1), 0);
+  BOOST_CHECK_EQUAL(query->getTargetSlot(1), 2);
+
+  ResultType result(query, netflow1);
+  BOOST_CHECK_EQUAL(result.getCurrentSource(), "target");
+  BOOST_CHECK(isNull(result.getCurrentTarget()));
+
+  // An edge from another source doesn't fit the binding of target1.
+  std::string otherString = "1,1,160.0,2013-04-10 08:32:36,"
+                           "20130410083236.384094,17,UDP,other,"
+                           "controller,29986,1900,0,0,1.0,133,0,1,0,1,0,0"; 
+  BOOST_CHECK(!result.addEdge(makeNetflow(otherString)).first);
+
+  auto pair = result.addEdge(netflow2);
+  BOOST_CHECK(pair.first);
+  BOOST_CHECK(pair.second.complete());
+  BOOST_CHECK_EQUAL(std::get<DestIp>(pair.second.getResultTuple(0)), "bait");
+  BOOST_CHECK_EQUAL(std::get<DestIp>(pair.second.getResultTuple(1)),
+                    "controller");
+  BOOST_CHECK_EQUAL(pair.second.getResultTuples().size(), 2);
+  BOOST_CHECK_THROW(pair.second.getResultTuple(2),
+                    SubgraphQueryResultException);
+
+  // The original is unchanged, and the same edge isn't added twice.
+  BOOST_CHECK(!result.complete());
+  BOOST_CHECK_EQUAL(result.getResultTuples().size(), 1);
+  BOOST_CHECK(!result.addEdge(netflow2).first);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_seen_edges, F )
+{
+  // Only edges that extend a result are recorded as seen, and the same
+  // edge can't extend a result twice.
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(*startTimeExpressionE1);
+  query->addExpression(*targetE1Bait);
+  query->addExpression(*startTimeExpressionE2_begin);
+  query->addExpression(*startTimeExpressionE2_end);
+  query->addExpression(*targetE2Controller);
+  query->finalize();
+
+  ResultType result(query, netflow1);
+  size_t bytes = result.memoryUsage();
+
+  // Starts too late.
+  BOOST_CHECK(!result.addEdge(netflow3).first);
+  BOOST_CHECK_EQUAL(result.memoryUsage(), bytes);
+
+  auto p = result.addEdge(netflow2);
+  BOOST_CHECK(p.first);
+  BOOST_CHECK(p.second.complete());
+  BOOST_CHECK(!result.complete());
+  BOOST_CHECK(!result.addEdge(netflow2).first);
+}
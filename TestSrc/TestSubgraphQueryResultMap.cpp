@@ -280,3 +280,145 @@ BOOST_FIXTURE_TEST_CASE( test_process_against_graph, F )
 }
 
 
+
+///
+/// In this test the query is a->b, b->c, and c->d.  Many results wait on
+/// the hub b, so one edge b->c advances all of them at once, and each then
+/// finds its c->d edges in the graph.  Expanding them over a thread pool
+/// has to give the same results as doing it serially.
+///
+BOOST_FIXTURE_TEST_CASE( test_parallel_expansion, F )
+{
+  auto query = std::make_shared<QueryType>(featureMap);
+  EdgeExpression A2B("nodea", "e0", "nodeb");
+  EdgeExpression B2C("nodeb", "e1", "nodec");
+  EdgeExpression C2D("nodec", "e2", "noded");
+  TimeEdgeExpression startTimeExpressionA2B(starttimeFunction, "e0",
+                                           equal_edge_operator, 0);
+  TimeEdgeExpression startTimeExpressionB2C(starttimeFunction, "e1",
+                                           greater_edge_operator, 0);
+  TimeEdgeExpression startTimeExpressionC2D(starttimeFunction, "e2",
+                                           greater_edge_operator, 0);
+  query->addExpression(A2B);
+  query->addExpression(B2C);
+  query->addExpression(C2D);
+  query->addExpression(startTimeExpressionA2B);
+  query->addExpression(startTimeExpressionB2C);
+  query->addExpression(startTimeExpressionC2D);
+  query->finalize();
+
+  size_t samId = 0;
+  auto makeEdge = [&](std::string src, std::string trg, double time) {
+    VastNetflow netflow = makeNetflow(samId++, generator->generate(time));
+    std::get<SourceIp>(netflow) = src;
+    std::get<DestIp>(netflow) = trg;
+    return netflow;
+  };
+
+  size_t numSources = 500;
+  size_t numTargets = 4;
+  std::vector<VastNetflow> firstEdges;
+  for (size_t i = 0; i < numSources; i++) {
+    firstEdges.push_back(makeEdge("S" + std::to_string(i), "Hub", 1));
+  }
+  VastNetflow hubEdge = makeEdge("Hub", "C", 2);
+  for (size_t i = 0; i < numTargets; i++) {
+    VastNetflow netflow = makeEdge("C", "D" + std::to_string(i), 3 + i);
+    csr->addEdge(netflow);
+    csc->addEdge(netflow);
+  }
+
+  auto run = [&](MapType& map) {
+    std::list<EdgeRequestType> edgeRequests;
+    for (auto const& netflow : firstEdges) {
+      map.add(QueryResultType(query, netflow), edgeRequests);
+    }
+    BOOST_CHECK_EQUAL(map.getNumIntermediateResults(), numSources);
+    map.process(hubEdge, edgeRequests);
+    BOOST_CHECK_EQUAL(edgeRequests.size(), 0);
+  };
+
+  MapType serial(1, 0, 1000, 10000, *csr, *csc);
+  run(serial);
+  BOOST_CHECK_EQUAL(serial.getNumResults(), numSources * numTargets);
+  BOOST_CHECK_EQUAL(serial.getNumParallelLevels(), 0);
+
+  MapType parallel(1, 0, 1000, 10000, *csr, *csc);
+  parallel.setExpansionPool(std::make_shared<ThreadPool>(4), 100);
+  run(parallel);
+  BOOST_CHECK_EQUAL(parallel.getNumResults(), numSources * numTargets);
+  BOOST_CHECK_EQUAL(parallel.getNumParallelLevels(), 1);
+  BOOST_CHECK(parallel.getNumExpansionTasks() > 0);
+
+  // The results left behind (still waiting on b->c) are the same too.
+  BOOST_CHECK_EQUAL(parallel.getNumIntermediateResults(),
+                    serial.getNumIntermediateResults());
+
+  BOOST_CHECK_THROW(parallel.setExpansionPool(nullptr, 0),
+                    SubgraphQueryResultMapException);
+}
+
+///
+/// Shedding evicts the results with the most edges left to find first, and
+/// the earliest of those.
+///
+BOOST_FIXTURE_TEST_CASE( test_shed_furthest_from_completion, F )
+{
+  auto query = std::make_shared<QueryType>(featureMap);
+  EdgeExpression A2B("nodea", "e0", "nodeb");
+  EdgeExpression B2C("nodeb", "e1", "nodec");
+  EdgeExpression C2D("nodec", "e2", "noded");
+  TimeEdgeExpression startTimeExpressionA2B(starttimeFunction, "e0",
+                                           equal_edge_operator, 0);
+  TimeEdgeExpression startTimeExpressionB2C(starttimeFunction, "e1",
+                                           greater_edge_operator, 0);
+  TimeEdgeExpression startTimeExpressionC2D(starttimeFunction, "e2",
+                                           greater_edge_operator, 0);
+  query->addExpression(A2B);
+  query->addExpression(B2C);
+  query->addExpression(C2D);
+  query->addExpression(startTimeExpressionA2B);
+  query->addExpression(startTimeExpressionB2C);
+  query->addExpression(startTimeExpressionC2D);
+  query->finalize();
+
+  size_t samId = 0;
+  auto makeEdge = [&](std::string src, std::string trg, double time) {
+    VastNetflow netflow = makeNetflow(samId++, generator->generate(time));
+    std::get<SourceIp>(netflow) = src;
+    std::get<DestIp>(netflow) = trg;
+    return netflow;
+  };
+
+  MapType map(1, 0, 1000, 1000, *csr, *csc);
+  std::list<EdgeRequestType> edgeRequests;
+
+  // Five results with two edges left, and three with one edge left.
+  for (size_t i = 0; i < 5; i++) {
+    std::string a = "A" + std::to_string(i);
+    map.add(QueryResultType(query, makeEdge(a, "B", 1 + i)), edgeRequests);
+  }
+  for (size_t i = 0; i < 3; i++) {
+    std::string a = "X" + std::to_string(i);
+    QueryResultType result(query, makeEdge(a, "Y", 1 + i));
+    auto p = result.addEdge(makeEdge("Y", "Z", 10 + i));
+    BOOST_CHECK(p.first);
+    map.add(p.second, edgeRequests);
+  }
+  BOOST_CHECK_EQUAL(map.getNumIntermediateResults(), 8);
+
+  std::map<QueryType const*, size_t> evicted;
+  BOOST_CHECK_EQUAL(map.shedFurthestFromCompletion(6, evicted), 6);
+  BOOST_CHECK_EQUAL(evicted[query.get()], 6);
+  BOOST_CHECK_EQUAL(map.getNumIntermediateResults(), 2);
+
+  // What is left is the two latest results with one edge left (their
+  // second edges are at 11 and 12), so an edge from Z at 11.5 completes
+  // only one of them, and one at 20 both.
+  map.process(makeEdge("Z", "D", 11.5), edgeRequests);
+  BOOST_CHECK_EQUAL(map.getNumResults(), 1);
+  map.process(makeEdge("Z", "D", 20), edgeRequests);
+  BOOST_CHECK_EQUAL(map.getNumResults(), 3);
+
+  BOOST_CHECK_EQUAL(map.shedFurthestFromCompletion(0, evicted), 0);
+}
@@ -0,0 +1,230 @@
+#define BOOST_TEST_MAIN TestSubgraphResultSink
+
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sam/GraphStore.hpp>
+#include <sam/SubgraphResultSink.hpp>
+#include <sam/VastNetflow.hpp>
+#include <sam/VastNetflowGenerators.hpp>
+
+using namespace sam;
+
+typedef GraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                   TimeSeconds, DurationSeconds,
+                   StringHashFunction, StringHashFunction,
+                   StringEqualityFunction, StringEqualityFunction>
+        GraphStoreType;
+
+typedef GraphStoreType::QueryType QueryType;
+typedef GraphStoreType::ResultType ResultType;
+typedef SubgraphResultSink<VastNetflow, SourceIp, DestIp, TimeSeconds,
+                           DurationSeconds> SinkType;
+
+/**
+ * Two edges into the same vertex, the second starting within 10 seconds
+ * after the first.
+ */
+std::shared_ptr<QueryType> makeQuery(std::shared_ptr<FeatureMap> featureMap)
+{
+  auto query = std::make_shared<QueryType>(featureMap);
+  query->addExpression(EdgeExpression("nodey", "e1", "nodex"));
+  query->addExpression(EdgeExpression("nodez", "e2", "nodex"));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e1",
+                                          EdgeOperator::Assignment, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::GreaterThan, 0));
+  query->addExpression(TimeEdgeExpression(EdgeFunction::StartTime, "e2",
+                                          EdgeOperator::LessThan, 10));
+  query->finalize();
+  return query;
+}
+
+BOOST_AUTO_TEST_CASE( test_binary_sink )
+{
+  std::string loc = "./subgraphresults.bin";
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+
+  // With a result capacity of zero, results only go to the sink.
+  GraphStoreType* graphStore = new GraphStoreType(1, 0, hostnames, 10600,
+    1000, 1000, 1000, 0, 1, 1, 100, 1000, featureMap, 100, true, 1);
+  graphStore->registerQuery(makeQuery(featureMap));
+
+  auto sink = std::make_shared<SinkType>(loc);
+  std::atomic<size_t> numSeen(0);
+  sink->subscribe([&numSeen](ResultType const& result) {
+    if (result.complete()) numSeen++;
+  });
+  graphStore->setPrinter(sink);
+
+  UniformDestPort generator("192.168.0.2", 1);
+  size_t n = 100;
+  for (size_t i = 0; i < n; i++) {
+    graphStore->consume(makeNetflow(i, generator.generate(i * 0.01)));
+  }
+  graphStore->waitForConsume();
+
+  size_t expected = n * (n - 1) / 2;
+  BOOST_CHECK_EQUAL(graphStore->getNumResults(), expected);
+  BOOST_CHECK_THROW(graphStore->getResult(0),
+                    SubgraphQueryResultMapException);
+
+  sink->flush();
+  BOOST_CHECK_EQUAL(sink->getNumPublished(), expected);
+  BOOST_CHECK_EQUAL(sink->getNumDropped(), 0);
+  BOOST_CHECK_EQUAL(sink->getNumWritten(), expected);
+  BOOST_CHECK_EQUAL(sink->getNumWriteErrors(), 0);
+  BOOST_CHECK(sink->getNumSyncs() > 0);
+  BOOST_CHECK_EQUAL(numSeen, expected);
+
+  size_t ordered = 0;
+  size_t numRead = SinkType::readBinary(loc,
+    [&ordered](double start, std::vector<VastNetflow> const& edges) {
+      if (edges.size() == 2 &&
+          std::get<TimeSeconds>(edges[0]) == start &&
+          std::get<TimeSeconds>(edges[0]) < std::get<TimeSeconds>(edges[1]))
+      {
+        ordered++;
+      }
+    });
+  BOOST_CHECK_EQUAL(numRead, expected);
+  BOOST_CHECK_EQUAL(ordered, expected);
+
+  graphStore->terminate();
+  delete graphStore;
+  std::remove(loc.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( test_json_sink )
+{
+  std::string loc = "./subgraphresults.json";
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = makeQuery(featureMap);
+
+  std::string netflowString = "1,1,156.0,2013-04-10 08:32:36,"
+                           "20130410083236.384094,17,UDP,\"quoted\","
+                           "bait,29986,1900,0,0,1.0,133,0,1,0,1,0,0";
+  VastNetflow netflow = makeNetflow(netflowString);
+
+  {
+    SinkType sink(loc, SinkFormat::JsonLines);
+    for (size_t i = 0; i < 10; i++) {
+      sink.print(ResultType(query, netflow));
+    }
+  }
+
+  std::ifstream in(loc);
+  std::string line;
+  size_t numLines = 0;
+  while (std::getline(in, line)) {
+    numLines++;
+    BOOST_CHECK_EQUAL(line.find("{\"start\":156,\"edges\":[{\"id\":1,"), 0);
+    BOOST_CHECK(line.find("\"target\":\"bait\"") != std::string::npos);
+    BOOST_CHECK(line.find("\"source\":\"\\\"quoted\\\"\"") !=
+                std::string::npos);
+  }
+  BOOST_CHECK_EQUAL(numLines, 10);
+  std::remove(loc.c_str());
+
+  BOOST_CHECK_THROW(SinkType("/nonexistent/dir/results"),
+                    SubgraphResultSinkException);
+}
+
+BOOST_AUTO_TEST_CASE( test_sink_never_blocks )
+{
+  // A slow subscriber backs up the queue; print drops rather than waits.
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = makeQuery(featureMap);
+  VastNetflow netflow = makeNetflow(0, "1,156.0,2013-04-10 08:32:36,"
+    "20130410083236.384094,17,UDP,source,target,29986,1900,0,0,1.0,133,0,1,"
+    "0,1,0,0");
+  ResultType result(query, netflow);
+
+  SinkType sink("", SinkFormat::Binary, 4);
+  sink.subscribe([](ResultType const&) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  });
+
+  auto t1 = std::chrono::steady_clock::now();
+  size_t n = 100;
+  for (size_t i = 0; i < n; i++) sink.print(result);
+  auto t2 = std::chrono::steady_clock::now();
+
+  BOOST_CHECK(t2 - t1 < std::chrono::milliseconds(500));
+  BOOST_CHECK_EQUAL(sink.getNumPublished() + sink.getNumDropped(), n);
+  BOOST_CHECK(sink.getNumDropped() > 0);
+  sink.flush();
+  BOOST_CHECK_EQUAL(sink.getNumWritten(), sink.getNumPublished());
+}
+
+BOOST_AUTO_TEST_CASE( test_sink_short_writes )
+{
+  // Interrupted and short writes are retried; after a failed write the
+  // file ends with the last complete result.
+  std::string loc = "./subgraphresults_short.bin";
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  auto query = makeQuery(featureMap);
+  VastNetflow netflow = makeNetflow(0, "1,156.0,2013-04-10 08:32:36,"
+    "20130410083236.384094,17,UDP,source,target,29986,1900,0,0,1.0,133,0,1,"
+    "0,1,0,0");
+  ResultType result(query, netflow);
+
+  {
+    SinkType sink(loc);
+    size_t numCalls = 0;
+    size_t budget = 0;
+    sink.setWriteFunction(
+      [&numCalls, &budget](int fd, void const* p, size_t n) -> ssize_t {
+        numCalls++;
+        if (numCalls % 3 == 0) {
+          errno = EINTR;
+          return -1;
+        }
+        if (budget == 0) {
+          errno = EIO;
+          return -1;
+        }
+        n = std::min(n, std::min(budget, size_t(7)));
+        budget -= n;
+        return ::write(fd, p, n);
+      });
+
+    // The first result is written in pieces, the second only in part.
+    std::string record;
+    serialize(record, result.getStartTime());
+    serialize(record, result.getResultTuples());
+    size_t recordSize = sizeof(uint32_t) + record.size();
+    budget = recordSize;
+    sink.print(result);
+    sink.flush();
+    BOOST_CHECK(!sink.getWriteFailed());
+
+    budget = recordSize / 2;
+    sink.print(result);
+    sink.flush();
+    BOOST_CHECK(sink.getWriteFailed());
+    BOOST_CHECK_EQUAL(sink.getNumWriteErrors(), 1);
+
+    // Nothing more is written.
+    budget = recordSize;
+    sink.print(result);
+    sink.flush();
+    BOOST_CHECK_EQUAL(sink.getNumWriteErrors(), 1);
+    BOOST_CHECK_EQUAL(sink.getNumWritten(), 3);
+  }
+
+  size_t numRead = SinkType::readBinary(loc,
+    [](double start, std::vector<VastNetflow> const& edges) {
+      BOOST_CHECK_EQUAL(start, 156.0);
+      BOOST_CHECK_EQUAL(edges.size(), 1);
+    });
+  BOOST_CHECK_EQUAL(numRead, 1);
+  std::remove(loc.c_str());
+}
@@ -0,0 +1,167 @@
+#define BOOST_TEST_MAIN TestTemporalMotifCounter
+
+#include <boost/test/unit_test.hpp>
+#include <random>
+#include <string>
+#include <vector>
+#include <sam/TemporalMotifCounter.hpp>
+#include <sam/Util.hpp>
+#include <sam/VastNetflow.hpp>
+
+using namespace sam;
+
+typedef TemporalMotifCounter<VastNetflow, SourceIp, DestIp, TimeSeconds>
+        CounterType;
+
+VastNetflow makeEdge(size_t id, double time, std::string src, std::string trg)
+{
+  std::string str = std::to_string(time) +
+    ",parseDate,dateTimeStr,ipLayerProtocol,ipLayerProtocolCode," +
+    src + "," + trg + ",29986,1900,1,1,0,1,1,1,1,1,1,1";
+  return makeNetflow(id, str);
+}
+
+/**
+ * Random edges with no duration among numVertices vertices, 100 a second.
+ * There are no self-loops, which the serial checker would count triangles
+ * through.
+ */
+std::vector<VastNetflow> randomEdges(size_t n, size_t numVertices)
+{
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<size_t> vertex(0, numVertices - 1);
+  std::vector<VastNetflow> edges;
+  for (size_t i = 0; i < n; i++) {
+    size_t src = vertex(gen);
+    size_t trg = vertex(gen);
+    if (src == trg) continue;
+    edges.push_back(makeEdge(i, 1 + i * 0.01,
+                             "10.0.0." + std::to_string(src),
+                             "10.0.0." + std::to_string(trg)));
+  }
+  return edges;
+}
+
+BOOST_AUTO_TEST_CASE( test_exact )
+{
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  CounterType counter(10, 0, featureMap, "motifs");
+
+  counter.consume(makeEdge(0, 1, "a", "b"));
+  counter.consume(makeEdge(1, 2, "b", "c"));
+  counter.consume(makeEdge(2, 3, "c", "a"));
+  counter.consume(makeEdge(3, 4, "a", "c"));
+
+  // a -> b -> c -> a is a triangle, c -> a -> c a 2-cycle, and a -> b -> c
+  // and b -> c -> a are wedges (c -> a -> c isn't).
+  BOOST_CHECK_EQUAL(counter.getNumTriangles(), 1);
+  BOOST_CHECK_EQUAL(counter.getNumCycles(), 1);
+  BOOST_CHECK_EQUAL(counter.getNumWedges(), 2);
+  BOOST_CHECK_EQUAL(counter.getCount("motifs_triangles", "b"), 1);
+  BOOST_CHECK_EQUAL(counter.getCount("motifs_wedges", "b"), 1);
+  BOOST_CHECK_EQUAL(counter.getCount("motifs_wedges", "a"), 0);
+  BOOST_CHECK_EQUAL(counter.getCount("motifs_cycles", "b"), 0);
+
+  BOOST_CHECK_EQUAL(featureMap->at("", "motifs_triangles")->getValue(), 1);
+  BOOST_CHECK_EQUAL(featureMap->at("a", "motifs_triangles")->getValue(), 1);
+  BOOST_CHECK_EQUAL(featureMap->at("c", "motifs_triangles")->getValue(), 1);
+  BOOST_CHECK_EQUAL(featureMap->at("a", "motifs_cycles")->getValue(), 1);
+  BOOST_CHECK_EQUAL(featureMap->at("c", "motifs_wedges")->getValue(), 1);
+  BOOST_CHECK(!featureMap->exists("b", "motifs_cycles"));
+  BOOST_CHECK_EQUAL(counter.getNumFailedUpdates(), 0);
+
+  // The self-loop isn't kept, and c -> b closes b -> c -> b but no
+  // triangle.
+  counter.consume(makeEdge(4, 5, "b", "b"));
+  counter.consume(makeEdge(5, 6, "c", "b"));
+  BOOST_CHECK_EQUAL(counter.getNumTriangles(), 1);
+  BOOST_CHECK_EQUAL(counter.getNumCycles(), 2);
+  BOOST_CHECK_EQUAL(counter.getNumEdgesInWindow(), 5);
+
+  // The edges before 10 expire once an edge at 20 comes, so b -> a closes
+  // nothing.
+  counter.consume(makeEdge(6, 20, "b", "a"));
+  BOOST_CHECK_EQUAL(counter.getNumEdgesInWindow(), 1);
+  BOOST_CHECK_EQUAL(counter.getNumCycles(), 2);
+  BOOST_CHECK_EQUAL(counter.getNumWedges(), 3);
+}
+
+BOOST_AUTO_TEST_CASE( test_random )
+{
+  // The same triangles as the serial checker.
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  double delta = 1.005;
+  std::vector<VastNetflow> edges = randomEdges(5000, 30);
+  size_t expected = numTriangles<VastNetflow, SourceIp, DestIp, TimeSeconds,
+                                 DurationSeconds>(edges, delta);
+  BOOST_CHECK(expected > 0);
+
+  CounterType counter(delta, 0, featureMap, "motifs");
+  for (auto const& edge : edges) counter.consume(edge);
+  BOOST_CHECK_EQUAL(counter.getNumTriangles(), expected);
+  BOOST_CHECK(counter.getNumEdgesInWindow() <= 101);
+
+  // Each triangle is counted at each of its three vertices.
+  double perVertex = 0;
+  for (size_t v = 0; v < 30; v++) {
+    perVertex += counter.getCount("motifs_triangles",
+                                  "10.0.0." + std::to_string(v));
+  }
+  BOOST_CHECK_EQUAL(perVertex, 3 * expected);
+}
+
+BOOST_AUTO_TEST_CASE( test_out_of_order )
+{
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  CounterType counter(2, 0, featureMap, "motifs");
+
+  // The late a -> b at 4 goes before the one at 5, and both close a
+  // 2-cycle with b -> a at 5.5.
+  counter.consume(makeEdge(0, 5, "a", "b"));
+  counter.consume(makeEdge(1, 4, "a", "b"));
+  BOOST_CHECK_EQUAL(counter.getNumLate(), 1);
+  counter.consume(makeEdge(2, 5.5, "b", "a"));
+  BOOST_CHECK_EQUAL(counter.getNumCycles(), 2);
+
+  // At 6.5 the edge at 4 has expired even though it arrived last.
+  counter.consume(makeEdge(3, 6.5, "b", "a"));
+  BOOST_CHECK_EQUAL(counter.getNumCycles(), 3);
+  BOOST_CHECK_EQUAL(counter.getNumEdgesInWindow(), 3);
+
+  // An edge delta or more behind the latest isn't kept.
+  counter.consume(makeEdge(4, 4, "a", "b"));
+  BOOST_CHECK_EQUAL(counter.getNumLate(), 2);
+  BOOST_CHECK_EQUAL(counter.getNumEdgesInWindow(), 3);
+  counter.consume(makeEdge(5, 6.9, "b", "a"));
+  BOOST_CHECK_EQUAL(counter.getNumCycles(), 4);
+
+  // The edges of a motif start less than delta apart.
+  counter.consume(makeEdge(6, 9, "c", "d"));
+  counter.consume(makeEdge(7, 11, "d", "c"));
+  BOOST_CHECK_EQUAL(counter.getNumCycles(), 4);
+}
+
+BOOST_AUTO_TEST_CASE( test_sampling )
+{
+  // Keeping half of the edges still estimates the counts.
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  std::vector<VastNetflow> edges = randomEdges(20000, 30);
+
+  CounterType exact(1.005, 0, featureMap, "exact");
+  CounterType sampled(1.005, 0, featureMap, "sampled", 0.5);
+  for (auto const& edge : edges) {
+    exact.consume(edge);
+    sampled.consume(edge);
+  }
+  BOOST_CHECK(sampled.getNumEdgesInWindow() < exact.getNumEdgesInWindow());
+  BOOST_CHECK_CLOSE(sampled.getNumTriangles(), exact.getNumTriangles(), 20);
+  BOOST_CHECK_CLOSE(sampled.getNumWedges(), exact.getNumWedges(), 10);
+  BOOST_CHECK_CLOSE(sampled.getNumCycles(), exact.getNumCycles(), 10);
+
+  BOOST_CHECK_THROW(CounterType(0, 0, featureMap, "motifs"),
+                    TemporalMotifCounterException);
+  BOOST_CHECK_THROW(CounterType(1, 0, featureMap, "motifs", 0),
+                    TemporalMotifCounterException);
+  BOOST_CHECK_THROW(CounterType(1, 0, featureMap, "motifs", 1.5),
+                    TemporalMotifCounterException);
+}
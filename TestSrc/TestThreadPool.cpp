@@ -0,0 +1,115 @@
+#define BOOST_TEST_MAIN TestThreadPool
+
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <sam/ThreadPool.hpp>
+
+using namespace sam;
+
+BOOST_AUTO_TEST_CASE( test_runs_every_task )
+{
+  ThreadPool pool(4, 16);
+  BOOST_CHECK_EQUAL(pool.getNumWorkers(), 4);
+  BOOST_CHECK_EQUAL(pool.getMaxQueued(), 16);
+
+  std::atomic<size_t> sum(0);
+  size_t n = 10000;
+  for (size_t i = 1; i <= n; i++) {
+    pool.submit([&sum, i]() { sum.fetch_add(i); });
+  }
+  pool.wait();
+
+  BOOST_CHECK_EQUAL(sum.load(), n * (n + 1) / 2);
+  BOOST_CHECK_EQUAL(pool.getNumCompleted(), n);
+  BOOST_CHECK_EQUAL(pool.getNumPending(), 0);
+  BOOST_CHECK_EQUAL(pool.getQueueLength(), 0);
+  BOOST_CHECK(pool.getMaxQueueLength() <= 16);
+  BOOST_CHECK(pool.getMeanLatency() > 0);
+  BOOST_CHECK(pool.getMaxLatency() >= pool.getMeanLatency());
+}
+
+BOOST_AUTO_TEST_CASE( test_queue_bound )
+{
+  // One worker stuck on the first task; the producer has to stop once
+  // the queue is full.
+  ThreadPool pool(1, 4);
+  std::atomic<bool> release(false);
+  pool.submit([&release]() {
+    while (!release) std::this_thread::yield();
+  });
+
+  std::atomic<size_t> submitted(0);
+  std::thread producer([&pool, &submitted]() {
+    for (size_t i = 0; i < 10; i++) {
+      pool.submit([]() {});
+      submitted.fetch_add(1);
+    }
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  BOOST_CHECK(submitted.load() <= 4);
+  BOOST_CHECK(pool.getQueueLength() <= 4);
+
+  release = true;
+  producer.join();
+  pool.wait();
+  BOOST_CHECK_EQUAL(submitted.load(), 10);
+  BOOST_CHECK_EQUAL(pool.getNumCompleted(), 11);
+}
+
+BOOST_AUTO_TEST_CASE( test_stealing )
+{
+  // Round robin puts every other task behind the slow one; the other
+  // worker should take them.
+  ThreadPool pool(2, 100);
+  std::atomic<bool> release(false);
+  std::atomic<size_t> done(0);
+  pool.submit([&release]() {
+    while (!release) std::this_thread::yield();
+  });
+  for (size_t i = 0; i < 20; i++) {
+    pool.submit([&done]() { done.fetch_add(1); });
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  while (done.load() < 20 &&
+         std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+    std::this_thread::yield();
+  }
+  BOOST_CHECK_EQUAL(done.load(), 20);
+  BOOST_CHECK(pool.getNumStolen() > 0);
+
+  release = true;
+  pool.wait();
+}
+
+BOOST_AUTO_TEST_CASE( test_exceptions_and_shutdown )
+{
+  ThreadPool pool(2, 8);
+  std::atomic<size_t> ran(0);
+  pool.submit([]() { throw std::runtime_error("bad tuple"); });
+  for (size_t i = 0; i < 5; i++) {
+    pool.submit([&ran]() { ran.fetch_add(1); });
+  }
+  BOOST_CHECK_THROW(pool.wait(), std::runtime_error);
+  BOOST_CHECK_EQUAL(ran.load(), 5);
+  BOOST_CHECK_EQUAL(pool.getNumFailed(), 1);
+
+  // The error is only reported once.
+  pool.wait();
+
+  // Tasks can submit more tasks.
+  pool.submit([&pool, &ran]() {
+    pool.submit([&ran]() { ran.fetch_add(1); });
+  });
+  pool.wait();
+  BOOST_CHECK_EQUAL(ran.load(), 6);
+
+  pool.shutdown();
+  BOOST_CHECK_THROW(pool.submit([]() {}), ThreadPoolException);
+  BOOST_CHECK_THROW(ThreadPool(1, 0), ThreadPoolException);
+}
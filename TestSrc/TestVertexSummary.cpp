@@ -0,0 +1,137 @@
+#define BOOST_TEST_MAIN TestVertexSummary
+
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+#include <sam/GraphStore.hpp>
+#include <sam/VertexSummary.hpp>
+#include <sam/VastNetflow.hpp>
+
+using namespace sam;
+
+typedef VertexSummaries<std::string, StringHashFunction> SummariesType;
+
+std::string vertex(size_t i) {
+  return "192.168.0." + std::to_string(i);
+}
+
+BOOST_AUTO_TEST_CASE( test_summaries )
+{
+  // Node 1 sees vertices 0-99, ten per second, in epochs of 10 seconds
+  // with a window of 20 seconds.
+  SummariesType owner(2, 1, 10, 20, 1000, 0.01, 0);
+  SummariesType requester(2, 0, 10, 20, 1000, 0.01, 0);
+
+  std::vector<std::string> messages;
+  for (size_t i = 0; i < 100; i++) {
+    std::string message;
+    if (owner.observe(vertex(i), i * 0.1, message)) {
+      messages.push_back(message);
+    }
+  }
+  BOOST_CHECK(messages.empty());
+
+  // Without a summary every request goes out.
+  BOOST_CHECK(requester.mayHave(1, vertex(200), 0, 1));
+  BOOST_CHECK_EQUAL(requester.getNumChecked(), 0);
+
+  // Moving into the next epoch broadcasts the first.
+  std::string message;
+  BOOST_CHECK(owner.observe(vertex(100), 10.5, message));
+  BOOST_CHECK(SummariesType::isSummary(message));
+  BOOST_CHECK_EQUAL(owner.getNumSent(), 1);
+  requester.receive(message);
+  BOOST_CHECK_EQUAL(requester.getNumReceived(), 1);
+
+  // Seen vertices are never ruled out.
+  for (size_t i = 0; i < 100; i++) {
+    BOOST_CHECK(requester.mayHave(1, vertex(i), 0, 9));
+  }
+
+  // Unseen vertices are (almost always) ruled out within the covered time.
+  size_t ruledOut = 0;
+  for (size_t i = 200; i < 300; i++) {
+    if (!requester.mayHave(1, vertex(i), 0, 9)) ruledOut++;
+  }
+  BOOST_CHECK(ruledOut > 90);
+  BOOST_CHECK_EQUAL(requester.getNumSuppressed(), ruledOut);
+  BOOST_CHECK_EQUAL(requester.getNumChecked(), 200);
+
+  // But not for times the summary doesn't cover, where edges can still
+  // show up.
+  BOOST_CHECK(requester.mayHave(1, vertex(200), 5, 15));
+  BOOST_CHECK(requester.mayHave(1, vertex(200), -5, 5));
+  BOOST_CHECK_EQUAL(requester.getNumChecked(), 200);
+
+  // Nor for other nodes.
+  BOOST_CHECK(requester.mayHave(0, vertex(200), 0, 9));
+
+  #ifdef METRICS
+  // The owner recognizes requests that got past the filter.
+  BOOST_CHECK(owner.checkFalsePositive(vertex(200), 0, 9));
+  BOOST_CHECK(!owner.checkFalsePositive(vertex(5), 0, 9));
+  BOOST_CHECK(!owner.checkFalsePositive(vertex(200), 5, 15));
+  BOOST_CHECK_EQUAL(owner.getNumFalsePositives(), 1);
+  #endif
+  BOOST_CHECK(owner.getEstimatedFalsePositiveRate() < 0.05);
+
+  // The next summary covers both epochs within the window; the one after
+  // that drops the first.
+  BOOST_CHECK(owner.observe(vertex(101), 20, message));
+  requester.receive(message);
+  BOOST_CHECK(requester.mayHave(1, vertex(5), 0, 19));
+  BOOST_CHECK(requester.mayHave(1, vertex(100), 0, 19));
+  BOOST_CHECK(owner.observe(vertex(102), 30, message));
+  requester.receive(message);
+  BOOST_CHECK(requester.mayHave(1, vertex(5), 0, 19));
+  BOOST_CHECK(requester.mayHave(1, vertex(100), 10, 29));
+  BOOST_CHECK(requester.mayHave(1, vertex(101), 10, 29));
+
+  // A tuple arriving after its time was summarized is counted as late.
+  BOOST_CHECK_EQUAL(owner.getNumLate(), 0);
+  BOOST_CHECK(!owner.observe(vertex(103), 25, message));
+  BOOST_CHECK_EQUAL(owner.getNumLate(), 1);
+
+  BOOST_CHECK_THROW(requester.receive("not a summary"),
+                    VertexSummaryException);
+  BOOST_CHECK_THROW(requester.receive(std::string(3, '\0')),
+                    VertexSummaryException);
+  BOOST_CHECK_THROW(SummariesType(2, 0, 0, 20), VertexSummaryException);
+}
+
+BOOST_AUTO_TEST_CASE( test_lateness )
+{
+  // With lateness, the summary stops short of the new epoch so slightly
+  // late tuples are still safe.
+  SummariesType owner(2, 1, 10, 20, 1000, 0.01, 2);
+  SummariesType requester(2, 0, 10, 20, 1000, 0.01, 2);
+  std::string message;
+  owner.observe(vertex(0), 1, message);
+  BOOST_CHECK(owner.observe(vertex(1), 10, message));
+  requester.receive(message);
+  owner.observe(vertex(2), 9, message);
+  BOOST_CHECK_EQUAL(owner.getNumLate(), 0);
+
+  BOOST_CHECK(requester.mayHave(1, vertex(2), 8.5, 9.5));
+  BOOST_CHECK_EQUAL(requester.getNumChecked(), 0);
+  BOOST_CHECK(!requester.mayHave(1, vertex(2), 0, 7));
+}
+
+BOOST_AUTO_TEST_CASE( test_single_node_graph_store )
+{
+  typedef GraphStore<VastNetflow, VastNetflowTuplizer, SourceIp, DestIp,
+                     TimeSeconds, DurationSeconds,
+                     StringHashFunction, StringHashFunction,
+                     StringEqualityFunction, StringEqualityFunction>
+          GraphStoreType;
+
+  // A single node never sends edge requests, so there is nothing to do.
+  std::vector<std::string> hostnames;
+  hostnames.push_back("localhost");
+  auto featureMap = std::make_shared<FeatureMap>(1000);
+  GraphStoreType graphStore(1, 0, hostnames, 10620, 1000, 1000, 1000, 1000,
+    1, 1, 100, 1000, featureMap, 100, true, 1);
+  graphStore.setVertexSummaries();
+  BOOST_CHECK(!graphStore.getVertexSummaries());
+  graphStore.terminate();
+}